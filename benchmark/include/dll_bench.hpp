@@ -0,0 +1,366 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*!
+ * \file dll_bench.hpp
+ * \brief Small harness for the benchmarks of DLL.
+ *
+ * Each benchmark is declared with DLL_BENCH and is given a state. The
+ * benchmark describes its work (number of samples and FLOPs per layer)
+ * and gives the code to measure to state.run(), which handles the
+ * warm-up and the repetitions.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <numeric>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+namespace dll_bench {
+
+/*!
+ * \brief The configuration of a benchmark run
+ */
+struct config {
+    std::size_t warmup  = 1;    ///< The number of runs before measuring
+    std::size_t repeat  = 5;    ///< The number of measured runs
+    std::string filter;         ///< Only the benchmarks containing this string are run
+    std::string json;           ///< The file in which to write the results (none if empty)
+    std::string baseline;       ///< The file of baseline results to compare to (none if empty)
+    double threshold = 0.1;     ///< The relative slowdown considered as a regression
+};
+
+/*!
+ * \brief The FLOPs of one layer of a benchmark
+ */
+struct layer_flops {
+    std::string name; ///< The name of the layer
+    double flops;     ///< The FLOPs of the layer for one sample
+};
+
+/*!
+ * \brief The results of one benchmark
+ */
+struct result {
+    std::string name;                ///< The name of the benchmark
+    std::size_t samples = 0;         ///< The number of samples processed in each run
+    std::vector<layer_flops> layers; ///< The FLOPs of each layer for one sample
+    std::vector<double> times;       ///< The duration of each measured run, in seconds
+
+    double mean() const {
+        return std::accumulate(times.begin(), times.end(), 0.0) / times.size();
+    }
+
+    double stddev() const {
+        auto m = mean();
+
+        double sum = 0.0;
+        for (auto t : times) {
+            sum += (t - m) * (t - m);
+        }
+
+        return std::sqrt(sum / times.size());
+    }
+
+    double min() const {
+        return *std::min_element(times.begin(), times.end());
+    }
+
+    double median() const {
+        auto sorted = times;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[sorted.size() / 2];
+    }
+
+    double samples_per_second() const {
+        return samples / mean();
+    }
+
+    double gflops(const layer_flops& layer) const {
+        return layer.flops * samples / mean() * 1e-9;
+    }
+
+    double gflops() const {
+        double flops = 0.0;
+
+        for (auto& layer : layers) {
+            flops += layer.flops;
+        }
+
+        return flops * samples / mean() * 1e-9;
+    }
+};
+
+/*!
+ * \brief The state given to each benchmark
+ */
+struct state {
+    state(const config& conf, result& res) : conf(conf), res(res) {}
+
+    /*!
+     * \brief Set the number of samples processed by each run
+     */
+    void samples(std::size_t n) {
+        res.samples = n;
+    }
+
+    /*!
+     * \brief Declare a layer of the benchmark with its FLOPs for one sample
+     */
+    void layer(std::string name, double flops) {
+        res.layers.push_back({std::move(name), flops});
+    }
+
+    /*!
+     * \brief Run the warm-up runs and then measure the given code
+     * \param fun The code to measure, called once per run
+     */
+    template <typename Functor>
+    void run(Functor&& fun) {
+        for (std::size_t i = 0; i < conf.warmup; ++i) {
+            fun();
+        }
+
+        for (std::size_t i = 0; i < conf.repeat; ++i) {
+            auto start = std::chrono::steady_clock::now();
+
+            fun();
+
+            auto end = std::chrono::steady_clock::now();
+
+            res.times.push_back(std::chrono::duration_cast<std::chrono::duration<double>>(end - start).count());
+        }
+    }
+
+private:
+    const config& conf;
+    result& res;
+};
+
+/*!
+ * \brief A registered benchmark
+ */
+struct benchmark {
+    std::string name;                  ///< The name of the benchmark
+    std::function<void(state&)> fun;   ///< The benchmark
+};
+
+inline std::vector<benchmark>& registry() {
+    static std::vector<benchmark> benchmarks;
+    return benchmarks;
+}
+
+/*!
+ * \brief Helper to register a benchmark at static initialization time
+ */
+struct registrar {
+    registrar(std::string name, std::function<void(state&)> fun) {
+        registry().push_back({std::move(name), std::move(fun)});
+    }
+};
+
+// FLOPs helpers
+
+/*!
+ * \brief FLOPs of CD-k on one sample for a V x H RBM: the hidden
+ * activations, the k Gibbs steps and the two outer products.
+ */
+inline double rbm_cd_flops(std::size_t v, std::size_t h, std::size_t k = 1) {
+    return 2.0 * v * h * (2 * k + 3);
+}
+
+/*!
+ * \brief FLOPs of CD-k on one sample for a convolutional RBM with NC
+ * channels of NV1xNV2 inputs and K filters of NW1xNW2.
+ */
+inline double crbm_cd_flops(std::size_t nc, std::size_t nv1, std::size_t nv2, std::size_t k, std::size_t nw1, std::size_t nw2, std::size_t steps = 1) {
+    const double nh = double(nv1 - nw1 + 1) * (nv2 - nw2 + 1);
+    return 2.0 * nc * k * nh * nw1 * nw2 * (2 * steps + 3);
+}
+
+/*!
+ * \brief FLOPs of the forward pass of a dense layer on one sample
+ */
+inline double dense_forward_flops(std::size_t in, std::size_t out) {
+    return 2.0 * in * out;
+}
+
+/*!
+ * \brief FLOPs of a training step (forward, backward and gradients) of a
+ * dense layer on one sample
+ */
+inline double dense_train_flops(std::size_t in, std::size_t out) {
+    return 3 * dense_forward_flops(in, out);
+}
+
+// Reporting
+
+inline void write_json(std::ostream& os, const std::vector<result>& results) {
+    os << "[\n";
+
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        auto& r = results[i];
+
+        // One benchmark per line, this is relied upon to read baselines
+        os << "  {\"name\": \"" << r.name << "\""
+           << ", \"samples\": " << r.samples
+           << ", \"mean\": " << r.mean()
+           << ", \"stddev\": " << r.stddev()
+           << ", \"min\": " << r.min()
+           << ", \"median\": " << r.median()
+           << ", \"samples_per_second\": " << r.samples_per_second()
+           << ", \"gflops\": " << r.gflops()
+           << ", \"layers\": [";
+
+        for (std::size_t l = 0; l < r.layers.size(); ++l) {
+            os << (l ? ", " : "") << "{\"name\": \"" << r.layers[l].name << "\", \"gflops\": " << r.gflops(r.layers[l]) << "}";
+        }
+
+        os << "]}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    os << "]\n";
+}
+
+/*!
+ * \brief Extract a numeric field from one line of JSON output
+ */
+inline bool json_number(const std::string& line, const std::string& key, double& value) {
+    auto pos = line.find("\"" + key + "\": ");
+
+    if (pos == std::string::npos) {
+        return false;
+    }
+
+    value = std::stod(line.substr(pos + key.size() + 4));
+
+    return true;
+}
+
+/*!
+ * \brief Extract a string field from one line of JSON output
+ */
+inline bool json_string(const std::string& line, const std::string& key, std::string& value) {
+    auto pos = line.find("\"" + key + "\": \"");
+
+    if (pos == std::string::npos) {
+        return false;
+    }
+
+    auto start = pos + key.size() + 5;
+    value      = line.substr(start, line.find('"', start) - start);
+
+    return true;
+}
+
+/*!
+ * \brief Compare the results to the baseline file
+ * \return The number of regressions
+ */
+inline std::size_t compare_baseline(const config& conf, const std::vector<result>& results) {
+    std::ifstream stream(conf.baseline);
+
+    if (!stream) {
+        std::cerr << "dll_bench: cannot read baseline " << conf.baseline << std::endl;
+        return 0;
+    }
+
+    std::size_t regressions = 0;
+
+    std::string line;
+    while (std::getline(stream, line)) {
+        std::string name;
+        double mean;
+
+        if (!json_string(line, "name", name) || !json_number(line, "mean", mean)) {
+            continue;
+        }
+
+        for (auto& r : results) {
+            if (r.name == name) {
+                auto ratio = r.mean() / mean;
+
+                if (ratio > 1.0 + conf.threshold) {
+                    std::cout << "REGRESSION " << name << ": " << mean << "s -> " << r.mean() << "s (+" << (ratio - 1.0) * 100.0 << "%)" << std::endl;
+                    ++regressions;
+                } else if (ratio < 1.0 - conf.threshold) {
+                    std::cout << "IMPROVEMENT " << name << ": " << mean << "s -> " << r.mean() << "s (" << (ratio - 1.0) * 100.0 << "%)" << std::endl;
+                }
+            }
+        }
+    }
+
+    return regressions;
+}
+
+/*!
+ * \brief Run all the registered benchmarks matching the configuration
+ * \return The number of regressions compared to the baseline
+ */
+inline std::size_t run_all(const config& conf) {
+    std::vector<result> results;
+
+    for (auto& bench : registry()) {
+        if (!conf.filter.empty() && bench.name.find(conf.filter) == std::string::npos) {
+            continue;
+        }
+
+        results.emplace_back();
+        auto& r = results.back();
+        r.name  = bench.name;
+
+        state s(conf, r);
+        bench.fun(s);
+
+        if (r.times.empty()) {
+            results.pop_back();
+            continue;
+        }
+
+        std::cout << r.name
+                  << ": mean=" << r.mean() * 1000.0 << "ms"
+                  << " stddev=" << r.stddev() * 1000.0 << "ms"
+                  << " min=" << r.min() * 1000.0 << "ms"
+                  << " samples/s=" << r.samples_per_second()
+                  << " GFLOP/s=" << r.gflops() << std::endl;
+
+        for (auto& layer : r.layers) {
+            std::cout << "    " << layer.name << ": " << r.gflops(layer) << " GFLOP/s" << std::endl;
+        }
+    }
+
+    if (!conf.json.empty()) {
+        std::ofstream stream(conf.json);
+        write_json(stream, results);
+    }
+
+    if (!conf.baseline.empty()) {
+        return compare_baseline(conf, results);
+    }
+
+    return 0;
+}
+
+} //end of namespace dll_bench
+
+#define DLL_BENCH_CAT_IMPL(a, b) a##b
+#define DLL_BENCH_CAT(a, b) DLL_BENCH_CAT_IMPL(a, b)
+
+/*!
+ * \brief Declare a benchmark with the given name
+ */
+#define DLL_BENCH(name)                                                                          \
+    static void DLL_BENCH_CAT(dll_bench_fun_, __LINE__)(dll_bench::state&);                     \
+    static dll_bench::registrar DLL_BENCH_CAT(dll_bench_reg_, __LINE__)(name, DLL_BENCH_CAT(dll_bench_fun_, __LINE__)); \
+    static void DLL_BENCH_CAT(dll_bench_fun_, __LINE__)(dll_bench::state& state)
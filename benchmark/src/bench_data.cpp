@@ -0,0 +1,31 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include "dll_bench.hpp"
+
+#include "etl/etl.hpp"
+
+#include "mnist/mnist_reader.hpp"
+#include "mnist/mnist_utils.hpp"
+
+DLL_BENCH("data/mnist/read") {
+    state.samples(10000);
+
+    state.run([&] {
+        auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(10000);
+        mnist::binarize_dataset(dataset);
+    });
+}
+
+DLL_BENCH("data/mnist/read_conv") {
+    state.samples(10000);
+
+    state.run([&] {
+        auto dataset = mnist::read_dataset_direct<std::vector, etl::fast_dyn_matrix<float, 1, 28, 28>>(10000);
+        mnist::normalize_dataset(dataset);
+    });
+}
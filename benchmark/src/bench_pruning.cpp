@@ -0,0 +1,71 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include "dll_bench.hpp"
+
+#include "dll/neural/dense_layer.hpp"
+#include "dll/util/pruning.hpp"
+
+// Compare the dense kernels and the sparse weights kernels on the same
+// pruned layer, to find the density below which sparsify() pays off
+
+namespace {
+
+using layer_t = dll::dense_desc<1024, 1024>::layer_t;
+
+constexpr const std::size_t batch   = 64;
+constexpr const std::size_t batches = 32;
+
+void pruned_forward(dll_bench::state& state, double ratio, bool sparse) {
+    auto layer = std::make_unique<layer_t>();
+
+    dll::prune(*layer, ratio);
+
+    if (sparse) {
+        dll::sparsify(*layer, 1.0);
+    }
+
+    etl::fast_matrix<float, batch, 1024> input;
+    etl::fast_matrix<float, batch, 1024> output;
+
+    input = etl::normal_generator<float>(0.0, 1.0);
+
+    state.samples(batch * batches);
+    state.layer("dense_1024_1024", dll_bench::dense_forward_flops(1024, 1024));
+
+    state.run([&] {
+        for (std::size_t b = 0; b < batches; ++b) {
+            layer->batch_activate_hidden(output, input);
+        }
+    });
+}
+
+} //end of anonymous namespace
+
+DLL_BENCH("inference/forward_batch/dense_pruned/70/dense") {
+    pruned_forward(state, 0.7, false);
+}
+
+DLL_BENCH("inference/forward_batch/dense_pruned/70/sparse") {
+    pruned_forward(state, 0.7, true);
+}
+
+DLL_BENCH("inference/forward_batch/dense_pruned/90/dense") {
+    pruned_forward(state, 0.9, false);
+}
+
+DLL_BENCH("inference/forward_batch/dense_pruned/90/sparse") {
+    pruned_forward(state, 0.9, true);
+}
+
+DLL_BENCH("inference/forward_batch/dense_pruned/97/dense") {
+    pruned_forward(state, 0.97, false);
+}
+
+DLL_BENCH("inference/forward_batch/dense_pruned/97/sparse") {
+    pruned_forward(state, 0.97, true);
+}
@@ -0,0 +1,59 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include "dll_bench.hpp"
+
+#include "dll/rbm/rbm.hpp"
+#include "dll/rbm/conv_rbm.hpp"
+
+#include "mnist/mnist_reader.hpp"
+#include "mnist/mnist_utils.hpp"
+
+DLL_BENCH("rbm/pretrain/784_500") {
+    using rbm_t = dll::rbm_desc<28 * 28, 500, dll::batch_size<64>, dll::weight_type<float>>::layer_t;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(2048);
+    mnist::binarize_dataset(dataset);
+
+    state.samples(dataset.training_images.size());
+    state.layer("rbm_784_500", dll_bench::rbm_cd_flops(28 * 28, 500));
+
+    state.run([&] {
+        auto rbm = std::make_unique<rbm_t>();
+        rbm->train<false>(dataset.training_images, 1);
+    });
+}
+
+DLL_BENCH("rbm/pretrain/784_500_parallel") {
+    using rbm_t = dll::rbm_desc<28 * 28, 500, dll::batch_size<64>, dll::parallel_mode, dll::weight_type<float>>::layer_t;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(2048);
+    mnist::binarize_dataset(dataset);
+
+    state.samples(dataset.training_images.size());
+    state.layer("rbm_784_500", dll_bench::rbm_cd_flops(28 * 28, 500));
+
+    state.run([&] {
+        auto rbm = std::make_unique<rbm_t>();
+        rbm->train<false>(dataset.training_images, 1);
+    });
+}
+
+DLL_BENCH("crbm/pretrain/1x28_20x5") {
+    using crbm_t = dll::conv_rbm_desc_square<1, 28, 20, 5, dll::batch_size<25>, dll::weight_type<float>>::layer_t;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::fast_dyn_matrix<float, 1, 28, 28>>(500);
+    mnist::binarize_dataset(dataset);
+
+    state.samples(dataset.training_images.size());
+    state.layer("crbm_1x28_20x5", dll_bench::crbm_cd_flops(1, 28, 28, 20, 5, 5));
+
+    state.run([&] {
+        auto crbm = std::make_unique<crbm_t>();
+        crbm->train<false>(dataset.training_images, 1);
+    });
+}
@@ -0,0 +1,88 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include "dll_bench.hpp"
+
+#include "dll/neural/dense_layer.hpp"
+#include "dll/dbn.hpp"
+#include "dll/trainer/stochastic_gradient_descent.hpp"
+
+#include "mnist/mnist_reader.hpp"
+#include "mnist/mnist_utils.hpp"
+
+namespace {
+
+using dbn_t = dll::dbn_desc<
+    dll::dbn_layers<
+        dll::dense_desc<28 * 28, 500>::layer_t,
+        dll::dense_desc<500, 250>::layer_t,
+        dll::dense_desc<250, 10, dll::activation<dll::function::SOFTMAX>>::layer_t>,
+    dll::trainer<dll::sgd_trainer>, dll::batch_size<64>>::dbn_t;
+
+void dense_layers(dll_bench::state& state, bool train) {
+    auto flops = train ? dll_bench::dense_train_flops : dll_bench::dense_forward_flops;
+
+    state.layer("dense_784_500", flops(28 * 28, 500));
+    state.layer("dense_500_250", flops(500, 250));
+    state.layer("dense_250_10", flops(250, 10));
+}
+
+} //end of anonymous namespace
+
+DLL_BENCH("sgd/fine_tune/dense") {
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(2048);
+    mnist::normalize_dataset(dataset);
+
+    state.samples(dataset.training_images.size());
+    dense_layers(state, true);
+
+    state.run([&] {
+        auto dbn = std::make_unique<dbn_t>();
+        dbn->learning_rate = 0.1;
+        dbn->fine_tune(dataset.training_images, dataset.training_labels, 1);
+    });
+}
+
+DLL_BENCH("inference/forward/dense") {
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(2048);
+    mnist::normalize_dataset(dataset);
+
+    auto dbn = std::make_unique<dbn_t>();
+
+    state.samples(dataset.training_images.size());
+    dense_layers(state, false);
+
+    state.run([&] {
+        for (auto& image : dataset.training_images) {
+            dbn->forward(image);
+        }
+    });
+}
+
+DLL_BENCH("inference/forward_batch/dense") {
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(2048);
+    mnist::normalize_dataset(dataset);
+
+    const std::size_t n = dataset.training_images.size();
+
+    etl::dyn_matrix<float, 2> data(n, 28 * 28);
+
+    for (std::size_t i = 0; i < n; ++i) {
+        data(i) = dataset.training_images[i];
+    }
+
+    auto dbn = std::make_unique<dbn_t>();
+
+    state.samples(n - n % dbn_t::batch_size);
+    dense_layers(state, false);
+
+    state.run([&] {
+        for (std::size_t i = 0; i + dbn_t::batch_size <= n; i += dbn_t::batch_size) {
+            dbn->forward_batch(etl::slice(data, i, i + dbn_t::batch_size));
+        }
+    });
+}
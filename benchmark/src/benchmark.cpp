@@ -0,0 +1,71 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <string>
+#include <iostream>
+
+#include "dll_bench.hpp"
+
+namespace {
+
+void usage() {
+    std::cout << "Usage: dll_benchmark [options]" << std::endl;
+    std::cout << "  --filter <string>   Only run the benchmarks containing <string>" << std::endl;
+    std::cout << "  --warmup <n>        Number of warm-up runs (default 1)" << std::endl;
+    std::cout << "  --repeat <n>        Number of measured runs (default 5)" << std::endl;
+    std::cout << "  --json <file>       Write the results in JSON to <file>" << std::endl;
+    std::cout << "  --baseline <file>   Compare the results to a previous JSON output" << std::endl;
+    std::cout << "  --threshold <r>     Relative slowdown considered as a regression (default 0.1)" << std::endl;
+}
+
+} //end of anonymous namespace
+
+int main(int argc, char* argv[]) {
+    dll_bench::config conf;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+
+        if (arg == "--help" || i + 1 >= argc) {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+
+        std::string value(argv[++i]);
+
+        if (arg == "--filter") {
+            conf.filter = value;
+        } else if (arg == "--warmup") {
+            conf.warmup = std::stoul(value);
+        } else if (arg == "--repeat") {
+            conf.repeat = std::stoul(value);
+        } else if (arg == "--json") {
+            conf.json = value;
+        } else if (arg == "--baseline") {
+            conf.baseline = value;
+        } else if (arg == "--threshold") {
+            conf.threshold = std::stod(value);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (!conf.repeat) {
+        std::cout << "dll_benchmark: --repeat must be at least 1" << std::endl;
+        return 1;
+    }
+
+    auto regressions = dll_bench::run_all(conf);
+
+    if (regressions) {
+        std::cout << regressions << " regression(s) compared to " << conf.baseline << std::endl;
+        return 2;
+    }
+
+    return 0;
+}
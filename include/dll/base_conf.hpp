@@ -75,12 +75,16 @@ struct serial_id;
 struct verbose_id;
 struct shuffle_id;
 struct shuffle_pre_id;
+struct checkpoint_id;
 struct svm_concatenate_id;
 struct svm_scale_id;
 struct init_weights_id;
 struct clip_gradients_id;
 struct weight_type_id;
 struct free_energy_id;
+struct free_energy_subset_id;
+struct free_energy_every_id;
+struct sparse_input_id;
 struct memory_id;
 struct batch_mode_id;
 struct dbn_only_id;
@@ -235,15 +239,50 @@ struct shuffle : basic_conf_elt<shuffle_id> {};
 
 /*
  * !\brief dbn: Shuffle the inputs before each pretraining epoch.
- * This implies that the inputs will be copied in memory!
+ * The inputs are visited through a permutation, they are only copied
+ * when the iterators are not random access.
  */
 struct shuffle_pre : basic_conf_elt<shuffle_pre_id> {};
 
+/*!
+ * \brief Enable gradient checkpointing during SGD fine-tuning.
+ *
+ * Only the inputs of every K-th layer are kept after the forward pass, the
+ * other activations are recomputed from the nearest checkpoint during the
+ * backward pass. Only the activations of the dynamic layers can be
+ * released.
+ *
+ * \tparam K The distance between two checkpoints (0 to disable)
+ */
+template <std::size_t K>
+struct checkpoint : value_conf_elt<checkpoint_id, std::size_t, K> {};
+
 /*
  * !\brief Enable free energy computation
  */
 struct free_energy : basic_conf_elt<free_energy_id> {};
 
+/*!
+ * \brief Compute the free energy on a fixed subset of S training samples
+ * instead of on each training batch.
+ */
+template <std::size_t S>
+struct free_energy_subset : value_conf_elt<free_energy_subset_id, std::size_t, S> {};
+
+/*!
+ * \brief Compute the free energy only every N training batches
+ */
+template <std::size_t N>
+struct free_energy_every : value_conf_elt<free_energy_every_id, std::size_t, N> {};
+
+/*!
+ * \brief Use sparse kernels when the inputs of the layer are mostly zeros.
+ *
+ * The density of the inputs is checked at runtime and the dense kernels
+ * are still used for inputs that are not sparse enough.
+ */
+struct sparse_input : basic_conf_elt<sparse_input_id> {};
+
 /*
  * !\brief Enable gradient clipping.
  */
@@ -17,21 +17,23 @@
 #pragma once
 
 #include "cpp_utils/assert.hpp"         //Assertions
-#include "cpp_utils/maybe_parallel.hpp" //conditional parallel loops
 #include "cpp_utils/static_if.hpp"      //static_if for compile-time reduction
 
 #include "etl/etl.hpp"
 
 #include "util/batch.hpp"
 #include "util/timers.hpp"
+#include "util/scheduler.hpp"
+#include "util/numa.hpp"
 #include "decay_type.hpp"
 #include "layer_traits.hpp"
 #include "util/blas.hpp"
+#include "util/sparse.hpp"
+#include "util/update.hpp"
+#include "util/distributed.hpp"
 
 namespace dll {
 
-#define STATIC_IF_DECAY(d, ...) cpp::static_if<decay == d>([&](auto f) { __VA_ARGS__; });
-
 /*!
  * \brief Base class for all standard trainer
  */
@@ -40,23 +42,47 @@ struct base_trainer {
     typedef RBM rbm_t;
 
     bool init = true;
-
-    template <decay_type decay, typename V, typename G>
-    void update_grad(G& grad, const V& value, const RBM& rbm, double penalty) {
-        STATIC_IF_DECAY(decay_type::NONE, f(grad) = grad - penalty);
-        STATIC_IF_DECAY(decay_type::L1, f(grad) = grad - rbm.l1_weight_cost * abs(value) - penalty);
-        STATIC_IF_DECAY(decay_type::L2, f(grad) = grad - rbm.l2_weight_cost * value - penalty);
-        STATIC_IF_DECAY(decay_type::L1L2, f(grad) = grad - rbm.l1_weight_cost * abs(value) - rbm.l2_weight_cost * value - penalty);
-    }
 };
 
-template<typename Grad, typename T>
-void apply_clip_gradients(Grad& grad, T t, size_t n){
-    auto grad_l2_norm = std::sqrt(etl::sum(grad >> grad) / (n * n));
+/*!
+ * \brief Update one parameter of the RBM from its gradients.
+ *
+ * Weight decay, penalty, gradient clipping, momentum and learning rate are
+ * all applied in a single pass over the parameter.
+ *
+ * \param rbm The RBM being trained
+ * \param t The trainer
+ * \param value The parameter to update
+ * \param grad The gradients of the parameter
+ * \param inc The increments of the parameter (momentum)
+ * \param penalty The penalty to subtract from the gradients
+ * \param n_samples The number of samples of the batch
+ */
+template <decay_type Decay, typename RBM, typename Trainer, typename V, typename G, typename I>
+void update_parameter(RBM& rbm, Trainer& t, V& value, const G& grad, I& inc, typename RBM::weight penalty, double n_samples) {
+    using rbm_t  = RBM;
+    using weight = typename rbm_t::weight;
+
+    update_parameters<weight> params;
+    params.eps      = rbm.learning_rate / n_samples;
+    params.momentum = rbm.momentum;
+    params.l1       = rbm.l1_weight_cost;
+    params.l2       = rbm.l2_weight_cost;
+    params.penalty  = penalty;
 
-    if(grad_l2_norm > t){
-        grad = grad >> (t / grad_l2_norm);
+    // Gradients clipping
+    if (rbm_layer_traits<rbm_t>::has_clip_gradients()) {
+        params.scale = clip_scale<Decay>(value, grad, params, weight(rbm.gradient_clip), n_samples);
     }
+
+    //Apply momentum and learning rate
+    cpp::static_if<rbm_layer_traits<rbm_t>::has_momentum()>([&](auto f) {
+        fused_update<Decay>(t.pool, value, grad, f(inc), params);
+    })
+        //Apply the learning rate
+        .else_([&](auto f) {
+            fused_update<Decay>(t.pool, f(value), grad, params);
+        });
 }
 
 /* The update weights procedure */
@@ -83,12 +109,6 @@ void update_normal(RBM& rbm, Trainer& t) {
         f(w_penalty) = h_penalty = cost * (t.q_global_t - p);
     });
 
-    //Apply L1/L2 regularization and penalties to the biases
-
-    t.template update_grad<w_decay(rbm_layer_traits<rbm_t>::decay())>(t.w_grad, rbm.w, rbm, w_penalty);
-    t.template update_grad<b_decay(rbm_layer_traits<rbm_t>::decay())>(t.b_grad, rbm.b, rbm, h_penalty);
-    t.template update_grad<b_decay(rbm_layer_traits<rbm_t>::decay())>(t.c_grad, rbm.c, rbm, v_penalty);
-
     //Local sparsity method
     cpp::static_if<rbm_layer_traits<rbm_t>::sparsity_method() == sparsity_method::LOCAL_TARGET>([&](auto f) {
         auto decay_rate = rbm.decay_rate;
@@ -111,36 +131,18 @@ void update_normal(RBM& rbm, Trainer& t) {
     //TODO the batch is not necessary full!
     const auto n_samples = double(etl::dim<0>(t.w_grad_b));
 
-    // Gradients clipping
-    if(rbm_layer_traits<rbm_t>::has_clip_gradients()){
-        auto grad_t = rbm.gradient_clip;
+    //Synchronize the gradients of the replicas
+    dll::distributed_step();
+    average_gradients(t.w_grad, t.b_grad, t.c_grad);
 
-        apply_clip_gradients(t.w_grad, grad_t, n_samples);
-        apply_clip_gradients(t.b_grad, grad_t, n_samples);
-        apply_clip_gradients(t.c_grad, grad_t, n_samples);
-    }
-
-    // Scale the learning rate with the size of the batch
-    auto eps = rbm.learning_rate / n_samples;
+    //Apply L1/L2 regularization, penalties, clipping, momentum and learning rate
 
-    //Apply momentum and learning rate
-    cpp::static_if<rbm_layer_traits<rbm_t>::has_momentum()>([&](auto f) {
-        auto momentum = rbm.momentum;
+    update_parameter<w_decay(rbm_layer_traits<rbm_t>::decay())>(rbm, t, rbm.w, t.w_grad, t.w_inc, w_penalty, n_samples);
+    update_parameter<b_decay(rbm_layer_traits<rbm_t>::decay())>(rbm, t, rbm.b, t.b_grad, t.b_inc, h_penalty, n_samples);
+    update_parameter<b_decay(rbm_layer_traits<rbm_t>::decay())>(rbm, t, rbm.c, t.c_grad, t.c_inc, v_penalty, n_samples);
 
-        f(t).w_inc = momentum * t.w_inc + eps * t.w_grad;
-        f(t).b_inc = momentum * t.b_inc + eps * t.b_grad;
-        f(t).c_inc = momentum * t.c_inc + eps * t.c_grad;
-
-        f(rbm).w += t.w_inc;
-        f(rbm).b += t.b_inc;
-        f(rbm).c += t.c_inc;
-    })
-        //Apply the learning rate
-        .else_([&](auto f) {
-            f(rbm).w += eps * t.w_grad;
-            f(rbm).b += eps * t.b_grad;
-            f(rbm).c += eps * t.c_grad;
-        });
+    //Synchronize the weights of the replicas
+    average_weights(rbm.w, rbm.b, rbm.c);
 
     //Check for NaN
     nan_check_deep_3(rbm.w, rbm.b, rbm.c);
@@ -169,12 +171,6 @@ void update_convolutional(RBM& rbm, Trainer& t) {
         f(w_penalty) = h_penalty = cost * (t.q_global_t - p);
     });
 
-    //Apply L1/L2 regularization and penalties to the biases
-
-    t.template update_grad<w_decay(rbm_layer_traits<rbm_t>::decay())>(t.w_grad, rbm.w, rbm, w_penalty);
-    t.template update_grad<b_decay(rbm_layer_traits<rbm_t>::decay())>(t.b_grad, rbm.b, rbm, h_penalty);
-    t.template update_grad<b_decay(rbm_layer_traits<rbm_t>::decay())>(t.c_grad, rbm.c, rbm, v_penalty);
-
     //Local sparsity method
     cpp::static_if<rbm_layer_traits<rbm_t>::sparsity_method() == sparsity_method::LOCAL_TARGET>([&](auto f) {
         auto decay_rate = rbm.decay_rate;
@@ -202,27 +198,20 @@ void update_convolutional(RBM& rbm, Trainer& t) {
         f(t).c_grad -= rbm.pbias_lambda * t.c_bias;
     });
 
-    const auto n_samples = get_batch_size(rbm);
-    auto eps             = rbm.learning_rate / n_samples;
+    const auto n_samples = double(get_batch_size(rbm));
 
-    //Apply momentum and learning rate
-    cpp::static_if<rbm_layer_traits<rbm_t>::has_momentum()>([&](auto f) {
-        auto momentum = rbm.momentum;
+    //Synchronize the gradients of the replicas
+    dll::distributed_step();
+    average_gradients(t.w_grad, t.b_grad, t.c_grad);
 
-        f(t).w_inc = momentum * t.w_inc + eps * t.w_grad;
-        f(t).b_inc = momentum * t.b_inc + eps * t.b_grad;
-        f(t).c_inc = momentum * t.c_inc + eps * t.c_grad;
+    //Apply L1/L2 regularization, penalties, momentum and learning rate
 
-        f(rbm.w) += t.w_inc;
-        f(rbm.b) += t.b_inc;
-        f(rbm.c) += t.c_inc;
-    })
-    //Apply learning rate only
-    .else_([&](auto f) {
-        f(rbm.w) += eps * t.w_grad;
-        f(rbm.b) += eps * t.b_grad;
-        f(rbm.c) += eps * t.c_grad;
-    });
+    update_parameter<w_decay(rbm_layer_traits<rbm_t>::decay())>(rbm, t, rbm.w, t.w_grad, t.w_inc, w_penalty, n_samples);
+    update_parameter<b_decay(rbm_layer_traits<rbm_t>::decay())>(rbm, t, rbm.b, t.b_grad, t.b_inc, h_penalty, n_samples);
+    update_parameter<b_decay(rbm_layer_traits<rbm_t>::decay())>(rbm, t, rbm.c, t.c_grad, t.c_inc, v_penalty, n_samples);
+
+    //Synchronize the weights of the replicas
+    average_weights(rbm.w, rbm.b, rbm.c);
 
     //Check for NaN
     nan_check_deep(rbm.w);
@@ -236,7 +225,8 @@ void batch_compute_gradients(Trainer& t) {
 
     const auto B = etl::dim<0>(t.w_grad_b);
 
-    t.w_grad = batch_outer(t.vf, t.h1_a);
+    //The positive phase can use the sparse kernel on sparse inputs
+    select_batch_outer<has_sparse_input<typename Trainer::rbm_t::desc>()>(t.w_grad, t.vf, t.h1_a);
     t.w_grad -= batch_outer(t.v2_a, t.h2_a);
 
     t.b_grad = t.h1_a(0) - t.h2_a(0);
@@ -275,7 +265,7 @@ void compute_gradients_normal(const dll::batch<T>& input_batch, const dll::batch
     auto n = input_batch.size();
 
     // clang-format off
-    maybe_parallel_foreach_pair_i(t.pool, input_batch.begin(), input_batch.end(), expected_batch.begin(), expected_batch.end(),
+    parallel_foreach_pair_i(t.pool, input_batch.begin(), input_batch.end(), expected_batch.begin(), expected_batch.end(),
             [&](const auto& input, const auto& expected, std::size_t i)
     {
         //Copy input/expected for computations
@@ -427,7 +417,7 @@ void compute_gradients_conv(const dll::batch<T>& input_batch, const dll::batch<T
     dll::auto_timer timer("cd:gradients:conv:par");
 
     // clang-format off
-    maybe_parallel_foreach_pair_i(t.pool, input_batch.begin(), input_batch.end(), expected_batch.begin(), expected_batch.end(),
+    parallel_foreach_pair_i(t.pool, input_batch.begin(), input_batch.end(), expected_batch.begin(), expected_batch.end(),
             [&](const auto& input, const auto& expected, std::size_t i)
     {
         //Copy input/expected for computations
@@ -632,9 +622,9 @@ struct base_cd_trainer : base_trainer<RBM> {
 
     //{{{ Momentum
 
-    etl::fast_matrix<weight, num_visible, num_hidden> w_inc;
-    etl::fast_vector<weight, num_hidden> b_inc;
-    etl::fast_vector<weight, num_visible> c_inc;
+    conditional_fast_matrix_t<rbm_layer_traits<rbm_t>::has_momentum(), weight, num_visible, num_hidden> w_inc;
+    conditional_fast_matrix_t<rbm_layer_traits<rbm_t>::has_momentum(), weight, num_hidden> b_inc;
+    conditional_fast_matrix_t<rbm_layer_traits<rbm_t>::has_momentum(), weight, num_visible> c_inc;
 
     //}}} Momentum end
 
@@ -648,21 +638,37 @@ struct base_cd_trainer : base_trainer<RBM> {
 
     //}}} Sparsity end
 
-    etl::fast_matrix<weight, batch_size, rbm_t::num_hidden> p_h_a;
-    etl::fast_matrix<weight, batch_size, rbm_t::num_hidden> p_h_s;
+    conditional_fast_matrix_t<Persistent, weight, batch_size, rbm_t::num_hidden> p_h_a;
+    conditional_fast_matrix_t<Persistent, weight, batch_size, rbm_t::num_hidden> p_h_s;
 
-    cpp::thread_pool<!rbm_layer_traits<rbm_t>::is_serial()> pool;
+    shared_pool_t<!rbm_layer_traits<rbm_t>::is_serial()>& pool; ///< The shared thread pool
 
     template <bool M = rbm_layer_traits<rbm_t>::has_momentum(), cpp_disable_if(M)>
     base_cd_trainer(rbm_t& rbm)
-            : rbm(rbm), q_global_t(0.0), q_local_t(0.0), pool(etl::threads) {
+            : rbm(rbm), q_global_t(0.0), q_local_t(0.0), pool(dll::shared_pool<!rbm_layer_traits<rbm_t>::is_serial()>()) {
         static_assert(!rbm_layer_traits<rbm_t>::has_momentum(), "This constructor should only be used without momentum support");
+
+        if (rbm_layer_traits<rbm_t>::is_parallel_mode()) {
+            first_touch(pool, v1, vf, h1_a, h1_s, v2_a, v2_s, h2_a, h2_s, w_grad_b);
+        }
+
+        if (rbm_layer_traits<rbm_t>::is_parallel_mode() && Persistent) {
+            first_touch(pool, p_h_a, p_h_s);
+        }
     }
 
     template <bool M = rbm_layer_traits<rbm_t>::has_momentum(), cpp_enable_if(M)>
     base_cd_trainer(rbm_t& rbm)
-            : rbm(rbm), w_inc(0.0), b_inc(0.0), c_inc(0.0), q_global_t(0.0), q_local_t(0.0), pool(etl::threads) {
+            : rbm(rbm), w_inc(0.0), b_inc(0.0), c_inc(0.0), q_global_t(0.0), q_local_t(0.0), pool(dll::shared_pool<!rbm_layer_traits<rbm_t>::is_serial()>()) {
         static_assert(rbm_layer_traits<rbm_t>::has_momentum(), "This constructor should only be used with momentum support");
+
+        if (rbm_layer_traits<rbm_t>::is_parallel_mode()) {
+            first_touch(pool, v1, vf, h1_a, h1_s, v2_a, v2_s, h2_a, h2_s, w_grad_b);
+        }
+
+        if (rbm_layer_traits<rbm_t>::is_parallel_mode() && Persistent) {
+            first_touch(pool, p_h_a, p_h_s);
+        }
     }
 
     void update(RBM& rbm) {
@@ -734,7 +740,7 @@ struct base_cd_trainer<N, RBM, Persistent, Denoising, std::enable_if_t<layer_tra
     etl::dyn_matrix<weight> p_h_a;
     etl::dyn_matrix<weight> p_h_s;
 
-    cpp::thread_pool<!rbm_layer_traits<rbm_t>::is_serial()> pool;
+    shared_pool_t<!rbm_layer_traits<rbm_t>::is_serial()>& pool; ///< The shared thread pool
 
     template <bool M = rbm_layer_traits<rbm_t>::has_momentum(), cpp_disable_if(M)>
     base_cd_trainer(rbm_t& rbm)
@@ -757,9 +763,17 @@ struct base_cd_trainer<N, RBM, Persistent, Denoising, std::enable_if_t<layer_tra
               q_global_t(0.0),
               q_local_batch(rbm.num_hidden),
               q_local_t(rbm.num_hidden, static_cast<weight>(0.0)),
-              p_h_a(get_batch_size(rbm), rbm.num_hidden),
-              p_h_s(get_batch_size(rbm), rbm.num_hidden), pool(etl::threads) {
+              p_h_a(Persistent ? get_batch_size(rbm) : 0, rbm.num_hidden),
+              p_h_s(Persistent ? get_batch_size(rbm) : 0, rbm.num_hidden), pool(dll::shared_pool<!rbm_layer_traits<rbm_t>::is_serial()>()) {
         static_assert(!rbm_layer_traits<rbm_t>::has_momentum(), "This constructor should only be used without momentum support");
+
+        if (rbm_layer_traits<rbm_t>::is_parallel_mode()) {
+            first_touch(pool, v1, vf, h1_a, h1_s, v2_a, v2_s, h2_a, h2_s, w_grad_b);
+        }
+
+        if (rbm_layer_traits<rbm_t>::is_parallel_mode() && Persistent) {
+            first_touch(pool, p_h_a, p_h_s);
+        }
     }
 
     template <bool M = rbm_layer_traits<rbm_t>::has_momentum(), cpp_enable_if(M)>
@@ -783,9 +797,17 @@ struct base_cd_trainer<N, RBM, Persistent, Denoising, std::enable_if_t<layer_tra
               q_global_t(0.0),
               q_local_batch(rbm.num_hidden),
               q_local_t(rbm.num_hidden, static_cast<weight>(0.0)),
-              p_h_a(get_batch_size(rbm), rbm.num_hidden),
-              p_h_s(get_batch_size(rbm), rbm.num_hidden), pool(etl::threads) {
+              p_h_a(Persistent ? get_batch_size(rbm) : 0, rbm.num_hidden),
+              p_h_s(Persistent ? get_batch_size(rbm) : 0, rbm.num_hidden), pool(dll::shared_pool<!rbm_layer_traits<rbm_t>::is_serial()>()) {
         static_assert(rbm_layer_traits<rbm_t>::has_momentum(), "This constructor should only be used with momentum support");
+
+        if (rbm_layer_traits<rbm_t>::is_parallel_mode()) {
+            first_touch(pool, v1, vf, h1_a, h1_s, v2_a, v2_s, h2_a, h2_s, w_grad_b);
+        }
+
+        if (rbm_layer_traits<rbm_t>::is_parallel_mode() && Persistent) {
+            first_touch(pool, p_h_a, p_h_s);
+        }
     }
 
     void update(RBM& rbm) {
@@ -837,9 +859,9 @@ struct base_cd_trainer<N, RBM, Persistent, Denoising, std::enable_if_t<!layer_tr
 
     //{{{ Momentum
 
-    etl::fast_matrix<weight, W_DIMS> w_inc;
-    etl::fast_vector<weight, K> b_inc;
-    etl::fast_vector<weight, NC> c_inc;
+    conditional_fast_matrix_t<rbm_layer_traits<rbm_t>::has_momentum(), weight, W_DIMS> w_inc;
+    conditional_fast_matrix_t<rbm_layer_traits<rbm_t>::has_momentum(), weight, K> b_inc;
+    conditional_fast_matrix_t<rbm_layer_traits<rbm_t>::has_momentum(), weight, NC> c_inc;
 
     //}}} Momentum end
 
@@ -879,7 +901,7 @@ struct base_cd_trainer<N, RBM, Persistent, Denoising, std::enable_if_t<!layer_tr
     etl::fast_matrix<weight, batch_size, K, NH1, NH2> h2_a;
     conditional_fast_matrix_t<(N > 1), weight, batch_size, K, NH1, NH2> h2_s;
 
-    cpp::thread_pool<!rbm_layer_traits<rbm_t>::is_serial()> pool;
+    shared_pool_t<!rbm_layer_traits<rbm_t>::is_serial()>& pool; ///< The shared thread pool
 
     template <bool M = rbm_layer_traits<rbm_t>::has_momentum(), cpp_disable_if(M)>
     base_cd_trainer(rbm_t& rbm)
@@ -888,7 +910,7 @@ struct base_cd_trainer<N, RBM, Persistent, Denoising, std::enable_if_t<!layer_tr
               q_local_t(0.0),
               w_bias(0.0),
               b_bias(0.0),
-              c_bias(0.0), pool(etl::threads) {
+              c_bias(0.0), pool(dll::shared_pool<!rbm_layer_traits<rbm_t>::is_serial()>()) {
         static_assert(!rbm_layer_traits<rbm_t>::has_momentum(), "This constructor should only be used without momentum support");
     }
 
@@ -902,7 +924,7 @@ struct base_cd_trainer<N, RBM, Persistent, Denoising, std::enable_if_t<!layer_tr
               q_local_t(0.0),
               w_bias(0.0),
               b_bias(0.0),
-              c_bias(0.0), pool(etl::threads) {
+              c_bias(0.0), pool(dll::shared_pool<!rbm_layer_traits<rbm_t>::is_serial()>()) {
         static_assert(rbm_layer_traits<rbm_t>::has_momentum(), "This constructor should only be used with momentum support");
     }
 
@@ -986,24 +1008,24 @@ struct base_cd_trainer<N, RBM, Persistent, Denoising, std::enable_if_t<layer_tra
     etl::dyn_matrix<weight, 4> h2_a;
     etl::dyn_matrix<weight, 4> h2_s;
 
-    cpp::thread_pool<!rbm_layer_traits<rbm_t>::is_serial()> pool;
+    shared_pool_t<!rbm_layer_traits<rbm_t>::is_serial()>& pool; ///< The shared thread pool
 
     base_cd_trainer(rbm_t& rbm)
             : rbm(rbm),
              w_grad(DYN_W_DIMS, 0.0),
              b_grad(rbm.k, 0.0),
              c_grad(rbm.nc, 0.0),
-             w_inc(DYN_W_DIMS, 0.0),
-             b_inc(rbm.k, 0.0),
-             c_inc(rbm.nc, 0.0),
+             w_inc(rbm_layer_traits<rbm_t>::has_momentum() ? rbm.k : 0, rbm.nc, rbm.nw1, rbm.nw2, 0.0),
+             b_inc(rbm_layer_traits<rbm_t>::has_momentum() ? rbm.k : 0, 0.0),
+             c_inc(rbm_layer_traits<rbm_t>::has_momentum() ? rbm.nc : 0, 0.0),
              q_global_t(0.0),
              q_local_batch(rbm.k, rbm.nh1, rbm.nh2),
              q_local_t(rbm.k, rbm.nh1, rbm.nh2, 0.0),
              w_bias(DYN_W_DIMS, 0.0),
              b_bias(rbm.k, 0.0),
              c_bias(rbm.nc, 0.0),
-             p_h_a(get_batch_size(rbm), rbm.k, rbm.nh1, rbm.nh2),
-             p_h_s(get_batch_size(rbm), rbm.k, rbm.nh1, rbm.nh2),
+             p_h_a(Persistent ? get_batch_size(rbm) : 0, rbm.k, rbm.nh1, rbm.nh2),
+             p_h_s(Persistent ? get_batch_size(rbm) : 0, rbm.k, rbm.nh1, rbm.nh2),
              w_pos(DYN_W_DIMS),
              w_neg(DYN_W_DIMS),
              v1(get_batch_size(rbm), rbm.nc, rbm.nv1, rbm.nv2),
@@ -1014,7 +1036,7 @@ struct base_cd_trainer<N, RBM, Persistent, Denoising, std::enable_if_t<layer_tra
              v2_s(get_batch_size(rbm), rbm.nc, rbm.nv1, rbm.nv2),
              h2_a(get_batch_size(rbm), rbm.k, rbm.nh1, rbm.nh2),
              h2_s(get_batch_size(rbm), rbm.k, rbm.nh1, rbm.nh2),
-             pool(etl::threads) {
+             pool(dll::shared_pool<!rbm_layer_traits<rbm_t>::is_serial()>()) {
         //Nothign else to init
     }
 
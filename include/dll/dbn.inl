@@ -17,7 +17,6 @@
 #pragma once
 
 #include "cpp_utils/static_if.hpp"
-#include "cpp_utils/maybe_parallel.hpp"
 
 #include "unit_type.hpp"
 #include "trainer/dbn_trainer.hpp"
@@ -29,7 +28,10 @@
 #include "util/converter.hpp" // Input type conversion
 #include "util/export.hpp"
 #include "util/timers.hpp"
+#include "util/scheduler.hpp"
 #include "util/random.hpp"
+#include "util/permutation.hpp"
+#include "util/snapshot.hpp" // For checkpoint_writer
 #include "dbn_detail.hpp" // dbn_detail namespace
 
 namespace dll {
@@ -167,7 +169,7 @@ public:
 #endif                       //DLL_SVM_SUPPORT
 
 private:
-    cpp::thread_pool<!dbn_traits<this_type>::is_serial()> pool;
+    shared_pool_t<!dbn_traits<this_type>::is_serial()>& pool; ///< The shared thread pool
 
     mutable int fake_resource; ///< Simple field to get a reference from for resource management
 
@@ -185,13 +187,93 @@ private:
     template<std::size_t I, cpp_enable_if(I == layers)>
     void dyn_init(){}
 
+    /*!
+     * \brief Indicates if the activations of the Ith layer can be computed
+     * in batches for inputs of the given iterator type
+     */
+    template <std::size_t I, typename Iterator>
+    static constexpr bool batch_activation() {
+        return batch_layer<I>()
+            && is_random_access_iterator<Iterator>::value
+            && etl::is_etl_expr<safe_value_t<Iterator>>::value;
+    }
+
+    /*!
+     * \brief Indicates if batch_activate_hidden of the Ith layer computes
+     * the same activations as its activate_hidden.
+     *
+     * This is not the case of the multiplex layers and of the CRBM with
+     * Probabilistic Max Pooling, whose outputs are the pooling units.
+     */
+    template <std::size_t I>
+    static constexpr bool batch_layer() {
+        return !layer_traits<layer_type<I>>::is_multiplex_layer()
+            && !dbn_detail::is_pooling_rbm<layer_type<I>>::value;
+    }
+
+    /*!
+     * \brief Indicates if all the layers from the Ith can be activated in
+     * batches
+     */
+    template <std::size_t I = 0, cpp_enable_if((I < layers))>
+    static constexpr bool batch_layers() {
+        return batch_layer<I>() && batch_layers<I + 1>();
+    }
+
+    template <std::size_t I = 0, cpp_enable_if((I == layers))>
+    static constexpr bool batch_layers() {
+        return true;
+    }
+
+    /*!
+     * \brief Indicates if all the layers from the Ith are dense RBMs
+     */
+    template <std::size_t I = 0, cpp_enable_if((I < layers))>
+    static constexpr bool dense_rbm_layers() {
+        return decay_layer_traits<layer_type<I>>::is_dense_rbm_layer() && dense_rbm_layers<I + 1>();
+    }
+
+    template <std::size_t I = 0, cpp_enable_if((I == layers))>
+    static constexpr bool dense_rbm_layers() {
+        return true;
+    }
+
+    /*!
+     * \brief Indicates if the labels of the samples of the given iterator
+     * type can be predicted in batches.
+     *
+     * The batches are propagated as matrices, which is only possible with
+     * dense RBMs.
+     */
+    template <typename Iterator>
+    static constexpr bool batch_labels() {
+        return dense_rbm_layers()
+            && is_random_access_iterator<Iterator>::value
+            && etl::is_etl_expr<safe_value_t<Iterator>>::value;
+    }
+
+    /*!
+     * \brief Indicates if the SVM features of the samples of the given
+     * iterator type can be extracted in batches.
+     *
+     * The samples must have the shape of the input of the network and the
+     * features must not be concatenated.
+     */
+    template <typename Iterator>
+    static constexpr bool svm_batch() {
+        return !dbn_traits<this_type>::concatenate()
+            && !dbn_traits<this_type>::is_multiplex()
+            && is_random_access_iterator<Iterator>::value
+            && dbn_detail::same_dimensions<safe_value_t<Iterator>, input_one_t>::value;
+    }
+
 public:
     /*!
      * Constructs a DBN and initializes all its members.
      *
      * This is the only way to create a DBN.
      */
-    dbn() : pool(etl::threads) {
+    dbn() : pool(dll::shared_pool<!dbn_traits<this_type>::is_serial()>()) {
         //Nothing else to init
 
         cpp::static_if<!std::is_same<typename desc::base_layers, typename desc::layers>::value>([&](auto f){
@@ -221,11 +303,78 @@ public:
                 parameters += f(layer).parameters();
             });
             layer.display();
+            std::cout << "        Training memory: " << layer_memory_bytes<std::decay_t<decltype(layer)>>() << " bytes" << std::endl;
         });
 
         std::cout << "Total parameters: " << parameters << std::endl;
+        std::cout << "Total training memory: " << training_memory_bytes() << " bytes" << std::endl;
+    }
+
+    /*!
+     * \brief Returns the memory, in bytes, needed to train the Ith layer,
+     * i.e. the layer itself, its SGD context and, for RBM layers, the
+     * buffers of its pretraining trainer.
+     *
+     * For dynamic layers, only the memory known at compile-time is
+     * counted, not the memory allocated at runtime.
+     */
+    template <std::size_t I>
+    static constexpr std::size_t layer_training_memory_bytes() {
+        return layer_memory_bytes<layer_type<I>>();
+    }
+
+    /*!
+     * \brief Returns the memory, in bytes, needed to train the network,
+     * i.e. the sum of the memory of each layer.
+     *
+     * For dynamic layers, only the memory known at compile-time is
+     * counted, not the memory allocated at runtime.
+     */
+    static constexpr std::size_t training_memory_bytes() {
+        return training_memory_bytes_impl(std::make_index_sequence<layers>());
+    }
+
+private:
+    template <typename L>
+    static constexpr std::size_t layer_memory_bytes() {
+        return sizeof(L) + sgd_memory_bytes<L>() + pretrain_memory_bytes<L>();
+    }
+
+    template <typename L, cpp_enable_if(decay_layer_traits<L>::sgd_supported())>
+    static constexpr std::size_t sgd_memory_bytes() {
+        return sizeof(sgd_context<this_type, L>);
     }
 
+    template <typename L, cpp_disable_if(decay_layer_traits<L>::sgd_supported())>
+    static constexpr std::size_t sgd_memory_bytes() {
+        return 0;
+    }
+
+    template <typename L, cpp_enable_if(decay_layer_traits<L>::is_rbm_layer())>
+    static constexpr std::size_t pretrain_memory_bytes() {
+        return sizeof(typename L::desc::template trainer_t<L, false>);
+    }
+
+    template <typename L, cpp_disable_if(decay_layer_traits<L>::is_rbm_layer())>
+    static constexpr std::size_t pretrain_memory_bytes() {
+        return 0;
+    }
+
+    template <std::size_t... I>
+    static constexpr std::size_t training_memory_bytes_impl(std::index_sequence<I...> /*s*/) {
+        std::size_t bytes[] = {layer_training_memory_bytes<I>()...};
+
+        std::size_t sum = 0;
+
+        for (auto b : bytes) {
+            sum += b;
+        }
+
+        return sum;
+    }
+
+public:
+
     /*!
      * \brief Backup the weights of all the layers into a temporary storage.
      *
@@ -263,6 +412,18 @@ public:
         store(os);
     }
 
+    /*!
+     * \brief Store the network weights to the given file, asynchronously.
+     *
+     * The weights are serialized in memory before returning, the file is
+     * written by the background thread of the checkpoint writer.
+     *
+     * \param file The path to the file
+     */
+    void store_async(const std::string& file) const {
+        dll::checkpoint_writer().write(*this, file);
+    }
+
     /*!
      * \brief Load the network weights from the given file.
      * \param file The path to the file
@@ -274,11 +435,15 @@ public:
 
     /*!
      * \brief Store the network weights using the given output stream.
+     *
+     * The parameters of all the trained layers (RBM, dense and
+     * convolutional) are stored, in the order of the layers.
+     *
      * \param os The stream to output the network weights to.
      */
     void store(std::ostream& os) const {
         for_each_layer([&os](auto& layer) {
-            cpp::static_if<decay_layer_traits<decltype(layer)>::is_rbm_layer()>([&](auto f) {
+            cpp::static_if<decay_layer_traits<decltype(layer)>::is_trained()>([&](auto f) {
                 f(layer).store(os);
             });
         });
@@ -294,7 +459,7 @@ public:
      */
     void load(std::istream& is) {
         for_each_layer([&is](auto& layer) {
-            cpp::static_if<decay_layer_traits<decltype(layer)>::is_rbm_layer()>([&](auto f) {
+            cpp::static_if<decay_layer_traits<decltype(layer)>::is_trained()>([&](auto f) {
                 f(layer).load(is);
             });
         });
@@ -399,7 +564,7 @@ public:
                 std::cout << "warning: batch_mode dbn does not support shuffle in layers (will be ignored)";
             }
 
-            pretrain_layer_batch<0>(first, last, watcher, max_epochs);
+            pretrain_batch(first, last, watcher, max_epochs);
         } else {
             pretrain_layer<0>(first, last, watcher, max_epochs, fake_resource);
         }
@@ -489,7 +654,7 @@ public:
             }
 
             //Pretrain each layer one-by-one
-            pretrain_layer_denoising_auto_batch<0>(cit, cend, watcher, max_epochs, noise);
+            pretrain_denoising_auto_batch(cit, cend, watcher, max_epochs, noise);
         } else {
             std::cout << "DBN: Denoising Pretraining" << std::endl;
 
@@ -557,6 +722,80 @@ public:
             std::max_element(std::prev(output_a.end(), labels), output_a.end()));
     }
 
+    /*!
+     * \brief Predict the labels of all the given samples (only when
+     * pretrained with labels).
+     *
+     * The samples are propagated in batches of batch_size samples, the
+     * batches being processed in parallel.
+     *
+     * \param first Iterator to the first sample
+     * \param last Iterator past the last sample
+     * \param labels The number of labels
+     * \return The predicted label of each sample
+     */
+    template <typename Iterator, cpp_enable_if(batch_labels<Iterator>())>
+    std::vector<std::size_t> predict_labels(Iterator first, Iterator last, std::size_t labels) const {
+        dll::auto_timer timer("dbn:predict_labels:batch");
+
+        cpp_assert(dll::input_size(layer_get<layers - 1>()) == dll::output_size(layer_get<layers - 2>()) + labels, "There is no room for the labels units");
+
+        const std::size_t n      = std::distance(first, last);
+        const std::size_t chunks = (n + batch_size - 1) / batch_size;
+
+        std::vector<std::size_t> predictions(n);
+        std::vector<std::size_t> ids(chunks);
+
+        parallel_foreach_i(pool, ids.begin(), ids.end(), [this, &predictions, first, n, labels](std::size_t& /*id*/, std::size_t c) {
+            const std::size_t start = c * batch_size;
+            const std::size_t end   = std::min(n, start + batch_size);
+
+            auto input = dbn_detail::make_batch<weight>(end - start, first[start]);
+
+            for (std::size_t i = start; i < end; ++i) {
+                input(i - start) = first[i];
+            }
+
+            const std::size_t visible = dll::input_size(this->template layer_get<layers - 1>());
+
+            etl::dyn_matrix<weight, 2> output(end - start, visible);
+
+            this->template batch_predict_labels<0>(input, output, labels);
+
+            for (std::size_t i = 0; i < end - start; ++i) {
+                auto* label_units = output.memory_start() + i * visible + (visible - labels);
+
+                predictions[start + i] = std::distance(label_units, std::max_element(label_units, label_units + labels));
+            }
+        });
+
+        return predictions;
+    }
+
+    /*!
+     * \brief Predict the labels of all the given samples (only when
+     * pretrained with labels), one sample at a time.
+     *
+     * This is used when the samples cannot be gathered into batches.
+     *
+     * \param first Iterator to the first sample
+     * \param last Iterator past the last sample
+     * \param labels The number of labels
+     * \return The predicted label of each sample
+     */
+    template <typename Iterator, cpp_disable_if(batch_labels<Iterator>())>
+    std::vector<std::size_t> predict_labels(Iterator first, Iterator last, std::size_t labels) const {
+        dll::auto_timer timer("dbn:predict_labels:single");
+
+        std::vector<std::size_t> predictions(std::distance(first, last));
+
+        parallel_foreach_i(pool, first, last, [this, &predictions, labels](auto& sample, std::size_t i) {
+            predictions[i] = this->predict_labels(sample, labels);
+        });
+
+        return predictions;
+    }
+
     //Note: features_sub are alias functions for activation_probabilities_sub
 
     /*!
@@ -615,6 +854,27 @@ public:
         return activation_probabilities(converted);
     }
 
+    /*!
+     * \brief Returns the output features of all the samples in [first, last)
+     *
+     * The activations are computed layer by layer, in parallel batches of
+     * batch_size samples for the layers supporting it (see activate_layer).
+     * The returned features are the same as the ones of features() for
+     * each sample.
+     *
+     * \param first Iterator to the first sample
+     * \param last Iterator past the last sample
+     * \return A container with the output features of each sample
+     */
+    template <typename Iterator>
+    auto batch_features(Iterator first, Iterator last) {
+        static_assert(!dbn_traits<this_type>::is_multiplex(), "batch_features does not support multiplex layers");
+
+        dll::auto_timer timer("dbn:batch_features");
+
+        return batch_features_impl<0>(first, last);
+    }
+
     // Forward one batch at a time
 
     //Note: Ideally, this should be done without using the SGD
@@ -775,12 +1035,28 @@ public:
      * \param max_epochs The maximum number of epochs to train the network for.
      * \return The final classification error
      */
-    template <typename Input, typename Labels>
+    template <typename Input, typename Labels, cpp_disable_if(etl::is_etl_expr<Input>::value && etl::is_etl_expr<Labels>::value)>
     weight fine_tune(const Input& training_data, Labels& labels, size_t max_epochs) {
         decltype(auto) converted = converter_many<Input, input_t>::convert(layer_get<input_layer_n>(), training_data);
         return fine_tune(converted.begin(), converted.end(), labels.begin(), labels.end(), max_epochs);
     }
 
+    /*!
+     * \brief Fine tune the network for classifcation on data held in ETL
+     * containers. The data is used in place, without any copy.
+     * \param training_data The samples, one per row (or 3D samples for convolutional networks)
+     * \param labels The labels, either as one-hot rows or as class indices
+     * \param max_epochs The maximum number of epochs to train the network for.
+     * \return The final classification error
+     */
+    template <typename Input, typename Labels, cpp_enable_if(etl::is_etl_expr<Input>::value && etl::is_etl_expr<Labels>::value)>
+    weight fine_tune(const Input& training_data, const Labels& labels, size_t max_epochs) {
+        dll::auto_timer timer("dbn:train:ft:direct");
+
+        dll::dbn_trainer<this_type> trainer;
+        return trainer.train_direct(*this, training_data, labels, max_epochs);
+    }
+
     /*!
      * \brief Fine tune the network for classifcation.
      * \param first Iterator to the first sample
@@ -1115,7 +1391,9 @@ public:
     bool svm_train(const Samples& training_data, const Labels& labels, const svm_parameter& parameters = default_svm_parameters()) {
         cpp::stop_watch<std::chrono::seconds> watch;
 
-        make_problem(training_data, labels, dbn_traits<this_type>::scale());
+        if (!make_problem(training_data, labels, dbn_traits<this_type>::scale())) {
+            return false;
+        }
 
         //Make libsvm quiet
         svm::make_quiet();
@@ -1139,10 +1417,12 @@ public:
     bool svm_train(Iterator&& first, Iterator&& last, LIterator&& lfirst, LIterator&& llast, const svm_parameter& parameters = default_svm_parameters()) {
         cpp::stop_watch<std::chrono::seconds> watch;
 
-        make_problem(
-            std::forward<Iterator>(first), std::forward<Iterator>(last),
-            std::forward<LIterator>(lfirst), std::forward<LIterator>(llast),
-            dbn_traits<this_type>::scale());
+        if (!make_problem(
+                std::forward<Iterator>(first), std::forward<Iterator>(last),
+                std::forward<LIterator>(lfirst), std::forward<LIterator>(llast),
+                dbn_traits<this_type>::scale())) {
+            return false;
+        }
 
         //Make libsvm quiet
         svm::make_quiet();
@@ -1164,7 +1444,9 @@ public:
 
     template <typename Samples, typename Labels>
     bool svm_grid_search(const Samples& training_data, const Labels& labels, std::size_t n_fold = 5, const svm::rbf_grid& g = svm::rbf_grid()) {
-        make_problem(training_data, labels, dbn_traits<this_type>::scale());
+        if (!make_problem(training_data, labels, dbn_traits<this_type>::scale())) {
+            return false;
+        }
 
         //Make libsvm quiet
         svm::make_quiet();
@@ -1184,10 +1466,12 @@ public:
 
     template <typename It, typename LIt>
     bool svm_grid_search(It&& first, It&& last, LIt&& lfirst, LIt&& llast, std::size_t n_fold = 5, const svm::rbf_grid& g = svm::rbf_grid()) {
-        make_problem(
-            std::forward<It>(first), std::forward<It>(last),
-            std::forward<LIt>(lfirst), std::forward<LIt>(llast),
-            dbn_traits<this_type>::scale());
+        if (!make_problem(
+                std::forward<It>(first), std::forward<It>(last),
+                std::forward<LIt>(lfirst), std::forward<LIt>(llast),
+                dbn_traits<this_type>::scale())) {
+            return false;
+        }
 
         //Make libsvm quiet
         svm::make_quiet();
@@ -1211,6 +1495,57 @@ public:
         return svm::predict(svm_model, features);
     }
 
+    /*!
+     * \brief Predict the classes of all the samples in [first, last)
+     *
+     * The features are extracted and classified in parallel on the
+     * thread pool of the DBN, one sample at a time.
+     *
+     * \return A vector with the predicted class of each sample
+     */
+    template <typename Iterator, cpp_disable_if(svm_batch<Iterator>())>
+    std::vector<double> svm_predict(Iterator first, Iterator last) {
+        std::vector<double> predictions(std::distance(first, last));
+
+        parallel_foreach_i(pool, first, last, [this, &predictions](auto& sample, std::size_t i) {
+            auto features  = this->get_final_activation_probabilities(sample);
+            predictions[i] = svm::predict(svm_model, features);
+        });
+
+        return predictions;
+    }
+
+    /*!
+     * \brief Predict the classes of all the samples in [first, last)
+     *
+     * The features are extracted by batched forward passes, one block of
+     * samples at a time, and classified in parallel on the thread pool of
+     * the DBN.
+     *
+     * \return A vector with the predicted class of each sample
+     */
+    template <typename Iterator, cpp_enable_if(svm_batch<Iterator>())>
+    std::vector<double> svm_predict(Iterator first, Iterator last) {
+        dll::auto_timer timer("dbn:svm:predict:batch");
+
+        const std::size_t n     = std::distance(first, last);
+        const std::size_t block = batch_size * dll::threads() * 4;
+
+        std::vector<double> predictions(n);
+
+        for (std::size_t start = 0; start < n; start += block) {
+            const std::size_t end = std::min(n, start + block);
+
+            auto batch = this->batch_features(first + start, first + end);
+
+            parallel_foreach_n(pool, 0, end - start, [this, &batch, &predictions, start](std::size_t i) {
+                predictions[start + i] = svm::predict(svm_model, batch[i]);
+            });
+        }
+
+        return predictions;
+    }
+
 #endif //DLL_SVM_SUPPORT
 
 private:
@@ -1247,7 +1582,7 @@ private:
 
         auto next_a = next_layer.template prepare_output<next_input_t>(std::distance(first, last));
 
-        maybe_parallel_foreach_i(pool, first, last, [&layer, &next_layer, &next_a](auto& v, std::size_t i) {
+        parallel_foreach_i(pool, first, last, [&layer, &next_layer, &next_a](auto& v, std::size_t i) {
             auto tmp = layer.template prepare_one_output<input_t>();
 
             layer.activate_hidden(tmp, v);
@@ -1282,9 +1617,7 @@ private:
         if (train_next<I + 1>::value && !inline_next<I + 1>::value) {
             auto next_a = layer.template prepare_output<safe_value_t<Iterator>>(std::distance(first, last));
 
-            maybe_parallel_foreach_i(pool, first, last, [&layer, &next_a](auto& v, std::size_t i) {
-                layer.activate_hidden(next_a[i], v);
-            });
+            activate_layer<I>(first, last, next_a);
 
             //At this point we don't need the storage of the previous layer
             release(previous);
@@ -1307,6 +1640,74 @@ private:
     template <std::size_t I, typename Iterator, typename Container, cpp_enable_if((I == layers))>
     void pretrain_layer(Iterator, Iterator, watcher_t&, std::size_t, Container&) {}
 
+    /*!
+     * \brief Compute the activations of the Ith layer for each input.
+     *
+     * The inputs are processed in chunks of batch_size samples, each chunk
+     * being copied into a contiguous batch and propagated with a single
+     * batch_activate_hidden.
+     */
+    template <std::size_t I, typename Iterator, typename Output, cpp_enable_if(batch_activation<I, Iterator>())>
+    void activate_layer(Iterator first, Iterator last, Output& output) {
+        dll::auto_timer timer("dbn:pretrain:activate_layer:batch");
+
+        decltype(auto) layer = layer_get<I>();
+
+        const std::size_t n      = std::distance(first, last);
+        const std::size_t chunks = (n + batch_size - 1) / batch_size;
+
+        std::vector<std::size_t> ids(chunks);
+
+        parallel_foreach_i(pool, ids.begin(), ids.end(), [&layer, &output, first, n](std::size_t& /*id*/, std::size_t c) {
+            const std::size_t start = c * batch_size;
+            const std::size_t end   = std::min(n, start + batch_size);
+
+            auto input_batch  = dbn_detail::make_batch<etl::value_t<safe_value_t<Iterator>>>(end - start, *first);
+            auto output_batch = dbn_detail::make_batch<etl::value_t<typename Output::value_type>>(end - start, output[0]);
+
+            for (std::size_t i = start; i < end; ++i) {
+                input_batch(i - start) = first[i];
+            }
+
+            layer.batch_activate_hidden(output_batch, input_batch);
+
+            for (std::size_t i = start; i < end; ++i) {
+                output[i] = output_batch(i - start);
+            }
+        });
+    }
+
+    /*!
+     * \brief Compute the activations of the Ith layer for each input, one
+     * sample at a time.
+     */
+    template <std::size_t I, typename Iterator, typename Output, cpp_disable_if(batch_activation<I, Iterator>())>
+    void activate_layer(Iterator first, Iterator last, Output& output) {
+        decltype(auto) layer = layer_get<I>();
+
+        parallel_foreach_i(pool, first, last, [&layer, &output](auto& v, std::size_t i) {
+            layer.activate_hidden(output[i], v);
+        });
+    }
+
+    template <std::size_t I, typename Iterator, cpp_enable_if((I < layers - 1))>
+    auto batch_features_impl(Iterator first, Iterator last) {
+        auto next_a = layer_get<I>().template prepare_output<safe_value_t<Iterator>>(std::distance(first, last));
+
+        activate_layer<I>(first, last, next_a);
+
+        return batch_features_impl<I + 1>(next_a.begin(), next_a.end());
+    }
+
+    template <std::size_t I, typename Iterator, cpp_enable_if((I == layers - 1))>
+    auto batch_features_impl(Iterator first, Iterator last) {
+        auto next_a = layer_get<I>().template prepare_output<safe_value_t<Iterator>>(std::distance(first, last));
+
+        activate_layer<I>(first, last, next_a);
+
+        return next_a;
+    }
+
     /* Pretrain with denoising */
 
     template <std::size_t I, typename NIterator, typename CIterator, typename NContainer, typename CContainer, cpp_enable_if((I < layers))>
@@ -1328,11 +1729,11 @@ private:
             auto next_n = layer.template prepare_output<safe_value_t<NIterator>>(std::distance(nit, nend));
             auto next_c = layer.template prepare_output<safe_value_t<CIterator>>(std::distance(nit, nend));
 
-            maybe_parallel_foreach_i(pool, nit, nend, [&layer, &next_n](auto& v, std::size_t i) {
+            parallel_foreach_i(pool, nit, nend, [&layer, &next_n](auto& v, std::size_t i) {
                 layer.activate_hidden(next_n[i], v);
             });
 
-            maybe_parallel_foreach_i(pool, cit, cend, [&layer, &next_c](auto& v, std::size_t i) {
+            parallel_foreach_i(pool, cit, cend, [&layer, &next_c](auto& v, std::size_t i) {
                 layer.activate_hidden(next_c[i], v);
             });
 
@@ -1371,7 +1772,7 @@ private:
         if (train_next<I + 1>::value) {
             auto next_c = layer.template prepare_output<safe_value_t<CIterator>>(std::distance(cit, cend));
 
-            maybe_parallel_foreach_i(pool, cit, cend, [&layer, &next_c](auto& v, std::size_t i) {
+            parallel_foreach_i(pool, cit, cend, [&layer, &next_c](auto& v, std::size_t i) {
                 layer.activate_hidden(next_c[i], v);
             });
 
@@ -1399,34 +1800,69 @@ private:
     template <std::size_t I>
     struct batch_layer_ignore<I, std::enable_if_t<(I < layers)>> : cpp::or_u<layer_traits<layer_type<I>>::is_pooling_layer(), layer_traits<layer_type<I>>::is_transform_layer(), layer_traits<layer_type<I>>::is_standard_layer(), !layer_traits<layer_type<I>>::pretrain_last()> {};
 
-    template <bool Bypass, typename Iterator, typename Container, typename T = this_type, cpp_enable_if(Bypass && dbn_traits<T>::shuffle_pretrain())>
-    auto prepare_it(Iterator it, Iterator end, Container& container){
-        std::copy(it, end, std::back_inserter(container));
-        return std::make_tuple(container.begin(), container.end());
+    //With shuffle_pre, the samples are visited through a permutation of
+    //their indices, they are never copied nor moved, unless the iterators
+    //are not random access
+
+    template <typename Iterator, typename T = this_type, cpp_enable_if(dbn_traits<T>::shuffle_pretrain() && !is_random_access_iterator<Iterator>::value)>
+    void pretrain_batch(Iterator first, Iterator last, watcher_t& watcher, std::size_t max_epochs) {
+        std::vector<std::remove_cv_t<typename std::iterator_traits<Iterator>::value_type>> input_copy(first, last);
+
+        pretrain_layer_batch<0>(input_copy.begin(), input_copy.end(), watcher, max_epochs);
     }
 
-    template <bool Bypass, typename Iterator, typename Container, typename T = this_type, cpp_disable_if(Bypass && dbn_traits<T>::shuffle_pretrain())>
-    auto prepare_it(Iterator it, Iterator end, Container& container){
-        cpp_unused(container);
-        return std::make_tuple(it, end);
+    template <typename Iterator, typename T = this_type, cpp_disable_if(dbn_traits<T>::shuffle_pretrain() && !is_random_access_iterator<Iterator>::value)>
+    void pretrain_batch(Iterator first, Iterator last, watcher_t& watcher, std::size_t max_epochs) {
+        pretrain_layer_batch<0>(first, last, watcher, max_epochs);
     }
 
-    template <typename Container>
-    void shuffle(Container& container){
-        decltype(auto) g = dll::rand_engine();
-        std::shuffle(container.begin(), container.end(), g);
+    template <typename Iterator, typename T = this_type, cpp_enable_if(dbn_traits<T>::shuffle_pretrain() && !is_random_access_iterator<Iterator>::value)>
+    void pretrain_denoising_auto_batch(Iterator first, Iterator last, watcher_t& watcher, std::size_t max_epochs, double noise) {
+        std::vector<std::remove_cv_t<typename std::iterator_traits<Iterator>::value_type>> input_copy(first, last);
+
+        pretrain_layer_denoising_auto_batch<0>(input_copy.begin(), input_copy.end(), watcher, max_epochs, noise);
+    }
+
+    template <typename Iterator, typename T = this_type, cpp_disable_if(dbn_traits<T>::shuffle_pretrain() && !is_random_access_iterator<Iterator>::value)>
+    void pretrain_denoising_auto_batch(Iterator first, Iterator last, watcher_t& watcher, std::size_t max_epochs, double noise) {
+        pretrain_layer_denoising_auto_batch<0>(first, last, watcher, max_epochs, noise);
+    }
+
+    template <typename Iterator, typename T = this_type, cpp_enable_if(dbn_traits<T>::shuffle_pretrain())>
+    auto ordered_begin(Iterator first, const permutation& order){
+        return permuted_begin(first, order);
+    }
+
+    template <typename Iterator, typename T = this_type, cpp_enable_if(dbn_traits<T>::shuffle_pretrain())>
+    auto ordered_end(Iterator first, Iterator /*last*/, const permutation& order){
+        return permuted_end(first, order);
+    }
+
+    template <typename Iterator, typename T = this_type, cpp_disable_if(dbn_traits<T>::shuffle_pretrain())>
+    auto ordered_begin(Iterator first, const permutation& /*order*/){
+        return first;
+    }
+
+    template <typename Iterator, typename T = this_type, cpp_disable_if(dbn_traits<T>::shuffle_pretrain())>
+    auto ordered_end(Iterator /*first*/, Iterator last, const permutation& /*order*/){
+        return last;
+    }
+
+    void shuffle(permutation& order){
+        if (dbn_traits<this_type>::shuffle_pretrain()) {
+            order.shuffle();
+        }
     }
 
     //Special handling for the layer 0
     //data is coming from iterators not from input
     template <std::size_t I, typename Iterator, cpp_enable_if((I == 0 && !batch_layer_ignore<I>::value))>
     void pretrain_layer_batch(Iterator orig_first, Iterator orig_last, watcher_t& watcher, std::size_t max_epochs) {
-        std::vector<std::remove_cv_t<typename std::iterator_traits<Iterator>::value_type>> input_copy;
+        //The order in which the samples are visited
+        permutation order(dbn_traits<this_type>::shuffle_pretrain() ? std::distance(orig_first, orig_last) : 0);
 
-        auto iterators = prepare_it<false>(orig_first, orig_last, input_copy);
-
-        decltype(auto) first = std::get<0>(iterators);
-        decltype(auto) last = std::get<1>(iterators);
+        auto first = ordered_begin(orig_first, order);
+        auto last  = ordered_end(orig_first, orig_last, order);
 
         using layer_t = layer_type<I>;
 
@@ -1440,7 +1876,7 @@ private:
         rbm_trainer_t r_trainer;
 
         //Init the RBM and training parameters
-        r_trainer.init_training(rbm, first, last); //TODO This may be highly slow...
+        r_trainer.init_training(rbm, first, last);
 
         //Get the specific trainer (CD)
         auto trainer = rbm_trainer_t::get_trainer(rbm);
@@ -1454,8 +1890,8 @@ private:
         for (std::size_t epoch = 0; epoch < max_epochs; ++epoch) {
             std::size_t big_batch = 0;
 
-            // Sort before training
-            shuffle(input_copy);
+            // Shuffle before training
+            shuffle(order);
 
             //Create a new context for this epoch
             rbm_training_context context;
@@ -1493,7 +1929,7 @@ private:
         r_trainer.finalize_training(rbm);
 
         //Train the next layer
-        pretrain_layer_batch<I + 1>(first, last, watcher, max_epochs);
+        pretrain_layer_batch<I + 1>(orig_first, orig_last, watcher, max_epochs);
     }
 
     //Special handling for untrained layers
@@ -1506,12 +1942,11 @@ private:
     //Normal version
     template <std::size_t I, typename Iterator, cpp_enable_if((I > 0 && I < layers && !dbn_traits<this_type>::is_multiplex() && !batch_layer_ignore<I>::value))>
     void pretrain_layer_batch(Iterator orig_first, Iterator orig_last, watcher_t& watcher, std::size_t max_epochs) {
-        std::vector<typename std::iterator_traits<Iterator>::value_type> input_copy;
-
-        auto iterators = prepare_it<!batch_layer_ignore<0>::value>(orig_first, orig_last, input_copy);
+        //The order in which the samples are visited
+        permutation order(dbn_traits<this_type>::shuffle_pretrain() ? std::distance(orig_first, orig_last) : 0);
 
-        decltype(auto) first = std::get<0>(iterators);
-        decltype(auto) last = std::get<1>(iterators);
+        auto first = ordered_begin(orig_first, order);
+        auto last  = ordered_end(orig_first, orig_last, order);
 
         using layer_t = layer_type<I>;
 
@@ -1541,8 +1976,8 @@ private:
         for (std::size_t epoch = 0; epoch < max_epochs; ++epoch) {
             std::size_t big_batch = 0;
 
-            // Sort before training
-            shuffle(input_copy);
+            // Shuffle before training
+            shuffle(order);
 
             //Create a new context for this epoch
             rbm_training_context context;
@@ -1582,7 +2017,7 @@ private:
         r_trainer.finalize_training(rbm);
 
         //train the next layer, if any
-        pretrain_layer_batch<I + 1>(first, last, watcher, max_epochs);
+        pretrain_layer_batch<I + 1>(orig_first, orig_last, watcher, max_epochs);
     }
 
     // TODO THis should not be necessary at all
@@ -1603,12 +2038,11 @@ private:
     //Multiplex version
     template <std::size_t I, typename Iterator, cpp_enable_if((I > 0 && I < layers && dbn_traits<this_type>::is_multiplex() && !batch_layer_ignore<I>::value))>
     void pretrain_layer_batch(Iterator orig_first, Iterator orig_last, watcher_t& watcher, std::size_t max_epochs) {
-        std::vector<typename std::iterator_traits<Iterator>::value_type> input_copy;
-
-        auto iterators = prepare_it<!batch_layer_ignore<0>::value>(orig_first, orig_last, input_copy);
+        //The order in which the samples are visited
+        permutation order(dbn_traits<this_type>::shuffle_pretrain() ? std::distance(orig_first, orig_last) : 0);
 
-        decltype(auto) first = std::get<0>(iterators);
-        decltype(auto) last = std::get<1>(iterators);
+        auto first = ordered_begin(orig_first, order);
+        auto last  = ordered_end(orig_first, orig_last, order);
 
         using layer_t = layer_type<I>;
 
@@ -1638,8 +2072,8 @@ private:
         for (std::size_t epoch = 0; epoch < max_epochs; ++epoch) {
             std::size_t big_batch = 0;
 
-            // Sort before training
-            shuffle(input_copy);
+            // Shuffle before training
+            shuffle(order);
 
             //Create a new context for this epoch
             rbm_training_context context;
@@ -1692,7 +2126,7 @@ private:
         r_trainer.finalize_training(rbm);
 
         //train the next layer, if any
-        pretrain_layer_batch<I + 1>(first, last, watcher, max_epochs);
+        pretrain_layer_batch<I + 1>(orig_first, orig_last, watcher, max_epochs);
     }
 
     //Stop template recursion
@@ -1716,12 +2150,11 @@ private:
     //data is coming from iterators not from input
     template <std::size_t I, typename Iterator, cpp_enable_if((I == 0 && !batch_layer_ignore<I>::value))>
     void pretrain_layer_denoising_auto_batch(Iterator orig_first, Iterator orig_last, watcher_t& watcher, std::size_t max_epochs, double noise) {
-        std::vector<std::remove_cv_t<typename std::iterator_traits<Iterator>::value_type>> input_copy;
-
-        auto iterators = prepare_it<false>(orig_first, orig_last, input_copy);
+        //The order in which the samples are visited
+        permutation order(dbn_traits<this_type>::shuffle_pretrain() ? std::distance(orig_first, orig_last) : 0);
 
-        decltype(auto) first = std::get<0>(iterators);
-        decltype(auto) last = std::get<1>(iterators);
+        auto first = ordered_begin(orig_first, order);
+        auto last  = ordered_end(orig_first, orig_last, order);
 
         using layer_t = layer_type<I>;
 
@@ -1735,7 +2168,7 @@ private:
         rbm_trainer_t r_trainer;
 
         //Init the RBM and training parameters
-        r_trainer.init_training(rbm, first, last); //TODO This may be highly slow...
+        r_trainer.init_training(rbm, first, last);
 
         //Get the specific trainer (CD)
         auto trainer = rbm_trainer_t::get_trainer(rbm);
@@ -1750,8 +2183,8 @@ private:
         for (std::size_t epoch = 0; epoch < max_epochs; ++epoch) {
             std::size_t big_batch = 0;
 
-            // Sort before training
-            shuffle(input_copy);
+            // Shuffle before training
+            shuffle(order);
 
             //Create a new context for this epoch
             rbm_training_context context;
@@ -1792,7 +2225,7 @@ private:
         r_trainer.finalize_training(rbm);
 
         //Train the next layer
-        pretrain_layer_denoising_auto_batch<I + 1>(first, last, watcher, max_epochs, noise);
+        pretrain_layer_denoising_auto_batch<I + 1>(orig_first, orig_last, watcher, max_epochs, noise);
     }
 
     //Special handling for untrained layers
@@ -1805,12 +2238,11 @@ private:
     //Normal version
     template <std::size_t I, typename Iterator, cpp_enable_if((I > 0 && I < layers && !batch_layer_ignore<I>::value))>
     void pretrain_layer_denoising_auto_batch(Iterator orig_first, Iterator orig_last, watcher_t& watcher, std::size_t max_epochs, double noise) {
-        std::vector<typename std::iterator_traits<Iterator>::value_type> input_copy;
+        //The order in which the samples are visited
+        permutation order(dbn_traits<this_type>::shuffle_pretrain() ? std::distance(orig_first, orig_last) : 0);
 
-        auto iterators = prepare_it<!batch_layer_ignore<0>::value>(orig_first, orig_last, input_copy);
-
-        decltype(auto) first = std::get<0>(iterators);
-        decltype(auto) last = std::get<1>(iterators);
+        auto first = ordered_begin(orig_first, order);
+        auto last  = ordered_end(orig_first, orig_last, order);
 
         using layer_t = layer_type<I>;
 
@@ -1841,8 +2273,8 @@ private:
         for (std::size_t epoch = 0; epoch < max_epochs; ++epoch) {
             std::size_t big_batch = 0;
 
-            // Sort before training
-            shuffle(input_copy);
+            // Shuffle before training
+            shuffle(order);
 
             //Create a new context for this epoch
             rbm_training_context context;
@@ -1888,7 +2320,7 @@ private:
         r_trainer.finalize_training(rbm);
 
         //train the next layer, if any
-        pretrain_layer_denoising_auto_batch<I + 1>(first, last, watcher, max_epochs, noise);
+        pretrain_layer_denoising_auto_batch<I + 1>(orig_first, orig_last, watcher, max_epochs, noise);
     }
 
     //Stop template recursion
@@ -1917,27 +2349,28 @@ private:
             using input_t = std::decay_t<decltype(*first)>;
             auto next_a = layer.template prepare_output<input_t>(input_size);
 
-            cpp::foreach_i(first, last, [&](auto& sample, std::size_t i) {
-                layer.activate_hidden(next_a[i], sample);
-            });
+            activate_layer<I>(first, last, next_a);
 
             //If the next layer is the last layer
             if (I == layers - 2) {
                 auto big_next_a = layer.template prepare_output<input_t>(input_size, true, labels);
 
-                //Cannot use std copy since the sub elements have different size
-                for (std::size_t i = 0; i < next_a.size(); ++i) {
-                    for (std::size_t j = 0; j < next_a[i].size(); ++j) {
-                        big_next_a[i][j] = next_a[i][j];
-                    }
-                }
+                const std::size_t hidden = dll::output_size(layer);
+
+                //The label units are set to zero, the activations are copied in front of them
+                parallel_foreach_pair_i(pool, next_a.begin(), next_a.end(), big_next_a.begin(), big_next_a.end(), [hidden](auto& a, auto& big_a, std::size_t /*i*/) {
+                    std::copy_n(a.begin(), hidden, big_a.begin());
+                    std::fill(big_a.begin() + hidden, big_a.end(), 0.0);
+                });
+
+                release(next_a);
 
                 std::size_t i = 0;
                 while (lit != lend) {
                     decltype(auto) label = *lit;
 
-                    for (size_t l = 0; l < labels; ++l) {
-                        big_next_a[i][dll::output_size(layer) + l] = label == l ? 1.0 : 0.0;
+                    if (static_cast<std::size_t>(label) < labels) {
+                        big_next_a[i][hidden + label] = 1.0;
                     }
 
                     ++i;
@@ -1999,68 +2432,91 @@ private:
     template <std::size_t I, typename Input, typename Output>
     std::enable_if_t<(I == layers)> predict_labels(const Input&, Output&, std::size_t) const {}
 
+    /*!
+     * \brief Predict the output labels of a batch of samples (only when
+     * pretrain with labels)
+     */
+    template <std::size_t I, typename Input, typename Output>
+    std::enable_if_t<(I < layers)> batch_predict_labels(const Input& input, Output& output, std::size_t labels) const {
+        decltype(auto) layer = layer_get<I>();
+
+        const std::size_t n = etl::dim<0>(input);
+
+        etl::dyn_matrix<weight, 2> next_a(n, dll::output_size(layer));
+
+        if (I == layers - 1) {
+            etl::dyn_matrix<weight, 2> next_s(n, dll::output_size(layer));
+            etl::dyn_matrix<weight, 2> output_s(n, dll::input_size(layer));
+
+            layer.batch_activate_hidden(next_a, next_s, input, input);
+            layer.batch_activate_visible(next_a, next_s, output, output_s);
+        } else {
+            layer.batch_activate_hidden(next_a, input);
+
+            //If the next layers is the last layer
+            if (I == layers - 2) {
+                const std::size_t hidden = dll::output_size(layer);
+
+                etl::dyn_matrix<weight, 2> big_next_a(n, hidden + labels);
+
+                big_next_a = 0.1;
+
+                for (std::size_t i = 0; i < n; ++i) {
+                    std::copy_n(next_a.memory_start() + i * hidden, hidden, big_next_a.memory_start() + i * (hidden + labels));
+                }
+
+                batch_predict_labels<I + 1>(big_next_a, output, labels);
+            } else {
+                batch_predict_labels<I + 1>(next_a, output, labels);
+            }
+        }
+    }
+
+    //Stop recursion
+    template <std::size_t I, typename Input, typename Output>
+    std::enable_if_t<(I == layers)> batch_predict_labels(const Input&, Output&, std::size_t) const {}
+
     /* Activation Probabilities */
 
     template <std::size_t I, typename Iterator, typename Output>
     void multi_activation_probabilities(Iterator first, Iterator last, Output& output) {
         //Collect an entire batch
-        maybe_parallel_foreach_i(pool, first, last, [this, &output](auto& v, std::size_t i) {
+        parallel_foreach_i(pool, first, last, [this, &output](auto& v, std::size_t i) {
             output[i] = this->activation_probabilities_sub<I>(v);
         });
     }
 
 #ifdef DLL_SVM_SUPPORT
 
-    template <typename Samples, typename Input, typename DBN = this_type, cpp_enable_if(dbn_traits<DBN>::concatenate())>
-    void add_activation_probabilities(Samples& result, const Input& sample) {
-        result.emplace_back(full_output_size());
-        full_activation_probabilities(sample, result.back());
-    }
-
-    template <typename Samples,typename Input, typename DBN = this_type, cpp_disable_if(dbn_traits<DBN>::concatenate())>
-    void add_activation_probabilities(Samples& result, const Input& sample) {
-        result.push_back(activation_probabilities(sample));
-    }
-
-    template <typename Input>
-    using svm_sample_t = std::conditional_t<
-        dbn_traits<this_type>::concatenate(),
-        etl::dyn_vector<weight>,                             //In full mode, use a simple 1D vector
-        typename types_helper<layers - 1, Input>::output_t>; //In normal mode, use the output of the last layer
-
-    template <typename Input>
-    using svm_samples_t = std::vector<svm_sample_t<Input>>;
-
+    /*!
+     * \brief Create the svm problem for this dbn
+     */
     template <typename Samples, typename Labels>
-    void make_problem(const Samples& training_data, const Labels& labels, bool scale = false) {
-        svm_samples_t<safe_value_t<Samples>> svm_samples;
-
-        //Get all the activation probabilities
-        for (auto& sample : training_data) {
-            add_activation_probabilities(svm_samples, sample);
-        }
-
-        //static_cast ensure using the correct overload
-        problem = svm::make_problem(labels, static_cast<const svm_samples_t<safe_value_t<Samples>>&>(svm_samples), scale);
+    bool make_problem(const Samples& training_data, const Labels& labels, bool scale = false) {
+        return make_problem(training_data.begin(), training_data.end(), labels.begin(), labels.end(), scale);
     }
 
     /*!
      * \brief Create the svm problem for this dbn
      */
-    template <typename Iterator, typename LIterator>
-    void make_problem(Iterator first, Iterator last, LIterator&& lfirst, LIterator&& llast, bool scale = false) {
-        svm_samples_t<safe_value_t<Iterator>> svm_samples;
-
-        //Get all the activation probabilities
-        std::for_each(first, last, [this, &svm_samples](auto& sample) {
-            this->add_activation_probabilities(svm_samples, sample);
+    template <typename Iterator, typename LIterator, cpp_disable_if(svm_batch<Iterator>())>
+    bool make_problem(Iterator first, Iterator last, LIterator&& lfirst, LIterator&& llast, bool scale = false) {
+        return make_svm_problem(*this, pool, first, last, lfirst, llast, scale, [this](auto& sample) {
+            return this->get_final_activation_probabilities(sample);
         });
+    }
 
-        //static_cast ensure using the correct overload
-        problem = svm::make_problem(
-            std::forward<LIterator>(lfirst), std::forward<LIterator>(llast),
-            svm_samples.begin(), svm_samples.end(),
-            scale);
+    /*!
+     * \brief Create the svm problem for this dbn, the features being
+     * extracted by batched forward passes
+     */
+    template <typename Iterator, typename LIterator, cpp_enable_if(svm_batch<Iterator>())>
+    bool make_problem(Iterator first, Iterator last, LIterator&& lfirst, LIterator&& llast, bool scale = false) {
+        const std::size_t block = batch_size * dll::threads() * 4;
+
+        return make_svm_problem_batch(*this, pool, first, last, lfirst, llast, scale, block, [this](Iterator block_first, Iterator block_last) {
+            return this->batch_features(block_first, block_last);
+        });
     }
 
 #endif //DLL_SVM_SUPPORT
@@ -14,6 +14,9 @@
 
 namespace dll {
 
+template <typename Derived, typename Desc>
+struct standard_crbm_mp;
+
 namespace dbn_detail {
 
 // extract_weight
@@ -67,6 +70,47 @@ struct validate_weight_type {
     static constexpr bool value = validate_weight_type_impl<0, DBN, T>::value;
 };
 
+// Create a contiguous batch of samples
+
+template <typename T, typename Sample, std::size_t... I>
+etl::dyn_matrix<T, sizeof...(I) + 1> make_batch_impl(std::size_t n, const Sample& sample, std::index_sequence<I...> /*s*/) {
+    return etl::dyn_matrix<T, sizeof...(I) + 1>(n, etl::dim<I>(sample)...);
+}
+
+/*!
+ * \brief Create a contiguous batch of n samples with the same dimensions as
+ * the given sample
+ */
+template <typename T, typename Sample>
+etl::dyn_matrix<T, etl::decay_traits<Sample>::dimensions() + 1> make_batch(std::size_t n, const Sample& sample) {
+    return make_batch_impl<T>(n, sample, std::make_index_sequence<etl::decay_traits<Sample>::dimensions()>());
+}
+
+// Detect the CRBMs with Probabilistic Max Pooling, whose activations are the
+// pooling units and not the hidden units computed by batch_activate_hidden
+
+template <typename Derived, typename Desc>
+std::true_type is_pooling_rbm_impl(const standard_crbm_mp<Derived, Desc>* /*layer*/);
+
+std::false_type is_pooling_rbm_impl(const void* /*layer*/);
+
+/*!
+ * \brief Indicates if the given layer is a CRBM with Probabilistic Max Pooling
+ */
+template <typename Layer>
+using is_pooling_rbm = decltype(is_pooling_rbm_impl(std::declval<Layer*>()));
+
+/*!
+ * \brief Traits indicating if two types are ETL expressions with the same
+ * number of dimensions
+ */
+template <typename T, typename U, typename Enable = void>
+struct same_dimensions : std::false_type {};
+
+template <typename T, typename U>
+struct same_dimensions<T, U, std::enable_if_t<etl::is_etl_expr<T>::value && etl::is_etl_expr<U>::value>>
+        : cpp::bool_constant<etl::decay_traits<T>::dimensions() == etl::decay_traits<U>::dimensions()> {};
+
 // Compute the distance between two iterators, only if random_access
 
 template <typename Iterator>
@@ -116,7 +160,7 @@ struct for_each_impl<D, 1, std::index_sequence<I...>> {
 
     template <typename Functor>
     void for_each_layer_i(Functor&& functor) {
-        functor(dbn.template layer_get<0>(), 0);
+        functor(0, dbn.template layer_get<0>());
     }
 
     template <typename Functor>
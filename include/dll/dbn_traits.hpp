@@ -71,6 +71,14 @@ struct dbn_traits {
         return desc::parameters::template contains<dll::shuffle_pre>();
     }
 
+    /*!
+     * \brief Returns the distance between two checkpoints of the SGD
+     * activations (0 if checkpointing is disabled)
+     */
+    static constexpr std::size_t checkpoint() noexcept {
+        return detail::get_value_l<dll::checkpoint<0>, typename desc::parameters>::value;
+    }
+
     /*!
      * \brief Indicates if the DBN features are concatenated from all levels
      */
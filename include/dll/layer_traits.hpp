@@ -172,6 +172,14 @@ struct layer_traits {
     static constexpr bool pretrain_last() {
         return base_traits::pretrain_last;
     }
+
+    /*!
+     * \brief Indicates if the layer can be trained with SGD, i.e. if it
+     * has a SGD context
+     */
+    static constexpr bool sgd_supported() {
+        return base_traits::sgd_supported;
+    }
 };
 
 /*!
@@ -233,6 +241,22 @@ struct rbm_layer_traits {
     static constexpr bool free_energy() {
         return base_traits::has_free_energy;
     }
+
+    /*!
+     * \brief Returns the number of samples of the free energy subset (0
+     * for all the samples). Only the dense RBMs accept this parameter.
+     */
+    static constexpr std::size_t free_energy_subset() {
+        return base_traits::free_energy_subset;
+    }
+
+    /*!
+     * \brief Returns the number of batches between two free energy
+     * computations. Only the dense RBMs accept this parameter.
+     */
+    static constexpr std::size_t free_energy_every() {
+        return base_traits::free_energy_every;
+    }
 };
 
 template <typename T>
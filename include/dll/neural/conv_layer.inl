@@ -8,6 +8,7 @@
 #pragma once
 
 #include "dll/neural_layer.hpp"
+#include "dll/util/sparse.hpp"
 
 #include "dll/util/timers.hpp" // for auto_timer
 
@@ -53,6 +54,8 @@ struct conv_layer final : neural_layer<conv_layer<Desc>, Desc> {
     std::unique_ptr<w_type> bak_w; //!< Backup Weights
     std::unique_ptr<b_type> bak_b; //!< Backup Hidden biases
 
+    std::unique_ptr<sparse_filters<weight>> sparse_w; //!< Remaining filters after pruning (nullptr if dense), rebuilt by sparsify()
+
     /*!
      * \brief Initialize a conv layer with basic weights.
      */
@@ -85,7 +88,11 @@ struct conv_layer final : neural_layer<conv_layer<Desc>, Desc> {
 
         auto b_rep = etl::force_temporary(etl::rep<NH1, NH2>(b));
 
-        etl::reshape<1, K, NH1, NH2>(output) = etl::conv_4d_valid_flipped(etl::reshape<1, NC, NV1, NV2>(v), w);
+        if (sparse_w) {
+            sparse_filters_conv(etl::reshape<1, K, NH1, NH2>(output), etl::reshape<1, NC, NV1, NV2>(v), *sparse_w);
+        } else {
+            etl::reshape<1, K, NH1, NH2>(output) = etl::conv_4d_valid_flipped(etl::reshape<1, NC, NV1, NV2>(v), w);
+        }
 
         output = f_activate<activation_function>(b_rep + output);
     }
@@ -101,7 +108,11 @@ struct conv_layer final : neural_layer<conv_layer<Desc>, Desc> {
     template <typename H1, typename V>
     void batch_activate_hidden(H1&& output, const V& v) const {
         dll::auto_timer timer("conv:forward_batch");
-        output = etl::conv_4d_valid_flipped(v, w);
+        if (sparse_w) {
+            sparse_filters_conv(output, v, *sparse_w);
+        } else {
+            output = etl::conv_4d_valid_flipped(v, w);
+        }
 
         static constexpr const auto batch_size = etl::decay_traits<H1>::template dim<0>();
 
@@ -110,6 +121,14 @@ struct conv_layer final : neural_layer<conv_layer<Desc>, Desc> {
         output = f_activate<activation_function>(b_rep + output);
     }
 
+    /*!
+     * \brief Compact the remaining filters if their ratio is at most
+     * max_ratio. The full convolution is used otherwise.
+     */
+    void sparsify(double max_ratio = sparse_filters_density_threshold) {
+        sparse_w = make_sparse_filters(w, max_ratio);
+    }
+
     template <typename Input>
     output_one_t prepare_one_output() const {
         return {};
@@ -234,8 +253,8 @@ struct sgd_context<DBN, conv_layer<Desc>> {
     etl::fast_matrix<weight, K, NC, NW1, NW2> w_grad;
     etl::fast_matrix<weight, K> b_grad;
 
-    etl::fast_matrix<weight, K, NC, NW1, NW2> w_inc;
-    etl::fast_matrix<weight, K> b_inc;
+    sgd_momentum_matrix_t<DBN, weight, K, NC, NW1, NW2> w_inc;
+    sgd_momentum_matrix_t<DBN, weight, K> b_inc;
 
     etl::fast_matrix<weight, batch_size, NC, NV1, NV2> input;
     etl::fast_matrix<weight, batch_size, K, NH1, NH2> output;
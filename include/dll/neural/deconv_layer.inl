@@ -231,8 +231,8 @@ struct sgd_context<DBN, deconv_layer<Desc>> {
     etl::fast_matrix<weight, NC, K, NW1, NW2> w_grad;
     etl::fast_matrix<weight, K> b_grad;
 
-    etl::fast_matrix<weight, NC, K, NW1, NW2> w_inc;
-    etl::fast_matrix<weight, K> b_inc;
+    sgd_momentum_matrix_t<DBN, weight, NC, K, NW1, NW2> w_inc;
+    sgd_momentum_matrix_t<DBN, weight, K> b_inc;
 
     etl::fast_matrix<weight, batch_size, NC, NV1, NV2> input;
     etl::fast_matrix<weight, batch_size, K, NH1, NH2> output;
@@ -9,6 +9,7 @@
 
 #include "dll/base_traits.hpp"
 #include "dll/neural_layer.hpp"
+#include "dll/util/sparse.hpp"
 
 #include "dll/util/timers.hpp" // for auto_timer
 
@@ -47,6 +48,8 @@ struct dense_layer final : neural_layer<dense_layer<Desc>, Desc> {
     std::unique_ptr<w_type> bak_w; //!< Backup Weights
     std::unique_ptr<b_type> bak_b; //!< Backup Hidden biases
 
+    std::unique_ptr<sparse_weights<weight>> sparse_w; //!< Pruned weights in sparse format (nullptr if dense), rebuilt by sparsify()
+
     /*!
      * \brief Initialize a dense layer with basic weights.
      *
@@ -89,6 +92,10 @@ struct dense_layer final : neural_layer<dense_layer<Desc>, Desc> {
     void activate_hidden(H&& output, const V& v) const {
         dll::auto_timer timer("dense:activate_hidden");
 
+        if (sparse_weights_activate_hidden(output, v)) {
+            return;
+        }
+
         output = f_activate<activation_function>(b + v * w);
     }
 
@@ -96,6 +103,10 @@ struct dense_layer final : neural_layer<dense_layer<Desc>, Desc> {
     void activate_hidden(H&& output, const V& v) const {
         dll::auto_timer timer("dense:activate_hidden");
 
+        if (sparse_weights_activate_hidden(output, v)) {
+            return;
+        }
+
         output = f_activate<activation_function>(b + etl::reshape<num_visible>(v) * w);
     }
 
@@ -107,6 +118,14 @@ struct dense_layer final : neural_layer<dense_layer<Desc>, Desc> {
 
         cpp_assert(etl::dim<0>(output) == Batch, "The number of samples must be consistent");
 
+        if (sparse_weights_batch_activate_hidden(output, v)) {
+            return;
+        }
+
+        if (sparse_batch_activate_hidden(output, v)) {
+            return;
+        }
+
         if (activation_function == function::SOFTMAX) {
             auto expr = etl::force_temporary(etl::rep_l(b, Batch) + v * w);
 
@@ -128,6 +147,14 @@ struct dense_layer final : neural_layer<dense_layer<Desc>, Desc> {
 
         cpp_assert(etl::dim<0>(output) == Batch, "The number of samples must be consistent");
 
+        if (sparse_weights_batch_activate_hidden(output, input)) {
+            return;
+        }
+
+        if (sparse_batch_activate_hidden(output, input)) {
+            return;
+        }
+
         if (activation_function == function::SOFTMAX) {
             auto expr = etl::force_temporary(etl::rep_l(b, Batch) + etl::reshape<Batch, num_visible>(input) * w);
 
@@ -141,6 +168,98 @@ struct dense_layer final : neural_layer<dense_layer<Desc>, Desc> {
         }
     }
 
+    /*!
+     * \brief Compute the activations of a sparse input batch with the
+     * sparse kernels.
+     * \return true if the activations have been computed, false if the
+     * input is not sparse enough and the dense kernels must be used
+     */
+    template <typename H, typename V, typename D = desc, cpp_enable_if(has_sparse_input<D>())>
+    bool sparse_batch_activate_hidden(H&& output, const V& v) const {
+        sparse_batch<etl::value_t<V>> sparse;
+
+        if (!make_sparse_batch(v, sparse)) {
+            return false;
+        }
+
+        const auto Batch = etl::dim<0>(v);
+
+        etl::dyn_matrix<weight, 2> expr(Batch, etl::size(b));
+
+        sparse_linear(expr, sparse, w, b);
+
+        if (activation_function == function::SOFTMAX) {
+            for (std::size_t i = 0; i < Batch; ++i) {
+                output(i) = f_activate<activation_function>(expr(i));
+            }
+        } else {
+            output = f_activate<activation_function>(expr);
+        }
+
+        return true;
+    }
+
+    template <typename H, typename V, typename D = desc, cpp_disable_if(has_sparse_input<D>())>
+    bool sparse_batch_activate_hidden(H&&, const V&) const {
+        return false;
+    }
+
+    /*!
+     * \brief Convert the weights to the sparse representation if their
+     * density is at most max_density. The dense kernels are used otherwise.
+     */
+    void sparsify(double max_density = sparse_weights_density_threshold) {
+        sparse_w = make_sparse_weights(w, max_density);
+    }
+
+    /*!
+     * \brief Compute the activations of one sample with the sparse weights.
+     * \return true if the activations have been computed, false if the
+     * weights are dense
+     */
+    template <typename H, typename V>
+    bool sparse_weights_activate_hidden(H&& output, const V& v) const {
+        if (!sparse_w) {
+            return false;
+        }
+
+        etl::dyn_matrix<weight, 1> expr(etl::size(b));
+
+        sparse_weights_linear(expr, v, *sparse_w, b);
+
+        output = f_activate<activation_function>(expr);
+
+        return true;
+    }
+
+    /*!
+     * \brief Compute the activations of a batch with the sparse weights.
+     * \return true if the activations have been computed, false if the
+     * weights are dense
+     */
+    template <typename H, typename V>
+    bool sparse_weights_batch_activate_hidden(H&& output, const V& v) const {
+        if (!sparse_w) {
+            return false;
+        }
+
+        const auto Batch = etl::dim<0>(v);
+
+        etl::dyn_matrix<weight, 2> expr(Batch, etl::size(b));
+
+        sparse_weights_linear(expr, v, *sparse_w, b);
+
+        if (activation_function == function::SOFTMAX) {
+            for (std::size_t i = 0; i < Batch; ++i) {
+                output(i) = f_activate<activation_function>(expr(i));
+            }
+        } else {
+            output = f_activate<activation_function>(expr);
+        }
+
+        return true;
+    }
+
     template <typename Input>
     output_one_t prepare_one_output() const {
         return {};
@@ -194,7 +313,7 @@ struct dense_layer final : neural_layer<dense_layer<Desc>, Desc> {
     void compute_gradients(C& context) const {
         dll::auto_timer timer("dense:compute_gradients");
 
-        context.w_grad = batch_outer(context.input, context.errors);
+        select_batch_outer<has_sparse_input<desc>()>(context.w_grad, context.input, context.errors);
         context.b_grad = etl::sum_l(context.errors);
     }
 };
@@ -243,8 +362,8 @@ struct sgd_context<DBN, dense_layer<Desc>> {
     etl::fast_matrix<weight, num_visible, num_hidden> w_grad;
     etl::fast_matrix<weight, num_hidden> b_grad;
 
-    etl::fast_matrix<weight, num_visible, num_hidden> w_inc;
-    etl::fast_matrix<weight, num_hidden> b_inc;
+    sgd_momentum_matrix_t<DBN, weight, num_visible, num_hidden> w_inc;
+    sgd_momentum_matrix_t<DBN, weight, num_hidden> b_inc;
 
     etl::fast_matrix<weight, batch_size, num_visible> input;
     etl::fast_matrix<weight, batch_size, num_hidden> output;
@@ -9,6 +9,7 @@
 
 #include "dll/base_traits.hpp"
 #include "dll/neural_layer.hpp"
+#include "dll/util/sparse.hpp"
 
 namespace dll {
 
@@ -42,6 +43,8 @@ struct dyn_conv_layer final : neural_layer<dyn_conv_layer<Desc>, Desc> {
     std::unique_ptr<w_type> bak_w; //!< Backup Weights
     std::unique_ptr<b_type> bak_b; //!< Backup Hidden biases
 
+    std::unique_ptr<sparse_filters<weight>> sparse_w; //!< Remaining filters after pruning (nullptr if dense), rebuilt by sparsify()
+
     size_t nv1; ///< The first visible dimension
     size_t nv2; ///< The second visible dimension
     size_t nh1; ///< The first output dimension
@@ -73,6 +76,8 @@ struct dyn_conv_layer final : neural_layer<dyn_conv_layer<Desc>, Desc> {
 
         initializer_function<w_initializer>::initialize(w, input_size(), output_size());
         initializer_function<b_initializer>::initialize(b, input_size(), output_size());
+
+        sparse_w.reset();
     }
 
     std::size_t input_size() const noexcept {
@@ -96,7 +101,11 @@ struct dyn_conv_layer final : neural_layer<dyn_conv_layer<Desc>, Desc> {
     void activate_hidden(output_one_t& output, const input_one_t& v) const {
         auto b_rep = etl::force_temporary(etl::rep(b, nh1, nh2));
 
-        etl::reshape(output, 1, k, nh1, nh2) = etl::conv_4d_valid_flipped(etl::reshape(v, 1, nc, nv1, nv2), w);
+        if (sparse_w) {
+            sparse_filters_conv(etl::reshape(output, 1, k, nh1, nh2), etl::reshape(v, 1, nc, nv1, nv2), *sparse_w);
+        } else {
+            etl::reshape(output, 1, k, nh1, nh2) = etl::conv_4d_valid_flipped(etl::reshape(v, 1, nc, nv1, nv2), w);
+        }
 
         output = f_activate<activation_function>(b_rep + output);
     }
@@ -109,7 +118,11 @@ struct dyn_conv_layer final : neural_layer<dyn_conv_layer<Desc>, Desc> {
 
     template <typename H1, typename V>
     void batch_activate_hidden(H1&& output, const V& v) const {
-        output = etl::conv_4d_valid_flipped(v, w);
+        if (sparse_w) {
+            sparse_filters_conv(output, v, *sparse_w);
+        } else {
+            output = etl::conv_4d_valid_flipped(v, w);
+        }
 
         auto b_rep = etl::force_temporary(etl::rep_l(etl::rep(b, nh1, nh2), etl::dim<0>(output)));
 
@@ -130,6 +143,14 @@ struct dyn_conv_layer final : neural_layer<dyn_conv_layer<Desc>, Desc> {
         return output;
     }
 
+    /*!
+     * \brief Compact the remaining filters if their ratio is at most
+     * max_ratio. The full convolution is used otherwise.
+     */
+    void sparsify(double max_ratio = sparse_filters_density_threshold) {
+        sparse_w = make_sparse_filters(w, max_ratio);
+    }
+
     template <typename Input>
     output_one_t prepare_one_output() const {
         return output_one_t(k, nh1, nh2);
@@ -220,7 +241,7 @@ struct sgd_context<DBN, dyn_conv_layer<Desc>> {
 
     sgd_context(size_t nc, size_t nv1, size_t nv2, size_t k, size_t nh1, size_t nh2)
             : w_grad(k, nc, nv1 - nh1 + 1, nv2 - nh2 + 1), b_grad(k),
-              w_inc(k, nc, nv1 - nh1 + 1, nv2 - nh2 + 1), b_inc(k),
+              w_inc(sgd_momentum_dim<DBN>(k), nc, nv1 - nh1 + 1, nv2 - nh2 + 1), b_inc(sgd_momentum_dim<DBN>(k)),
               input(batch_size, nc, nv1, nv2),
               output(batch_size, k, nh1, nh2), errors(batch_size, k, nh1, nh2) {}
 };
@@ -226,7 +226,7 @@ struct sgd_context<DBN, dyn_conv_same_layer<Desc>> {
 
     sgd_context(size_t nc, size_t nv1, size_t nv2, size_t k, size_t nw1, size_t nw2)
             : w_grad(k, nc, nw1, nw2), b_grad(k),
-              w_inc(k, nc, nv1, nv2), b_inc(k),
+              w_inc(sgd_momentum_dim<DBN>(k), nc, nv1, nv2), b_inc(sgd_momentum_dim<DBN>(k)),
               input(batch_size, nc, nv1, nv2),
               output(batch_size, k, nv1, nv2), errors(batch_size, k, nv1, nv2) {}
 };
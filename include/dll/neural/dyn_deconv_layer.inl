@@ -235,7 +235,7 @@ struct sgd_context<DBN, dyn_deconv_layer<Desc>> {
 
     sgd_context(size_t nc, size_t nv1, size_t nv2, size_t k, size_t nh1, size_t nh2, size_t nw1, size_t nw2)
             : w_grad(nc, k, nw1, nw2), b_grad(k),
-              w_inc(nc, k, nw1, nw2), b_inc(k),
+              w_inc(sgd_momentum_dim<DBN>(nc), k, nw1, nw2), b_inc(sgd_momentum_dim<DBN>(k)),
               input(batch_size, nc, nv1, nv2),
               output(batch_size, k, nh1, nh2),
               errors(batch_size, k, nh1, nh2) {}
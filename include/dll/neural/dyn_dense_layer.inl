@@ -9,6 +9,7 @@
 
 #include "dll/base_traits.hpp"
 #include "dll/neural_layer.hpp"
+#include "dll/util/sparse.hpp"
 
 namespace dll {
 
@@ -42,6 +43,8 @@ struct dyn_dense_layer final : neural_layer<dyn_dense_layer<Desc>, Desc> {
     std::unique_ptr<w_type> bak_w; //!< Backup Weights
     std::unique_ptr<b_type> bak_b; //!< Backup Hidden biases
 
+    std::unique_ptr<sparse_weights<weight>> sparse_w; //!< Pruned weights in sparse format (nullptr if dense), rebuilt by sparsify()
+
     std::size_t num_visible;
     std::size_t num_hidden;
 
@@ -56,6 +59,8 @@ struct dyn_dense_layer final : neural_layer<dyn_dense_layer<Desc>, Desc> {
 
         initializer_function<w_initializer>::initialize(w, input_size(), output_size());
         initializer_function<b_initializer>::initialize(b, input_size(), output_size());
+
+        sparse_w.reset();
     }
 
     /*!
@@ -87,11 +92,19 @@ struct dyn_dense_layer final : neural_layer<dyn_dense_layer<Desc>, Desc> {
 
     template <typename H, typename V, cpp_enable_if(etl::decay_traits<V>::dimensions() == 1)>
     void activate_hidden(H&& output, const V& v) const {
+        if (sparse_weights_activate_hidden(output, v)) {
+            return;
+        }
+
         output = f_activate<activation_function>(b + v * w);
     }
 
     template <typename H, typename V, cpp_enable_if(etl::decay_traits<V>::dimensions() != 1)>
     void activate_hidden(H&& output, const V& v) const {
+        if (sparse_weights_activate_hidden(output, v)) {
+            return;
+        }
+
         output = f_activate<activation_function>(b + etl::reshape(v, num_visible) * w);
     }
 
@@ -101,6 +114,14 @@ struct dyn_dense_layer final : neural_layer<dyn_dense_layer<Desc>, Desc> {
 
         cpp_assert(etl::dim<0>(output) == Batch, "The number of samples must be consistent");
 
+        if (sparse_weights_batch_activate_hidden(output, v)) {
+            return;
+        }
+
+        if (sparse_batch_activate_hidden(output, v)) {
+            return;
+        }
+
         if (activation_function == function::SOFTMAX) {
             auto expr = etl::force_temporary(etl::rep_l(b, Batch) + v * w);
 
@@ -118,6 +139,14 @@ struct dyn_dense_layer final : neural_layer<dyn_dense_layer<Desc>, Desc> {
 
         cpp_assert(etl::dim<0>(output) == Batch, "The number of samples must be consistent");
 
+        if (sparse_weights_batch_activate_hidden(output, input)) {
+            return;
+        }
+
+        if (sparse_batch_activate_hidden(output, input)) {
+            return;
+        }
+
         if (activation_function == function::SOFTMAX) {
             auto expr = etl::force_temporary(etl::rep_l(b, Batch) + etl::reshape(input, Batch, num_visible) * w);
 
@@ -134,6 +163,98 @@ struct dyn_dense_layer final : neural_layer<dyn_dense_layer<Desc>, Desc> {
         this->sgd_context_ptr = std::make_shared<sgd_context<DBN, this_type>>(num_visible, num_hidden);
     }
 
+    /*!
+     * \brief Compute the activations of a sparse input batch with the
+     * sparse kernels.
+     * \return true if the activations have been computed, false if the
+     * input is not sparse enough and the dense kernels must be used
+     */
+    template <typename H, typename V, typename D = desc, cpp_enable_if(has_sparse_input<D>())>
+    bool sparse_batch_activate_hidden(H&& output, const V& v) const {
+        sparse_batch<etl::value_t<V>> sparse;
+
+        if (!make_sparse_batch(v, sparse)) {
+            return false;
+        }
+
+        const auto Batch = etl::dim<0>(v);
+
+        etl::dyn_matrix<weight, 2> expr(Batch, etl::size(b));
+
+        sparse_linear(expr, sparse, w, b);
+
+        if (activation_function == function::SOFTMAX) {
+            for (std::size_t i = 0; i < Batch; ++i) {
+                output(i) = f_activate<activation_function>(expr(i));
+            }
+        } else {
+            output = f_activate<activation_function>(expr);
+        }
+
+        return true;
+    }
+
+    template <typename H, typename V, typename D = desc, cpp_disable_if(has_sparse_input<D>())>
+    bool sparse_batch_activate_hidden(H&&, const V&) const {
+        return false;
+    }
+
+    /*!
+     * \brief Convert the weights to the sparse representation if their
+     * density is at most max_density. The dense kernels are used otherwise.
+     */
+    void sparsify(double max_density = sparse_weights_density_threshold) {
+        sparse_w = make_sparse_weights(w, max_density);
+    }
+
+    /*!
+     * \brief Compute the activations of one sample with the sparse weights.
+     * \return true if the activations have been computed, false if the
+     * weights are dense
+     */
+    template <typename H, typename V>
+    bool sparse_weights_activate_hidden(H&& output, const V& v) const {
+        if (!sparse_w) {
+            return false;
+        }
+
+        etl::dyn_matrix<weight, 1> expr(etl::size(b));
+
+        sparse_weights_linear(expr, v, *sparse_w, b);
+
+        output = f_activate<activation_function>(expr);
+
+        return true;
+    }
+
+    /*!
+     * \brief Compute the activations of a batch with the sparse weights.
+     * \return true if the activations have been computed, false if the
+     * weights are dense
+     */
+    template <typename H, typename V>
+    bool sparse_weights_batch_activate_hidden(H&& output, const V& v) const {
+        if (!sparse_w) {
+            return false;
+        }
+
+        const auto Batch = etl::dim<0>(v);
+
+        etl::dyn_matrix<weight, 2> expr(Batch, etl::size(b));
+
+        sparse_weights_linear(expr, v, *sparse_w, b);
+
+        if (activation_function == function::SOFTMAX) {
+            for (std::size_t i = 0; i < Batch; ++i) {
+                output(i) = f_activate<activation_function>(expr(i));
+            }
+        } else {
+            output = f_activate<activation_function>(expr);
+        }
+
+        return true;
+    }
+
     template <typename Input>
     output_one_t prepare_one_output() const {
         return output_one_t(num_hidden);
@@ -188,7 +309,7 @@ struct dyn_dense_layer final : neural_layer<dyn_dense_layer<Desc>, Desc> {
      */
     template<typename C>
     void compute_gradients(C& context) const {
-        context.w_grad = batch_outer(context.input, context.errors);
+        select_batch_outer<has_sparse_input<desc>()>(context.w_grad, context.input, context.errors);
         context.b_grad = etl::sum_l(context.errors);
     }
 };
@@ -235,7 +356,7 @@ struct sgd_context<DBN, dyn_dense_layer<Desc>> {
 
     sgd_context(size_t num_visible, size_t num_hidden)
             : w_grad(num_visible, num_hidden), b_grad(num_hidden),
-              w_inc(num_visible, num_hidden, 0.0), b_inc(num_hidden, 0.0),
+              w_inc(sgd_momentum_dim<DBN>(num_visible), num_hidden, 0.0), b_inc(sgd_momentum_dim<DBN>(num_hidden), 0.0),
               input(batch_size, num_visible, 0.0), output(batch_size, num_hidden, 0.0), errors(batch_size, num_hidden, 0.0) {}
 };
 
@@ -8,12 +8,15 @@
 #pragma once
 
 #include "cpp_utils/assert.hpp" //Assertions
+#include "cpp_utils/io.hpp"     //Binary I/O
 
 #include "etl/etl.hpp"
 
 #include "layer.hpp"
 #include "util/tmp.hpp"
 #include "util/converter.hpp"
+#include "util/snapshot.hpp"
+#include "util/sparse.hpp"
 #include "layer_traits.hpp"
 
 namespace dll {
@@ -33,14 +36,42 @@ struct neural_layer : layer<Derived> {
         // Nothing to init here
     }
 
+    /*!
+     * \brief Backup the weights of the layer into its snapshot buffers
+     */
     void backup_weights() {
-        unique_safe_get(as_derived().bak_w) = as_derived().w;
-        unique_safe_get(as_derived().bak_b) = as_derived().b;
+        backup_parameter(as_derived().bak_w, as_derived().w);
+        backup_parameter(as_derived().bak_b, as_derived().b);
     }
 
+    /*!
+     * \brief Restore the weights of the layer from its snapshot buffers
+     */
     void restore_weights() {
-        as_derived().w = *as_derived().bak_w;
-        as_derived().b = *as_derived().bak_b;
+        restore_parameter(as_derived().w, as_derived().bak_w);
+        restore_parameter(as_derived().b, as_derived().bak_b);
+
+        clear_sparse_weights(as_derived());
+    }
+
+    //I/O functions
+
+    /*!
+     * \brief Store the weights and the biases of the layer to the given stream
+     */
+    void store(std::ostream& os) const {
+        cpp::binary_write_all(os, as_derived().w);
+        cpp::binary_write_all(os, as_derived().b);
+    }
+
+    /*!
+     * \brief Load the weights and the biases of the layer from the given stream
+     */
+    void load(std::istream& is) {
+        cpp::binary_load_all(is, as_derived().w);
+        cpp::binary_load_all(is, as_derived().b);
+
+        clear_sparse_weights(as_derived());
     }
 
 private:
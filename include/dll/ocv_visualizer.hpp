@@ -7,10 +7,15 @@
 
 #pragma once
 
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
 #include "cpp_utils/stop_watch.hpp"
 
 #include "layer_traits.hpp"
 #include "dbn_traits.hpp"
+#include "util/metrics.hpp"
 
 #ifndef DLL_DETAIL_ONLY
 #include <opencv2/opencv.hpp>
@@ -98,8 +103,17 @@ constexpr inline std::size_t best_width(const std::size_t total) {
 
 #ifndef DLL_DETAIL_ONLY
 
+/*!
+ * \brief Base class for the RBM visualizers.
+ *
+ * The weights are drawn by a background thread, which owns the window. At
+ * the end of each epoch, the training thread only copies the weights into
+ * a snapshot. If the renderer is late, only the latest snapshot is drawn.
+ */
 template <typename RBM>
 struct base_ocv_rbm_visualizer {
+    using weights_t = std::decay_t<decltype(std::declval<RBM&>().w)>;
+
     cpp::stop_watch<std::chrono::seconds> watch;
 
     const std::size_t width;
@@ -112,7 +126,16 @@ struct base_ocv_rbm_visualizer {
         //Nothing to init
     }
 
+    virtual ~base_ocv_rbm_visualizer() = default;
+
+    /*!
+     * \brief Draw the given weights into the buffer image
+     */
+    virtual void draw_weights(const weights_t& w) = 0;
+
     void training_begin(const RBM& rbm) {
+        dll::metrics().drain();
+
         std::cout << "Train RBM with \"" << RBM::desc::template trainer_t<RBM, false>::name() << "\"" << std::endl;
         std::cout << "With parameters:" << std::endl;
         std::cout << "   learning_rate=" << rbm.learning_rate << std::endl;
@@ -138,27 +161,121 @@ struct base_ocv_rbm_visualizer {
             std::cout << "   sparsity_target(Local)=" << rbm.sparsity_target << std::endl;
         }
 
-        cv::namedWindow("RBM Training", cv::WINDOW_NORMAL);
-
-        refresh();
+        done     = false;
+        pending  = false;
+        renderer = std::thread([this] { render(); });
     }
 
     void training_end(const RBM&) {
+        dll::metrics().drain();
+
         std::cout << "Training took " << watch.elapsed() << "s" << std::endl;
 
-        std::cout << "Press on any key to close the window..." << std::endl;
-        cv::waitKey(0);
+        stop_renderer();
     }
 
     void batch_end(const RBM& /* rbm */, const rbm_training_context& context, std::size_t batch, std::size_t batches) {
-        printf("Batch %ld/%ld - Reconstruction error: %.5f - Sparsity: %.5f\n", batch, batches,
-               context.batch_error, context.batch_sparsity);
+        metric_record record(metric_kind::RBM_BATCH);
+        record.batch    = batch;
+        record.batches  = batches;
+        record.error    = context.batch_error;
+        record.sparsity = context.batch_sparsity;
+
+        dll::metrics().push(record);
+    }
+
+    void epoch_end(std::size_t epoch, const rbm_training_context& context, const RBM& rbm) {
+        metric_record record(metric_kind::RBM_EPOCH);
+        record.epoch           = epoch;
+        record.error           = context.reconstruction_error;
+        record.sparsity        = context.sparsity;
+        record.free_energy     = context.free_energy;
+        record.has_free_energy = true;
+
+        dll::metrics().push(record);
+
+        {
+            std::unique_lock<std::mutex> l(lock);
+
+            snapshot       = rbm.w;
+            snapshot_epoch = epoch;
+            pending        = true;
+        }
+
+        condition.notify_one();
     }
 
     void refresh() {
         cv::imshow("RBM Training", buffer_image);
         cv::waitKey(30);
     }
+
+protected:
+    /*!
+     * \brief Wait for the renderer thread to draw the last snapshot and stop.
+     * This must be called by the destructors of the derived classes.
+     */
+    void stop_renderer() {
+        if (renderer.joinable()) {
+            {
+                std::unique_lock<std::mutex> l(lock);
+                done = true;
+            }
+
+            condition.notify_one();
+            renderer.join();
+        }
+    }
+
+private:
+    /*!
+     * \brief The loop of the renderer thread
+     */
+    void render() {
+        cv::namedWindow("RBM Training", cv::WINDOW_NORMAL);
+
+        refresh();
+
+        weights_t w;
+        std::size_t epoch = 0;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> l(lock);
+
+                condition.wait(l, [this] { return pending || done; });
+
+                if (!pending) {
+                    break;
+                }
+
+                w       = snapshot;
+                epoch   = snapshot_epoch;
+                pending = false;
+            }
+
+            buffer_image = cv::Scalar(255);
+
+            cv::putText(buffer_image, "epoch " + std::to_string(epoch), cv::Point(10, 12), CV_FONT_NORMAL, 0.3, cv::Scalar(0), 1, 2);
+
+            draw_weights(w);
+
+            refresh();
+        }
+
+        dll::metrics().drain();
+
+        std::cout << "Press on any key to close the window..." << std::endl;
+        cv::waitKey(0);
+    }
+
+    std::thread renderer;              ///< The thread drawing the weights
+    std::mutex lock;                   ///< Lock protecting the snapshot
+    std::condition_variable condition; ///< Condition to wake up the renderer
+    weights_t snapshot;                ///< The latest weights to draw
+    std::size_t snapshot_epoch = 0;    ///< The epoch of the snapshot
+    bool pending               = false; ///< Indicates if the snapshot has not been drawn
+    bool done                  = false; ///< Indicates if the training is over
 };
 
 //rbm_ocv_config is used instead of directly passing the parameters because
@@ -192,7 +309,17 @@ struct opencv_rbm_visualizer : base_ocv_rbm_visualizer<RBM> {
                   filter_shape.width * tile_shape.width + (tile_shape.height + 1) * 1 + 2 * padding,
                   filter_shape.height * tile_shape.height + (tile_shape.height + 1) * 1 + 2 * padding) {}
 
+    ~opencv_rbm_visualizer() {
+        this->stop_renderer();
+    }
+
+    using typename base_type::weights_t;
+
     void draw_weights(const RBM& rbm) {
+        draw_weights(rbm.w);
+    }
+
+    void draw_weights(const weights_t& w) override {
         for (std::size_t hi = 0; hi < tile_shape.width; ++hi) {
             for (std::size_t hj = 0; hj < tile_shape.height; ++hj) {
                 auto real_h = hi * tile_shape.height + hj;
@@ -205,8 +332,8 @@ struct opencv_rbm_visualizer : base_ocv_rbm_visualizer<RBM> {
                 typename RBM::weight max;
 
                 if (scale) {
-                    min = etl::min(rbm.w);
-                    max = etl::max(rbm.w);
+                    min = etl::min(w);
+                    max = etl::max(w);
                 }
 
                 for (std::size_t i = 0; i < filter_shape.width; ++i) {
@@ -217,7 +344,7 @@ struct opencv_rbm_visualizer : base_ocv_rbm_visualizer<RBM> {
                             break;
                         }
 
-                        auto value = rbm.w(real_v, real_h);
+                        auto value = w(real_v, real_h);
 
                         if (scale) {
                             value -= min;
@@ -233,18 +360,6 @@ struct opencv_rbm_visualizer : base_ocv_rbm_visualizer<RBM> {
         }
     }
 
-    void epoch_end(std::size_t epoch, const rbm_training_context& context, const RBM& rbm) {
-        printf("epoch %ld - Reconstruction error: %.5f - Free energy: %.3f - Sparsity: %.5f\n", epoch,
-               context.reconstruction_error, context.free_energy, context.sparsity);
-
-        buffer_image = cv::Scalar(255);
-
-        cv::putText(buffer_image, "epoch " + std::to_string(epoch), cv::Point(10, 12), CV_FONT_NORMAL, 0.3, cv::Scalar(0), 1, 2);
-
-        draw_weights(rbm);
-
-        refresh();
-    }
 };
 
 template <typename RBM, typename C>
@@ -266,7 +381,17 @@ struct opencv_rbm_visualizer<RBM, C, std::enable_if_t<layer_traits<RBM>::is_conv
                   filter_shape.width * tile_shape.width + (tile_shape.height + 1) * 1 + 2 * padding,
                   filter_shape.height * tile_shape.height + (tile_shape.height + 1) * 1 + 2 * padding) {}
 
+    ~opencv_rbm_visualizer() {
+        this->stop_renderer();
+    }
+
+    using typename base_type::weights_t;
+
     void draw_weights(const RBM& rbm) {
+        draw_weights(rbm.w);
+    }
+
+    void draw_weights(const weights_t& w) override {
         std::size_t channel = 0;
 
         for (std::size_t hi = 0; hi < tile_shape.width; ++hi) {
@@ -281,13 +406,13 @@ struct opencv_rbm_visualizer<RBM, C, std::enable_if_t<layer_traits<RBM>::is_conv
                 typename RBM::weight max;
 
                 if (scale) {
-                    min = etl::min(rbm.w(channel)(real_k));
-                    max = etl::max(rbm.w(channel)(real_k));
+                    min = etl::min(w(channel)(real_k));
+                    max = etl::max(w(channel)(real_k));
                 }
 
                 for (std::size_t fi = 0; fi < filter_shape.width; ++fi) {
                     for (std::size_t fj = 0; fj < filter_shape.height; ++fj) {
-                        auto value = rbm.w(channel, real_k, fi, fj);
+                        auto value = w(channel, real_k, fi, fj);
 
                         if (scale) {
                             value -= min;
@@ -303,18 +428,6 @@ struct opencv_rbm_visualizer<RBM, C, std::enable_if_t<layer_traits<RBM>::is_conv
         }
     }
 
-    void epoch_end(std::size_t epoch, const rbm_training_context& context, const RBM& rbm) {
-        printf("epoch %ld - Reconstruction error: %.5f - Free energy: %.3f - Sparsity: %.5f\n", epoch,
-               context.reconstruction_error, context.free_energy, context.sparsity);
-
-        buffer_image = cv::Scalar(255);
-
-        cv::putText(buffer_image, "epoch " + std::to_string(epoch), cv::Point(10, 12), CV_FONT_NORMAL, 0.3, cv::Scalar(0), 1, 2);
-
-        draw_weights(rbm);
-
-        refresh();
-    }
 };
 
 template <typename DBN, typename C = rbm_ocv_config<>, typename Enable = void>
@@ -506,6 +619,10 @@ struct opencv_dbn_visualizer {
         std::cout << formatted << std::endl;
     }
 
+    void ft_checkpoint(const DBN& /*dbn*/, std::size_t bytes) {
+        std::cout << "checkpoint: " << bytes << " bytes of activations freed" << std::endl;
+    }
+
     void fine_tuning_end(const DBN&) {
         std::cout << "Total training took " << watch.elapsed() << "s" << std::endl;
 
@@ -12,10 +12,23 @@
  * \brief This file is made to be included by the dllp generated file only.
  */
 
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
 #include <string>
 #include <vector>
+#include <random>
+#include <sstream>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <functional>
+#include <limits>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
 #include "dll/rbm/rbm.hpp"
 #include "dll/rbm/conv_rbm.hpp"
@@ -23,6 +36,7 @@
 #include "dll/neural/conv_layer.hpp"
 #include "dll/dbn.hpp"
 #include "dll/text_reader.hpp"
+#include "dll/util/scheduler.hpp"
 
 #include "mnist/mnist_reader.hpp"
 #include "mnist/mnist_utils.hpp"
@@ -32,11 +46,12 @@ namespace dll {
 namespace processor {
 
 struct options {
-    bool quiet  = false;
-    bool mkl    = false;
-    bool cublas = false;
-    bool cufft  = false;
-    bool cache  = false;
+    bool quiet       = false;
+    bool mkl         = false;
+    bool cublas      = false;
+    bool cufft       = false;
+    bool cache       = false;
+    bool interpreted = false;
 };
 
 template <typename LastLayer, typename Enable = void>
@@ -75,6 +90,8 @@ struct datasource {
 
     long limit = -1;
 
+    bool cache = false; ///< Indicates if the preprocessed samples are cached on disk
+
     datasource() {}
     datasource(std::string source_file, std::string reader)
             : source_file(std::move(source_file)), reader(std::move(reader)) {}
@@ -116,6 +133,16 @@ struct weights_desc {
     std::string file = "weights.dat";
 };
 
+/*!
+ * \brief The description of the bulk scoring (predict and features actions)
+ */
+struct prediction_desc {
+    std::string file          = "predictions.csv"; ///< The output file of the predictions
+    std::string features_file = "features.csv";    ///< The output file of the features
+    std::string format        = "csv";             ///< The output format (csv or binary)
+    std::size_t chunk         = 4096;              ///< The number of samples read and scored at once
+};
+
 struct task {
     std::vector<std::string> default_actions;
 
@@ -123,69 +150,481 @@ struct task {
     dll::processor::datasource_pack pretraining_clean;
     dll::processor::datasource_pack training;
     dll::processor::datasource_pack testing;
+    dll::processor::datasource_pack predicting;
 
     dll::processor::pretraining_desc pt_desc;
     dll::processor::training_desc ft_desc;
     dll::processor::weights_desc w_desc;
+    dll::processor::prediction_desc pr_desc;
     dll::processor::general_desc general_desc;
 };
 
-template <bool Three, typename Sample>
-bool read_samples(const datasource& ds, std::vector<Sample>& samples) {
-    std::size_t limit = 0;
+namespace detail {
 
-    if (ds.limit > 0) {
-        limit = ds.limit;
+/*!
+ * \brief Normalize the given values to zero-mean and unit variance.
+ *
+ * Constant values are only centered, since their variance is zero.
+ */
+template <typename T>
+void normalize(T* values, std::size_t n) {
+    double mean = 0.0;
+
+    for (std::size_t i = 0; i < n; ++i) {
+        mean += values[i];
     }
 
-    if (ds.reader == "mnist") {
-        mnist::read_mnist_image_file<std::vector, Sample>(samples, ds.source_file, limit, [] { return Sample(1 * 28 * 28); });
-    } else if(ds.reader == "text"){
-        dll::text::read_images_direct<Three, std::vector, Sample>(samples, ds.source_file, limit);
+    mean /= n;
+
+    double var = 0.0;
+
+    for (std::size_t i = 0; i < n; ++i) {
+        var += (values[i] - mean) * (values[i] - mean);
+    }
+
+    const double stddev = std::sqrt(var / n);
+
+    if (stddev > 0.0) {
+        for (std::size_t i = 0; i < n; ++i) {
+            values[i] = (values[i] - mean) / stddev;
+        }
     } else {
-        std::cout << "dllp: error: unknown samples reader: " << ds.reader << std::endl;
-        return false;
+        for (std::size_t i = 0; i < n; ++i) {
+            values[i] = values[i] - mean;
+        }
     }
+}
+
+/*!
+ * \brief Apply all the transformations of the datasource to one sample, in
+ * a single pass over its memory.
+ */
+template <typename Sample>
+void transform_sample(const datasource& ds, Sample& sample) {
+    using T = etl::value_t<Sample>;
+
+    T* values           = sample.memory_start();
+    const std::size_t n = etl::size(sample);
 
+    //Same threshold as mnist::binarize_each
     if (ds.binarize) {
-        mnist::binarize_each(samples);
+        for (std::size_t i = 0; i < n; ++i) {
+            values[i] = values[i] > T(30) ? T(1) : T(0);
+        }
     }
 
     if (ds.normalize) {
-        mnist::normalize_each(samples);
+        normalize(values, n);
     }
 
-    if (ds.shift) {
-        for (auto& vec : samples) {
-            for (auto& v : vec) {
-                v += ds.shift_d;
-            }
+    if (ds.shift || ds.scale) {
+        const T shift = ds.shift ? T(ds.shift_d) : T(0);
+        const T scale = ds.scale ? T(ds.scale_d) : T(1);
+
+        for (std::size_t i = 0; i < n; ++i) {
+            values[i] = (values[i] + shift) * scale;
+        }
+    }
+
+    if (ds.normal_noise) {
+        static thread_local std::default_random_engine rand_engine(std::random_device{}());
+
+        std::normal_distribution<float> normal_distribution(0.0, ds.normal_noise_d);
+
+        //The sample is already normalized if nothing was done after the normalization
+        if (!ds.normalize || ds.shift || ds.scale) {
+            normalize(values, n);
+        }
+
+        for (std::size_t i = 0; i < n; ++i) {
+            values[i] += normal_distribution(rand_engine);
+        }
+
+        normalize(values, n);
+    }
+}
+
+/*!
+ * \brief Apply the transformations of the datasource to all the samples,
+ * in parallel.
+ */
+template <typename Sample>
+void transform_samples(const datasource& ds, std::vector<Sample>& samples) {
+    if (!ds.binarize && !ds.normalize && !ds.shift && !ds.scale && !ds.normal_noise) {
+        return;
+    }
+
+    dll::parallel_foreach_i(dll::shared_pool<true>(), samples.begin(), samples.end(), [&ds](Sample& sample, std::size_t /*i*/) {
+        transform_sample(ds, sample);
+    });
+}
+
+/*!
+ * \brief The header of a file of the preprocessed samples cache
+ */
+struct cache_header {
+    char magic[8];            ///< The magic string of the cache files
+    std::uint64_t key_size;   ///< The size of the key following the header
+    std::uint64_t samples;    ///< The number of samples
+    std::uint64_t dimensions; ///< The number of dimensions of each sample
+    std::uint64_t value_size; ///< The size of one value of a sample
+};
+
+constexpr const char cache_magic[8] = {'D', 'L', 'L', 'P', 'D', 'A', 'T', '1'};
+
+/*!
+ * \brief Append the modification time and the size of the given file to
+ * the cache key
+ */
+inline void cache_key_file(std::stringstream& key, const std::string& file) {
+    struct stat attr;
+
+    long long mtime = 0;
+    long long size  = 0;
+
+    if (!stat(file.c_str(), &attr)) {
+        mtime = attr.st_mtime;
+        size  = attr.st_size;
+    }
+
+    key << ";" << mtime << ";" << size;
+}
+
+/*!
+ * \brief Returns the key identifying the preprocessed samples of the
+ * datasource in the cache.
+ *
+ * The key contains the source file with its modification time and size,
+ * the reader and all the transformations. For the text reader, the source
+ * is a directory and the key contains each of the files read from it.
+ */
+inline std::string cache_key(const datasource& ds, bool three) {
+    std::stringstream key;
+
+    key << ds.source_file;
+
+    if (ds.reader == "text") {
+        for (auto& file : dll::text::list_images(ds.source_file, ds.limit > 0 ? ds.limit : 0)) {
+            key << ";" << file;
+            cache_key_file(key, file);
+        }
+    } else {
+        cache_key_file(key, ds.source_file);
+    }
+
+    key << ";" << ds.reader << ";" << three << ";" << ds.limit
+        << ";" << ds.binarize << ";" << ds.normalize
+        << ";" << ds.shift << ";" << ds.shift_d
+        << ";" << ds.scale << ";" << ds.scale_d;
+
+    return key.str();
+}
+
+inline std::string cache_file(const std::string& key) {
+    std::stringstream file;
+    file << ".dllp_cache/" << std::hex << std::hash<std::string>()(key) << ".bin";
+    return file.str();
+}
+
+template <typename Sample, std::size_t... I, cpp_enable_if(etl::decay_traits<Sample>::is_fast)>
+Sample make_sample(const std::uint64_t* /*dims*/, std::index_sequence<I...> /*s*/) {
+    return Sample();
+}
+
+template <typename Sample, std::size_t... I, cpp_disable_if(etl::decay_traits<Sample>::is_fast)>
+Sample make_sample(const std::uint64_t* dims, std::index_sequence<I...> /*s*/) {
+    return Sample(static_cast<std::size_t>(dims[I])...);
+}
+
+/*!
+ * \brief Read the preprocessed samples from the cache. The values are
+ * read directly into the samples.
+ * \return true if the samples were found in the cache, false otherwise
+ */
+template <typename Sample>
+bool read_cache(const std::string& key, std::vector<Sample>& samples) {
+    using T = etl::value_t<Sample>;
+
+    constexpr const std::size_t D = etl::decay_traits<Sample>::dimensions();
+
+    std::ifstream stream(cache_file(key), std::ios::binary);
+
+    if (!stream) {
+        return false;
+    }
+
+    stream.seekg(0, std::ios::end);
+    const std::size_t file_size = stream.tellg();
+    stream.seekg(0, std::ios::beg);
+
+    if (file_size < sizeof(cache_header)) {
+        return false;
+    }
+
+    cache_header header;
+    stream.read(reinterpret_cast<char*>(&header), sizeof(cache_header));
+
+    const std::size_t offset = sizeof(cache_header) + header.key_size + D * sizeof(std::uint64_t);
+
+    if (!stream || !std::equal(cache_magic, cache_magic + 8, header.magic) || header.dimensions != D || header.value_size != sizeof(T) || offset > file_size) {
+        return false;
+    }
+
+    std::string file_key(header.key_size, ' ');
+    stream.read(&file_key[0], header.key_size);
+
+    std::uint64_t dims[D];
+    stream.read(reinterpret_cast<char*>(dims), sizeof(dims));
+
+    if (!stream || file_key != key) {
+        return false;
+    }
+
+    std::size_t sample_size = 1;
+    for (std::size_t d = 0; d < D; ++d) {
+        sample_size *= dims[d];
+    }
+
+    if (offset + header.samples * sample_size * sizeof(T) > file_size) {
+        return false;
+    }
+
+    samples.clear();
+    samples.reserve(header.samples);
+
+    for (std::size_t i = 0; i < header.samples; ++i) {
+        samples.push_back(make_sample<Sample>(dims, std::make_index_sequence<D>()));
+
+        stream.read(reinterpret_cast<char*>(samples.back().memory_start()), sample_size * sizeof(T));
+    }
+
+    if (!stream) {
+        samples.clear();
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write the preprocessed samples to the cache.
+ *
+ * The samples are written to a temporary file which is then renamed, so
+ * that concurrent runs never read a partial file.
+ */
+template <typename Sample>
+void write_cache(const std::string& key, const std::vector<Sample>& samples) {
+    using T = etl::value_t<Sample>;
+
+    constexpr const std::size_t D = etl::decay_traits<Sample>::dimensions();
+
+    if (samples.empty()) {
+        return;
+    }
+
+    mkdir(".dllp_cache", 0755);
+
+    auto file = cache_file(key);
+    auto tmp  = file + "." + std::to_string(getpid());
+
+    {
+        std::ofstream stream(tmp, std::ios::binary);
+
+        if (!stream) {
+            return;
+        }
+
+        cache_header header;
+        std::copy_n(cache_magic, 8, header.magic);
+        header.key_size   = key.size();
+        header.samples    = samples.size();
+        header.dimensions = D;
+        header.value_size = sizeof(T);
+
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        stream.write(key.data(), key.size());
+
+        for (std::size_t d = 0; d < D; ++d) {
+            std::uint64_t dim = etl::dim(samples.front(), d);
+            stream.write(reinterpret_cast<const char*>(&dim), sizeof(dim));
+        }
+
+        for (auto& sample : samples) {
+            stream.write(reinterpret_cast<const char*>(sample.memory_start()), etl::size(sample) * sizeof(T));
+        }
+
+        if (!stream) {
+            stream.close();
+            std::remove(tmp.c_str());
+            return;
         }
     }
 
-    if (ds.scale) {
-        for (auto& vec : samples) {
-            for (auto& v : vec) {
-                v *= ds.scale_d;
+    std::rename(tmp.c_str(), file.c_str());
+}
+
+template <bool Three, typename Sample, cpp_enable_if(etl::decay_traits<Sample>::is_fast)>
+Sample make_image_sample(std::size_t /*rows*/, std::size_t /*columns*/) {
+    return Sample();
+}
+
+template <bool Three, typename Sample, cpp_enable_if(Three && !etl::decay_traits<Sample>::is_fast)>
+Sample make_image_sample(std::size_t rows, std::size_t columns) {
+    return Sample(1, rows, columns);
+}
+
+template <bool Three, typename Sample, cpp_enable_if(!Three && !etl::decay_traits<Sample>::is_fast)>
+Sample make_image_sample(std::size_t rows, std::size_t columns) {
+    return Sample(rows * columns);
+}
+
+/*!
+ * \brief Reader of the samples of a datasource, one chunk at a time.
+ *
+ * Contrary to read_samples, only the samples of the current chunk are in
+ * memory, which allows to process datasources that do not fit in memory.
+ * The samples are not cached.
+ */
+template <bool Three, typename Sample>
+struct sample_stream {
+    explicit sample_stream(const datasource& ds) : ds(ds) {
+        remaining = ds.limit > 0 ? std::size_t(ds.limit) : std::numeric_limits<std::size_t>::max();
+
+        if (ds.reader == "mnist") {
+            mnist_file.open(ds.source_file, std::ios::binary);
+
+            if (!mnist_file) {
+                std::cout << "dllp: error: impossible to open " << ds.source_file << std::endl;
+                return;
+            }
+
+            //The header is made of four big-endian 32-bit integers
+            unsigned char raw[16];
+            mnist_file.read(reinterpret_cast<char*>(raw), sizeof(raw));
+
+            std::uint32_t header[4];
+
+            for (std::size_t i = 0; i < 4; ++i) {
+                header[i] = (std::uint32_t(raw[4 * i]) << 24) | (std::uint32_t(raw[4 * i + 1]) << 16) | (std::uint32_t(raw[4 * i + 2]) << 8) | std::uint32_t(raw[4 * i + 3]);
             }
+
+            if (!mnist_file || header[0] != 0x803) {
+                std::cout << "dllp: error: invalid MNIST image file " << ds.source_file << std::endl;
+                return;
+            }
+
+            remaining = std::min<std::size_t>(remaining, header[1]);
+            rows      = header[2];
+            columns   = header[3];
+            buffer.resize(rows * columns);
+        } else if (ds.reader == "text") {
+            text_files = dll::text::list_images(ds.source_file, ds.limit > 0 ? ds.limit : 0);
+            remaining  = text_files.size();
+        } else {
+            std::cout << "dllp: error: unknown samples reader: " << ds.reader << std::endl;
+            return;
         }
+
+        valid = true;
     }
 
-    if (ds.normal_noise) {
-        mnist::normalize_each(samples);
+    /*!
+     * \brief Indicates if the datasource could be opened
+     */
+    explicit operator bool() const {
+        return valid;
+    }
 
-        std::random_device rd;
-        std::default_random_engine rand_engine(rd());
-        std::normal_distribution<float> normal_distribution(0.0, ds.normal_noise_d);
-        auto noise = std::bind(normal_distribution, rand_engine);
+    /*!
+     * \brief Read the next samples, transformed, into the given chunk
+     * \param chunk The container of the samples, its content is replaced
+     * \param n The maximum number of samples to read
+     * \return true if some samples were read, false at the end of the datasource
+     */
+    bool next(std::vector<Sample>& chunk, std::size_t n) {
+        chunk.clear();
+
+        if (!valid) {
+            return false;
+        }
 
-        for (auto& vec : samples) {
-            for (auto& noisy_x : vec) {
-                noisy_x += noise();
+        while (chunk.size() < n && remaining) {
+            if (ds.reader == "mnist") {
+                mnist_file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+
+                if (!mnist_file) {
+                    std::cout << "dllp: error: truncated MNIST image file " << ds.source_file << std::endl;
+                    remaining = 0;
+                    break;
+                }
+
+                chunk.push_back(make_image_sample<Three, Sample>(rows, columns));
+                std::copy(buffer.begin(), buffer.end(), chunk.back().memory_start());
+            } else {
+                chunk.push_back(dll::text::read_image_direct<Three, Sample>(text_files[text_files.size() - remaining]));
             }
+
+            --remaining;
         }
 
-        mnist::normalize_each(samples);
+        transform_samples(ds, chunk);
+
+        return !chunk.empty();
+    }
+
+private:
+    const datasource& ds;                ///< The datasource
+    bool valid            = false;       ///< Indicates if the datasource could be opened
+    std::size_t remaining = 0;           ///< The number of samples still to be read
+
+    std::ifstream mnist_file;            ///< The MNIST image file
+    std::size_t rows    = 0;             ///< The number of rows of the MNIST images
+    std::size_t columns = 0;             ///< The number of columns of the MNIST images
+    std::vector<std::uint8_t> buffer;    ///< The raw bytes of one MNIST image
+
+    std::vector<std::string> text_files; ///< The image files of the text datasource
+};
+
+} //end of namespace detail
+
+/*!
+ * \brief Read the samples of the datasource and apply its transformations.
+ *
+ * The transformations are applied to each sample in a single pass, the
+ * samples being processed in parallel. If the datasource enables it, the
+ * preprocessed samples are cached on disk and read directly from the
+ * cache by the next reads of the same datasource. Samples with normal
+ * noise are never cached since the noise must be drawn again each time.
+ */
+template <bool Three, typename Sample>
+bool read_samples(const datasource& ds, std::vector<Sample>& samples) {
+    const bool cached = ds.cache && !ds.normal_noise;
+
+    const auto key = cached ? detail::cache_key(ds, Three) : std::string();
+
+    if (cached && detail::read_cache(key, samples)) {
+        return !samples.empty();
+    }
+
+    std::size_t limit = 0;
+
+    if (ds.limit > 0) {
+        limit = ds.limit;
+    }
+
+    if (ds.reader == "mnist") {
+        mnist::read_mnist_image_file<std::vector, Sample>(samples, ds.source_file, limit, [] { return Sample(1 * 28 * 28); });
+    } else if(ds.reader == "text"){
+        dll::text::read_images_direct<Three, std::vector, Sample>(samples, ds.source_file, limit);
+    } else {
+        std::cout << "dllp: error: unknown samples reader: " << ds.reader << std::endl;
+        return false;
+    }
+
+    detail::transform_samples(ds, samples);
+
+    if (cached) {
+        detail::write_cache(key, samples);
     }
 
     return !samples.empty();
@@ -219,6 +658,104 @@ inline void print_title(const std::string& value) {
     std::cout << std::string(25, ' ') << std::endl;
 }
 
+/*!
+ * \brief Score all the samples of the predicting datasource and write the
+ * predicted labels (or the features) of each sample to the output file.
+ *
+ * The samples are streamed in chunks. Each chunk is scored with the batch
+ * inference of the network and written before the next one is read, so
+ * that the memory does not depend on the number of samples.
+ *
+ * \param features If true, write the features, otherwise the labels
+ * \return true if all the samples were scored, false otherwise
+ */
+template <typename Container, bool Three, typename DBN>
+bool score(DBN& dbn, const task& task, bool features) {
+    detail::sample_stream<Three, Container> stream(task.predicting.samples);
+
+    if (!stream) {
+        std::cout << "dllp: error: failed to open the samples to score" << std::endl;
+        return false;
+    }
+
+    const auto& desc = task.pr_desc;
+
+    if (desc.format != "csv" && desc.format != "binary") {
+        std::cout << "dllp: error: invalid output format, must be one of [csv, binary]" << std::endl;
+        return false;
+    }
+
+    const bool binary       = desc.format == "binary";
+    const std::string& file = features ? desc.features_file : desc.file;
+
+    std::ofstream os(file, binary ? std::ios::binary : std::ios::out);
+
+    if (!os) {
+        std::cout << "dllp: error: impossible to open " << file << std::endl;
+        return false;
+    }
+
+    const std::size_t chunk = std::max(std::size_t(1), desc.chunk);
+    const std::size_t dims  = dbn.output_size();
+
+    std::vector<Container> samples;
+    std::vector<float> values(features ? chunk * dims : 0);
+    std::vector<std::uint32_t> labels(features ? 0 : chunk);
+
+    samples.reserve(chunk);
+
+    std::size_t n = 0;
+
+    while (stream.next(samples, chunk)) {
+        dll::auto_timer timer("dllp:score:chunk");
+
+        auto results = dbn.batch_features(samples.begin(), samples.end());
+
+        const std::size_t m = samples.size();
+
+        for (std::size_t i = 0; i < m; ++i) {
+            cpp_assert(etl::size(results[i]) == dims, "Invalid number of features");
+
+            if (features) {
+                std::copy(results[i].begin(), results[i].end(), values.begin() + i * dims);
+            } else {
+                labels[i] = static_cast<std::uint32_t>(dbn.predict_label(results[i]));
+            }
+        }
+
+        if (features && binary) {
+            os.write(reinterpret_cast<const char*>(values.data()), m * dims * sizeof(float));
+        } else if (features) {
+            for (std::size_t i = 0; i < m; ++i) {
+                export_features_dll(values.begin() + i * dims, values.begin() + (i + 1) * dims, os);
+            }
+        } else if (binary) {
+            os.write(reinterpret_cast<const char*>(labels.data()), m * sizeof(std::uint32_t));
+        } else {
+            for (std::size_t i = 0; i < m; ++i) {
+                os << labels[i] << '\n';
+            }
+        }
+
+        n += m;
+
+        if (!os) {
+            std::cout << "dllp: error: failed to write to " << file << std::endl;
+            return false;
+        }
+    }
+
+    std::cout << "Scored " << n << " samples into " << file;
+
+    if (features && binary) {
+        std::cout << " (" << n << "x" << dims << " float values)";
+    }
+
+    std::cout << std::endl;
+
+    return true;
+}
+
 template <typename Container, bool Three, typename DBN>
 void execute(DBN& dbn, task& task, const std::vector<std::string>& actions) {
     print_title("Network");
@@ -379,6 +916,17 @@ void execute(DBN& dbn, task& task, const std::vector<std::string>& actions) {
                 std::cout << std::endl;
             }
             std::cout << std::endl;
+        } else if (action == "predict" || action == "features") {
+            print_title(action == "predict" ? "Prediction" : "Features");
+
+            if (task.predicting.samples.empty()) {
+                std::cout << "dllp: error: " << action << " is not possible without samples to score" << std::endl;
+                return;
+            }
+
+            if (!score<Container, Three>(dbn, task, action == "features")) {
+                return;
+            }
         } else if (action == "save") {
             print_title("Save Weights");
 
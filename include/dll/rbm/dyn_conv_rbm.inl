@@ -328,7 +328,7 @@ struct sgd_context<DBN, dyn_conv_rbm<Desc>> {
 
     sgd_context(size_t nc, size_t nv1, size_t nv2, size_t k, size_t nh1, size_t nh2)
             : w_grad(k, nc, nv1 - nh1 + 1, nv2 - nh2 + 1), b_grad(k),
-              w_inc(k, nc, nv1 - nh1 + 1, nv2 - nh2 + 1), b_inc(k),
+              w_inc(sgd_momentum_dim<DBN>(k), nc, nv1 - nh1 + 1, nv2 - nh2 + 1), b_inc(sgd_momentum_dim<DBN>(k)),
               input(batch_size, nc, nv1, nv2),
               output(batch_size, k, nh1, nh2), errors(batch_size, k, nh1, nh2) {}
 };
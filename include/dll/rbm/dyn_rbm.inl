@@ -48,6 +48,8 @@ struct dyn_rbm final : public standard_rbm<dyn_rbm<Desc>, Desc> {
     std::unique_ptr<b_type> bak_b; //!< Backup Hidden biases
     std::unique_ptr<c_type> bak_c; //!< Backup Visible biases
 
+    std::unique_ptr<sparse_weights<weight>> sparse_w; //!< Pruned weights in sparse format (nullptr if dense), rebuilt by sparsify()
+
     //Reconstruction data
     etl::dyn_vector<weight> v1; //!< State of the visible units
 
@@ -108,6 +110,8 @@ struct dyn_rbm final : public standard_rbm<dyn_rbm<Desc>, Desc> {
 
         //Initialize the weights with a zero-mean and unit variance Gaussian distribution
         w = etl::normal_generator<weight>() * 0.1;
+
+        sparse_w.reset();
     }
 
     std::size_t input_size() const noexcept {
@@ -244,6 +248,8 @@ struct rbm_layer_base_traits<dyn_rbm<Desc>> {
     static constexpr bool is_dbn_only        = param::template contains<dbn_only>();                            ///< Does the RBM is only used inside a DBN
     static constexpr bool has_init_weights   = param::template contains<init_weights>();                        ///< Does the RBM use weights initialization
     static constexpr bool has_free_energy    = param::template contains<free_energy>();                         ///< Does the RBM displays the free energy
+    static constexpr auto free_energy_subset = get_value_l<dll::free_energy_subset<0>, param>::value;            ///< The number of samples of the free energy subset (0 for all)
+    static constexpr auto free_energy_every  = get_value_l<dll::free_energy_every<1>, param>::value;             ///< The number of batches between free energy computations
     static constexpr auto sparsity_method    = get_value_l<sparsity<dll::sparsity_method::NONE>, param>::value; ///< The RBM's sparsity method
     static constexpr auto bias_mode          = get_value_l<bias<dll::bias_mode::NONE>, param>::value;           ///< The RBM's sparsity bias mode
     static constexpr auto decay              = get_value_l<weight_decay<dll::decay_type::NONE>, param>::value;  ///< The RMB's sparsity decay type
@@ -272,7 +278,7 @@ struct sgd_context<DBN, dyn_rbm<Desc>> {
 
     sgd_context(size_t num_visible, size_t num_hidden)
             : w_grad(num_visible, num_hidden), b_grad(num_hidden),
-              w_inc(num_visible, num_hidden, 0.0), b_inc(num_hidden, 0.0),
+              w_inc(sgd_momentum_dim<DBN>(num_visible), num_hidden, 0.0), b_inc(sgd_momentum_dim<DBN>(num_hidden), 0.0),
               input(batch_size, num_visible, 0.0), output(batch_size, num_hidden, 0.0), errors(batch_size, num_hidden, 0.0) {}
 };
 
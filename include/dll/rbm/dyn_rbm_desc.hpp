@@ -51,7 +51,7 @@ struct dyn_rbm_desc {
     //Make sure only valid types are passed to the configuration list
     static_assert(
         detail::is_valid<cpp::type_list<momentum_id, visible_id, hidden_id, weight_decay_id, parallel_mode_id, serial_id, verbose_id,
-                                        init_weights_id, sparsity_id, trainer_rbm_id, weight_type_id, shuffle_id, nop_id, free_energy_id, clip_gradients_id>,
+                                        init_weights_id, sparsity_id, trainer_rbm_id, weight_type_id, shuffle_id, nop_id, free_energy_id, free_energy_subset_id, free_energy_every_id, clip_gradients_id, sparse_input_id>,
                          Parameters...>::value,
         "Invalid parameters type");
 
@@ -65,6 +65,8 @@ struct rbm final : public standard_rbm<rbm<Desc>, Desc> {
     std::unique_ptr<b_type> bak_b; //!< Backup Hidden biases
     std::unique_ptr<c_type> bak_c; //!< Backup Visible biases
 
+    std::unique_ptr<sparse_weights<weight>> sparse_w; //!< Pruned weights in sparse format (nullptr if dense), rebuilt by sparsify()
+
     //Reconstruction data
     conditional_fast_matrix_t<!dbn_only, weight, num_visible> v1; //!< State of the visible units
 
@@ -228,6 +230,8 @@ struct rbm_layer_base_traits<rbm<Desc>> {
     static constexpr bool is_dbn_only        = param::template contains<dbn_only>();                            ///< Does the RBM is only used inside a DBN
     static constexpr bool has_init_weights   = param::template contains<init_weights>();                        ///< Does the RBM use weights initialization
     static constexpr bool has_free_energy    = param::template contains<free_energy>();                         ///< Does the RBM displays the free energy
+    static constexpr auto free_energy_subset = get_value_l<dll::free_energy_subset<0>, param>::value;            ///< The number of samples of the free energy subset (0 for all)
+    static constexpr auto free_energy_every  = get_value_l<dll::free_energy_every<1>, param>::value;             ///< The number of batches between free energy computations
     static constexpr auto sparsity_method    = get_value_l<sparsity<dll::sparsity_method::NONE>, param>::value; ///< The RBM's sparsity method
     static constexpr auto bias_mode          = get_value_l<bias<dll::bias_mode::NONE>, param>::value;           ///< The RBM's sparsity bias mode
     static constexpr auto decay              = get_value_l<weight_decay<dll::decay_type::NONE>, param>::value;  ///< The RMB's sparsity decay type
@@ -250,8 +254,8 @@ struct sgd_context<DBN, rbm<Desc>> {
     etl::fast_matrix<weight, num_visible, num_hidden> w_grad;
     etl::fast_matrix<weight, num_hidden> b_grad;
 
-    etl::fast_matrix<weight, num_visible, num_hidden> w_inc;
-    etl::fast_matrix<weight, num_hidden> b_inc;
+    sgd_momentum_matrix_t<DBN, weight, num_visible, num_hidden> w_inc;
+    sgd_momentum_matrix_t<DBN, weight, num_hidden> b_inc;
 
     etl::fast_matrix<weight, batch_size, num_visible> input;
     etl::fast_matrix<weight, batch_size, num_hidden> output;
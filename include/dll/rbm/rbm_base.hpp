@@ -15,6 +15,8 @@
 #include "dll/layer.hpp"
 #include "dll/trainer/rbm_trainer_fwd.hpp"
 #include "dll/util/converter.hpp" //converter
+#include "dll/util/snapshot.hpp"  //backup_parameter
+#include "dll/util/sparse.hpp"    //clear_sparse_weights
 
 namespace dll {
 
@@ -69,15 +71,17 @@ struct rbm_base : layer<Parent> {
     }
 
     void backup_weights() {
-        unique_safe_get(as_derived().bak_w) = as_derived().w;
-        unique_safe_get(as_derived().bak_b) = as_derived().b;
-        unique_safe_get(as_derived().bak_c) = as_derived().c;
+        backup_parameter(as_derived().bak_w, as_derived().w);
+        backup_parameter(as_derived().bak_b, as_derived().b);
+        backup_parameter(as_derived().bak_c, as_derived().c);
     }
 
     void restore_weights() {
-        as_derived().w = *as_derived().bak_w;
-        as_derived().b = *as_derived().bak_b;
-        as_derived().c = *as_derived().bak_c;
+        restore_parameter(as_derived().w, as_derived().bak_w);
+        restore_parameter(as_derived().b, as_derived().bak_b);
+        restore_parameter(as_derived().c, as_derived().bak_c);
+
+        clear_sparse_weights(as_derived());
     }
 
     double reconstruction_error(const input_one_t& item) {
@@ -215,6 +219,8 @@ private:
         cpp::binary_load_all(is, rbm.w);
         cpp::binary_load_all(is, rbm.b);
         cpp::binary_load_all(is, rbm.c);
+
+        clear_sparse_weights(rbm);
     }
 
     static void store(const std::string& file, const parent_t& rbm) {
@@ -59,7 +59,7 @@ struct rbm_desc {
     static_assert(
         detail::is_valid<cpp::type_list<momentum_id, parallel_mode_id, serial_id, verbose_id, batch_size_id, visible_id,
                                         hidden_id, weight_decay_id, init_weights_id, sparsity_id, trainer_rbm_id, watcher_id,
-                                        weight_type_id, shuffle_id, free_energy_id, dbn_only_id, nop_id, clip_gradients_id>,
+                                        weight_type_id, shuffle_id, free_energy_id, free_energy_subset_id, free_energy_every_id, dbn_only_id, nop_id, clip_gradients_id, sparse_input_id>,
                          Parameters...>::value,
         "Invalid parameters type for rbm_desc");
 
@@ -25,6 +25,7 @@
 #include "dll/rbm/standard_conv_rbm.hpp" //The base class
 #include "dll/base_conf.hpp"             //The configuration helpers
 #include "dll/rbm/rbm_tmp.hpp"           // static_if macros
+#include "dll/util/pmp.hpp"              // Fused probabilistic max pooling
 
 namespace dll {
 
@@ -65,22 +66,25 @@ struct standard_crbm_mp : public standard_conv_rbm<Derived, Desc> {
         static_assert(hidden_unit == unit_type::BINARY || is_relu(hidden_unit), "Invalid hidden unit type");
         static_assert(P, "Computing S without P is not implemented");
 
-        auto b_rep = as_derived().get_b_rep();
-
         as_derived().reshape_h_a(h_a) = etl::conv_4d_valid_flipped(as_derived().reshape_v_a(v_a), as_derived().w);
 
         // Note: this is wrong because of PMP
 
-        // Need to be done before h_a is computed!
-        H_SAMPLE_PROBS(unit_type::RELU, f(h_s) = max(logistic_noise(b_rep + h_a), 0.0));
-        H_SAMPLE_PROBS(unit_type::RELU6, f(h_s) = min(max(ranged_noise(b_rep + h_a, 6.0), 0.0), 6.0));
-        H_SAMPLE_PROBS(unit_type::RELU1, f(h_s) = min(max(ranged_noise(b_rep + h_a, 1.0), 0.0), 1.0));
+        cpp::static_if<is_relu(hidden_unit)>([&](auto g) {
+            auto b_rep = g(as_derived()).get_b_rep();
+
+            // Need to be done before h_a is computed!
+            H_SAMPLE_PROBS(unit_type::RELU, f(h_s) = max(logistic_noise(b_rep + h_a), 0.0));
+            H_SAMPLE_PROBS(unit_type::RELU6, f(h_s) = min(max(ranged_noise(b_rep + h_a, 6.0), 0.0), 6.0));
+            H_SAMPLE_PROBS(unit_type::RELU1, f(h_s) = min(max(ranged_noise(b_rep + h_a, 1.0), 0.0), 1.0));
+
+            H_PROBS(unit_type::RELU, f(h_a) = max(b_rep + h_a, 0.0));
+            H_PROBS(unit_type::RELU6, f(h_a) = min(max(b_rep + h_a, 0.0), 6.0));
+            H_PROBS(unit_type::RELU1, f(h_a) = min(max(b_rep + h_a, 0.0), 1.0));
+        });
 
-        H_PROBS2(unit_type::BINARY, unit_type::BINARY, f(h_a) = etl::p_max_pool_h(b_rep + h_a, this->C(), this->C()));
-        H_PROBS2(unit_type::BINARY, unit_type::GAUSSIAN, f(h_a) = etl::p_max_pool_h((1.0 / (0.1 * 0.1)) >> (b_rep + h_a), this->C(), this->C()));
-        H_PROBS(unit_type::RELU, f(h_a) = max(b_rep + h_a, 0.0));
-        H_PROBS(unit_type::RELU6, f(h_a) = min(max(b_rep + h_a, 0.0), 6.0));
-        H_PROBS(unit_type::RELU1, f(h_a) = min(max(b_rep + h_a, 0.0), 1.0));
+        // The bias, the scaling and the pooling are fused, in place
+        H_PROBS(unit_type::BINARY, dll::pmp_hidden<!rbm_layer_traits<derived_t>::is_serial()>(f(h_a), as_derived().b, this->C(), pmp_scale()));
 
         H_SAMPLE_PROBS(unit_type::BINARY, f(h_s) = bernoulli(h_a));
 
@@ -124,13 +128,13 @@ struct standard_crbm_mp : public standard_conv_rbm<Derived, Desc> {
         static_assert(pooling_unit == unit_type::BINARY, "Invalid pooling unit type");
         static_assert(P, "Computing S without P is not implemented");
 
-        auto b_rep = as_derived().get_b_rep();
-
         auto v_cv = as_derived().energy_tmp();
         v_cv = etl::conv_4d_valid_flipped(as_derived().reshape_v_a(v_a), as_derived().w);
 
+        // The probabilities of the pooling units are computed in the same
+        // pass as the ones of the hidden units, which are discarded
         if (pooling_unit == unit_type::BINARY) {
-            p_a = etl::p_max_pool_p(b_rep + v_cv(0), C(), C());
+            dll::pmp_pooling<!rbm_layer_traits<derived_t>::is_serial()>(v_cv, p_a, as_derived().b, C());
         }
 
         nan_check_etl(p_a);
@@ -159,20 +163,23 @@ struct standard_crbm_mp : public standard_conv_rbm<Derived, Desc> {
 
         h_a = etl::conv_4d_valid_flipped(v_a, as_derived().w);
 
-        auto b_rep = as_derived().get_batch_b_rep(v_a);
-
         // Note: this is wrong because of PMP
 
-        // Need to be done before h_a is computed!
-        H_SAMPLE_PROBS(unit_type::RELU, f(h_s) = max(logistic_noise(b_rep + h_a), 0.0));
-        H_SAMPLE_PROBS(unit_type::RELU6, f(h_s) = min(max(ranged_noise(b_rep + h_a, 6.0), 0.0), 6.0));
-        H_SAMPLE_PROBS(unit_type::RELU1, f(h_s) = min(max(ranged_noise(b_rep + h_a, 1.0), 0.0), 1.0));
+        cpp::static_if<is_relu(hidden_unit)>([&](auto g) {
+            auto b_rep = g(as_derived()).get_batch_b_rep(v_a);
 
-        H_PROBS2(unit_type::BINARY, unit_type::BINARY, f(h_a) = etl::p_max_pool_h(b_rep + h_a, this->C(), this->C()));
-        H_PROBS2(unit_type::BINARY, unit_type::GAUSSIAN, f(h_a) = etl::p_max_pool_h((1.0 / (0.1 * 0.1)) >> (b_rep + h_a), this->C(), this->C()));
-        H_PROBS(unit_type::RELU, f(h_a) = max(b_rep + h_a, 0.0));
-        H_PROBS(unit_type::RELU6, f(h_a) = min(max(b_rep + h_a, 0.0), 6.0));
-        H_PROBS(unit_type::RELU1, f(h_a) = min(max(b_rep + h_a, 0.0), 1.0));
+            // Need to be done before h_a is computed!
+            H_SAMPLE_PROBS(unit_type::RELU, f(h_s) = max(logistic_noise(b_rep + h_a), 0.0));
+            H_SAMPLE_PROBS(unit_type::RELU6, f(h_s) = min(max(ranged_noise(b_rep + h_a, 6.0), 0.0), 6.0));
+            H_SAMPLE_PROBS(unit_type::RELU1, f(h_s) = min(max(ranged_noise(b_rep + h_a, 1.0), 0.0), 1.0));
+
+            H_PROBS(unit_type::RELU, f(h_a) = max(b_rep + h_a, 0.0));
+            H_PROBS(unit_type::RELU6, f(h_a) = min(max(b_rep + h_a, 0.0), 6.0));
+            H_PROBS(unit_type::RELU1, f(h_a) = min(max(b_rep + h_a, 0.0), 1.0));
+        });
+
+        // The bias, the scaling and the pooling are fused, in place
+        H_PROBS(unit_type::BINARY, dll::pmp_hidden<!rbm_layer_traits<derived_t>::is_serial()>(f(h_a), as_derived().b, this->C(), pmp_scale()));
 
         H_SAMPLE_PROBS(unit_type::BINARY, f(h_s) = bernoulli(h_a));
 
@@ -289,6 +296,13 @@ private:
         }
     }
 
+    /*!
+     * \brief Returns the scale of the activations of the hidden units
+     */
+    static constexpr weight pmp_scale() {
+        return visible_unit == unit_type::GAUSSIAN ? 1.0 / (0.1 * 0.1) : 1.0;
+    }
+
     derived_t& as_derived() {
         return *static_cast<derived_t*>(this);
     }
@@ -8,6 +8,7 @@
 #pragma once
 
 #include <cmath>
+#include <limits>
 #include <vector>
 #include <random>
 #include <functional>
@@ -20,8 +21,11 @@
 #include "etl/etl.hpp"
 
 #include "dll/util/checks.hpp"    //NaN checks
+#include "dll/layer_traits.hpp"   //layer_traits
 #include "dll/util/timers.hpp"    //auto_timer
+#include "dll/util/scheduler.hpp" //shared_pool
 #include "dll/util/converter.hpp" //converter
+#include "dll/util/sparse.hpp"    //sparse kernels
 #include "dll/rbm/rbm_base.hpp"       //The base class
 #include "dll/base_conf.hpp"      //Descriptor configuration
 #include "dll/rbm/rbm_tmp.hpp"        // static_if macros
@@ -88,6 +92,32 @@ struct standard_rbm : public rbm_base<Parent, Desc> {
         return free_energy(rbm, rbm.v1);
     }
 
+    /*!
+     * \brief Compute the sum of the free energies of a batch of samples.
+     *
+     * The hidden pre-activations of the complete batch are computed at once.
+     *
+     * \param v The batch of samples, a row per sample
+     */
+    template <typename V>
+    weight batch_free_energy(const V& v) const {
+        return batch_free_energy(as_derived(), v);
+    }
+
+    /*!
+     * \brief Compute the sum of the free energies of the n first samples of a
+     * batch, reusing the activation probabilities of the hidden units that
+     * were already computed for these samples (by the trainer for instance).
+     *
+     * \param v The batch of samples, a row per sample
+     * \param h_a The activation probabilities of the hidden units for v
+     * \param n The number of samples to consider
+     */
+    template <typename V, typename H>
+    weight batch_free_energy(const V& v, const H& h_a, std::size_t n) const {
+        return batch_free_energy(as_derived(), v, h_a, n);
+    }
+
     //Various functions
 
     template <typename Iterator>
@@ -99,6 +129,14 @@ struct standard_rbm : public rbm_base<Parent, Desc> {
         reconstruct(items, as_derived());
     }
 
+    /*!
+     * \brief Convert the weights to the sparse representation if their
+     * density is at most max_density. The dense kernels are used otherwise.
+     */
+    void sparsify(double max_density = sparse_weights_density_threshold) {
+        as_derived().sparse_w = make_sparse_weights(as_derived().w, max_density);
+    }
+
     // activate_hidden
 
     using base_type::activate_hidden;
@@ -111,12 +149,16 @@ struct standard_rbm : public rbm_base<Parent, Desc> {
 
     template <bool P = true, bool S = true, typename H1, typename H2, typename V>
     void activate_hidden(H1&& h_a, H2&& h_s, const V& v_a, const V& v_s) const {
-        std_activate_hidden<P, S>(std::forward<H1>(h_a), std::forward<H2>(h_s), v_a, v_s, as_derived().b, as_derived().w);
+        if (as_derived().sparse_w) {
+            sparse_weights_std_activate_hidden<P, S>(h_a, h_s, v_a, *as_derived().sparse_w, as_derived().b);
+        } else {
+            std_activate_hidden<P, S>(std::forward<H1>(h_a), std::forward<H2>(h_s), v_a, v_s, as_derived().b, as_derived().w);
+        }
     }
 
     template <typename H>
     void activate_hidden(H&& h_a, const input_one_t& v_a) const {
-        std_activate_hidden<true, false>(std::forward<H>(h_a), std::forward<H>(h_a), v_a, v_a, as_derived().b, as_derived().w);
+        activate_hidden<true, false>(h_a, h_a, v_a, v_a);
     }
 
     template <typename H, typename Input>
@@ -143,12 +185,16 @@ struct standard_rbm : public rbm_base<Parent, Desc> {
 
     template <bool P = true, bool S = true, typename H1, typename H2, typename V>
     void batch_activate_hidden(H1&& h_a, H2&& h_s, const V& v_a, const V& v_s) const {
-        batch_std_activate_hidden<P, S>(std::forward<H1>(h_a), std::forward<H2>(h_s), v_a, v_s, as_derived().b, as_derived().w);
+        if (as_derived().sparse_w) {
+            sparse_weights_batch_std_activate_hidden<P, S>(h_a, h_s, v_a, *as_derived().sparse_w, as_derived().b);
+        } else {
+            batch_std_activate_hidden<P, S>(std::forward<H1>(h_a), std::forward<H2>(h_s), v_a, v_s, as_derived().b, as_derived().w);
+        }
     }
 
     template <typename H, typename V, cpp_enable_if(etl::decay_traits<V>::dimensions() == 2)>
     void batch_activate_hidden(H&& h_a, const V& v_a) const {
-        batch_std_activate_hidden<true, false>(std::forward<H>(h_a), std::forward<H>(h_a), v_a, v_a, as_derived().b, as_derived().w);
+        batch_activate_hidden<true, false>(h_a, h_a, v_a, v_a);
     }
 
     template <typename H, typename V, cpp_enable_if(etl::decay_traits<V>::dimensions() != 2)>
@@ -229,16 +275,86 @@ private:
         return etl::mean((rbm.v1 - rbm.v2_a) >> (rbm.v1 - rbm.v2_a));
     }
 
+    /*!
+     * \brief Statistics of the visible units over a set of samples
+     */
+    struct visible_statistics {
+        std::size_t n = 0;             ///< The number of samples
+        std::vector<std::size_t> ones; ///< The number of times each visible unit is on
+
+        explicit visible_statistics(std::size_t nv) : ones(nv) {}
+
+        template <typename Sample>
+        void add(const Sample& v) {
+            ++n;
+
+            for (std::size_t i = 0; i < ones.size(); ++i) {
+                ones[i] += v[i] == 1.0;
+            }
+        }
+
+        void merge(const visible_statistics& rhs) {
+            n += rhs.n;
+
+            for (std::size_t i = 0; i < ones.size(); ++i) {
+                ones[i] += rhs.ones[i];
+            }
+        }
+    };
+
+    //The statistics are gathered in a single pass over the samples. When the
+    //samples can be accessed randomly, the pass is split in contiguous blocks
+    //of samples, each block being processed by a thread.
+
+    template <typename Iterator, cpp_enable_if(std::is_same<typename std::iterator_traits<Iterator>::iterator_category, std::random_access_iterator_tag>::value)>
+    static visible_statistics gather_statistics(Iterator first, Iterator last, std::size_t nv) {
+        const std::size_t n      = std::distance(first, last);
+        const std::size_t blocks = std::max(std::size_t(1), std::min(dll::threads(), n));
+
+        std::vector<visible_statistics> partials(blocks, visible_statistics(nv));
+
+        decltype(auto) pool = dll::shared_pool<!rbm_layer_traits<parent_t>::is_serial()>();
+
+        parallel_foreach_i(pool, partials.begin(), partials.end(), [first, n, blocks](auto& stats, std::size_t b) {
+            auto it  = first + (b * n) / blocks;
+            auto end = first + ((b + 1) * n) / blocks;
+
+            for (; it != end; ++it) {
+                stats.add(*it);
+            }
+        });
+
+        for (std::size_t b = 1; b < blocks; ++b) {
+            partials[0].merge(partials[b]);
+        }
+
+        return partials[0];
+    }
+
+    template <typename Iterator, cpp_disable_if(std::is_same<typename std::iterator_traits<Iterator>::iterator_category, std::random_access_iterator_tag>::value)>
+    static visible_statistics gather_statistics(Iterator first, Iterator last, std::size_t nv) {
+        visible_statistics stats(nv);
+
+        for (; first != last; ++first) {
+            stats.add(*first);
+        }
+
+        return stats;
+    }
+
     template <typename Iterator>
     static void init_weights(Iterator first, Iterator last, parent_t& rbm) {
-        auto size = std::distance(first, last);
+        dll::auto_timer timer("rbm:std:init_weights");
+
+        auto stats = gather_statistics(first, last, num_visible(rbm));
+
+        if (!stats.n) {
+            return;
+        }
 
         //Initialize the visible biases to log(pi/(1-pi))
         for (std::size_t i = 0; i < num_visible(rbm); ++i) {
-            auto count = std::count_if(first, last,
-                                       [i](auto& a) { return a[i] == 1; });
-
-            auto pi = static_cast<double>(count) / size;
+            auto pi = static_cast<double>(stats.ones[i]) / stats.n;
             pi += 0.0001;
             rbm.c(i) = log(pi / (1.0 - pi));
 
@@ -363,10 +479,73 @@ private:
         return free_energy(rbm, ev);
     }
 
+    template <typename V>
+    static weight batch_free_energy(const parent_t& rbm, const V& v) {
+        dll::auto_timer timer("rbm:std:batch_free_energy");
+
+        const auto Batch = etl::dim<0>(v);
+
+        if (visible_unit == unit_type::BINARY && hidden_unit == unit_type::BINARY) {
+            auto x = etl::force_temporary(etl::rep_l(rbm.b, Batch) + v * rbm.w);
+
+            return -etl::sum(v * rbm.c) - etl::sum(etl::log(1.0 + etl::exp(x)));
+        } else if (visible_unit == unit_type::GAUSSIAN && hidden_unit == unit_type::BINARY) {
+            auto x = etl::force_temporary(etl::rep_l(rbm.b, Batch) + v * rbm.w);
+
+            return etl::sum(etl::pow(v - etl::rep_l(rbm.c, Batch), 2) / 2.0) - etl::sum(etl::log(1.0 + etl::exp(x)));
+        } else if (hidden_unit == unit_type::SOFTMAX && (visible_unit == unit_type::BINARY || visible_unit == unit_type::GAUSSIAN)) {
+            //A single hidden unit is active, the hidden term is log(sum(e^(xj)))
+            auto x = etl::force_temporary(etl::rep_l(rbm.b, Batch) + v * rbm.w);
+
+            weight hidden_term = 0.0;
+
+            for (std::size_t i = 0; i < Batch; ++i) {
+                const weight m = etl::max(x(i));
+                hidden_term += m + std::log(etl::sum(etl::exp(x(i) - m)));
+            }
+
+            if (visible_unit == unit_type::BINARY) {
+                return -etl::sum(v * rbm.c) - hidden_term;
+            } else {
+                return etl::sum(etl::pow(v - etl::rep_l(rbm.c, Batch), 2) / 2.0) - hidden_term;
+            }
+        } else {
+            return 0.0;
+        }
+    }
+
+    //With binary hidden units, h_j = sigmoid(x_j) and therefore
+    //log(1 + e^(xj)) = -log(1 - h_j), no need to compute x again.
+    //The term of a saturated unit (h_j == 1) is bounded by -log(epsilon).
+    //The activations of the other hidden units cannot be reused, the free
+    //energy is then computed from the samples.
+
+    template <typename V, typename H>
+    static weight batch_free_energy(const parent_t& rbm, const V& v, const H& h_a, std::size_t n) {
+        dll::auto_timer timer("rbm:std:batch_free_energy:reuse");
+
+        const weight epsilon = std::numeric_limits<weight>::epsilon();
+
+        auto v_n = etl::slice(v, 0, n);
+        auto h_n = etl::slice(h_a, 0, n);
+
+        if (visible_unit == unit_type::BINARY && hidden_unit == unit_type::BINARY) {
+            return -etl::sum(v_n * rbm.c) + etl::sum(etl::log(etl::max(1.0 - h_n, epsilon)));
+        } else if (visible_unit == unit_type::GAUSSIAN && hidden_unit == unit_type::BINARY) {
+            return etl::sum(etl::pow(v_n - etl::rep_l(rbm.c, n), 2) / 2.0) + etl::sum(etl::log(etl::max(1.0 - h_n, epsilon)));
+        } else {
+            return batch_free_energy(rbm, v_n);
+        }
+    }
+
     template <bool P = true, bool S = true, typename H1, typename H2, typename V, typename B, typename W>
     static void std_activate_hidden(H1&& h_a, H2&& h_s, const V& v_a, const V&, const B& b, const W& w) {
         dll::auto_timer timer("rbm:std:activate_hidden");
 
+        if (sparse_std_activate_hidden<P, S>(h_a, h_s, v_a, b, w)) {
+            return;
+        }
+
         using namespace etl;
 
         //Compute activation probabilities
@@ -432,6 +611,10 @@ private:
 
         cpp_assert(etl::dim<0>(h_s) == Batch && etl::dim<0>(v_a) == Batch, "The number of batch must be consistent");
 
+        if (sparse_batch_std_activate_hidden<P, S>(h_a, h_s, v_a, b, w)) {
+            return;
+        }
+
         H_PROBS(unit_type::BINARY, f(h_a) = sigmoid(rep_l(b, Batch) + v_a * w));
         H_PROBS(unit_type::RELU, f(h_a) = max(rep_l(b, Batch) + v_a * w, 0.0));
         H_PROBS(unit_type::RELU1, f(h_a) = min(max(rep_l(b, Batch) + v_a * w, 0.0), 1.0));
@@ -479,6 +662,182 @@ private:
         }
     }
 
+    /*!
+     * \brief Compute the hidden activations of one sample from its
+     * pre-activations (b + v * w), computed by a sparse kernel.
+     */
+    template <bool P, bool S, typename H1, typename H2, typename X>
+    static void std_activate_hidden_from(H1&& h_a, H2&& h_s, const X& x) {
+        using namespace etl;
+
+        H_PROBS(unit_type::BINARY, f(h_a) = sigmoid(x));
+        H_PROBS(unit_type::RELU, f(h_a) = max(x, 0.0));
+        H_PROBS(unit_type::RELU1, f(h_a) = min(max(x, 0.0), 1.0));
+        H_PROBS(unit_type::RELU6, f(h_a) = min(max(x, 0.0), 6.0));
+        H_PROBS(unit_type::SOFTMAX, f(h_a) = stable_softmax(x));
+
+        H_SAMPLE_PROBS(unit_type::BINARY, f(h_s) = bernoulli(h_a));
+        H_SAMPLE_PROBS(unit_type::RELU, f(h_s) = max(logistic_noise(x), 0.0));
+        H_SAMPLE_PROBS(unit_type::RELU1, f(h_s) = min(max(ranged_noise(x, 1.0), 0.0), 1.0));
+        H_SAMPLE_PROBS(unit_type::RELU6, f(h_s) = min(max(ranged_noise(x, 6.0), 0.0), 6.0));
+        H_SAMPLE_PROBS(unit_type::SOFTMAX, f(h_s) = one_if_max(h_a));
+
+        H_SAMPLE_INPUT(unit_type::BINARY, f(h_s) = bernoulli(sigmoid(x)));
+        H_SAMPLE_INPUT(unit_type::RELU, f(h_s) = max(logistic_noise(x), 0.0));
+        H_SAMPLE_INPUT(unit_type::RELU1, f(h_s) = min(max(ranged_noise(x, 1.0), 0.0), 1.0));
+        H_SAMPLE_INPUT(unit_type::RELU6, f(h_s) = min(max(ranged_noise(x, 6.0), 0.0), 6.0));
+        H_SAMPLE_INPUT(unit_type::SOFTMAX, f(h_s) = one_if_max(stable_softmax(x)));
+
+        if (P) {
+            nan_check_deep(h_a);
+        }
+
+        if (S) {
+            nan_check_deep(h_s);
+        }
+    }
+
+    /*!
+     * \brief Compute the hidden activations of a batch from its
+     * pre-activations (rep_l(b) + v * w), computed by a sparse kernel.
+     */
+    template <bool P, bool S, typename H1, typename H2, typename X>
+    static void batch_std_activate_hidden_from(H1&& h_a, H2&& h_s, const X& x) {
+        using namespace etl;
+
+        const auto Batch = etl::dim<0>(h_a);
+
+        H_PROBS(unit_type::BINARY, f(h_a) = sigmoid(x));
+        H_PROBS(unit_type::RELU, f(h_a) = max(x, 0.0));
+        H_PROBS(unit_type::RELU1, f(h_a) = min(max(x, 0.0), 1.0));
+        H_PROBS(unit_type::RELU6, f(h_a) = min(max(x, 0.0), 6.0));
+
+        H_PROBS_MULTI(unit_type::SOFTMAX)
+        ([&](auto f) {
+            for (std::size_t b = 0; b < Batch; ++b) {
+                f(h_a)(b) = stable_softmax(x(b));
+            }
+        });
+
+        H_SAMPLE_PROBS(unit_type::BINARY, f(h_s) = bernoulli(h_a));
+        H_SAMPLE_PROBS(unit_type::RELU, f(h_s) = max(logistic_noise(x), 0.0));
+        H_SAMPLE_PROBS(unit_type::RELU1, f(h_s) = min(max(ranged_noise(x, 1.0), 0.0), 1.0));
+        H_SAMPLE_PROBS(unit_type::RELU6, f(h_s) = min(max(ranged_noise(x, 6.0), 0.0), 6.0));
+
+        H_SAMPLE_PROBS_MULTI(unit_type::SOFTMAX)
+        ([&](auto f) {
+            for (std::size_t b = 0; b < Batch; ++b) {
+                f(h_s)(b) = one_if_max(h_a(b));
+            }
+        });
+
+        H_SAMPLE_INPUT(unit_type::BINARY, f(h_s) = bernoulli(sigmoid(x)));
+        H_SAMPLE_INPUT(unit_type::RELU, f(h_s) = max(logistic_noise(x), 0.0));
+        H_SAMPLE_INPUT(unit_type::RELU1, f(h_s) = min(max(ranged_noise(x, 1.0), 0.0), 1.0));
+        H_SAMPLE_INPUT(unit_type::RELU6, f(h_s) = min(max(ranged_noise(x, 6.0), 0.0), 6.0));
+
+        H_SAMPLE_INPUT_MULTI(unit_type::SOFTMAX)
+        ([&](auto f) {
+            for (std::size_t b = 0; b < Batch; ++b) {
+                f(h_s)(b) = one_if_max(stable_softmax(x(b)));
+            }
+        });
+
+        if (P) {
+            nan_check_deep(h_a);
+        }
+
+        if (S) {
+            nan_check_deep(h_s);
+        }
+    }
+
+    /*!
+     * \brief Compute the hidden activations of one sample with the sparse
+     * representation of the pruned weights.
+     */
+    template <bool P, bool S, typename H1, typename H2, typename V, typename B>
+    static void sparse_weights_std_activate_hidden(H1&& h_a, H2&& h_s, const V& v_a, const sparse_weights<weight>& w, const B& b) {
+        dll::auto_timer timer("rbm:std:sparse_weights:activate_hidden");
+
+        etl::dyn_vector<weight> x(etl::size(b));
+
+        sparse_weights_linear(x, v_a, w, b);
+
+        std_activate_hidden_from<P, S>(h_a, h_s, x);
+    }
+
+    /*!
+     * \brief Compute the hidden activations of a batch with the sparse
+     * representation of the pruned weights.
+     */
+    template <bool P, bool S, typename H1, typename H2, typename V, typename B>
+    static void sparse_weights_batch_std_activate_hidden(H1&& h_a, H2&& h_s, const V& v_a, const sparse_weights<weight>& w, const B& b) {
+        dll::auto_timer timer("rbm:std:sparse_weights:batch_activate_hidden");
+
+        etl::dyn_matrix<weight, 2> x(etl::dim<0>(h_a), etl::size(b));
+
+        sparse_weights_linear(x, v_a, w, b);
+
+        batch_std_activate_hidden_from<P, S>(h_a, h_s, x);
+    }
+
+    /*!
+     * \brief Compute the hidden activations of a sparse input sample with
+     * the sparse kernels.
+     * \return true if the activations have been computed, false if the
+     * input is not sparse enough and the dense kernels must be used
+     */
+    template <bool P, bool S, typename H1, typename H2, typename V, typename B, typename W, typename D = desc, cpp_enable_if(has_sparse_input<D>())>
+    static bool sparse_std_activate_hidden(H1&& h_a, H2&& h_s, const V& v_a, const B& b, const W& w) {
+        sparse_batch<etl::value_t<V>> sparse;
+
+        if (!make_sparse_sample(v_a, sparse)) {
+            return false;
+        }
+
+        etl::dyn_vector<weight> x(etl::size(b));
+
+        sparse_linear_one(x, sparse, w, b);
+
+        std_activate_hidden_from<P, S>(h_a, h_s, x);
+
+        return true;
+    }
+
+    template <bool P, bool S, typename H1, typename H2, typename V, typename B, typename W, typename D = desc, cpp_disable_if(has_sparse_input<D>())>
+    static bool sparse_std_activate_hidden(H1&&, H2&&, const V&, const B&, const W&) {
+        return false;
+    }
+
+    /*!
+     * \brief Compute the hidden activations of a sparse input batch with
+     * the sparse kernels.
+     * \return true if the activations have been computed, false if the
+     * input is not sparse enough and the dense kernels must be used
+     */
+    template <bool P, bool S, typename H1, typename H2, typename V, typename B, typename W, typename D = desc, cpp_enable_if(has_sparse_input<D>())>
+    static bool sparse_batch_std_activate_hidden(H1&& h_a, H2&& h_s, const V& v_a, const B& b, const W& w) {
+        sparse_batch<etl::value_t<V>> sparse;
+
+        if (!make_sparse_batch(v_a, sparse)) {
+            return false;
+        }
+
+        etl::dyn_matrix<weight, 2> x(etl::dim<0>(h_a), etl::size(b));
+
+        sparse_linear(x, sparse, w, b);
+
+        batch_std_activate_hidden_from<P, S>(h_a, h_s, x);
+
+        return true;
+    }
+
+    template <bool P, bool S, typename H1, typename H2, typename V, typename B, typename W, typename D = desc, cpp_disable_if(has_sparse_input<D>())>
+    static bool sparse_batch_std_activate_hidden(H1&&, H2&&, const V&, const B&, const W&) {
+        return false;
+    }
+
     template <bool P = true, bool S = true, typename H, typename V, typename C, typename W>
     static void batch_std_activate_visible(const H&, const H& h_s, V&& v_a, V&& v_s, const C& c, const W& w) {
         dll::auto_timer timer("rbm:std:batch_activate_visible");
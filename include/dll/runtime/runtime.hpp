@@ -0,0 +1,200 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*!
+ * \file runtime.hpp
+ * \brief Type-erased layers and networks, backed by precompiled kernels.
+ *
+ * This header does not include ETL nor any layer, its functions are
+ * defined in the dll_runtime library (runtime/src), where the layers of
+ * the catalogue are explicitly instantiated once. Code using only this
+ * interface compiles in a fraction of the time and memory of a network
+ * built from dbn_desc.
+ *
+ * The catalogue is made of the dynamic dense layers (all the activation
+ * functions) and of the dynamic RBMs (binary or Gaussian visible units,
+ * binary, ReLU or softmax hidden units), all in single precision.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <iosfwd>
+
+#include "dll/function.hpp"
+#include "dll/unit_type.hpp"
+
+namespace dll {
+
+namespace runtime {
+
+/*!
+ * \brief The hyper parameters of the pretraining of a layer
+ */
+struct hyper_parameters {
+    double learning_rate   = 0.1;  ///< The learning rate
+    double momentum        = 0.9;  ///< The momentum (0 to disable)
+    double l1_weight_cost  = 0.0;  ///< The L1 weight cost (0 to disable)
+    double l2_weight_cost  = 0.0;  ///< The L2 weight cost (0 to disable)
+    std::size_t batch_size = 25;   ///< The size of the mini-batches
+};
+
+/*!
+ * \brief A type-erased layer.
+ *
+ * The samples are passed as row-major matrices of batch x size values.
+ */
+struct layer {
+    virtual ~layer() = default;
+
+    /*!
+     * \brief Returns the number of inputs of the layer
+     */
+    virtual std::size_t input_size() const = 0;
+
+    /*!
+     * \brief Returns the number of outputs of the layer
+     */
+    virtual std::size_t output_size() const = 0;
+
+    /*!
+     * \brief Returns a short description of the layer
+     */
+    virtual std::string to_short_string() const = 0;
+
+    /*!
+     * \brief Compute the activations of a batch of samples
+     * \param input The batch x input_size() inputs
+     * \param output The batch x output_size() outputs
+     * \param batch The number of samples
+     */
+    virtual void forward(const float* input, float* output, std::size_t batch) const = 0;
+
+    /*!
+     * \brief Indicates if the layer can be pretrained
+     */
+    virtual bool pretrainable() const = 0;
+
+    /*!
+     * \brief Pretrain the layer on the given samples (no effect if the
+     * layer cannot be pretrained)
+     * \return The final reconstruction error
+     */
+    virtual double pretrain(const std::vector<std::vector<float>>& samples, std::size_t epochs, const hyper_parameters& params) = 0;
+
+    /*!
+     * \brief Store the parameters of the layer in the given stream
+     */
+    virtual void store(std::ostream& os) const = 0;
+
+    /*!
+     * \brief Load the parameters of the layer from the given stream
+     */
+    virtual void load(std::istream& is) = 0;
+};
+
+/*!
+ * \brief Create a dense layer of the catalogue
+ * \param visible The number of inputs
+ * \param hidden The number of outputs
+ * \param activation The activation function
+ * \return The layer
+ */
+std::unique_ptr<layer> make_dense(std::size_t visible, std::size_t hidden, function activation = function::SIGMOID);
+
+/*!
+ * \brief Create a RBM layer of the catalogue
+ * \param visible The number of visible units
+ * \param hidden The number of hidden units
+ * \param visible_unit The type of the visible units
+ * \param hidden_unit The type of the hidden units
+ * \return The layer, nullptr if the units are not in the catalogue
+ */
+std::unique_ptr<layer> make_rbm(std::size_t visible, std::size_t hidden, unit_type visible_unit = unit_type::BINARY, unit_type hidden_unit = unit_type::BINARY);
+
+/*!
+ * \brief A type-erased network, a stack of type-erased layers
+ */
+struct network {
+    /*!
+     * \brief Add a layer on top of the network
+     * \throw std::invalid_argument if the layer is null or if its inputs do
+     * not match the outputs of the network
+     */
+    void add(std::unique_ptr<layer> l);
+
+    /*!
+     * \brief Returns the number of layers of the network
+     */
+    std::size_t layers() const {
+        return stack.size();
+    }
+
+    /*!
+     * \brief Returns the layer at the given index
+     */
+    layer& layer_get(std::size_t i) {
+        return *stack[i];
+    }
+
+    /*!
+     * \copydoc layer_get
+     */
+    const layer& layer_get(std::size_t i) const {
+        return *stack[i];
+    }
+
+    /*!
+     * \brief Returns the number of inputs of the network
+     */
+    std::size_t input_size() const;
+
+    /*!
+     * \brief Returns the number of outputs of the network
+     */
+    std::size_t output_size() const;
+
+    /*!
+     * \brief Compute the outputs of the network for a batch of samples
+     * \param input The batch x input_size() inputs
+     * \param batch The number of samples
+     * \return The batch x output_size() outputs
+     */
+    std::vector<float> forward(const std::vector<float>& input, std::size_t batch) const;
+
+    /*!
+     * \brief Pretrain the pretrainable layers, layer per layer
+     * \param samples The training samples
+     * \param epochs The number of epochs for each layer
+     * \param params The hyper parameters of the pretraining
+     */
+    void pretrain(const std::vector<std::vector<float>>& samples, std::size_t epochs, const hyper_parameters& params = hyper_parameters());
+
+    /*!
+     * \brief Store the parameters of the network in the given stream
+     */
+    void store(std::ostream& os) const;
+
+    /*!
+     * \brief Load the parameters of the network from the given stream
+     */
+    void load(std::istream& is);
+
+    /*!
+     * \brief Display the network on the console
+     */
+    void display() const;
+
+private:
+    std::vector<std::unique_ptr<layer>> stack; ///< The layers of the network
+};
+
+} //end of namespace runtime
+
+} //end of namespace dll
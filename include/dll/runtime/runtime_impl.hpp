@@ -0,0 +1,202 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*!
+ * \file runtime_impl.hpp
+ * \brief Implementation of the type-erased layers on top of the layers.
+ *
+ * The layers of the catalogue are declared as explicitly instantiated
+ * (extern template), their definitions are compiled once in the dll_runtime
+ * library. This header is only needed to wrap layers that are not in the
+ * catalogue.
+ */
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <algorithm>
+
+#include "cpp_utils/io.hpp"
+#include "cpp_utils/static_if.hpp"
+
+#include "etl/etl.hpp"
+
+#include "dll/rbm/dyn_rbm.hpp"
+#include "dll/neural/dyn_dense_layer.hpp"
+#include "dll/runtime/runtime.hpp"
+
+namespace dll {
+
+namespace runtime {
+
+/*!
+ * \brief The dense layer of the catalogue with the given activation function
+ */
+template <function F>
+using dense_t = typename dyn_dense_desc<activation<F>>::layer_t;
+
+/*!
+ * \brief The RBM of the catalogue with the given units
+ */
+template <unit_type V, unit_type H>
+using rbm_t = typename dyn_rbm_desc<momentum, weight_decay<decay_type::L1L2>, visible<V>, hidden<H>>::layer_t;
+
+/*!
+ * \brief Type-erased layer wrapping a dynamic layer.
+ *
+ * The buffers of the forward pass are kept between the calls, a layer
+ * cannot therefore be used by several threads at the same time.
+ *
+ * \tparam L The type of the wrapped layer
+ */
+template <typename L>
+struct layer_impl final : layer {
+    using layer_t = L;
+    using weight  = typename layer_t::weight;
+
+    /*!
+     * \brief Create and initialize the wrapped layer
+     */
+    layer_impl(std::size_t visible, std::size_t hidden);
+
+    std::size_t input_size() const override;
+    std::size_t output_size() const override;
+    std::string to_short_string() const override;
+    void forward(const float* input, float* output, std::size_t batch) const override;
+    bool pretrainable() const override;
+    double pretrain(const std::vector<std::vector<float>>& samples, std::size_t epochs, const hyper_parameters& params) override;
+    void store(std::ostream& os) const override;
+    void load(std::istream& is) override;
+
+    /*!
+     * \brief Returns the wrapped layer
+     */
+    layer_t& get() {
+        return *impl;
+    }
+
+private:
+    std::unique_ptr<layer_t> impl; ///< The wrapped layer (the layers cannot be moved)
+
+    mutable etl::dyn_matrix<weight, 2> in;  ///< The inputs of the last forward pass
+    mutable etl::dyn_matrix<weight, 2> out; ///< The outputs of the last forward pass
+};
+
+template <typename L>
+layer_impl<L>::layer_impl(std::size_t visible, std::size_t hidden) : impl(std::make_unique<layer_t>()) {
+    impl->init_layer(visible, hidden);
+}
+
+template <typename L>
+std::size_t layer_impl<L>::input_size() const {
+    return impl->input_size();
+}
+
+template <typename L>
+std::size_t layer_impl<L>::output_size() const {
+    return impl->output_size();
+}
+
+template <typename L>
+std::string layer_impl<L>::to_short_string() const {
+    return impl->to_short_string();
+}
+
+template <typename L>
+void layer_impl<L>::forward(const float* input, float* output, std::size_t batch) const {
+    // The buffers are only reallocated when the size of the batch changes
+    if (etl::dim<0>(in) != batch) {
+        in  = etl::dyn_matrix<weight, 2>(batch, input_size());
+        out = etl::dyn_matrix<weight, 2>(batch, output_size());
+    }
+
+    std::copy(input, input + etl::size(in), in.memory_start());
+
+    impl->batch_activate_hidden(out, in);
+
+    std::copy(out.memory_start(), out.memory_end(), output);
+}
+
+template <typename L>
+bool layer_impl<L>::pretrainable() const {
+    return decay_layer_traits<layer_t>::is_rbm_layer();
+}
+
+template <typename L>
+double layer_impl<L>::pretrain(const std::vector<std::vector<float>>& samples, std::size_t epochs, const hyper_parameters& params) {
+    double error = 0.0;
+
+    cpp::static_if<decay_layer_traits<layer_t>::is_rbm_layer()>([&](auto f) {
+        auto& rbm = f(*impl);
+
+        rbm.learning_rate    = params.learning_rate;
+        rbm.initial_momentum = params.momentum;
+        rbm.final_momentum   = params.momentum;
+        rbm.l1_weight_cost   = params.l1_weight_cost;
+        rbm.l2_weight_cost   = params.l2_weight_cost;
+        rbm.batch_size       = params.batch_size;
+
+        std::vector<etl::dyn_vector<weight>> data;
+        data.reserve(samples.size());
+
+        for (auto& sample : samples) {
+            data.emplace_back(sample.size());
+            std::copy(sample.begin(), sample.end(), data.back().memory_start());
+        }
+
+        error = rbm.train(data, epochs);
+    });
+
+    return error;
+}
+
+template <typename L>
+void layer_impl<L>::store(std::ostream& os) const {
+    cpp::binary_write_all(os, impl->w);
+    cpp::binary_write_all(os, impl->b);
+
+    cpp::static_if<decay_layer_traits<layer_t>::is_rbm_layer()>([&](auto f) {
+        cpp::binary_write_all(os, f(*impl).c);
+    });
+}
+
+template <typename L>
+void layer_impl<L>::load(std::istream& is) {
+    cpp::binary_load_all(is, impl->w);
+    cpp::binary_load_all(is, impl->b);
+
+    cpp::static_if<decay_layer_traits<layer_t>::is_rbm_layer()>([&](auto f) {
+        cpp::binary_load_all(is, f(*impl).c);
+    });
+
+    clear_sparse_weights(*impl);
+}
+
+// The catalogue is compiled once in the dll_runtime library
+
+#ifndef DLL_RUNTIME_NO_EXTERN
+
+extern template struct layer_impl<dense_t<function::IDENTITY>>;
+extern template struct layer_impl<dense_t<function::SIGMOID>>;
+extern template struct layer_impl<dense_t<function::TANH>>;
+extern template struct layer_impl<dense_t<function::RELU>>;
+extern template struct layer_impl<dense_t<function::SOFTMAX>>;
+
+extern template struct layer_impl<rbm_t<unit_type::BINARY, unit_type::BINARY>>;
+extern template struct layer_impl<rbm_t<unit_type::BINARY, unit_type::RELU>>;
+extern template struct layer_impl<rbm_t<unit_type::BINARY, unit_type::SOFTMAX>>;
+extern template struct layer_impl<rbm_t<unit_type::GAUSSIAN, unit_type::BINARY>>;
+extern template struct layer_impl<rbm_t<unit_type::GAUSSIAN, unit_type::RELU>>;
+extern template struct layer_impl<rbm_t<unit_type::GAUSSIAN, unit_type::SOFTMAX>>;
+
+#endif
+
+} //end of namespace runtime
+
+} //end of namespace dll
@@ -12,9 +12,14 @@
 
 #ifdef DLL_SVM_SUPPORT
 
+#include <limits>
+
 #include "cpp_utils/io.hpp"
 #include "nice_svm.hpp"
 
+#include "util/timers.hpp"
+#include "util/scheduler.hpp"
+
 namespace dll {
 
 inline svm_parameter default_svm_parameters() {
@@ -86,21 +91,19 @@ void svm_load(DBN& dbn, std::istream& is) {
     }
 }
 
-template <typename DBN, typename Result, typename Sample, cpp_enable_if(dbn_traits<std::decay_t<DBN>>::concatenate())>
-void add_activation_probabilities(DBN& dbn, Result& result, Sample& sample) {
-    result.emplace_back(dbn_full_output_size(dbn));
-    dbn.smart_full_activation_probabilities(sample, result.back());
+template <typename DBN, cpp_enable_if(dbn_traits<std::decay_t<DBN>>::concatenate())>
+std::size_t svm_features(const DBN& dbn) {
+    return dbn_full_output_size(dbn);
 }
 
-template <typename DBN, typename Result, typename Sample, cpp_disable_if(dbn_traits<std::decay_t<DBN>>::concatenate())>
-void add_activation_probabilities(DBN& dbn, Result& result, Sample& sample) {
-    result.emplace_back(dbn_output_size(dbn));
-    dbn.activation_probabilities(sample, result.back());
+template <typename DBN, cpp_disable_if(dbn_traits<std::decay_t<DBN>>::concatenate())>
+std::size_t svm_features(const DBN& dbn) {
+    return dbn_output_size(dbn);
 }
 
 template <typename DBN, typename Sample, cpp_enable_if(dbn_traits<std::decay_t<DBN>>::concatenate())>
 etl::dyn_vector<typename DBN::weight> get_activation_probabilities(DBN& dbn, Sample& sample) {
-    return dbn.smart_full_activation_probabilities(sample);
+    return dbn.full_activation_probabilities(sample);
 }
 
 template <typename DBN, typename Sample, cpp_disable_if(dbn_traits<std::decay_t<DBN>>::concatenate())>
@@ -108,41 +111,244 @@ etl::dyn_vector<typename DBN::weight> get_activation_probabilities(DBN& dbn, Sam
     return dbn.activation_probabilities(sample);
 }
 
-template <typename DBN, typename Samples, typename Labels>
-void make_problem(DBN& dbn, const Samples& training_data, const Labels& labels, bool scale = false) {
-    using svm_samples_t = std::vector<etl::dyn_vector<typename DBN::weight>>;
-    svm_samples_t svm_samples;
+/*!
+ * \brief Write the given features into a libsvm node array.
+ *
+ * The array must be able to hold size(features) + 1 nodes, the
+ * last one being the -1 terminator.
+ *
+ * \param nodes The node array to fill
+ * \param features The features to write
+ */
+template <typename Features>
+void fill_svm_nodes(svm_node* nodes, const Features& features) {
+    const std::size_t n = etl::size(features);
+
+    for (std::size_t i = 0; i < n; ++i) {
+        nodes[i].index = i + 1;
+        nodes[i].value = features[i];
+    }
+
+    nodes[n].index = -1;
+}
+
+/*!
+ * \brief Scale each feature of the problem into [-1, 1]
+ *
+ * The minimum and maximum of each feature are first computed in parallel
+ * on blocks of samples and then reduced, the samples are then rescaled
+ * in parallel.
+ *
+ * \param pool The thread pool
+ * \param problem The problem to scale
+ * \param features The number of features of each sample
+ */
+template <typename Pool>
+void scale_svm_problem(Pool& pool, svm::problem& problem, std::size_t features) {
+    dll::auto_timer timer("dbn:svm:scale");
+
+    const std::size_t n      = problem.n_samples;
+    const std::size_t blocks = std::max(std::size_t(1), std::min(n, dll::threads()));
+
+    std::vector<std::vector<double>> mins(blocks, std::vector<double>(features, std::numeric_limits<double>::max()));
+    std::vector<std::vector<double>> maxs(blocks, std::vector<double>(features, std::numeric_limits<double>::lowest()));
+
+    parallel_foreach_n(pool, 0, blocks, [&problem, &mins, &maxs, features, n, blocks](std::size_t b) {
+        auto& min = mins[b];
+        auto& max = maxs[b];
+
+        for (std::size_t i = b * n / blocks; i < (b + 1) * n / blocks; ++i) {
+            auto* nodes = problem.sample(i);
+
+            for (std::size_t f = 0; f < features; ++f) {
+                min[f] = std::min(min[f], nodes[f].value);
+                max[f] = std::max(max[f], nodes[f].value);
+            }
+        }
+    });
+
+    auto& min = mins[0];
+    auto& max = maxs[0];
+
+    for (std::size_t b = 1; b < blocks; ++b) {
+        for (std::size_t f = 0; f < features; ++f) {
+            min[f] = std::min(min[f], mins[b][f]);
+            max[f] = std::max(max[f], maxs[b][f]);
+        }
+    }
+
+    parallel_foreach_n(pool, 0, n, [&problem, &min, &max, features](std::size_t i) {
+        auto* nodes = problem.sample(i);
+
+        for (std::size_t f = 0; f < features; ++f) {
+            if (max[f] != min[f]) {
+                nodes[f].value = -1.0 + 2.0 * (nodes[f].value - min[f]) / (max[f] - min[f]);
+            }
+        }
+    });
+}
+
+/*!
+ * \brief Allocate the node arrays of the problem
+ * \param problem The problem to fill (already sized)
+ * \param features The number of features per sample
+ */
+inline void allocate_svm_problem(svm::problem& problem, std::size_t features) {
+    for (std::size_t i = 0; i < problem.n_samples; ++i) {
+        problem.sample(i) = new svm_node[features + 1];
+    }
+}
+
+/*!
+ * \brief Fill the SVM problem with the features of the samples in [first, last).
+ *
+ * The node arrays are all allocated upfront and the features of each
+ * sample are extracted in parallel and written directly into them, no
+ * intermediate container of features is built.
+ *
+ * \param pool The thread pool to use for extraction
+ * \param problem The problem to fill (already sized)
+ * \param features The number of features per sample
+ * \param first Iterator to the first sample
+ * \param last Iterator to the past-the-end sample
+ * \param extract Functor returning the features of one sample
+ */
+template <typename Pool, typename Iterator, typename Extract>
+void fill_svm_problem(Pool& pool, svm::problem& problem, std::size_t features, Iterator first, Iterator last, Extract&& extract) {
+    allocate_svm_problem(problem, features);
+
+    parallel_foreach_i(pool, first, last, [&problem, &extract](auto& sample, std::size_t i) {
+        fill_svm_nodes(problem.sample(i), extract(sample));
+    });
+}
+
+/*!
+ * \brief Fill the SVM problem with the features of the samples in
+ * [first, last), extracted in batches.
+ *
+ * The samples are processed in blocks of the given size, the features of
+ * a whole block being extracted at once (by batched forward passes) before
+ * being written in parallel into the node arrays. Only the features of
+ * one block are kept in memory.
+ *
+ * \param pool The thread pool to use
+ * \param problem The problem to fill (already sized)
+ * \param features The number of features per sample
+ * \param first Iterator to the first sample (random access)
+ * \param last Iterator to the past-the-end sample
+ * \param block The number of samples extracted at once
+ * \param extract Functor returning the features of a range of samples
+ */
+template <typename Pool, typename Iterator, typename Extract>
+void fill_svm_problem_batch(Pool& pool, svm::problem& problem, std::size_t features, Iterator first, Iterator last, std::size_t block, Extract&& extract) {
+    allocate_svm_problem(problem, features);
+
+    const std::size_t n = std::distance(first, last);
+
+    for (std::size_t start = 0; start < n; start += block) {
+        const std::size_t end = std::min(n, start + block);
+
+        auto batch = extract(first + start, first + end);
+
+        parallel_foreach_n(pool, 0, end - start, [&problem, &batch, start](std::size_t i) {
+            fill_svm_nodes(problem.sample(start + i), batch[i]);
+        });
+    }
+}
+
+/*!
+ * \brief Size the SVM problem of the DBN and set its labels.
+ * \return false if there is not the same number of labels than samples,
+ * true otherwise
+ */
+template <typename DBN, typename LIterator>
+bool prepare_svm_problem(DBN& dbn, std::size_t n, LIterator lfirst, LIterator llast) {
+    if (static_cast<std::size_t>(std::distance(lfirst, llast)) != n) {
+        std::cerr << "dll: svm: There must be the same number of labels than samples" << std::endl;
+        return false;
+    }
+
+    dbn.problem = svm::problem(n);
+
+    for (std::size_t i = 0; lfirst != llast; ++lfirst, ++i) {
+        dbn.problem.label(i) = *lfirst;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Create the SVM problem of the DBN from the given samples and labels
+ * \return false if there is not the same number of labels than samples,
+ * true otherwise
+ */
+template <typename DBN, typename Pool, typename Iterator, typename LIterator, typename Extract>
+bool make_svm_problem(DBN& dbn, Pool& pool, Iterator first, Iterator last, LIterator lfirst, LIterator llast, bool scale, Extract&& extract) {
+    dll::auto_timer timer("dbn:svm:make_problem");
+
+    const std::size_t n        = std::distance(first, last);
+    const std::size_t features = svm_features(dbn);
+
+    if (!prepare_svm_problem(dbn, n, lfirst, llast)) {
+        return false;
+    }
+
+    fill_svm_problem(pool, dbn.problem, features, first, last, std::forward<Extract>(extract));
+
+    if (scale && n) {
+        scale_svm_problem(pool, dbn.problem, features);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Create the SVM problem of the DBN from the given samples and
+ * labels, the features being extracted in batches of samples
+ * \return false if there is not the same number of labels than samples,
+ * true otherwise
+ */
+template <typename DBN, typename Pool, typename Iterator, typename LIterator, typename Extract>
+bool make_svm_problem_batch(DBN& dbn, Pool& pool, Iterator first, Iterator last, LIterator lfirst, LIterator llast, bool scale, std::size_t block, Extract&& extract) {
+    dll::auto_timer timer("dbn:svm:make_problem:batch");
+
+    const std::size_t n        = std::distance(first, last);
+    const std::size_t features = svm_features(dbn);
 
-    //Get all the activation probabilities
-    for (auto& sample : training_data) {
-        add_activation_probabilities(dbn, svm_samples, sample);
+    if (!prepare_svm_problem(dbn, n, lfirst, llast)) {
+        return false;
     }
 
-    //static_cast ensure using the correct overload
-    dbn.problem = svm::make_problem(labels, static_cast<const svm_samples_t&>(svm_samples), scale);
+    fill_svm_problem_batch(pool, dbn.problem, features, first, last, block, std::forward<Extract>(extract));
+
+    if (scale && n) {
+        scale_svm_problem(pool, dbn.problem, features);
+    }
+
+    return true;
 }
 
 template <typename DBN, typename Iterator, typename LIterator>
-void make_problem(DBN& dbn, Iterator first, Iterator last, LIterator&& lfirst, LIterator&& llast, bool scale = false) {
-    std::vector<etl::dyn_vector<typename DBN::weight>> svm_samples;
+bool make_problem(DBN& dbn, Iterator first, Iterator last, LIterator&& lfirst, LIterator&& llast, bool scale = false) {
+    decltype(auto) pool = dll::shared_pool<!dbn_traits<DBN>::is_serial()>();
 
-    //Get all the activation probabilities
-    std::for_each(first, last, [&dbn, &svm_samples](auto& sample) {
-        add_activation_probabilities(dbn, svm_samples, sample);
+    return make_svm_problem(dbn, pool, first, last, lfirst, llast, scale, [&dbn](auto& sample) {
+        return get_activation_probabilities(dbn, sample);
     });
+}
 
-    //static_cast ensure using the correct overload
-    dbn.problem = svm::make_problem(
-        std::forward<LIterator>(lfirst), std::forward<LIterator>(llast),
-        svm_samples.begin(), svm_samples.end(),
-        scale);
+template <typename DBN, typename Samples, typename Labels>
+bool make_problem(DBN& dbn, const Samples& training_data, const Labels& labels, bool scale = false) {
+    return make_problem(dbn, training_data.begin(), training_data.end(), labels.begin(), labels.end(), scale);
 }
 
 template <typename DBN, typename Samples, typename Labels>
 bool svm_train(DBN& dbn, const Samples& training_data, const Labels& labels, const svm_parameter& parameters) {
     cpp::stop_watch<std::chrono::seconds> watch;
 
-    make_problem(dbn, training_data, labels, dbn_traits<DBN>::scale());
+    if (!make_problem(dbn, training_data, labels, dbn_traits<DBN>::scale())) {
+        return false;
+    }
 
     //Make libsvm quiet
     svm::make_quiet();
@@ -166,10 +372,12 @@ template <typename DBN, typename Iterator, typename LIterator>
 bool svm_train(DBN& dbn, Iterator&& first, Iterator&& last, LIterator&& lfirst, LIterator&& llast, const svm_parameter& parameters) {
     cpp::stop_watch<std::chrono::seconds> watch;
 
-    make_problem(dbn,
-                 std::forward<Iterator>(first), std::forward<Iterator>(last),
-                 std::forward<LIterator>(lfirst), std::forward<LIterator>(llast),
-                 dbn_traits<DBN>::scale());
+    if (!make_problem(dbn,
+                      std::forward<Iterator>(first), std::forward<Iterator>(last),
+                      std::forward<LIterator>(lfirst), std::forward<LIterator>(llast),
+                      dbn_traits<DBN>::scale())) {
+        return false;
+    }
 
     //Make libsvm quiet
     svm::make_quiet();
@@ -191,7 +399,9 @@ bool svm_train(DBN& dbn, Iterator&& first, Iterator&& last, LIterator&& lfirst,
 
 template <typename DBN, typename Samples, typename Labels>
 bool svm_grid_search(DBN& dbn, const Samples& training_data, const Labels& labels, std::size_t n_fold = 5, const svm::rbf_grid& g = svm::rbf_grid()) {
-    make_problem(dbn, training_data, labels, dbn_traits<DBN>::scale());
+    if (!make_problem(dbn, training_data, labels, dbn_traits<DBN>::scale())) {
+        return false;
+    }
 
     //Make libsvm quiet
     svm::make_quiet();
@@ -211,10 +421,12 @@ bool svm_grid_search(DBN& dbn, const Samples& training_data, const Labels& label
 
 template <typename DBN, typename Iterator, typename LIterator>
 bool svm_grid_search(DBN& dbn, Iterator&& first, Iterator&& last, LIterator&& lfirst, LIterator&& llast, std::size_t n_fold = 5, const svm::rbf_grid& g = svm::rbf_grid()) {
-    make_problem(dbn,
-                 std::forward<Iterator>(first), std::forward<Iterator>(last),
-                 std::forward<LIterator>(lfirst), std::forward<LIterator>(llast),
-                 dbn_traits<DBN>::scale());
+    if (!make_problem(dbn,
+                      std::forward<Iterator>(first), std::forward<Iterator>(last),
+                      std::forward<LIterator>(lfirst), std::forward<LIterator>(llast),
+                      dbn_traits<DBN>::scale())) {
+        return false;
+    }
 
     //Make libsvm quiet
     svm::make_quiet();
@@ -238,6 +450,19 @@ double svm_predict(DBN& dbn, const Sample& sample) {
     return svm::predict(dbn.svm_model, features);
 }
 
+/*!
+ * \brief Predict the classes of all the samples in [first, last).
+ *
+ * The features are extracted in batches when the network supports it
+ * (see dbn::svm_predict) and classified in parallel.
+ *
+ * \return A vector with the predicted class of each sample
+ */
+template <typename DBN, typename Iterator>
+std::vector<double> svm_predict(DBN& dbn, Iterator first, Iterator last) {
+    return dbn.svm_predict(first, last);
+}
+
 } // end of namespace dll
 
 #endif //DLL_SVM_SUPPORT
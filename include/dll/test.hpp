@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "cpp_utils/stop_watch.hpp"
 
 namespace dll {
@@ -41,6 +43,11 @@ struct label_predictor {
     std::size_t operator()(T& dbn, V& image) {
         return dbn->predict_labels(image, 10);
     }
+
+    template <typename T, typename Iterator>
+    std::vector<std::size_t> batch(T& dbn, Iterator first, Iterator last) {
+        return dbn->predict_labels(first, last, 10);
+    }
 };
 
 struct deep_label_predictor {
@@ -55,8 +62,31 @@ double test_set(DBN& dbn, const Samples& images, const Labels& labels, Functor&&
     return test_set(dbn, images.begin(), images.end(), labels.begin(), labels.end(), std::forward<Functor>(f));
 }
 
+namespace test_detail {
+
+/*!
+ * \brief Test the samples with a predictor able to predict a whole set at
+ * once
+ */
 template <typename DBN, typename Functor, typename Iterator, typename LIterator>
-double test_set(DBN& dbn, Iterator first, Iterator last, LIterator lfirst, LIterator /*llast*/, Functor&& f) {
+auto test_set(DBN& dbn, Iterator first, Iterator last, LIterator lfirst, Functor& f, int /*prefer*/) -> decltype(f.batch(dbn, first, last), double()) {
+    auto predictions = f.batch(dbn, first, last);
+
+    std::size_t success = 0;
+
+    for (auto predicted : predictions) {
+        if (predicted == *lfirst) {
+            ++success;
+        }
+
+        ++lfirst;
+    }
+
+    return (predictions.size() - success) / static_cast<double>(predictions.size());
+}
+
+template <typename DBN, typename Functor, typename Iterator, typename LIterator>
+double test_set(DBN& dbn, Iterator first, Iterator last, LIterator lfirst, Functor& f, long /*prefer*/) {
     std::size_t success = 0;
     std::size_t images  = 0;
 
@@ -78,6 +108,13 @@ double test_set(DBN& dbn, Iterator first, Iterator last, LIterator lfirst, LIter
     return (images - success) / static_cast<double>(images);
 }
 
+} //end of namespace test_detail
+
+template <typename DBN, typename Functor, typename Iterator, typename LIterator>
+double test_set(DBN& dbn, Iterator first, Iterator last, LIterator lfirst, LIterator /*llast*/, Functor&& f) {
+    return test_detail::test_set(dbn, first, last, lfirst, f, 0);
+}
+
 template <typename DBN, typename Samples>
 double test_set_ae(DBN& dbn, const Samples& images) {
     return test_set_ae(dbn, images.begin(), images.end());
@@ -16,7 +16,12 @@
 #include <iostream>
 #include <vector>
 #include <cstdint>
+#include <cstdlib>
 #include <memory>
+#include <string>
+#include <sstream>
+#include <utility>
+#include <algorithm>
 
 #include <dirent.h>
 
@@ -26,6 +31,59 @@
 namespace dll {
 namespace text {
 
+/*!
+ * \brief Returns the id of the given image file, 0 if this is not an image file
+ */
+inline int image_id(const std::string& file_name){
+    if (file_name.size() <= 3 || file_name.find(".dat") != file_name.size() - 4) {
+        return 0;
+    }
+
+    return std::atoi(std::string(file_name.begin(), file_name.begin() + file_name.size() - 4).c_str());
+}
+
+/*!
+ * \brief Read one image file
+ * \param full_path The path to the image file
+ * \param func The functor creating an image of the given dimensions (c, h, w)
+ * \return The image
+ */
+template<typename Image, typename Functor>
+Image read_image(const std::string& full_path, Functor func){
+    std::vector<double> temp;
+
+    std::ifstream file(full_path);
+
+    std::size_t lines = 0;
+    std::size_t columns = 0;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream ss(line);
+        std::string value;
+
+        while (std::getline(ss, value, ';')) {
+            auto v = std::atof(value.c_str());
+            temp.push_back(v);
+
+            if(lines == 0){
+                ++columns;
+            }
+        }
+
+        ++lines;
+    }
+
+    Image image = func(1, lines, columns);
+
+    std::size_t i = 0;
+    for (auto& value : temp) {
+        image[i++] = static_cast<typename Image::value_type>(value);
+    }
+
+    return image;
+}
+
 template<template<typename...> class Container = std::vector, typename Image, typename Functor>
 void read_images(Container<Image>& images, const std::string& path, std::size_t limit, Functor func){
     struct dirent* entry;
@@ -34,51 +92,58 @@ void read_images(Container<Image>& images, const std::string& path, std::size_t
     while ((entry = readdir(dir))) {
         std::string file_name(entry->d_name);
 
-        if (file_name.size() <= 3 || file_name.find(".dat") != file_name.size() - 4) {
+        int id = image_id(file_name);
+
+        if (!id) {
             continue;
         }
 
-        int id = std::atoi(std::string(file_name.begin(), file_name.begin() + file_name.size() - 4).c_str());
-
         if(!limit || id - 1 < (int) limit){
-            std::vector<double> temp;
+            if((int) images.size() < id){
+                images.resize(id);
+            }
 
-            std::string full_path(path + "/" + file_name);
+            images[id - 1] = read_image<Image>(path + "/" + file_name, func);
+        }
+    }
+}
 
-            std::ifstream file(full_path);
+/*!
+ * \brief Returns the paths of the image files of the given folder, ordered
+ * by id.
+ */
+inline std::vector<std::string> list_images(const std::string& path, std::size_t limit){
+    std::vector<std::pair<int, std::string>> files;
 
-            std::size_t lines = 0;
-            std::size_t columns = 0;
+    struct dirent* entry;
+    auto dir = opendir(path.c_str());
 
-            std::string line;
-            while (std::getline(file, line)) {
-                std::istringstream ss(line);
-                std::string value;
+    if (!dir) {
+        return {};
+    }
 
-                while (std::getline(ss, value, ';')) {
-                    auto v = std::atof(value.c_str());
-                    temp.push_back(v);
+    while ((entry = readdir(dir))) {
+        std::string file_name(entry->d_name);
 
-                    if(lines == 0){
-                        ++columns;
-                    }
-                }
+        int id = image_id(file_name);
 
-                ++lines;
-            }
+        if (id && (!limit || id - 1 < (int) limit)) {
+            files.emplace_back(id, path + "/" + file_name);
+        }
+    }
 
-            if((int) images.size() < id){
-                images.resize(id);
-            }
+    closedir(dir);
 
-            images[id - 1] = func(1, lines, columns);
+    std::sort(files.begin(), files.end());
 
-            std::size_t i = 0;
-            for (auto& value : temp) {
-                images[id - 1][i++] = static_cast<typename Image::value_type>(value);
-            }
-        }
+    std::vector<std::string> paths;
+    paths.reserve(files.size());
+
+    for (auto& file : files) {
+        paths.push_back(std::move(file.second));
     }
+
+    return paths;
 }
 
 template<template<typename...> class  Container = std::vector, typename Label = uint8_t>
@@ -127,6 +192,21 @@ void read_images_direct(Container<Image>& images, const std::string& path, std::
     read_images<Container, Image>(images, path, limit, [](std::size_t c, std::size_t h, std::size_t w){ return Image(c * h * w);});
 }
 
+template<bool Three, typename Image, cpp_enable_if(etl::all_fast<Image>::value)>
+Image read_image_direct(const std::string& full_path){
+    return read_image<Image>(full_path, [](std::size_t /*c*/, std::size_t /*h*/, std::size_t /*w*/){ return Image();});
+}
+
+template<bool Three, typename Image, cpp_enable_if(Three && !etl::all_fast<Image>::value)>
+Image read_image_direct(const std::string& full_path){
+    return read_image<Image>(full_path, [](std::size_t c, std::size_t h, std::size_t w){ return Image(c, h, w);});
+}
+
+template<bool Three, typename Image, cpp_enable_if(!Three && !etl::all_fast<Image>::value)>
+Image read_image_direct(const std::string& full_path){
+    return read_image<Image>(full_path, [](std::size_t c, std::size_t h, std::size_t w){ return Image(c * h * w);});
+}
+
 template<template<typename...> class Container, typename Image, bool Three>
 Container<Image> read_images(const std::string& path, std::size_t limit){
     Container<Image> images;
@@ -12,6 +12,9 @@
 
 #pragma once
 
+#include "dll/util/tmp.hpp"
+#include "dll/dbn_traits.hpp"
+
 namespace dll {
 
 /*!
@@ -22,6 +25,22 @@ namespace dll {
 template <typename DBN, typename Layer, typename Enable = void>
 struct sgd_context;
 
+/*!
+ * \brief The type of a momentum buffer of a SGD context. The buffer has no
+ * storage when the DBN is not trained with momentum.
+ */
+template <typename DBN, typename W, std::size_t... Dims>
+using sgd_momentum_matrix_t = conditional_fast_matrix_t<dbn_traits<DBN>::has_momentum(), W, Dims...>;
+
+/*!
+ * \brief Returns the first dimension of a momentum buffer of a dynamic SGD
+ * context, zero when the DBN is not trained with momentum.
+ */
+template <typename DBN>
+constexpr std::size_t sgd_momentum_dim(std::size_t n) {
+    return dbn_traits<DBN>::has_momentum() ? n : 0;
+}
+
 /*!
  * \brief The context of a RBM during CG training
  * \tparam RBM The RBM.
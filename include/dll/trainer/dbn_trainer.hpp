@@ -7,14 +7,15 @@
 
 #pragma once
 
-#include "cpp_utils/algorithm.hpp" // For parallel_shuffle
-
 #include "etl/etl.hpp"
 
 #include "dll/util/labels.hpp"
 #include "dll/util/timers.hpp"
 #include "dll/util/random.hpp"
+#include "dll/util/permutation.hpp"
+#include "dll/util/numa.hpp"
 #include "dll/util/batch.hpp" // For make_batch
+#include "dll/util/distributed.hpp" // For average_epoch
 #include "dll/test.hpp"
 #include "dll/dbn_traits.hpp"
 
@@ -127,6 +128,39 @@ struct dbn_trainer {
         return train_impl(dbn, true, first, last, first, last, max_epochs, error_function, input_transformer, label_transformer);
     }
 
+    /*!
+     * \brief Fine-tune the network on data held by the caller.
+     *
+     * The data is used directly through views, it is never copied. The
+     * samples can be flat (2D data) or kept in their original shape (4D
+     * data for convolutional networks).
+     *
+     * \param dbn The network to train
+     * \param data The samples, the first dimension being the samples
+     * \param labels The labels, either one-hot rows or class indices
+     * \param max_epochs The maximum number of epochs
+     * \return The final error
+     */
+    template <typename Data, typename Labels>
+    error_type train_direct(DBN& dbn, const Data& data, const Labels& labels, size_t max_epochs) {
+        dll::auto_timer timer("dbn::trainer::train_direct");
+
+        cpp_assert(etl::dim<0>(data) == etl::dim<0>(labels), "There must be as many labels as samples");
+
+        auto input_transformer = [](const auto& /*value*/){
+            // NOP
+        };
+
+        // Initialization steps
+        start_training(dbn, false, max_epochs);
+
+        // Train the model
+        train_fast_full_direct(dbn, false, data, labels, max_epochs, input_transformer);
+
+        // Finalization
+        return stop_training(dbn);
+    }
+
     /*!
      * \brief Initialize the training
      * \param dbn The network to train
@@ -157,12 +191,30 @@ struct dbn_trainer {
      * \param dbn The network that was trained
      */
     error_type stop_training(dbn_t& dbn){
+        report_checkpoint(dbn, *trainer, 0);
 
         watcher.fine_tuning_end(dbn);
 
         return error;
     }
 
+    /*!
+     * \brief Report the memory freed by gradient checkpointing to the
+     * watcher, if the trainer supports checkpointing
+     */
+    template <typename T>
+    auto report_checkpoint(dbn_t& dbn, T& t, int /*overload*/) -> decltype(t.checkpoint_saved, void()) {
+        if (dbn_traits<dbn_t>::checkpoint()) {
+            watcher.ft_checkpoint(dbn, t.checkpoint_saved);
+        }
+    }
+
+    /*!
+     * \copydoc report_checkpoint
+     */
+    template <typename T>
+    void report_checkpoint(dbn_t& /*dbn*/, T& /*t*/, long /*overload*/) {}
+
     /*!
      * \brief Start a new epoch
      * \param dbn The network that is trained
@@ -220,6 +272,9 @@ struct dbn_trainer {
      * \return true if the training is over
      */
     bool stop_epoch(dbn_t& dbn, size_t epoch, double new_error, double loss){
+        // All the replicas must take the same decisions
+        dll::average_epoch(new_error, loss);
+
         auto last_error = new_error;
 
         error = new_error;
@@ -291,13 +346,42 @@ private:
         return stop_training(dbn);
     }
 
-    template<typename Iterator>
+    /*!
+     * \brief Traits to get the number of dimensions of a sample, non-ETL
+     * samples being considered flat.
+     */
+    template <typename T, typename Enable = void>
+    struct sample_dimensions : std::integral_constant<size_t, 1> {};
+
+    template <typename T>
+    struct sample_dimensions<T, std::enable_if_t<etl::is_etl_expr<T>::value>> : std::integral_constant<size_t, etl::decay_traits<T>::dimensions()> {};
+
+    template <typename Iterator>
+    using iterator_sample_dimensions = sample_dimensions<std::decay_t<typename std::iterator_traits<Iterator>::value_type>>;
+
+    template<typename Iterator, cpp_disable_if(iterator_sample_dimensions<Iterator>::value == 3)>
     etl::dyn_matrix<weight, 2> prepare_data(dbn_t& dbn, Iterator first, size_t n){
         decltype(auto) input_layer  = dbn.template layer_get<dbn_t::input_layer_n>();
 
-        // TODO Create correctly the type for conv
         etl::dyn_matrix<weight, 2> data(n, input_layer.input_size());
 
+        first_touch(dll::shared_pool<!dbn_traits<dbn_t>::is_serial()>(), data);
+
+        for(size_t l = 0; l < n; ++l){
+            data(l) = *first++;
+        }
+
+        return data;
+    }
+
+    template<typename Iterator, cpp_enable_if(iterator_sample_dimensions<Iterator>::value == 3)>
+    etl::dyn_matrix<weight, 4> prepare_data(dbn_t& /*dbn*/, Iterator first, size_t n){
+        // The shape of the samples is kept for convolutional networks
+
+        etl::dyn_matrix<weight, 4> data(n, etl::dim<0>(*first), etl::dim<1>(*first), etl::dim<2>(*first));
+
+        first_touch(dll::shared_pool<!dbn_traits<dbn_t>::is_serial()>(), data);
+
         for(size_t l = 0; l < n; ++l){
             data(l) = *first++;
         }
@@ -325,29 +409,43 @@ private:
         // The number of elements on which to train
         const size_t n = std::distance(first, last);
 
-        //Compute the number of batches
-        constexpr const auto batch_size = std::decay_t<DBN>::batch_size;
-        const auto batches = n / batch_size + (n % batch_size == 0 ? 0 : 1);
-
         // Prepare the data
 
         auto data   = prepare_data(dbn, first, n);
         auto labels = prepare_labels(dbn, lfirst, n, label_transformer);
 
+        train_fast_full_direct(dbn, ae, data, labels, max_epochs, input_transformer);
+    }
+
+    template <typename Data, typename Labels, typename InputTransformer>
+    void train_fast_full_direct(DBN& dbn, bool ae, const Data& data, const Labels& labels, size_t max_epochs, InputTransformer input_transformer) {
+        // The number of elements on which to train
+        const size_t n = etl::dim<0>(data);
+
+        //Compute the number of batches
+        constexpr const auto batch_size = std::decay_t<DBN>::batch_size;
+        const auto batches = n / batch_size + (n % batch_size == 0 ? 0 : 1);
+
+        // The order in which the samples are visited
+        permutation order(dbn_traits<dbn_t>::shuffle() ? n : 0);
+
         //Train for max_epochs epoch
         for (size_t epoch = 0; epoch < max_epochs; ++epoch) {
             dll::auto_timer timer("dbn::trainer::train_impl::epoch");
 
             start_epoch(dbn, epoch);
 
-            // Shuffle before the epoch if necessary
-            if(dbn_traits<dbn_t>::shuffle()){
-                etl::parallel_shuffle(data, labels);
-            }
-
             double new_error;
             double loss;
-            std::tie(loss, new_error) = train_fast_partial_direct(dbn, ae, data, labels, batches, epoch, input_transformer);
+
+            // Shuffle the order of the samples before the epoch if necessary
+            if(dbn_traits<dbn_t>::shuffle()){
+                order.shuffle();
+
+                std::tie(loss, new_error) = train_fast_partial_shuffled(dbn, ae, data, labels, order, batches, epoch, input_transformer);
+            } else {
+                std::tie(loss, new_error) = train_fast_partial_direct(dbn, ae, data, labels, batches, epoch, input_transformer);
+            }
 
             if(stop_epoch(dbn, epoch, new_error, loss)){
                 break;
@@ -356,7 +454,7 @@ private:
     }
 
     template<typename Data, typename Labels, typename Transformer>
-    std::pair<double, double> train_fast_partial_direct(dbn_t& dbn, bool ae, Data& data, Labels& labels, size_t batches, size_t epoch, Transformer input_transformer){
+    std::pair<double, double> train_fast_partial_direct(dbn_t& dbn, bool ae, const Data& data, const Labels& labels, size_t batches, size_t epoch, Transformer input_transformer){
         constexpr const auto batch_size = std::decay_t<DBN>::batch_size;
 
         const size_t n = etl::dim<0>(data);
@@ -400,6 +498,67 @@ private:
         return {loss, new_error};
     }
 
+    /*!
+     * \brief Train one epoch on the data, visiting the samples in the
+     * given order.
+     *
+     * The samples of each mini-batch are gathered into batch buffers,
+     * the data and labels themselves are never moved.
+     */
+    template<typename Data, typename Labels, typename Transformer>
+    std::pair<double, double> train_fast_partial_shuffled(dbn_t& dbn, bool ae, const Data& data, const Labels& labels, const permutation& order, size_t batches, size_t epoch, Transformer input_transformer){
+        constexpr const auto batch_size = std::decay_t<DBN>::batch_size;
+
+        const size_t n = etl::dim<0>(data);
+
+        auto data_batch   = batch_buffer(data, batch_size);
+        auto labels_batch = batch_buffer(labels, batch_size);
+
+        double loss = 0;
+
+        //Train one mini-batch at a time
+        for (size_t i = 0; i < batches; ++i) {
+            dll::auto_timer timer("dbn::trainer::train_impl::epoch::batch");
+
+            const auto start = i * batch_size;
+            const auto end   = std::min(start + batch_size, n);
+
+            //Gather the samples of the batch
+            for (size_t j = start; j < end; ++j) {
+                data_batch(j - start)   = data(order[j]);
+                labels_batch(j - start) = labels(order[j]);
+            }
+
+            double batch_error;
+            double batch_loss;
+            std::tie(batch_error, batch_loss) = trainer->train_batch(
+                epoch,
+                slice(data_batch, 0, end - start),
+                slice(labels_batch, 0, end - start),
+                input_transformer);
+
+            if(dbn_traits<dbn_t>::is_verbose()){
+                auto full_batch_error = batch_error_function(dbn, ae, data, labels);
+                watcher.ft_batch_end(epoch, i, batches, batch_error, batch_loss, full_batch_error, dbn);
+            }
+
+            loss += batch_loss;
+        }
+
+        loss /= batches;
+
+        // Compute the error at this epoch
+        double new_error;
+
+        {
+            dll::auto_timer timer("dbn::trainer::train_impl::epoch::error");
+
+            new_error = batch_error_function(dbn, ae, data, labels);
+        }
+
+        return {loss, new_error};
+    }
+
     template <typename Iterator, typename LIterator, typename Error, typename InputTransformer, typename LabelTransformer>
     void train_batch_full(DBN& dbn, Iterator first, Iterator last, LIterator lfirst, size_t max_epochs, Error error_function, InputTransformer input_transformer, LabelTransformer label_transformer) {
 
@@ -484,6 +643,11 @@ private:
             error = error_function();
             loss /= n;
 
+            // All the replicas must take the same decisions
+            double epoch_error = error;
+            dll::average_epoch(epoch_error, loss);
+            error = epoch_error;
+
             //After some time increase the momentum
             if (dbn_traits<dbn_t>::has_momentum() && epoch == dbn.final_momentum_epoch) {
                 dbn.momentum = dbn.final_momentum;
@@ -498,6 +662,63 @@ private:
         }
     }
 
+    /*!
+     * \brief Create a buffer for a batch of b elements of the given
+     * data, keeping the shape of the elements.
+     */
+    template <typename E, cpp_enable_if(etl::decay_traits<E>::dimensions() == 1)>
+    static etl::dyn_matrix<weight, 1> batch_buffer(const E& /*data*/, size_t b) {
+        return etl::dyn_matrix<weight, 1>(b);
+    }
+
+    /*!
+     * \copydoc batch_buffer
+     */
+    template <typename E, cpp_enable_if(etl::decay_traits<E>::dimensions() == 2)>
+    static etl::dyn_matrix<weight, 2> batch_buffer(const E& data, size_t b) {
+        return etl::dyn_matrix<weight, 2>(b, etl::dim<1>(data));
+    }
+
+    /*!
+     * \copydoc batch_buffer
+     */
+    template <typename E, cpp_enable_if(etl::decay_traits<E>::dimensions() == 4)>
+    static etl::dyn_matrix<weight, 4> batch_buffer(const E& data, size_t b) {
+        return etl::dyn_matrix<weight, 4>(b, etl::dim<1>(data), etl::dim<2>(data), etl::dim<3>(data));
+    }
+
+    /*!
+     * \brief Compute the error of the network on one sample with class
+     * indices as labels.
+     */
+    template <typename Output, typename Labels, cpp_enable_if(etl::decay_traits<Labels>::dimensions() == 1)>
+    static double sample_error(bool /*ae*/, const Output& output, const Labels& labels, size_t i) {
+        size_t max_k = 0;
+
+        for (size_t k = 1; k < etl::size(output); ++k) {
+            if (output[k] > output[max_k]) {
+                max_k = k;
+            }
+        }
+
+        return max_k == size_t(labels(i)) ? 0.0 : 1.0;
+    }
+
+    /*!
+     * \brief Compute the error of the network on one sample
+     */
+    template <typename Output, typename Labels, cpp_disable_if(etl::decay_traits<Labels>::dimensions() == 1)>
+    static double sample_error(bool ae, const Output& output, const Labels& labels, size_t i) {
+        if (ae) {
+            return amean(labels(i) - output);
+        } else {
+            // TODO Review this calculation
+            // The result is correct, but can probably be done in a more clean way
+
+            return std::min(1.0, (double) asum(labels(i) - one_if_max(output)));
+        }
+    }
+
     /*!
      * \brief Compute the error on a set of data using batch
      * activation of the network.
@@ -522,17 +743,8 @@ private:
 
             decltype(auto) output = dbn.forward_batch(slice(data, start, end));
 
-            if(ae){
-                for(size_t b = 0; b < end - start; ++b){
-                    error += amean(labels(start + b) - output(b));
-                }
-            } else {
-                // TODO Review this calculation
-                // The result is correct, but can probably be done in a more clean way
-
-                for(size_t b = 0; b < end - start; ++b){
-                    error += std::min(1.0, (double) asum(labels(start + b) - one_if_max(output(b))));
-                }
+            for(size_t b = 0; b < end - start; ++b){
+                error += sample_error(ae, output(b), labels, start + b);
             }
         }
 
@@ -544,14 +756,7 @@ private:
             for(size_t i = start; i < end; ++i){
                 decltype(auto) output = dbn.forward(data(i));
 
-                if(ae){
-                    error += amean(labels(i) - output);
-                } else {
-                    // TODO Review this calculation
-                    // The result is correct, but can probably be done in a more clean way
-
-                    error += std::min(1.0, (double) asum(labels(i) - one_if_max(output)));
-                }
+                error += sample_error(ae, output, labels, i);
             }
         }
 
@@ -0,0 +1,245 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*!
+ * \file multi_rbm_trainer.hpp
+ * \brief Trainer for several RBMs sharing the same input, in a single data
+ * pass.
+ */
+
+#pragma once
+
+#include <array>
+#include <tuple>
+#include <vector>
+
+#include "cpp_utils/assert.hpp"
+#include "cpp_utils/static_if.hpp"
+
+#include "dll/util/permutation.hpp"
+#include "dll/util/scheduler.hpp"
+#include "dll/util/timers.hpp"
+#include "dll/trainer/rbm_trainer.hpp"
+
+namespace dll {
+
+/*!
+ * \brief Train several RBMs on the same data at once.
+ *
+ * The RBMs can have different configurations (hidden units, learning rate,
+ * sparsity, CD-k, ...), but must have the same number of visible units and
+ * the same batch size. The data is visited once per epoch, each mini-batch
+ * being given to the trainers of all the RBMs while it is still hot in the
+ * cache. The RBMs that are shuffled all see the samples in the same
+ * shuffled order, the others see them in their original order.
+ */
+template <typename... RBMs>
+struct multi_rbm_trainer {
+    static constexpr const std::size_t models = sizeof...(RBMs); ///< The number of models to train
+
+    using error_type = double;
+
+    std::tuple<RBMs&...> rbms;                           ///< The models to train
+    std::tuple<rbm_trainer<RBMs, true, void, false>...> trainers; ///< The trainer of each model
+
+    bool parallel = true; ///< Indicates if the models can be trained concurrently on each mini-batch
+
+    /*!
+     * \brief Create a trainer for the given models
+     */
+    explicit multi_rbm_trainer(RBMs&... rbms)
+            : rbms(rbms...) {}
+
+    /*!
+     * \brief Train all the models on the given data
+     * \param training_data The container of the samples
+     * \param max_epochs The maximum number of epochs
+     * \return The final reconstruction error of each model
+     */
+    template <typename Samples>
+    std::array<error_type, models> train(const Samples& training_data, std::size_t max_epochs) {
+        return train(training_data.begin(), training_data.end(), max_epochs);
+    }
+
+    /*!
+     * \brief Train all the models on the given range of samples
+     * \param first Iterator to the first sample
+     * \param last Iterator past the last sample
+     * \param max_epochs The maximum number of epochs
+     * \return The final reconstruction error of each model
+     */
+    template <typename Iterator>
+    std::array<error_type, models> train(Iterator first, Iterator last, std::size_t max_epochs) {
+        dll::auto_timer timer("multi_rbm_trainer:train");
+
+        // The data is copied only once, if it cannot be accessed randomly
+
+        std::vector<typename std::iterator_traits<Iterator>::value_type> input_copy;
+
+        return train_impl(prepare(first, last, input_copy), max_epochs, std::make_index_sequence<models>());
+    }
+
+private:
+    /*!
+     * \brief Indicates if one of the models needs shuffled data
+     */
+    static constexpr bool shuffle() {
+        bool values[] = {rbm_layer_traits<RBMs>::has_shuffle()...};
+
+        for (auto value : values) {
+            if (value) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    template <typename Iterator, typename Vector, cpp_enable_if_cst(shuffle() && !is_random_access_iterator<Iterator>::value)>
+    static auto prepare(Iterator first, Iterator last, Vector& copy) {
+        std::copy(first, last, std::back_inserter(copy));
+        return std::make_pair(copy.begin(), copy.end());
+    }
+
+    template <typename Iterator, typename Vector, cpp_disable_if_cst(shuffle() && !is_random_access_iterator<Iterator>::value)>
+    static auto prepare(Iterator first, Iterator last, Vector& /*copy*/) {
+        return std::make_pair(first, last);
+    }
+
+    template <typename Range, std::size_t... I>
+    std::array<error_type, models> train_impl(Range range, std::size_t max_epochs, std::index_sequence<I...> /*s*/) {
+        auto first = range.first;
+        auto last  = range.second;
+
+        // Initialize the models and their trainers
+
+        int wormhole[] = {(init<I>(first, last), 0)...};
+        cpp_unused(wormhole);
+
+        const std::size_t batch_size = std::get<0>(trainers).batch_size;
+
+        for (auto b : {std::get<I>(trainers).batch_size...}) {
+            cpp_assert(b == batch_size, "All the models must have the same batch size");
+            cpp_unused(b);
+        }
+
+        auto cd_trainers = std::make_tuple(std::get<I>(trainers).get_trainer(std::get<I>(rbms))...);
+
+        //The order in which the samples are visited
+        permutation order(shuffle() ? std::distance(first, last) : 0);
+
+        //Train for max_epochs epoch
+        for (std::size_t epoch = 0; epoch < max_epochs; ++epoch) {
+            if (shuffle()) {
+                order.shuffle();
+            }
+
+            //Create a new context for each model for this epoch
+            std::array<rbm_training_context, models> contexts;
+
+            int wormhole_epoch[] = {(std::get<I>(trainers).init_epoch(), 0)...};
+            cpp_unused(wormhole_epoch);
+
+            train_epoch(first, last, order, batch_size, cd_trainers, contexts, std::index_sequence<I...>());
+
+            int wormhole_finalize[] = {(std::get<I>(trainers).finalize_epoch(epoch, contexts[I], std::get<I>(rbms)), 0)...};
+            cpp_unused(wormhole_finalize);
+        }
+
+        return {{static_cast<error_type>(std::get<I>(trainers).finalize_training(std::get<I>(rbms)))...}};
+    }
+
+    template <std::size_t I, typename Iterator>
+    void init(Iterator first, Iterator last) {
+        auto& rbm     = std::get<I>(rbms);
+        auto& trainer = std::get<I>(trainers);
+
+        trainer.init_training(rbm, first, last);
+        trainer.init_weights(rbm, first, last);
+    }
+
+    template <typename Iterator, typename Trainers, std::size_t... I, cpp_enable_if_cst(sizeof(Iterator) && shuffle())>
+    void train_epoch(Iterator first, Iterator last, const permutation& order, std::size_t batch_size, Trainers& cd_trainers, std::array<rbm_training_context, models>& contexts, std::index_sequence<I...> s) {
+        train_pass(first, last, permuted_begin(first, order), batch_size, cd_trainers, contexts, s);
+    }
+
+    template <typename Iterator, typename Trainers, std::size_t... I, cpp_disable_if_cst(sizeof(Iterator) && shuffle())>
+    void train_epoch(Iterator first, Iterator last, const permutation& /*order*/, std::size_t batch_size, Trainers& cd_trainers, std::array<rbm_training_context, models>& contexts, std::index_sequence<I...> s) {
+        train_pass(first, last, first, batch_size, cd_trainers, contexts, s);
+    }
+
+    /*!
+     * \brief Visit the data once, giving each mini-batch to all the models.
+     *
+     * The sequential and the permuted ranges are walked together, each
+     * model taking its batch from the range matching its own shuffle
+     * setting. When there are fewer models than threads, the models are
+     * trained one after another so that ETL can use all the threads for
+     * each of them. The watchers are always notified from this thread.
+     */
+    template <typename Iterator, typename PIterator, typename Trainers, std::size_t... I>
+    void train_pass(Iterator first, Iterator last, PIterator pfirst, std::size_t batch_size, Trainers& cd_trainers, std::array<rbm_training_context, models>& contexts, std::index_sequence<I...> /*s*/) {
+        auto it  = first;
+        auto pit = pfirst;
+
+        while (it != last) {
+            auto start  = it;
+            auto pstart = pit;
+
+            std::size_t n = 0;
+            while (it != last && n < batch_size) {
+                ++it;
+                ++pit;
+                ++n;
+            }
+
+            auto end  = it;
+            auto pend = pit;
+
+            auto train_model = [&](std::size_t m) {
+                int wormhole[] = {(m == I ? (train_batch<I>(start, end, pstart, pend, n, cd_trainers, contexts), 0) : 0)...};
+                cpp_unused(wormhole);
+            };
+
+            if (parallel && models >= dll::threads()) {
+                parallel_foreach_n(dll::shared_pool<true>(), 0, models, train_model);
+            } else {
+                for (std::size_t m = 0; m < models; ++m) {
+                    train_model(m);
+                }
+            }
+
+            int wormhole_notify[] = {(std::get<I>(trainers).notify_batch(contexts[I], std::get<I>(rbms)), 0)...};
+            cpp_unused(wormhole_notify);
+        }
+    }
+
+    template <std::size_t I, typename Iterator, typename PIterator, typename Trainers>
+    void train_batch(Iterator first, Iterator last, PIterator pfirst, PIterator plast, std::size_t n, Trainers& cd_trainers, std::array<rbm_training_context, models>& contexts) {
+        using rbm_t = std::tuple_element_t<I, std::tuple<RBMs...>>;
+
+        auto& trainer = std::get<I>(trainers);
+
+        trainer.samples += n;
+
+        cpp::static_if<rbm_layer_traits<rbm_t>::has_shuffle()>([&](auto f) {
+            f(trainer).update_batch(pfirst, plast, pfirst, plast, std::get<I>(cd_trainers), contexts[I], std::get<I>(rbms));
+        }).else_([&](auto f) {
+            f(trainer).update_batch(first, last, first, last, std::get<I>(cd_trainers), contexts[I], std::get<I>(rbms));
+        });
+    }
+};
+
+/*!
+ * \brief Create a trainer for the given models, sharing the same input
+ */
+template <typename... RBMs>
+multi_rbm_trainer<RBMs...> make_multi_rbm_trainer(RBMs&... rbms) {
+    return multi_rbm_trainer<RBMs...>(rbms...);
+}
+
+} //end of dll namespace
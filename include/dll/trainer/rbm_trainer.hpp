@@ -12,10 +12,15 @@
 #include "cpp_utils/algorithm.hpp"
 #include "cpp_utils/static_if.hpp"
 
+#include "etl/etl.hpp"
+
 #include "dll/decay_type.hpp"
 #include "dll/util/batch.hpp"
 #include "dll/util/timers.hpp"
 #include "dll/util/random.hpp"
+#include "dll/util/permutation.hpp"
+#include "dll/util/sparse.hpp"
+#include "dll/util/distributed.hpp"
 #include "dll/layer_traits.hpp"
 #include "dll/trainer/rbm_trainer_fwd.hpp"
 #include "dll/trainer/rbm_training_context.hpp"
@@ -35,6 +40,24 @@ struct watcher_type<RBM, RW, std::enable_if_t<cpp::not_u<std::is_void<RW>::value
     using watcher_t = RW;
 };
 
+/*!
+ * \brief The configuration of the free energy monitoring of a RBM.
+ *
+ * Only the RBMs displaying the free energy (the dense RBMs) have a subset
+ * and a period.
+ */
+template <typename RBM, bool Monitor>
+struct free_energy_config {
+    static constexpr std::size_t subset = 0; ///< The number of samples of the subset (0 for all)
+    static constexpr std::size_t every  = 1; ///< The number of batches between two computations
+};
+
+template <typename RBM>
+struct free_energy_config<RBM, true> {
+    static constexpr std::size_t subset = rbm_layer_traits<RBM>::free_energy_subset(); ///< The number of samples of the subset (0 for all)
+    static constexpr std::size_t every  = rbm_layer_traits<RBM>::free_energy_every();  ///< The number of batches between two computations
+};
+
 /*!
  * \brief A generic trainer for Restricted Boltzmann Machine
  *
@@ -72,29 +95,25 @@ struct rbm_trainer {
         //NOP
     }
 
-    template <typename IIterator, cpp_enable_if_cst(rbm_layer_traits<rbm_t>::has_shuffle())>
-    static void shuffle_direct(IIterator ifirst, IIterator ilast) {
-        decltype(auto) g = dll::rand_engine();
-        std::shuffle(ifirst, ilast, g);
+    /*!
+     * \brief Shuffle the order in which the samples are visited, if
+     * necessary.
+     */
+    static void shuffle(permutation& order) {
+        if (rbm_layer_traits<rbm_t>::has_shuffle()) {
+            order.shuffle();
+        }
     }
 
-    template <typename IIterator, cpp_disable_if_cst(rbm_layer_traits<rbm_t>::has_shuffle())>
-    static void shuffle_direct(IIterator, IIterator) {}
+    // Shuffling is done on a permutation of the indices, only ranges that
+    // cannot be accessed randomly need to be copied first
 
-    template <typename IIterator, typename EIterator, cpp_enable_if_cst(rbm_layer_traits<rbm_t>::has_shuffle())>
-    static void shuffle(IIterator ifirst, IIterator ilast, EIterator efirst, EIterator elast) {
-        decltype(auto) g = dll::rand_engine();
-        if (Denoising) {
-            cpp::parallel_shuffle(ifirst, ilast, efirst, elast, g);
-        } else {
-            std::shuffle(ifirst, ilast, g);
-        }
+    template <typename IIterator, typename EIterator>
+    static constexpr bool need_copy() {
+        return rbm_layer_traits<rbm_t>::has_shuffle() && !(is_random_access_iterator<IIterator>::value && is_random_access_iterator<EIterator>::value);
     }
 
-    template <typename IIterator, typename EIterator, cpp_disable_if_cst(rbm_layer_traits<rbm_t>::has_shuffle())>
-    static void shuffle(IIterator, IIterator, EIterator, EIterator) {}
-
-    template <typename IIterator, typename EIterator, typename IVector, typename EVector, cpp_enable_if_cst(rbm_layer_traits<rbm_t>::has_shuffle())>
+    template <typename IIterator, typename EIterator, typename IVector, typename EVector, cpp_enable_if_cst(need_copy<IIterator, EIterator>())>
     static auto prepare_it(IIterator ifirst, IIterator ilast, EIterator efirst, EIterator elast, IVector& ivec, EVector& evec) {
         std::copy(ifirst, ilast, std::back_inserter(ivec));
 
@@ -112,21 +131,23 @@ struct rbm_trainer {
         }
     }
 
-    template <typename IIterator, typename EIterator, typename IVector, typename EVector, cpp_disable_if_cst(rbm_layer_traits<rbm_t>::has_shuffle())>
+    template <typename IIterator, typename EIterator, typename IVector, typename EVector, cpp_disable_if_cst(need_copy<IIterator, EIterator>())>
     static auto prepare_it(IIterator ifirst, IIterator ilast, EIterator efirst, EIterator elast, IVector&, EVector&) {
         return std::make_tuple(ifirst, ilast, efirst, elast);
     }
 
-    template <typename rbm_t, typename Iterator>
-    using fix_iterator_t = std::conditional_t<
-        rbm_layer_traits<rbm_t>::has_shuffle(),
-        typename std::vector<typename std::iterator_traits<Iterator>::value_type>::iterator,
-        Iterator>;
-
     std::size_t batch_size            = 0;
     std::size_t total_batches         = 0;
     error_type last_error = 0.0;
 
+    static constexpr bool monitor_free_energy    = EnableWatcher && rbm_layer_traits<rbm_t>::free_energy();
+    static constexpr std::size_t fe_subset_size  = free_energy_config<rbm_t, monitor_free_energy>::subset;
+    static constexpr std::size_t fe_every        = free_energy_config<rbm_t, monitor_free_energy>::every;
+
+    etl::dyn_matrix<typename rbm_t::weight> fe_subset; ///< The fixed subset of samples to compute the free energy on
+    std::size_t fe_subset_filled = 0;                  ///< The number of samples already in the subset
+    std::size_t fe_samples       = 0;                  ///< The number of free energies computed in the current epoch
+
     //Note: input_first/input_last only relevant for its size, not
     //values since they can point to the input of the first level
     //and not the current level
@@ -134,6 +155,9 @@ struct rbm_trainer {
     void init_training(RBM& rbm, Iterator input_first, Iterator input_last) {
         rbm.momentum = rbm.initial_momentum;
 
+        // The weights of a pruned RBM are trained again
+        clear_sparse_weights(rbm);
+
         if (EnableWatcher) {
             watcher.training_begin(rbm);
         }
@@ -160,6 +184,8 @@ struct rbm_trainer {
         }
 
         last_error = 0.0;
+
+        fe_subset_filled = 0;
     }
 
     template <typename Iterator>
@@ -168,6 +194,9 @@ struct rbm_trainer {
     }
 
     static trainer_type get_trainer(RBM& rbm) {
+        //All the replicas start from the weights of the first process
+        synchronize_weights(rbm.w, rbm.b, rbm.c);
+
         //Allocate the trainer on the heap (may be large)
         return std::make_unique<trainer_t<rbm_t>>(rbm);
     }
@@ -184,7 +213,7 @@ struct rbm_trainer {
     error_type train(RBM& rbm, IIterator ifirst, IIterator ilast, EIterator efirst, EIterator elast, std::size_t max_epochs) {
         dll::auto_timer timer("rbm_trainer:train");
 
-        //In case of shuffle, we don't want to shuffle the input, therefore create a copy and shuffle it
+        //In case of shuffle, the input is never moved, only copied if it cannot be accessed randomly
 
         std::vector<typename std::iterator_traits<IIterator>::value_type> input_copy;
         std::vector<typename std::iterator_traits<EIterator>::value_type> expected_copy;
@@ -208,10 +237,13 @@ struct rbm_trainer {
         //Allocate the trainer
         auto trainer = get_trainer(rbm);
 
+        //The order in which the samples are visited
+        permutation order(rbm_layer_traits<rbm_t>::has_shuffle() ? std::distance(input_first, input_last) : 0);
+
         //Train for max_epochs epoch
         for (std::size_t epoch = 0; epoch < max_epochs; ++epoch) {
             //Shuffle if necessary
-            shuffle(input_first, input_last, expected_first, expected_last);
+            shuffle(order);
 
             //Create a new context for this epoch
             rbm_training_context context;
@@ -220,7 +252,7 @@ struct rbm_trainer {
             init_epoch();
 
             //Train on all the data
-            train_sub(input_first, input_last, expected_first, trainer, context, rbm);
+            train_epoch(input_first, input_last, expected_first, order, trainer, context, rbm);
 
             //Finalize the current epoch
             finalize_epoch(epoch, context, rbm);
@@ -235,7 +267,7 @@ struct rbm_trainer {
 
         cpp_assert(!Denoising, "train_denoising_auto should not set Denoising");
 
-        //In case of shuffle, we don't want to shuffle the input, therefore create a copy and shuffle it
+        //The input is copied to be corrupted at each epoch
 
         auto n = std::distance(ifirst, ilast);
         std::vector<typename std::iterator_traits<IIterator>::value_type> input_clean(n);
@@ -254,6 +286,9 @@ struct rbm_trainer {
         //Allocate the trainer
         auto trainer = get_trainer(rbm);
 
+        //The order in which the samples are visited
+        permutation order(rbm_layer_traits<rbm_t>::has_shuffle() ? n : 0);
+
         auto input_transformer = [noise](auto&& value){
             decltype(auto) g = dll::rand_engine();
 
@@ -267,7 +302,7 @@ struct rbm_trainer {
         //Train for max_epochs epoch
         for (std::size_t epoch = 0; epoch < max_epochs; ++epoch) {
             //Shuffle if necessary
-            shuffle_direct(input_clean.begin(), input_clean.end());
+            shuffle(order);
 
             // Copy the input
             std::copy(input_clean.begin(), input_clean.end(), input_copy.begin());
@@ -284,7 +319,7 @@ struct rbm_trainer {
             init_epoch();
 
             //Train on all the data
-            train_sub(input_copy.begin(), input_copy.end(), input_clean.begin(), trainer, context, rbm);
+            train_epoch(input_copy.begin(), input_copy.end(), input_clean.begin(), order, trainer, context, rbm);
 
             //Finalize the current epoch
             finalize_epoch(epoch, context, rbm);
@@ -297,8 +332,25 @@ struct rbm_trainer {
     std::size_t samples = 0;
 
     void init_epoch() {
-        batches = 0;
-        samples = 0;
+        batches    = 0;
+        samples    = 0;
+        fe_samples = 0;
+    }
+
+    /*!
+     * \brief Train on all the samples, in permuted order if shuffle is enabled.
+     *
+     * The samples are accessed through the permutation and gathered into
+     * the batch buffers of the trainer, they are never moved.
+     */
+    template <typename IIT, typename EIT, cpp_enable_if_cst(rbm_layer_traits<rbm_t>::has_shuffle())>
+    void train_epoch(IIT input_first, IIT /*input_last*/, EIT expected_first, const permutation& order, trainer_type& trainer, rbm_training_context& context, rbm_t& rbm) {
+        train_sub(permuted_begin(input_first, order), permuted_end(input_first, order), permuted_begin(expected_first, order), trainer, context, rbm);
+    }
+
+    template <typename IIT, typename EIT, cpp_disable_if_cst(rbm_layer_traits<rbm_t>::has_shuffle())>
+    void train_epoch(IIT input_first, IIT input_last, EIT expected_first, const permutation& /*order*/, trainer_type& trainer, rbm_training_context& context, rbm_t& rbm) {
+        train_sub(input_first, input_last, expected_first, trainer, context, rbm);
     }
 
     template <typename IIT, typename EIT>
@@ -326,6 +378,15 @@ struct rbm_trainer {
 
     template <typename IIT, typename EIT>
     void train_batch(IIT input_first, IIT input_last, EIT expected_first, EIT expected_last, trainer_type& trainer, rbm_training_context& context, rbm_t& rbm) {
+        update_batch(input_first, input_last, expected_first, expected_last, trainer, context, rbm);
+        notify_batch(context, rbm);
+    }
+
+    /*!
+     * \brief Train on one batch, without notifying the watcher
+     */
+    template <typename IIT, typename EIT>
+    void update_batch(IIT input_first, IIT input_last, EIT expected_first, EIT expected_last, trainer_type& trainer, rbm_training_context& context, rbm_t& rbm) {
         ++batches;
 
         auto input_batch    = make_batch(input_first, input_last);
@@ -335,22 +396,67 @@ struct rbm_trainer {
         context.reconstruction_error += context.batch_error;
         context.sparsity += context.batch_sparsity;
 
-        cpp::static_if<EnableWatcher && rbm_layer_traits<rbm_t>::free_energy()>([&](auto f) {
-            for (auto& v : input_batch) {
-                context.free_energy += f(rbm).free_energy(v);
-            }
-        });
+        compute_free_energy(input_batch, *trainer, context, rbm);
+    }
 
+    /*!
+     * \brief Notify the watcher of the end of the last batch
+     */
+    void notify_batch(rbm_training_context& context, rbm_t& rbm) {
         if (EnableWatcher && rbm_layer_traits<rbm_t>::is_verbose()) {
             watcher.batch_end(rbm, context, batches, total_batches);
         }
     }
 
+    /*!
+     * \brief Compute the free energy of the current batch, reusing the
+     * activations already computed by the trainer.
+     */
+    template <typename Batch, typename Trainer, cpp_enable_if_cst(monitor_free_energy && fe_subset_size == 0)>
+    void compute_free_energy(const Batch& input_batch, const Trainer& trainer, rbm_training_context& context, rbm_t& rbm) {
+        if (batches % fe_every == 0) {
+            context.free_energy += rbm.batch_free_energy(trainer.v1, trainer.h1_a, input_batch.size());
+            fe_samples += input_batch.size();
+        }
+    }
+
+    /*!
+     * \brief Compute the free energy of the fixed subset of samples.
+     *
+     * The subset is made of the first samples seen during training. The
+     * hidden activations of the whole subset are computed at once.
+     */
+    template <typename Batch, typename Trainer, cpp_enable_if_cst(monitor_free_energy && fe_subset_size > 0)>
+    void compute_free_energy(const Batch& input_batch, const Trainer& /*trainer*/, rbm_training_context& context, rbm_t& rbm) {
+        if (fe_subset_filled < fe_subset_size) {
+            if (!fe_subset_filled) {
+                fe_subset = etl::dyn_matrix<typename rbm_t::weight>(fe_subset_size, input_size(rbm));
+            }
+
+            for (auto it = input_batch.begin(); it != input_batch.end() && fe_subset_filled < fe_subset_size; ++it) {
+                fe_subset(fe_subset_filled++) = *it;
+            }
+        }
+
+        if (batches % fe_every == 0) {
+            context.free_energy += rbm.batch_free_energy(etl::slice(fe_subset, 0, fe_subset_filled));
+            fe_samples += fe_subset_filled;
+        }
+    }
+
+    template <typename Batch, typename Trainer, cpp_disable_if_cst(monitor_free_energy)>
+    void compute_free_energy(const Batch& /*input_batch*/, const Trainer& /*trainer*/, rbm_training_context& /*context*/, rbm_t& /*rbm*/) {
+        //NOP
+    }
+
     void finalize_epoch(std::size_t epoch, rbm_training_context& context, rbm_t& rbm) {
         //Average all the gathered information
         context.reconstruction_error /= batches;
         context.sparsity /= batches;
-        context.free_energy /= samples;
+
+        if (fe_samples) {
+            context.free_energy /= fe_samples;
+        }
 
         //After some time increase the momentum
         if (rbm_layer_traits<rbm_t>::has_momentum() && epoch == rbm.final_momentum_epoch) {
@@ -15,10 +15,22 @@
 
 #pragma once
 
+#include <cmath>
+#include <tuple>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
 #include "cpp_utils/static_if.hpp"
 
 #include "dll/util/checks.hpp"         // For NaN checks
 #include "dll/util/timers.hpp"         // For auto_timer
+#include "dll/util/update.hpp"         // For fused_update
+#include "dll/util/scheduler.hpp"      // For shared_pool
+#include "dll/util/numa.hpp"           // For first_touch
+#include "dll/util/checkpoint.hpp"     // For release_buffer
+#include "dll/util/sparse.hpp"         // For clear_sparse_weights
+#include "dll/util/distributed.hpp"    // For average_gradients
 #include "dll/dbn_traits.hpp"
 
 namespace dll {
@@ -31,11 +43,22 @@ struct sgd_trainer {
 
     static constexpr const auto layers     = dbn_t::layers;
     static constexpr const auto batch_size = dbn_t::batch_size;
+    static constexpr const auto checkpoint = dbn_traits<dbn_t>::checkpoint();
 
     bool ae_training = false;
 
+    std::vector<std::vector<std::size_t>> input_shapes;  ///< The shapes of the released inputs (checkpointing)
+    std::vector<std::vector<std::size_t>> output_shapes; ///< The shapes of the released outputs (checkpointing)
+
+    buffer_stash stash; ///< The released activations kept for reuse (checkpointing)
+
+    std::size_t checkpoint_saved = 0; ///< The largest number of bytes of activations freed by checkpointing after a forward pass
+    std::size_t misclassified    = 0; ///< The number of misclassified samples of the last batch
+
     dbn_t& dbn;
 
+    shared_pool_t<!dbn_traits<dbn_t>::is_serial()>& pool; ///< The thread pool used for the updates of large layers
+
     /*!
      * \brief Indicates if the model is being trained as an auto-encoder (true) or not (false)
      */
@@ -87,10 +110,18 @@ struct sgd_trainer {
     template<typename L1, typename L2, cpp_disable_if(decay_layer_traits<L2>::is_transform_layer())>
     static void inherit_from_front(L1& /*l1*/, L2& /*l2*/){ }
 
-    explicit sgd_trainer(dbn_t& dbn) : dbn(dbn) {
+    explicit sgd_trainer(dbn_t& dbn) : input_shapes(layers), output_shapes(layers), stash(2 * checkpoint), dbn(dbn), pool(dll::shared_pool<!dbn_traits<dbn_t>::is_serial()>()) {
+        static_assert(!checkpoint || dynamic_activations(), "checkpoint<K> only releases dynamic activations, no layer of this network has any");
+
         // Initialize all the SGD contexts
         dbn.for_each_layer([](auto& layer) {
             layer.template init_sgd_context<dbn_t>();
+
+            // All the replicas start from the weights of the first process
+            this_type::synchronize_layer(layer);
+
+            // The weights of pruned layers are trained again
+            clear_sparse_weights(layer);
         });
 
         // Inherit dimensions from back
@@ -113,6 +144,14 @@ struct sgd_trainer {
                 this_type::inherit_from_front(l1, l2);
             }
         });
+
+        // Place the buffers of the contexts on the nodes of the workers
+
+        dbn.for_each_layer([this](auto& layer) {
+            auto& ctx = layer.template get_sgd_context<dbn_t>();
+
+            first_touch(pool, ctx.input, ctx.output, ctx.errors);
+        });
     }
 
     void init_training(std::size_t) {}
@@ -158,6 +197,8 @@ struct sgd_trainer {
     std::pair<double, double> train_batch(std::size_t /*epoch*/, const Inputs& inputs, const Labels& labels, InputTransformer input_transformer) {
         dll::auto_timer timer("sgd::train_batch");
 
+        dll::distributed_step();
+
         // Ensure that the data batch and the label batch are of the same size
         cpp_assert(etl::dim<0>(inputs) == etl::dim<0>(labels), "Invalid sizes");
 
@@ -183,6 +224,10 @@ struct sgd_trainer {
         {
             dll::auto_timer timer("sgd::forward");
 
+            if (checkpoint) {
+                restore_buffer(first_ctx.output, output_shapes[0], stash);
+            }
+
             if(cpp_unlikely(!full_batch)){
                 first_ctx.input  = 0;
                 first_ctx.output = 0;
@@ -196,26 +241,45 @@ struct sgd_trainer {
 
             first_layer.batch_activate_hidden(first_ctx.output, first_ctx.input);
 
-            dbn.for_each_layer_pair([](auto& layer_1, auto& layer_2) {
+            std::size_t released = 0;
+
+            dbn.for_each_layer_pair_i([this, &released](std::size_t i, auto& layer_1, auto& layer_2) {
                 auto& ctx1 = layer_1.template get_sgd_context<dbn_t>();
                 auto& ctx2 = layer_2.template get_sgd_context<dbn_t>();
 
+                if (checkpoint) {
+                    restore_buffer(ctx2.input, input_shapes[i + 1], stash);
+                    restore_buffer(ctx2.output, output_shapes[i + 1], stash);
+                }
+
                 ctx2.input = ctx1.output;
                 layer_2.batch_activate_hidden(ctx2.output, ctx2.input);
+
+                // The activations are recomputed during the backward pass
+                if (checkpoint) {
+                    released += release_buffer(ctx1.output, output_shapes[i], stash);
+
+                    if (!is_checkpoint(i + 1)) {
+                        released += release_buffer(ctx2.input, input_shapes[i + 1], stash);
+                    }
+                }
             });
+
+            // The buffers kept in the stash for the recomputations are not freed
+            if (checkpoint) {
+                checkpoint_saved = std::max(checkpoint_saved, released - std::min(released, stash.bytes()));
+            }
         }
 
-        //Compute the errors of the last layer
+        //Compute the errors of the last layer, the error and the loss
+
+        double error = 0.0;
+        double loss = 0.0;
 
-        if (cpp_unlikely(!full_batch)) {
-            first_ctx.input = 0;
-            last_ctx.errors = 0;
+        {
+            dll::auto_timer timer("sgd::error");
 
-            for (size_t i = 0; i < etl::dim<0>(inputs); ++i) {
-                last_ctx.errors(i) = labels(i) - last_ctx.output(i);
-            }
-        } else {
-            last_ctx.errors = labels - last_ctx.output;
+            std::tie(error, loss) = output_errors(last_ctx.output, labels, last_ctx.errors, n);
         }
 
         // Backpropagate the error
@@ -223,15 +287,37 @@ struct sgd_trainer {
         {
             dll::auto_timer timer("sgd::backward");
 
-            dbn.for_each_layer_rpair([](auto& r1, auto& r2) {
+            dbn.for_each_layer_rpair_i([this](std::size_t i, auto& r1, auto& r2) {
                 auto& ctx1 = r1.template get_sgd_context<dbn_t>();
                 auto& ctx2 = r2.template get_sgd_context<dbn_t>();
 
+                if (checkpoint) {
+                    this->recompute_segment(i + 1);
+                }
+
                 r2.adapt_errors(ctx2);
                 r2.backward_batch(ctx1.errors, ctx2);
+
+                // With checkpointing, the gradients are computed while the
+                // activations of the segment are still available
+                if (checkpoint) {
+                    r2.compute_gradients(ctx2);
+
+                    this->release_layer(i + 1, ctx2);
+                }
             });
 
+            if (checkpoint) {
+                this->recompute_segment(0);
+            }
+
             first_layer.adapt_errors(first_ctx);
+
+            if (checkpoint) {
+                first_layer.compute_gradients(first_ctx);
+
+                this->release_layer(0, first_ctx);
+            }
         }
 
         // Compute and apply the gradients
@@ -241,47 +327,211 @@ struct sgd_trainer {
 
             dbn.for_each_layer([this, n](auto& layer) {
                 // Compute the gradients
-                layer.compute_gradients(layer.template get_sgd_context<dbn_t>());
+                if (!checkpoint) {
+                    layer.compute_gradients(layer.template get_sgd_context<dbn_t>());
+                }
 
                 // Apply the gradients
                 this->apply_gradients(layer, n);
             });
         }
 
-        // Compute error and loss
+        return std::make_pair(error, loss);
+    }
 
-        double error = 0.0;
-        double loss = 0.0;
+    /*!
+     * \brief Indicates if the input of the given layer is kept after the
+     * forward pass
+     */
+    static constexpr bool is_checkpoint(std::size_t i) {
+        return !checkpoint || i % std::max<std::size_t>(checkpoint, 1) == 0;
+    }
 
-        {
-            dll::auto_timer timer("sgd::error");
+    /*!
+     * \brief Indicates if the activations of at least one layer, starting
+     * from layer I, are dynamic and can be released by checkpointing
+     */
+    template <std::size_t I = 0, cpp_enable_if((I < layers))>
+    static constexpr bool dynamic_activations() {
+        using context_t = sgd_context<dbn_t, typename dbn_t::template layer_type<I>>;
 
-            auto& out = last_ctx.output;
+        return !etl::decay_traits<decltype(std::declval<context_t&>().output)>::is_fast || dynamic_activations<I + 1>();
+    }
 
-            if (cpp_unlikely(!full_batch)) {
-                error = amean(labels - slice(out, 0, etl::dim<0>(inputs)));
+    /*!
+     * \copydoc dynamic_activations
+     */
+    template <std::size_t I = 0, cpp_enable_if((I == layers))>
+    static constexpr bool dynamic_activations() {
+        return false;
+    }
 
-                if (ae_training) {
-                    // Reconstruction Cross-Entropy Loss
-                    loss = -sum((labels >> log(slice(out, 0, etl::dim<0>(inputs)))) + ((1.0 - labels) >> log(1 - slice(out, 0, etl::dim<0>(inputs))))) / double(n);
-                } else {
-                    // Cross-Entropy Loss
-                    loss = -sum(log(slice(out, 0, etl::dim<0>(inputs))) >> labels) / double(n);
+    /*!
+     * \brief Recompute the activations of the segment of the given layer,
+     * from the checkpoint at its beginning.
+     *
+     * Nothing is done if the activations of the given layer have not been
+     * released. The output of the last layer is never released and the
+     * input of the next checkpoint is always available, so only the layers
+     * before the given one are activated.
+     */
+    void recompute_segment(std::size_t l) {
+        if (input_shapes[l].empty() && output_shapes[l].empty()) {
+            return;
+        }
+
+        dll::auto_timer timer("sgd::recompute");
+
+        const std::size_t first = l - l % std::max<std::size_t>(checkpoint, 1);
+
+        dbn.for_each_layer_i([this, first](std::size_t i, auto& layer) {
+            if (i == first && i < layers - 1) {
+                auto& ctx = layer.template get_sgd_context<dbn_t>();
+
+                restore_buffer(ctx.output, output_shapes[i], stash);
+                layer.batch_activate_hidden(ctx.output, ctx.input);
+            }
+        });
+
+        dbn.for_each_layer_pair_i([this, first, l](std::size_t i, auto& layer_1, auto& layer_2) {
+            if (i >= first && i < l) {
+                auto& ctx1 = layer_1.template get_sgd_context<dbn_t>();
+                auto& ctx2 = layer_2.template get_sgd_context<dbn_t>();
+
+                restore_buffer(ctx2.input, input_shapes[i + 1], stash);
+                ctx2.input = ctx1.output;
+
+                if (i + 1 < layers - 1) {
+                    restore_buffer(ctx2.output, output_shapes[i + 1], stash);
+                    layer_2.batch_activate_hidden(ctx2.output, ctx2.input);
                 }
-            } else {
-                error = amean(labels - out);
+            }
+        });
+    }
+
+    /*!
+     * \brief Release the activations of the given layer once its backward
+     * pass is done
+     */
+    template <typename Context>
+    void release_layer(std::size_t i, Context& ctx) {
+        if (i < layers - 1) {
+            release_buffer(ctx.output, output_shapes[i], stash);
+        }
+
+        if (!is_checkpoint(i)) {
+            release_buffer(ctx.input, input_shapes[i], stash);
+        }
+    }
+
+    /*!
+     * \brief Compute the errors of the output layer, the error, the loss and
+     * the number of misclassified samples of the batch, in a single pass
+     * over the outputs.
+     *
+     * Only the n first samples are considered, the errors of the other
+     * samples (incomplete batch) are set to zero.
+     *
+     * \param out The output of the last layer
+     * \param labels The expected outputs, one row per sample
+     * \param errors The errors of the last layer
+     * \param n The number of samples in the batch
+     *
+     * \return a pair containing the error and the loss of the batch
+     */
+    template <typename Output, typename Labels, typename Errors, cpp_disable_if(etl::decay_traits<Labels>::dimensions() == 1)>
+    std::pair<double, double> output_errors(const Output& out, const Labels& labels, Errors& errors, std::size_t n) {
+        const std::size_t K = etl::size(out) / etl::dim<0>(out);
+
+        const weight* o = out.memory_start();
+        weight* e       = errors.memory_start();
+
+        double error = 0.0;
+        double loss  = 0.0;
+
+        misclassified = 0;
+
+        for (std::size_t i = 0; i < n; ++i) {
+            std::size_t predicted = 0;
+            std::size_t expected  = 0;
+
+            for (std::size_t k = 0; k < K; ++k) {
+                const std::size_t j = i * K + k;
+                const weight l      = labels[j];
+
+                e[j] = l - o[j];
+                error += std::abs(e[j]);
 
                 if (ae_training) {
                     // Reconstruction Cross-Entropy Loss
-                    loss = -sum((labels >> log(out)) + ((1.0 - labels) >> log(1 - out))) / double(n);
-                } else {
+                    loss -= l * std::log(o[j]) + (1.0 - l) * std::log(1.0 - o[j]);
+                } else if (l != 0.0) {
                     // Cross-Entropy Loss
-                    loss = -sum(log(out) >> labels) / double(n);
+                    loss -= l * std::log(o[j]);
                 }
+
+                predicted = o[j] > o[i * K + predicted] ? k : predicted;
+                expected  = l > labels[i * K + expected] ? k : expected;
             }
+
+            misclassified += !ae_training && predicted != expected;
         }
 
-        return std::make_pair(error, loss);
+        std::fill(e + n * K, e + etl::size(errors), weight(0));
+
+        return std::make_pair(error / double(n * K), loss / double(n));
+    }
+
+    /*!
+     * \brief Compute the errors of the output layer, the error, the loss and
+     * the number of misclassified samples of the batch, in a single pass
+     * over the outputs.
+     *
+     * The labels are the indices of the classes, no one-hot representation
+     * is necessary.
+     *
+     * \param out The output of the last layer
+     * \param labels The class of each sample
+     * \param errors The errors of the last layer
+     * \param n The number of samples in the batch
+     *
+     * \return a pair containing the error and the loss of the batch
+     */
+    template <typename Output, typename Labels, typename Errors, cpp_enable_if(etl::decay_traits<Labels>::dimensions() == 1)>
+    std::pair<double, double> output_errors(const Output& out, const Labels& labels, Errors& errors, std::size_t n) {
+        const std::size_t K = etl::size(out) / etl::dim<0>(out);
+
+        const weight* o = out.memory_start();
+        weight* e       = errors.memory_start();
+
+        double error = 0.0;
+        double loss  = 0.0;
+
+        misclassified = 0;
+
+        for (std::size_t i = 0; i < n; ++i) {
+            const std::size_t label = labels[i];
+
+            cpp_assert(label < K, "The label must be the index of one of the output units");
+
+            std::size_t predicted = 0;
+
+            for (std::size_t k = 0; k < K; ++k) {
+                e[i * K + k] = (k == label ? 1.0 : 0.0) - o[i * K + k];
+                error += std::abs(e[i * K + k]);
+
+                predicted = o[i * K + k] > o[i * K + predicted] ? k : predicted;
+            }
+
+            // Cross-Entropy Loss
+            loss -= std::log(o[i * K + label]);
+
+            misclassified += predicted != label;
+        }
+
+        std::fill(e + n * K, e + etl::size(errors), weight(0));
+
+        return std::make_pair(error / double(n * K), loss / double(n));
     }
 
     template <typename L, cpp_enable_if(decay_layer_traits<L>::is_neural_layer())>
@@ -290,30 +540,27 @@ struct sgd_trainer {
 
         auto& context = layer.template get_sgd_context<dbn_t>();
 
-        //Update the gradients
-        this->update_grad(layer.w, context.w_grad, w_decay(dbn_traits<dbn_t>::decay()), 0.0);
-        this->update_grad(layer.b, context.b_grad, b_decay(dbn_traits<dbn_t>::decay()), 0.0);
-
-        //Update with momentum and learning rate
-        if (dbn_traits<dbn_t>::has_momentum()) {
-            auto momentum = dbn.momentum;
-            auto eps      = dbn.learning_rate;
-
-            // Note(perf): Some performance could be gained by doing the pair of
-            // operations on w in a loop to improve data locality
+        //Synchronize the gradients of the replicas
+        average_gradients(context.w_grad, context.b_grad);
 
-            context.w_inc = momentum * context.w_inc + (eps / n) * context.w_grad;
-            layer.w += context.w_inc;
+        update_parameters<weight> params;
+        params.eps      = dbn.learning_rate / n;
+        params.momentum = dbn.momentum;
+        params.l1       = dbn.l1_weight_cost;
+        params.l2       = dbn.l2_weight_cost;
 
-            context.b_inc = momentum * context.b_inc + (eps / n) * context.b_grad;
-            layer.b += context.b_inc;
+        //Apply decay, momentum and learning rate in a single pass
+        if (dbn_traits<dbn_t>::has_momentum()) {
+            fused_update<w_decay(dbn_traits<dbn_t>::decay())>(pool, layer.w, context.w_grad, context.w_inc, params);
+            fused_update<b_decay(dbn_traits<dbn_t>::decay())>(pool, layer.b, context.b_grad, context.b_inc, params);
         } else {
-            auto eps = dbn.learning_rate;
-
-            layer.w += (eps / n) * context.w_grad;
-            layer.b += (eps / n) * context.b_grad;
+            fused_update<w_decay(dbn_traits<dbn_t>::decay())>(pool, layer.w, context.w_grad, params);
+            fused_update<b_decay(dbn_traits<dbn_t>::decay())>(pool, layer.b, context.b_grad, params);
         }
 
+        //Synchronize the weights of the replicas
+        average_weights(layer.w, layer.b);
+
         nan_check_deep(layer.w);
         nan_check_deep(layer.b);
     }
@@ -324,19 +571,14 @@ struct sgd_trainer {
         //gradients
     }
 
-    template <typename V, typename G>
-    void update_grad(const V& value, G& grad, decay_type decay, double penalty) {
-        if (decay == decay_type::L1) {
-            grad = grad - dbn.l1_weight_cost * abs(value) - penalty;
-        } else if (decay == decay_type::L2) {
-            grad = grad - dbn.l2_weight_cost * value - penalty;
-        } else if (decay == decay_type::L1L2) {
-            grad = grad - dbn.l1_weight_cost * abs(value) - dbn.l2_weight_cost * value - penalty;
-        } else {
-            if(penalty != 0.0){
-                grad = grad - penalty;
-            }
-        }
+    template <typename L, cpp_enable_if(decay_layer_traits<L>::is_neural_layer())>
+    static void synchronize_layer(L& layer) {
+        synchronize_weights(layer.w, layer.b);
+    }
+
+    template <typename L, cpp_disable_if(decay_layer_traits<L>::is_neural_layer())>
+    static void synchronize_layer(L&) {
+        //Pooling and transform layers have no weights
     }
 
     static std::string name() {
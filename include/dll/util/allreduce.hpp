@@ -0,0 +1,527 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*!
+ * \file allreduce.hpp
+ * \brief Communicators to average buffers between the processes of a
+ * data-parallel training.
+ *
+ * Two transports are available: shared memory between the processes of
+ * the same host and a TCP ring between several hosts.
+ */
+
+#pragma once
+
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+#include <poll.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+namespace dll {
+
+/*!
+ * \brief A group of processes that can reduce buffers together.
+ *
+ * All the processes of the group must call the collective operations in
+ * the same order and with the same sizes.
+ */
+struct communicator {
+    virtual ~communicator() = default;
+
+    /*!
+     * \brief Returns the rank of the current process in the group
+     */
+    virtual std::size_t rank() const = 0;
+
+    /*!
+     * \brief Returns the number of processes in the group
+     */
+    virtual std::size_t size() const = 0;
+
+    /*!
+     * \brief Replace the buffer by its sum over all the processes
+     */
+    virtual void allreduce(float* data, std::size_t n) = 0;
+
+    /*!
+     * \copydoc allreduce
+     */
+    virtual void allreduce(double* data, std::size_t n) = 0;
+
+    /*!
+     * \brief Replace the buffer by its average over all the processes
+     */
+    template <typename T>
+    void average(T* data, std::size_t n) {
+        allreduce(data, n);
+
+        const T scale = T(1) / size();
+
+        for (std::size_t i = 0; i < n; ++i) {
+            data[i] *= scale;
+        }
+    }
+
+    /*!
+     * \brief Replace the buffer by the buffer of the first process
+     */
+    template <typename T>
+    void broadcast(T* data, std::size_t n) {
+        if (rank() != 0) {
+            std::fill(data, data + n, T(0));
+        }
+
+        allreduce(data, n);
+    }
+
+    /*!
+     * \brief Wait for all the processes of the group
+     */
+    void barrier() {
+        float value = 0;
+        allreduce(&value, 1);
+    }
+};
+
+/*!
+ * \brief Communicator between the processes of a single host, through a
+ * shared memory segment.
+ *
+ * The segment must be mapped before the processes are forked, it contains
+ * a barrier and one slot per process. Each buffer is reduced in pieces of
+ * the size of a slot: each process sums one chunk of the piece over all
+ * the slots (reduce-scatter) and then gathers the reduced chunks of the
+ * other processes (allgather).
+ *
+ * A process that waits too long at the barrier, or that sees the segment
+ * aborted by another process, throws instead of waiting forever.
+ */
+struct shm_communicator final : communicator {
+    /*!
+     * \brief The header of the shared segment
+     */
+    struct header {
+        std::atomic<std::size_t> count; ///< The number of processes arrived at the barrier
+        std::atomic<std::size_t> sense; ///< The current sense of the barrier
+        std::atomic<bool> aborted;      ///< Indicates if a process of the group failed
+    };
+
+    /*!
+     * \brief Returns the size of the segment for the given number of
+     * processes and slot capacity
+     */
+    static std::size_t segment_size(std::size_t processes, std::size_t capacity) {
+        return sizeof(header) + processes * capacity;
+    }
+
+    /*!
+     * \brief Map a new shared segment, to be inherited by forked processes
+     * \return The segment, nullptr on failure
+     */
+    static void* map_segment(std::size_t processes, std::size_t capacity) {
+        void* segment = mmap(nullptr, segment_size(processes, capacity), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+        if (segment == MAP_FAILED) {
+            return nullptr;
+        }
+
+        auto* h = new (segment) header;
+        h->count.store(0);
+        h->sense.store(0);
+        h->aborted.store(false);
+
+        return segment;
+    }
+
+    /*!
+     * \brief Abort the group of the given segment, the processes waiting at
+     * the barrier throw
+     */
+    static void abort(void* segment) {
+        static_cast<header*>(segment)->aborted.store(true);
+    }
+
+    /*!
+     * \brief Unmap a segment created with map_segment
+     */
+    static void unmap_segment(void* segment, std::size_t processes, std::size_t capacity) {
+        munmap(segment, segment_size(processes, capacity));
+    }
+
+    /*!
+     * \brief Create the communicator of the given process
+     * \param segment The shared segment
+     * \param rank The rank of the process
+     * \param processes The number of processes
+     * \param capacity The size of each slot, in bytes
+     * \param timeout The maximal wait at the barrier, in seconds
+     */
+    shm_communicator(void* segment, std::size_t rank, std::size_t processes, std::size_t capacity, std::size_t timeout = 600)
+            : h(static_cast<header*>(segment)), slots(static_cast<char*>(segment) + sizeof(header)), r(rank), n(processes), capacity(capacity), timeout(timeout) {}
+
+    std::size_t rank() const override {
+        return r;
+    }
+
+    std::size_t size() const override {
+        return n;
+    }
+
+    void allreduce(float* data, std::size_t size) override {
+        allreduce_impl(data, size);
+    }
+
+    void allreduce(double* data, std::size_t size) override {
+        allreduce_impl(data, size);
+    }
+
+private:
+    template <typename T>
+    T* slot(std::size_t p) {
+        return reinterpret_cast<T*>(slots + p * capacity);
+    }
+
+    void wait() {
+        const std::size_t local = 1 - sense;
+        sense                   = local;
+
+        if (h->count.fetch_add(1) + 1 == n) {
+            h->count.store(0);
+            h->sense.store(local);
+        } else {
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+
+            for (std::size_t spins = 1; h->sense.load() != local; ++spins) {
+                // Checking the clock at each spin would slow down the barrier
+                if (spins % 1024 == 0) {
+                    if (h->aborted.load()) {
+                        throw std::runtime_error("shm_communicator: another process failed");
+                    }
+
+                    if (std::chrono::steady_clock::now() > deadline) {
+                        h->aborted.store(true);
+                        throw std::runtime_error("shm_communicator: timeout at the barrier");
+                    }
+                }
+
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    template <typename T>
+    void allreduce_impl(T* data, std::size_t size) {
+        const std::size_t piece = capacity / sizeof(T);
+
+        for (std::size_t offset = 0; offset < size; offset += piece) {
+            const std::size_t m = std::min(piece, size - offset);
+
+            std::copy(data + offset, data + offset + m, slot<T>(r));
+
+            wait();
+
+            // Reduce the chunk of this process over all the slots
+
+            const std::size_t first = (r * m) / n;
+            const std::size_t last  = ((r + 1) * m) / n;
+
+            for (std::size_t p = 0; p < n; ++p) {
+                if (p != r) {
+                    const T* other = slot<T>(p);
+                    T* mine        = slot<T>(r);
+
+                    for (std::size_t i = first; i < last; ++i) {
+                        mine[i] += other[i];
+                    }
+                }
+            }
+
+            wait();
+
+            // Gather the reduced chunks of all the processes
+
+            for (std::size_t p = 0; p < n; ++p) {
+                const T* reduced = slot<T>(p);
+
+                std::copy(reduced + (p * m) / n, reduced + ((p + 1) * m) / n, data + offset + (p * m) / n);
+            }
+
+            wait();
+        }
+    }
+
+    header* h;             ///< The header of the segment
+    char* slots;           ///< The slots of the processes
+    std::size_t r;         ///< The rank of the process
+    std::size_t n;         ///< The number of processes
+    std::size_t capacity;  ///< The size of each slot, in bytes
+    std::size_t timeout;   ///< The maximal wait at the barrier, in seconds
+    std::size_t sense = 0; ///< The local sense of the barrier
+};
+
+/*!
+ * \brief Communicator between processes on several hosts, as a TCP ring.
+ *
+ * Each process listens on its own port, connects to the next process of
+ * the ring and accepts the connection of the previous one. Buffers are
+ * reduced with the ring algorithm: size - 1 steps of reduce-scatter
+ * followed by size - 1 steps of allgather, each process exchanging one
+ * chunk with its neighbours at each step.
+ */
+struct tcp_communicator final : communicator {
+    /*!
+     * \brief Create the communicator and connect the ring, the process of
+     * rank i listening on base_port + i
+     * \param rank The rank of the process
+     * \param hosts The host of each process
+     * \param base_port The port of the first process
+     */
+    tcp_communicator(std::size_t rank, std::vector<std::string> hosts, std::size_t base_port)
+            : tcp_communicator(rank, hosts.size() < 2 ? -1 : listen_on(base_port + rank), hosts, consecutive_ports(base_port, hosts.size())) {}
+
+    /*!
+     * \brief Create the communicator and connect the ring from a socket
+     * already listening.
+     * \param rank The rank of the process
+     * \param listener The listening socket of this process, closed once the ring is connected
+     * \param hosts The host of each process
+     * \param ports The port of each process
+     */
+    tcp_communicator(std::size_t rank, int listener, std::vector<std::string> hosts, std::vector<std::size_t> ports)
+            : r(rank), n(hosts.size()) {
+        if (n < 2) {
+            if (listener >= 0) {
+                close(listener);
+            }
+
+            return;
+        }
+
+        next = connect_to(hosts[(r + 1) % n], ports[(r + 1) % n]);
+        prev = accept(listener, nullptr, nullptr);
+
+        close(listener);
+
+        if (next < 0 || prev < 0) {
+            throw std::runtime_error("tcp_communicator: cannot connect the ring");
+        }
+
+        int one = 1;
+        setsockopt(next, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    tcp_communicator(const tcp_communicator& rhs) = delete;
+    tcp_communicator& operator=(const tcp_communicator& rhs) = delete;
+
+    ~tcp_communicator() {
+        if (next >= 0) {
+            close(next);
+        }
+
+        if (prev >= 0) {
+            close(prev);
+        }
+    }
+
+    std::size_t rank() const override {
+        return r;
+    }
+
+    std::size_t size() const override {
+        return n;
+    }
+
+    void allreduce(float* data, std::size_t size) override {
+        allreduce_impl(data, size);
+    }
+
+    void allreduce(double* data, std::size_t size) override {
+        allreduce_impl(data, size);
+    }
+
+    /*!
+     * \brief Create a socket listening on the given port, on all the
+     * interfaces
+     * \param port The port, 0 for any free port
+     * \return The listening socket
+     */
+    static int listen_on(std::size_t port) {
+        int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+        int one = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in addr{};
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port        = htons(port);
+
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) || listen(listener, 1)) {
+            if (listener >= 0) {
+                close(listener);
+            }
+
+            throw std::runtime_error("tcp_communicator: cannot listen on port " + std::to_string(port));
+        }
+
+        return listener;
+    }
+
+    /*!
+     * \brief Returns the port the given socket is bound to
+     */
+    static std::size_t local_port(int fd) {
+        sockaddr_in addr{};
+        socklen_t length = sizeof(addr);
+
+        if (getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &length)) {
+            throw std::runtime_error("tcp_communicator: cannot get the port of the socket");
+        }
+
+        return ntohs(addr.sin_port);
+    }
+
+private:
+    static std::vector<std::size_t> consecutive_ports(std::size_t base_port, std::size_t n) {
+        std::vector<std::size_t> ports(n);
+
+        for (std::size_t i = 0; i < n; ++i) {
+            ports[i] = base_port + i;
+        }
+
+        return ports;
+    }
+
+    static int connect_to(const std::string& host, std::size_t port) {
+        addrinfo hints{};
+        hints.ai_family   = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo* result = nullptr;
+
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) || !result) {
+            return -1;
+        }
+
+        int fd = -1;
+
+        // The next process may not be listening yet
+        for (std::size_t attempt = 0; attempt < 600; ++attempt) {
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+
+            if (!connect(fd, result->ai_addr, result->ai_addrlen)) {
+                break;
+            }
+
+            close(fd);
+            fd = -1;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+
+        freeaddrinfo(result);
+
+        return fd;
+    }
+
+    /*!
+     * \brief Send a buffer to the next process while receiving a buffer
+     * from the previous one
+     */
+    void send_recv(const char* out, std::size_t out_n, char* in, std::size_t in_n) {
+        while (out_n || in_n) {
+            pollfd fds[2];
+            fds[0] = {next, short(out_n ? POLLOUT : 0), 0};
+            fds[1] = {prev, short(in_n ? POLLIN : 0), 0};
+
+            if (poll(fds, 2, -1) < 0) {
+                throw std::runtime_error("tcp_communicator: poll failed");
+            }
+
+            if (out_n && (fds[0].revents & POLLOUT)) {
+                auto sent = ::send(next, out, out_n, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+                if (sent > 0) {
+                    out += sent;
+                    out_n -= sent;
+                }
+            }
+
+            if (in_n && (fds[1].revents & (POLLIN | POLLHUP))) {
+                auto received = ::recv(prev, in, in_n, MSG_DONTWAIT);
+
+                if (received == 0) {
+                    throw std::runtime_error("tcp_communicator: connection closed");
+                }
+
+                if (received > 0) {
+                    in += received;
+                    in_n -= received;
+                }
+            }
+        }
+    }
+
+    template <typename T>
+    void allreduce_impl(T* data, std::size_t size) {
+        if (n < 2) {
+            return;
+        }
+
+        auto first = [&](std::size_t c) { return ((c % n) * size) / n; };
+        auto last  = [&](std::size_t c) { return ((c % n + 1) * size) / n; };
+
+        std::vector<T> buffer(size / n + 1);
+
+        // Reduce-scatter: after the loop, chunk r + 1 is fully reduced
+
+        for (std::size_t s = 0; s < n - 1; ++s) {
+            const std::size_t send_c = r + n - s;
+            const std::size_t recv_c = r + n - s - 1;
+
+            const std::size_t recv_n = last(recv_c) - first(recv_c);
+
+            send_recv(reinterpret_cast<const char*>(data + first(send_c)), (last(send_c) - first(send_c)) * sizeof(T),
+                      reinterpret_cast<char*>(buffer.data()), recv_n * sizeof(T));
+
+            for (std::size_t i = 0; i < recv_n; ++i) {
+                data[first(recv_c) + i] += buffer[i];
+            }
+        }
+
+        // Allgather: circulate the reduced chunks
+
+        for (std::size_t s = 0; s < n - 1; ++s) {
+            const std::size_t send_c = r + 1 + n - s;
+            const std::size_t recv_c = r + n - s;
+
+            send_recv(reinterpret_cast<const char*>(data + first(send_c)), (last(send_c) - first(send_c)) * sizeof(T),
+                      reinterpret_cast<char*>(data + first(recv_c)), (last(recv_c) - first(recv_c)) * sizeof(T));
+        }
+    }
+
+    std::size_t r; ///< The rank of the process
+    std::size_t n; ///< The number of processes
+    int next = -1; ///< The connection to the next process
+    int prev = -1; ///< The connection from the previous process
+};
+
+} //end of dll namespace
@@ -0,0 +1,191 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*!
+ * \file checkpoint.hpp
+ * \brief Release and restore of the activation buffers for gradient
+ * checkpointing.
+ *
+ * Only the dynamic buffers can be released, the storage of the fast
+ * matrices is part of their type. The most recently released buffers are
+ * kept in a stash to be reused by the next restores of the same shape,
+ * instead of being allocated again at each batch. The memory of the
+ * buffers kept in the stash is not freed.
+ */
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <utility>
+#include <typeindex>
+
+#include "cpp_utils/tmp.hpp"
+
+#include "etl/etl.hpp"
+
+namespace dll {
+
+namespace checkpoint_detail {
+
+template <typename M, std::size_t... I>
+M make_buffer(const std::vector<std::size_t>& shape, std::index_sequence<I...> /*s*/) {
+    return M(shape[I]...);
+}
+
+} //end of namespace checkpoint_detail
+
+/*!
+ * \brief Stash of released buffers, kept to be reused instead of being
+ * allocated again.
+ *
+ * At most capacity buffers are kept, the oldest ones being freed first.
+ */
+struct buffer_stash {
+    /*!
+     * \brief Create a stash keeping at most capacity buffers
+     */
+    explicit buffer_stash(std::size_t capacity = 0) : capacity(capacity) {}
+
+    /*!
+     * \brief Move the given buffer into the stash.
+     *
+     * The buffer is empty after the call.
+     */
+    template <typename M>
+    void push(M& m, const std::vector<std::size_t>& shape) {
+        if (capacity) {
+            if (entries.size() == capacity) {
+                held -= entries.front().bytes;
+                entries.erase(entries.begin());
+            }
+
+            const std::size_t bytes = etl::size(m) * sizeof(etl::value_t<M>);
+
+            entries.push_back({std::type_index(typeid(M)), shape, bytes, std::make_shared<M>(std::move(m))});
+
+            held += bytes;
+        }
+
+        m = M();
+    }
+
+    /*!
+     * \brief Move a buffer of the given type and shape from the stash into
+     * the given buffer.
+     * \return true if a buffer has been found, false otherwise
+     */
+    template <typename M>
+    bool pop(M& m, const std::vector<std::size_t>& shape) {
+        for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+            if (it->type == std::type_index(typeid(M)) && it->shape == shape) {
+                m = std::move(*std::static_pointer_cast<M>(it->buffer));
+                held -= it->bytes;
+                entries.erase(std::next(it).base());
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /*!
+     * \brief Returns the number of buffers in the stash
+     */
+    std::size_t size() const {
+        return entries.size();
+    }
+
+    /*!
+     * \brief Returns the number of bytes of the buffers in the stash
+     */
+    std::size_t bytes() const {
+        return held;
+    }
+
+private:
+    struct entry {
+        std::type_index type;            ///< The type of the buffer
+        std::vector<std::size_t> shape;  ///< The shape of the buffer
+        std::size_t bytes;               ///< The size of the buffer, in bytes
+        std::shared_ptr<void> buffer;    ///< The buffer
+    };
+
+    std::size_t capacity;       ///< The maximum number of buffers
+    std::size_t held = 0;       ///< The number of bytes of the buffers
+    std::vector<entry> entries; ///< The buffers, from the oldest to the newest
+};
+
+/*!
+ * \brief Release the memory of the given buffer into the stash, its shape
+ * is saved to be able to restore it. Does nothing for fast matrices.
+ *
+ * The memory is only freed once the buffer leaves the stash, the bytes
+ * held by the stash must be subtracted from the released bytes.
+ *
+ * \param m The buffer to release
+ * \param shape The saved shape of the buffer
+ * \param stash The stash of released buffers
+ *
+ * \return The number of bytes released
+ */
+template <typename M, cpp_enable_if(etl::decay_traits<M>::is_fast)>
+std::size_t release_buffer(M& /*m*/, std::vector<std::size_t>& /*shape*/, buffer_stash& /*stash*/) {
+    return 0;
+}
+
+/*!
+ * \copydoc release_buffer
+ */
+template <typename M, cpp_disable_if(etl::decay_traits<M>::is_fast)>
+std::size_t release_buffer(M& m, std::vector<std::size_t>& shape, buffer_stash& stash) {
+    if (!shape.empty() || !etl::size(m)) {
+        return 0;
+    }
+
+    constexpr const std::size_t D = etl::decay_traits<M>::dimensions();
+
+    for (std::size_t d = 0; d < D; ++d) {
+        shape.push_back(etl::dim(m, d));
+    }
+
+    const std::size_t bytes = etl::size(m) * sizeof(etl::value_t<M>);
+
+    stash.push(m, shape);
+
+    return bytes;
+}
+
+/*!
+ * \brief Restore a buffer previously released with release_buffer, from
+ * the stash if possible, otherwise by allocating it again. Its content is
+ * undefined. Does nothing if the buffer is not released.
+ *
+ * \param m The buffer to restore
+ * \param shape The saved shape of the buffer
+ * \param stash The stash of released buffers
+ */
+template <typename M, cpp_enable_if(etl::decay_traits<M>::is_fast)>
+void restore_buffer(M& /*m*/, std::vector<std::size_t>& /*shape*/, buffer_stash& /*stash*/) {}
+
+/*!
+ * \copydoc restore_buffer
+ */
+template <typename M, cpp_disable_if(etl::decay_traits<M>::is_fast)>
+void restore_buffer(M& m, std::vector<std::size_t>& shape, buffer_stash& stash) {
+    if (shape.empty()) {
+        return;
+    }
+
+    if (!stash.pop(m, shape)) {
+        m = checkpoint_detail::make_buffer<M>(shape, std::make_index_sequence<etl::decay_traits<M>::dimensions()>());
+    }
+
+    shape.clear();
+}
+
+} //end of dll namespace
@@ -0,0 +1,397 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*!
+ * \file distributed.hpp
+ * \brief Data-parallel training over several processes.
+ *
+ * Each process trains a replica of the network on its own shard of the
+ * dataset. Once a communicator is set, the trainers either average the
+ * gradients of each batch over all the processes before applying them
+ * (synchronous training) or average the weights themselves every few
+ * batches (model averaging).
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <utility>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "etl/etl.hpp"
+
+#include "dll/util/timers.hpp"
+#include "dll/util/metrics.hpp"
+#include "dll/util/scheduler.hpp"
+#include "dll/util/allreduce.hpp"
+
+namespace dll {
+
+/*!
+ * \brief The synchronization of the replicas
+ */
+enum class distributed_mode {
+    GRADIENTS, ///< Average the gradients of each batch
+    WEIGHTS    ///< Average the weights every period batches
+};
+
+/*!
+ * \brief The transport used between the workers of launch_workers
+ */
+enum class distributed_transport {
+    SHM, ///< Shared memory segment
+    TCP  ///< TCP ring on the loopback interface
+};
+
+/*!
+ * \brief The options of launch_workers
+ */
+struct distributed_options {
+    distributed_mode mode           = distributed_mode::GRADIENTS; ///< The synchronization of the replicas
+    std::size_t period              = 1;                           ///< The number of batches between two weights averages
+    distributed_transport transport = distributed_transport::SHM;  ///< The transport between the workers
+    std::size_t capacity            = 1UL << 22;                   ///< The size of the shared slot of each worker, in bytes
+    std::size_t port                = 29500;                       ///< The port of the first worker, 0 for any free ports (TCP)
+    std::size_t timeout             = 600;                         ///< The maximal wait at a barrier, in seconds (SHM)
+};
+
+namespace distributed_detail {
+
+/*!
+ * \brief The global state of the distributed training
+ */
+struct distributed_state {
+    communicator* comm    = nullptr;                     ///< The communicator (none if not distributed)
+    distributed_mode mode = distributed_mode::GRADIENTS; ///< The synchronization of the replicas
+    std::size_t period    = 1;                           ///< The number of batches between two weights averages
+    std::size_t steps     = 0;                           ///< The number of batches trained
+};
+
+inline distributed_state& state() {
+    static distributed_state s;
+    return s;
+}
+
+template <typename M>
+void average(M& m) {
+    if (etl::size(m)) {
+        state().comm->average(m.memory_start(), etl::size(m));
+    }
+}
+
+inline void average_all() {}
+
+template <typename M, typename... Rest>
+void average_all(M& m, Rest&... rest) {
+    average(m);
+    average_all(rest...);
+}
+
+template <typename M>
+void broadcast(M& m) {
+    if (etl::size(m)) {
+        state().comm->broadcast(m.memory_start(), etl::size(m));
+    }
+}
+
+inline void broadcast_all() {}
+
+template <typename M, typename... Rest>
+void broadcast_all(M& m, Rest&... rest) {
+    broadcast(m);
+    broadcast_all(rest...);
+}
+
+} //end of namespace distributed_detail
+
+/*!
+ * \brief Set the communicator used by the trainers of this process.
+ * \param comm The communicator, nullptr to disable the distributed training
+ * \param mode The synchronization of the replicas
+ * \param period The number of batches between two weights averages
+ */
+inline void set_communicator(communicator* comm, distributed_mode mode = distributed_mode::GRADIENTS, std::size_t period = 1) {
+    auto& s = distributed_detail::state();
+
+    s.comm   = comm;
+    s.mode   = mode;
+    s.period = std::max<std::size_t>(period, 1);
+    s.steps  = 0;
+}
+
+/*!
+ * \brief Returns the communicator used by the trainers, nullptr if the
+ * training is not distributed
+ */
+inline communicator* get_communicator() {
+    return distributed_detail::state().comm;
+}
+
+/*!
+ * \brief Indicates if the training is distributed
+ */
+inline bool is_distributed() {
+    return get_communicator() != nullptr;
+}
+
+/*!
+ * \brief Mark the start of a new batch
+ */
+inline void distributed_step() {
+    if (is_distributed()) {
+        ++distributed_detail::state().steps;
+    }
+}
+
+/*!
+ * \brief Average the given gradients over all the processes, if the
+ * replicas are synchronized by their gradients
+ */
+template <typename... G>
+void average_gradients(G&... grads) {
+    auto& s = distributed_detail::state();
+
+    if (s.comm && s.mode == distributed_mode::GRADIENTS) {
+        dll::auto_timer timer("distributed:gradients");
+
+        distributed_detail::average_all(grads...);
+    }
+}
+
+/*!
+ * \brief Average the given weights over all the processes, if the
+ * replicas are synchronized by their weights and the current batch ends
+ * a period
+ */
+template <typename... W>
+void average_weights(W&... weights) {
+    auto& s = distributed_detail::state();
+
+    if (s.comm && s.mode == distributed_mode::WEIGHTS && s.steps % s.period == 0) {
+        dll::auto_timer timer("distributed:weights");
+
+        distributed_detail::average_all(weights...);
+    }
+}
+
+/*!
+ * \brief Replace the given weights by the weights of the first process,
+ * regardless of the synchronization mode. The trainers call it on all the
+ * parameters of the layers before training them, so that all the replicas
+ * start from the same initialization.
+ */
+template <typename... W>
+void synchronize_weights(W&... weights) {
+    if (is_distributed()) {
+        distributed_detail::broadcast_all(weights...);
+    }
+}
+
+/*!
+ * \brief Average the error and the loss of an epoch over all the
+ * processes, so that all the replicas take the same decisions at the end
+ * of the epoch.
+ */
+inline void average_epoch(double& error, double& loss) {
+    if (is_distributed()) {
+        double values[2] = {error, loss};
+
+        get_communicator()->average(values, 2);
+
+        error = values[0];
+        loss  = values[1];
+    }
+}
+
+/*!
+ * \brief Returns the shard of the given range for the current process.
+ *
+ * All the shards have the same size so that all the processes train the
+ * same number of batches, the last elements of the range may be left out.
+ */
+template <typename Iterator>
+std::pair<Iterator, Iterator> distributed_shard(Iterator first, Iterator last) {
+    auto* comm = get_communicator();
+
+    if (!comm) {
+        return {first, last};
+    }
+
+    const std::size_t shard = std::distance(first, last) / comm->size();
+
+    auto begin = std::next(first, comm->rank() * shard);
+
+    return {begin, std::next(begin, shard)};
+}
+
+/*!
+ * \brief Run the given functor in n worker processes, connected with a
+ * communicator.
+ *
+ * The workers are forked from the current process, the threads of the
+ * shared pool are divided between them. The functor is called with the
+ * rank of the worker and the number of workers and must return true on
+ * success. This must be called while no parallel loop is running.
+ *
+ * When a worker fails, the other workers waiting for it at a barrier of the
+ * shared segment are aborted.
+ *
+ * \param n The number of workers
+ * \param functor The training of each worker
+ * \param options The options of the distributed training
+ *
+ * \return The number of workers that failed
+ */
+template <typename Functor>
+std::size_t launch_workers(std::size_t n, Functor&& functor, const distributed_options& options = distributed_options()) {
+    void* segment = nullptr;
+
+    if (options.transport == distributed_transport::SHM) {
+        segment = shm_communicator::map_segment(n, options.capacity);
+
+        if (!segment) {
+            std::cerr << "DLL: Impossible to map the shared segment" << std::endl;
+            return n;
+        }
+    }
+
+    // The listeners are created before the fork, so that the ports are known by all the workers
+
+    std::vector<int> listeners;
+    std::vector<std::size_t> ports;
+
+    if (options.transport == distributed_transport::TCP && n > 1) {
+        try {
+            for (std::size_t rank = 0; rank < n; ++rank) {
+                listeners.push_back(tcp_communicator::listen_on(options.port ? options.port + rank : 0));
+                ports.push_back(tcp_communicator::local_port(listeners.back()));
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "DLL: " << e.what() << std::endl;
+
+            for (auto listener : listeners) {
+                close(listener);
+            }
+
+            return n;
+        }
+    }
+
+    const std::size_t worker_threads = std::max<std::size_t>(threads() / n, 1);
+
+    std::cout.flush();
+    std::cerr.flush();
+
+    std::vector<pid_t> workers;
+
+    for (std::size_t rank = 0; rank < n; ++rank) {
+        pid_t pid = fork();
+
+        if (pid == 0) {
+            int status = 1;
+
+            try {
+                reset_after_fork(worker_threads);
+                etl::local_context().serial = true;
+
+                std::unique_ptr<communicator> comm;
+
+                if (options.transport == distributed_transport::SHM) {
+                    comm = std::make_unique<shm_communicator>(segment, rank, n, options.capacity, options.timeout);
+                } else {
+                    int listener = -1;
+
+                    for (std::size_t other = 0; other < listeners.size(); ++other) {
+                        if (other == rank) {
+                            listener = listeners[other];
+                        } else {
+                            close(listeners[other]);
+                        }
+                    }
+
+                    comm = std::make_unique<tcp_communicator>(rank, listener, std::vector<std::string>(n, "127.0.0.1"), ports);
+                }
+
+                set_communicator(comm.get(), options.mode, options.period);
+
+                status = functor(rank, n) ? 0 : 1;
+
+                set_communicator(nullptr);
+            } catch (const std::exception& e) {
+                std::cerr << "DLL: Worker " << rank << " failed: " << e.what() << std::endl;
+            }
+
+            if (status && segment) {
+                shm_communicator::abort(segment);
+            }
+
+            // The records of the watchers are written by a thread that _exit does not wait for
+            dll::metrics().drain();
+
+            std::cout.flush();
+            std::cerr.flush();
+
+            // Do not run the destructors of the parent state
+            _exit(status);
+        }
+
+        if (pid > 0) {
+            workers.push_back(pid);
+        }
+    }
+
+    for (auto listener : listeners) {
+        close(listener);
+    }
+
+    std::size_t failures = n - workers.size();
+
+    // Poll the workers, a worker killed by a signal cannot abort the segment itself
+
+    while (!workers.empty()) {
+        if (failures && segment) {
+            shm_communicator::abort(segment);
+        }
+
+        for (auto it = workers.begin(); it != workers.end();) {
+            int status = 0;
+            pid_t pid  = waitpid(*it, &status, WNOHANG);
+
+            if (pid == 0) {
+                ++it;
+                continue;
+            }
+
+            if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+                ++failures;
+            }
+
+            it = workers.erase(it);
+        }
+
+        if (!workers.empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    if (segment) {
+        shm_communicator::unmap_segment(segment, n, options.capacity);
+    }
+
+    return failures;
+}
+
+} //end of dll namespace
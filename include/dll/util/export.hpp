@@ -20,18 +20,29 @@
 
 namespace dll {
 
-template <typename Features>
-void export_features_dll(const Features& features, const std::string& file) {
-    std::ofstream os(file);
-
+/*!
+ * \brief Write the given features as one line to the given stream
+ * \param first Iterator to the first feature
+ * \param last Iterator past the last feature
+ * \param os The output stream
+ */
+template <typename Iterator>
+void export_features_dll(Iterator first, Iterator last, std::ostream& os) {
     std::string comma = "";
 
-    for (auto& feature : features) {
-        os << comma << feature;
+    for (; first != last; ++first) {
+        os << comma << *first;
         comma = ";";
     }
 
     os << '\n';
 }
 
+template <typename Features>
+void export_features_dll(const Features& features, const std::string& file) {
+    std::ofstream os(file);
+
+    export_features_dll(features.begin(), features.end(), os);
+}
+
 } //end of dll namespace
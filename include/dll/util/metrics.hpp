@@ -0,0 +1,519 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*!
+ * \file metrics.hpp
+ * \brief Asynchronous pipeline for the training metrics.
+ *
+ * The watchers push compact records into a bounded lock-free queue and
+ * return immediately. A background thread formats the records and writes
+ * them to the configured sinks (console, CSV, JSON lines). The training
+ * thread never formats, writes or flushes anything itself.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include <pthread.h>
+
+#include "cpp_utils/assert.hpp"
+
+namespace dll {
+
+/*!
+ * \brief The type of a metric record
+ */
+enum class metric_kind : std::size_t {
+    RBM_BATCH,    ///< End of a batch of RBM training
+    RBM_EPOCH,    ///< End of an epoch of RBM training
+    FT_BATCH,     ///< End of a batch of fine-tuning
+    FT_EPOCH,     ///< End of an epoch of fine-tuning
+    LR_ADAPT,     ///< Adaptation of the learning rate
+    FT_CHECKPOINT ///< Memory freed by gradient checkpointing, at the end of fine-tuning
+};
+
+/*!
+ * \brief Returns a string representation of a metric kind
+ */
+inline const char* to_string(metric_kind kind) {
+    switch (kind) {
+        case metric_kind::RBM_BATCH:
+            return "rbm_batch";
+        case metric_kind::RBM_EPOCH:
+            return "rbm_epoch";
+        case metric_kind::FT_BATCH:
+            return "ft_batch";
+        case metric_kind::FT_EPOCH:
+            return "ft_epoch";
+        case metric_kind::LR_ADAPT:
+            return "lr_adapt";
+        case metric_kind::FT_CHECKPOINT:
+            return "ft_checkpoint";
+    }
+
+    return "unknown";
+}
+
+/*!
+ * \brief A metric record, as pushed by the watchers.
+ *
+ * The fields that do not make sense for the kind of the record are left
+ * to zero.
+ */
+struct metric_record {
+    metric_kind kind;             ///< The type of record
+    std::size_t epoch      = 0;   ///< The current epoch
+    std::size_t max_epochs = 0;   ///< The number of epochs of the training
+    std::size_t batch      = 0;   ///< The current batch
+    std::size_t batches    = 0;   ///< The number of batches of the epoch (0 if unknown)
+    double error           = 0.0; ///< The error (of the batch for batch records)
+    double loss            = 0.0; ///< The loss (of the batch for batch records)
+    double set_error       = 0.0; ///< The error on the whole set
+    double sparsity        = 0.0; ///< The sparsity of the hidden units
+    double free_energy     = 0.0; ///< The free energy
+    double learning_rate   = 0.0; ///< The learning rate
+    std::size_t duration   = 0;   ///< The duration of the epoch, in milliseconds
+    std::size_t bytes      = 0;   ///< The number of bytes of activations freed by checkpointing
+    bool has_free_energy   = false; ///< Indicates if the free energy is computed
+
+    explicit metric_record(metric_kind kind) : kind(kind) {}
+    metric_record() = default;
+};
+
+/*!
+ * \brief A destination for the metric records.
+ *
+ * The sinks are only used from the thread of the pipeline.
+ */
+struct metrics_sink {
+    virtual ~metrics_sink() = default;
+
+    /*!
+     * \brief Write the given record
+     */
+    virtual void write(const metric_record& record) = 0;
+
+    /*!
+     * \brief Flush the written records, called each time the queue is empty
+     */
+    virtual void flush() {}
+};
+
+/*!
+ * \brief Sink writing the records on the console, in the format of the
+ * default watchers
+ */
+struct console_sink final : metrics_sink {
+    void write(const metric_record& r) override {
+        switch (r.kind) {
+            case metric_kind::RBM_BATCH:
+                printf("Batch %ld/%ld - Reconstruction error: %.5f - Sparsity: %.5f\n", r.batch, r.batches, r.error, r.sparsity);
+                break;
+
+            case metric_kind::RBM_EPOCH:
+                if (r.has_free_energy) {
+                    printf("epoch %ld - Reconstruction error: %.5f - Free energy: %.3f - Sparsity: %.5f\n", r.epoch, r.error, r.free_energy, r.sparsity);
+                } else {
+                    printf("epoch %ld - Reconstruction error: %.5f - Sparsity: %.5f\n", r.epoch, r.error, r.sparsity);
+                }
+                break;
+
+            case metric_kind::FT_BATCH:
+                if (r.batches) {
+                    printf("Epoch %3ld:%ld/%ld- B. Error: %.5f B. Loss: %.5f Set: %.5f \n", r.epoch, r.batch, r.batches, r.error, r.loss, r.set_error);
+                } else {
+                    printf("Epoch %3ld - B.Error: %.5f B.Loss: %.5f Set: %.5f \n", r.epoch, r.error, r.loss, r.set_error);
+                }
+                break;
+
+            case metric_kind::FT_EPOCH:
+                printf("Epoch %3ld/%ld - Classification error: %.5f Loss: %.5f Time %ldms \n", r.epoch, r.max_epochs, r.error, r.loss, r.duration);
+                break;
+
+            case metric_kind::LR_ADAPT:
+                printf("driver: learning rate adapted to %.5f \n", r.learning_rate);
+                break;
+
+            case metric_kind::FT_CHECKPOINT:
+                printf("checkpoint: %ld bytes of activations freed \n", r.bytes);
+                break;
+        }
+    }
+
+    void flush() override {
+        std::cout.flush();
+        fflush(stdout);
+    }
+};
+
+/*!
+ * \brief Sink writing the records in a CSV file, one line per record
+ */
+struct csv_sink final : metrics_sink {
+    /*!
+     * \brief Create the sink and write the header of the file
+     * \param path The path to the file
+     */
+    explicit csv_sink(const std::string& path) : stream(path) {
+        stream << "kind,epoch,max_epochs,batch,batches,error,loss,set_error,sparsity,free_energy,learning_rate,duration,bytes\n";
+    }
+
+    void write(const metric_record& r) override {
+        char formatted[512];
+        snprintf(formatted, 512, "%s,%ld,%ld,%ld,%ld,%.7f,%.7f,%.7f,%.7f,%.7f,%.7f,%ld,%ld\n", to_string(r.kind), r.epoch, r.max_epochs, r.batch, r.batches,
+                 r.error, r.loss, r.set_error, r.sparsity, r.free_energy, r.learning_rate, r.duration, r.bytes);
+        stream << formatted;
+    }
+
+    void flush() override {
+        stream.flush();
+    }
+
+private:
+    std::ofstream stream; ///< The output file
+};
+
+/*!
+ * \brief Sink writing the records in a file, one JSON object per line
+ */
+struct json_sink final : metrics_sink {
+    /*!
+     * \brief Create the sink
+     * \param path The path to the file
+     */
+    explicit json_sink(const std::string& path) : stream(path) {}
+
+    void write(const metric_record& r) override {
+        char formatted[512];
+        snprintf(formatted, 512,
+                 "{\"kind\":\"%s\",\"epoch\":%ld,\"max_epochs\":%ld,\"batch\":%ld,\"batches\":%ld,\"error\":%.7f,\"loss\":%.7f,"
+                 "\"set_error\":%.7f,\"sparsity\":%.7f,\"free_energy\":%.7f,\"learning_rate\":%.7f,\"duration\":%ld,\"bytes\":%ld}\n",
+                 to_string(r.kind), r.epoch, r.max_epochs, r.batch, r.batches, r.error, r.loss, r.set_error, r.sparsity, r.free_energy,
+                 r.learning_rate, r.duration, r.bytes);
+        stream << formatted;
+    }
+
+    void flush() override {
+        stream.flush();
+    }
+
+private:
+    std::ofstream stream; ///< The output file
+};
+
+/*!
+ * \brief Bounded lock-free multi-producer multi-consumer queue.
+ *
+ * Each cell holds a sequence number indicating if it is ready to be
+ * written or read at the current position (Vyukov's bounded queue).
+ *
+ * \tparam T The type of the elements
+ * \tparam N The capacity of the queue, must be a power of two
+ */
+template <typename T, std::size_t N>
+struct bounded_queue {
+    static_assert(N && !(N & (N - 1)), "The capacity of the queue must be a power of two");
+
+    bounded_queue() {
+        for (std::size_t i = 0; i < N; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /*!
+     * \brief Push an element in the queue
+     * \return true if the element was pushed, false if the queue is full
+     */
+    bool try_push(const T& value) {
+        std::size_t pos = tail.load(std::memory_order_relaxed);
+
+        while (true) {
+            auto& cell      = cells[pos & (N - 1)];
+            std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+
+            if (seq == pos) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (seq < pos) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /*!
+     * \brief Pop an element from the queue
+     * \return true if an element was popped, false if the queue is empty
+     */
+    bool try_pop(T& value) {
+        std::size_t pos = head.load(std::memory_order_relaxed);
+
+        while (true) {
+            auto& cell      = cells[pos & (N - 1)];
+            std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+
+            if (seq == pos + 1) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = cell.value;
+                    cell.sequence.store(pos + N, std::memory_order_release);
+                    return true;
+                }
+            } else if (seq < pos + 1) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct cell_t {
+        std::atomic<std::size_t> sequence; ///< The position at which the cell is ready
+        T value;                           ///< The element
+    };
+
+    cell_t cells[N];                                ///< The cells of the queue
+    alignas(64) std::atomic<std::size_t> tail{0};   ///< The next position to push
+    alignas(64) std::atomic<std::size_t> head{0};   ///< The next position to pop
+};
+
+/*!
+ * \brief The pipeline between the watchers and the sinks.
+ *
+ * The background thread is started on the first record. When the queue
+ * is full, batch records are dropped (and counted) instead of blocking
+ * the training, epoch records wait for a free cell.
+ */
+struct metrics_pipeline {
+    static constexpr const std::size_t capacity = 4096; ///< The capacity of the queue
+
+    metrics_pipeline() {
+        sinks.push_back(std::make_unique<console_sink>());
+    }
+
+    metrics_pipeline(const metrics_pipeline& rhs) = delete;
+    metrics_pipeline& operator=(const metrics_pipeline& rhs) = delete;
+
+    ~metrics_pipeline() {
+        if (started.load()) {
+            stopping = true;
+            consumer->join();
+        }
+    }
+
+    /*!
+     * \brief Add a sink to the pipeline
+     */
+    void add_sink(std::unique_ptr<metrics_sink> sink) {
+        std::unique_lock<std::mutex> l(sinks_lock);
+        sinks.push_back(std::move(sink));
+    }
+
+    /*!
+     * \brief Remove all the sinks of the pipeline, including the console
+     */
+    void clear_sinks() {
+        drain();
+
+        std::unique_lock<std::mutex> l(sinks_lock);
+        sinks.clear();
+    }
+
+    /*!
+     * \brief Push a record in the pipeline, without blocking for batch records
+     */
+    void push(const metric_record& record) {
+        ensure_started();
+
+        const bool batch = record.kind == metric_kind::RBM_BATCH || record.kind == metric_kind::FT_BATCH;
+
+        while (!queue.try_push(record)) {
+            if (batch) {
+                ++dropped_records;
+                return;
+            }
+
+            std::this_thread::yield();
+        }
+
+        ++pushed;
+    }
+
+    /*!
+     * \brief Wait for all the pushed records to be written and flushed
+     */
+    void drain() {
+        if (!started.load()) {
+            return;
+        }
+
+        const std::size_t target = pushed.load();
+
+        while (flushed.load() < target) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    /*!
+     * \brief Returns the number of batch records dropped because the
+     * queue was full
+     */
+    std::size_t dropped() const {
+        return dropped_records.load();
+    }
+
+    /*!
+     * \brief Take the locks before fork(), so that the child inherits them
+     * in a consistent state
+     */
+    void prepare_fork() {
+        start_lock.lock();
+        sinks_lock.lock();
+    }
+
+    /*!
+     * \brief Release the locks in the parent after fork()
+     */
+    void parent_after_fork() {
+        sinks_lock.unlock();
+        start_lock.unlock();
+    }
+
+    /*!
+     * \brief Release the locks in the child after fork().
+     *
+     * The background thread does not exist in the child, its handle is
+     * abandoned and a new thread is started on the next record. The
+     * pending records are left to the parent.
+     */
+    void child_after_fork() {
+        metric_record record;
+
+        while (queue.try_pop(record)) {
+            // Written by the parent
+        }
+
+        flushed = pushed.load();
+
+        consumer.release();
+        started = false;
+
+        sinks_lock.unlock();
+        start_lock.unlock();
+    }
+
+private:
+    void ensure_started() {
+        if (started.load(std::memory_order_acquire)) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> l(start_lock);
+
+        if (!started.load()) {
+            stopping = false;
+            consumer = std::make_unique<std::thread>([this] { run(); });
+            started.store(true, std::memory_order_release);
+        }
+    }
+
+    void run() {
+        metric_record record;
+        std::size_t written = flushed.load();
+
+        while (true) {
+            bool any = false;
+
+            {
+                std::unique_lock<std::mutex> l(sinks_lock);
+
+                while (queue.try_pop(record)) {
+                    for (auto& sink : sinks) {
+                        sink->write(record);
+                    }
+
+                    ++written;
+                    any = true;
+                }
+
+                if (any) {
+                    for (auto& sink : sinks) {
+                        sink->flush();
+                    }
+                }
+            }
+
+            if (any) {
+                flushed.store(written);
+            } else if (stopping.load()) {
+                return;
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+        }
+    }
+
+    bounded_queue<metric_record, capacity> queue;       ///< The queue between the watchers and the thread
+    std::vector<std::unique_ptr<metrics_sink>> sinks;   ///< The sinks of the pipeline
+    std::mutex sinks_lock;                              ///< Lock protecting the sinks
+    std::mutex start_lock;                              ///< Lock protecting the start of the thread
+    std::unique_ptr<std::thread> consumer;              ///< The background thread
+    std::atomic<bool> started{false};                   ///< Indicates if the thread is running
+    std::atomic<bool> stopping{false};                  ///< Indicates if the thread must stop once the queue is empty
+    std::atomic<std::size_t> pushed{0};                 ///< The number of records pushed
+    std::atomic<std::size_t> flushed{0};                ///< The number of records written and flushed
+    std::atomic<std::size_t> dropped_records{0};        ///< The number of batch records dropped
+};
+
+namespace metrics_detail {
+
+inline void prepare_fork();
+inline void parent_after_fork();
+inline void child_after_fork();
+
+} //end of namespace metrics_detail
+
+/*!
+ * \brief Returns the metrics pipeline of the process
+ */
+inline metrics_pipeline& metrics() {
+    static metrics_pipeline pipeline;
+    static int registered = pthread_atfork(&metrics_detail::prepare_fork, &metrics_detail::parent_after_fork, &metrics_detail::child_after_fork);
+    cpp_unused(registered);
+    return pipeline;
+}
+
+namespace metrics_detail {
+
+inline void prepare_fork() {
+    metrics().prepare_fork();
+}
+
+inline void parent_after_fork() {
+    metrics().parent_after_fork();
+}
+
+inline void child_after_fork() {
+    metrics().child_after_fork();
+}
+
+} //end of namespace metrics_detail
+
+} //end of dll namespace
@@ -0,0 +1,219 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*!
+ * \file numa.hpp
+ * \brief NUMA-aware placement of the training buffers.
+ *
+ * When the NUMA mode is enabled, the workers of the shared pool are pinned
+ * in round robin on the CPUs of the NUMA nodes and the large dynamic
+ * training buffers (datasets, trainer scratch, SGD contexts of dynamic
+ * layers) are reallocated and first-touched by the workers, so that their
+ * pages are spread over the nodes of the threads that use them instead of
+ * all being placed on the node of the main thread. The buffers of fixed
+ * size live inside their owner object and are not moved.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <utility>
+#include <algorithm>
+
+#include "dll/util/scheduler.hpp"
+
+namespace dll {
+
+namespace numa_detail {
+
+inline bool& enabled() {
+    static bool numa = false;
+    return numa;
+}
+
+/*!
+ * \brief Parse a list of CPUs in the kernel format (e.g. "0-3,8-11")
+ */
+inline std::vector<std::size_t> parse_cpu_list(const std::string& list) {
+    std::vector<std::size_t> cpus;
+
+    std::stringstream stream(list);
+    std::string range;
+
+    while (std::getline(stream, range, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+
+        auto dash = range.find('-');
+
+        std::size_t first = std::stoul(range.substr(0, dash));
+        std::size_t last  = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+
+        for (std::size_t cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+
+    return cpus;
+}
+
+} //end of namespace numa_detail
+
+/*!
+ * \brief Returns the CPUs of each NUMA node of the machine.
+ *
+ * If the topology cannot be read, a single node containing all the
+ * threads of the shared pool is returned.
+ */
+inline std::vector<std::vector<std::size_t>> numa_nodes() {
+    std::vector<std::vector<std::size_t>> nodes;
+
+    for (std::size_t node = 0;; ++node) {
+        std::ifstream stream("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+
+        if (!stream) {
+            break;
+        }
+
+        std::string list;
+        std::getline(stream, list);
+
+        auto cpus = numa_detail::parse_cpu_list(list);
+
+        if (!cpus.empty()) {
+            nodes.push_back(std::move(cpus));
+        }
+    }
+
+    if (nodes.empty()) {
+        nodes.emplace_back(dll::threads());
+
+        for (std::size_t cpu = 0; cpu < dll::threads(); ++cpu) {
+            nodes.back()[cpu] = cpu;
+        }
+    }
+
+    return nodes;
+}
+
+/*!
+ * \brief Indicates if the NUMA mode is enabled
+ */
+inline bool numa_enabled() {
+    return numa_detail::enabled();
+}
+
+/*!
+ * \brief Enable the NUMA mode.
+ *
+ * The workers of the shared pool are pinned on the CPUs of the first
+ * nodes, alternating between the nodes, so that consecutive workers are
+ * placed on different nodes.
+ *
+ * \param n The number of nodes to use (all the nodes if zero)
+ */
+inline void enable_numa(std::size_t n = 0) {
+    auto nodes = numa_nodes();
+
+    if (n && n < nodes.size()) {
+        nodes.resize(n);
+    }
+
+    std::vector<std::size_t> cpus;
+
+    const std::size_t max_cpus = std::max_element(nodes.begin(), nodes.end(), [](auto& a, auto& b) { return a.size() < b.size(); })->size();
+
+    for (std::size_t c = 0; c < max_cpus; ++c) {
+        for (auto& node : nodes) {
+            if (c < node.size()) {
+                cpus.push_back(node[c]);
+            }
+        }
+    }
+
+    dll::set_threads(cpus.size());
+    dll::set_affinity(std::move(cpus));
+
+    numa_detail::enabled() = true;
+}
+
+/*!
+ * \brief Disable the NUMA mode, the workers are not pinned anymore.
+ */
+inline void disable_numa() {
+    dll::set_threads(0);
+    dll::set_affinity({});
+
+    numa_detail::enabled() = false;
+}
+
+namespace numa_detail {
+
+template <typename M, std::size_t... I>
+M allocate_like(const M& matrix, std::index_sequence<I...> /*seq*/) {
+    return M(etl::dim(matrix, I)...);
+}
+
+} //end of namespace numa_detail
+
+/*!
+ * \brief First-touch the given matrix from the workers of the pool.
+ *
+ * The memory of the matrix is replaced by a new uninitialized allocation
+ * whose rows are zeroed in blocks by the workers, so that its pages are
+ * placed on their nodes. Does nothing if the NUMA mode is not enabled.
+ *
+ * \param pool The thread pool
+ * \param matrix The matrix to touch, its content is lost
+ */
+template <typename Pool, typename M, cpp_disable_if(etl::decay_traits<M>::is_fast)>
+void first_touch(Pool& pool, M& matrix) {
+    const std::size_t n = etl::size(matrix);
+
+    if (!numa_enabled() || !n) {
+        return;
+    }
+
+    // The pages of the current memory may already have been touched
+    auto fresh = numa_detail::allocate_like(matrix, std::make_index_sequence<etl::decay_traits<M>::dimensions()>());
+
+    const std::size_t rows   = etl::dim<0>(fresh);
+    const std::size_t row    = n / rows;
+    const std::size_t blocks = std::min(rows, 4 * dll::threads());
+
+    auto* memory = fresh.memory_start();
+
+    parallel_foreach_n(pool, 0, blocks, [=](std::size_t b) {
+        std::fill(memory + ((b * rows) / blocks) * row, memory + (((b + 1) * rows) / blocks) * row, 0);
+    });
+
+    matrix = std::move(fresh);
+}
+
+/*!
+ * \brief First-touch the given matrix from the workers of the pool.
+ *
+ * The storage of the matrices of fixed size is part of the object holding
+ * them, its placement cannot be changed, nothing is done.
+ */
+template <typename Pool, typename M, cpp_enable_if(etl::decay_traits<M>::is_fast)>
+void first_touch(Pool& /*pool*/, M& /*matrix*/) {}
+
+/*!
+ * \brief First-touch all the given matrices from the workers of the pool.
+ */
+template <typename Pool, typename M1, typename M2, typename... M>
+void first_touch(Pool& pool, M1& m1, M2& m2, M&... matrices) {
+    first_touch(pool, m1);
+    first_touch(pool, m2, matrices...);
+}
+
+} //end of dll namespace
@@ -0,0 +1,200 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <vector>
+#include <numeric>
+#include <iterator>
+#include <algorithm>
+
+#include "dll/util/random.hpp"
+
+namespace dll {
+
+/*!
+ * \brief A permutation of the indices of a dataset.
+ *
+ * Shuffling the permutation instead of the dataset itself means the
+ * samples are never copied nor moved, the data can be read-only.
+ */
+struct permutation {
+    using index_iterator = std::vector<std::size_t>::const_iterator;
+
+    /*!
+     * \brief Create the identity permutation of the given size
+     * \param n The number of indices
+     */
+    explicit permutation(std::size_t n) : indices(n) {
+        std::iota(indices.begin(), indices.end(), std::size_t(0));
+    }
+
+    /*!
+     * \brief Shuffle the indices with the DLL random engine
+     */
+    void shuffle() {
+        decltype(auto) g = dll::rand_engine();
+        std::shuffle(indices.begin(), indices.end(), g);
+    }
+
+    /*!
+     * \brief Returns the index at the given position
+     */
+    std::size_t operator[](std::size_t i) const {
+        return indices[i];
+    }
+
+    /*!
+     * \brief Returns the number of indices
+     */
+    std::size_t size() const {
+        return indices.size();
+    }
+
+    index_iterator begin() const {
+        return indices.begin();
+    }
+
+    index_iterator end() const {
+        return indices.end();
+    }
+
+private:
+    std::vector<std::size_t> indices; ///< The permuted indices
+};
+
+/*!
+ * \brief Random access iterator visiting a random access range in the
+ * order given by a sequence of indices.
+ *
+ * Dereferencing the iterator gives direct access to the element of the
+ * underlying range, no copy is made.
+ */
+template <typename Iterator>
+struct permutation_iterator {
+    using base_traits       = std::iterator_traits<Iterator>;
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type        = typename base_traits::value_type;
+    using difference_type   = typename base_traits::difference_type;
+    using reference         = typename base_traits::reference;
+    using pointer           = typename base_traits::pointer;
+
+    using index_iterator = permutation::index_iterator;
+
+    permutation_iterator() = default;
+
+    permutation_iterator(Iterator base, index_iterator index)
+            : base(base), index(index) {}
+
+    reference operator*() const {
+        return base[*index];
+    }
+
+    pointer operator->() const {
+        return &base[*index];
+    }
+
+    reference operator[](difference_type n) const {
+        return base[index[n]];
+    }
+
+    permutation_iterator& operator++() {
+        ++index;
+        return *this;
+    }
+
+    permutation_iterator operator++(int) {
+        auto it = *this;
+        ++index;
+        return it;
+    }
+
+    permutation_iterator& operator--() {
+        --index;
+        return *this;
+    }
+
+    permutation_iterator operator--(int) {
+        auto it = *this;
+        --index;
+        return it;
+    }
+
+    permutation_iterator& operator+=(difference_type n) {
+        index += n;
+        return *this;
+    }
+
+    permutation_iterator& operator-=(difference_type n) {
+        index -= n;
+        return *this;
+    }
+
+    permutation_iterator operator+(difference_type n) const {
+        return {base, index + n};
+    }
+
+    permutation_iterator operator-(difference_type n) const {
+        return {base, index - n};
+    }
+
+    difference_type operator-(const permutation_iterator& rhs) const {
+        return index - rhs.index;
+    }
+
+    bool operator==(const permutation_iterator& rhs) const {
+        return index == rhs.index;
+    }
+
+    bool operator!=(const permutation_iterator& rhs) const {
+        return index != rhs.index;
+    }
+
+    bool operator<(const permutation_iterator& rhs) const {
+        return index < rhs.index;
+    }
+
+    bool operator>(const permutation_iterator& rhs) const {
+        return index > rhs.index;
+    }
+
+    bool operator<=(const permutation_iterator& rhs) const {
+        return index <= rhs.index;
+    }
+
+    bool operator>=(const permutation_iterator& rhs) const {
+        return index >= rhs.index;
+    }
+
+private:
+    Iterator base;        ///< The beginning of the underlying range
+    index_iterator index; ///< The current position in the indices
+};
+
+/*!
+ * \brief Returns an iterator on the first element of the range [first, ...) in permuted order
+ */
+template <typename Iterator>
+permutation_iterator<Iterator> permuted_begin(Iterator first, const permutation& p) {
+    return {first, p.begin()};
+}
+
+/*!
+ * \brief Returns an iterator past the last element of the range [first, ...) in permuted order
+ */
+template <typename Iterator>
+permutation_iterator<Iterator> permuted_end(Iterator first, const permutation& p) {
+    return {first, p.end()};
+}
+
+/*!
+ * \brief Traits indicating if an iterator is random access
+ */
+template <typename Iterator>
+using is_random_access_iterator = std::is_same<typename std::iterator_traits<Iterator>::iterator_category, std::random_access_iterator_tag>;
+
+} //end of dll namespace
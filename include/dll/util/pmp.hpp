@@ -0,0 +1,185 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*!
+ * \file pmp.hpp
+ * \brief Fused kernel for Probabilistic Max Pooling.
+ *
+ * The bias, the exponentials of each pooling block, the probabilities of
+ * the hidden units and the probabilities of the pooling units are all
+ * computed in the same pass over each pooling block, directly from the
+ * output of the convolution.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+#include "etl/etl.hpp"
+
+#include "dll/util/timers.hpp"
+#include "dll/util/scheduler.hpp"
+
+namespace dll {
+
+/*!
+ * \brief Minimum number of hidden units for the pooling to be done in parallel
+ */
+constexpr const std::size_t parallel_pmp_threshold = 1UL << 14;
+
+namespace pmp_detail {
+
+/*!
+ * \brief Compute the probabilities of one feature map.
+ *
+ * The probabilities are the same as etl::p_max_pool_h and
+ * etl::p_max_pool_p, computed relative to the maximum of each block to
+ * avoid overflows in the exponentials.
+ *
+ * \param h The output of the convolution, replaced by the probabilities of the hidden units
+ * \param p The probabilities of the pooling units (not computed if nullptr)
+ * \param bias The bias of the feature map
+ * \param scale The scale of the activations
+ * \param nh1 The first dimension of the map
+ * \param nh2 The second dimension of the map
+ * \param c The size of the pooling blocks
+ */
+template <typename T>
+void pmp_map(T* h, T* p, T bias, T scale, std::size_t nh1, std::size_t nh2, std::size_t c) {
+    const std::size_t np2 = nh2 / c;
+
+    for (std::size_t bi = 0; bi < nh1 / c; ++bi) {
+        for (std::size_t bj = 0; bj < np2; ++bj) {
+            T* block = h + bi * c * nh2 + bj * c;
+
+            // Activations and maximum of the block
+
+            T max = 0;
+
+            for (std::size_t i = 0; i < c; ++i) {
+                T* row = block + i * nh2;
+
+                for (std::size_t j = 0; j < c; ++j) {
+                    row[j] = scale * (bias + row[j]);
+                    max    = std::max(max, row[j]);
+                }
+            }
+
+            // Exponentials and normalization of the block
+
+            T sum = std::exp(-max);
+
+            for (std::size_t i = 0; i < c; ++i) {
+                T* row = block + i * nh2;
+
+                for (std::size_t j = 0; j < c; ++j) {
+                    row[j] = std::exp(row[j] - max);
+                    sum += row[j];
+                }
+            }
+
+            const T inv = T(1) / sum;
+
+            for (std::size_t i = 0; i < c; ++i) {
+                T* row = block + i * nh2;
+
+                for (std::size_t j = 0; j < c; ++j) {
+                    row[j] *= inv;
+                }
+            }
+
+            if (p) {
+                p[bi * np2 + bj] = std::exp(-max) * inv;
+            }
+        }
+    }
+}
+
+} //end of namespace pmp_detail
+
+/*!
+ * \brief Compute the probabilistic max pooling of the given convolution
+ * output, in place, and the probabilities of the pooling units.
+ *
+ * Large outputs are split in contiguous blocks of feature maps, each
+ * block being processed by a thread. Small outputs are processed
+ * directly by the calling thread.
+ *
+ * \tparam Parallel Indicates if the maps can be processed in parallel
+ * \param h The output of the convolution, replaced by the probabilities of the hidden units
+ * \param p The probabilities of the pooling units, [batch x] filters x NH1/c x NH2/c (not computed if nullptr)
+ * \param b The biases of the filters
+ * \param c The size of the pooling blocks
+ * \param scale The scale of the activations
+ */
+template <bool Parallel = true, typename H, typename B>
+void pmp_pooling(H&& h, etl::value_t<B>* p, const B& b, std::size_t c, etl::value_t<B> scale = 1) {
+    using T = etl::value_t<B>;
+
+    dll::auto_timer timer("pmp:fused");
+
+    constexpr const std::size_t D = etl::decay_traits<H>::dimensions();
+
+    const std::size_t nh1  = etl::dim(h, D - 2);
+    const std::size_t nh2  = etl::dim(h, D - 1);
+    const std::size_t k    = etl::size(b);
+    const std::size_t n    = etl::size(h);
+    const std::size_t maps = n / (nh1 * nh2);
+
+    const std::size_t map_size  = nh1 * nh2;
+    const std::size_t pool_size = (nh1 / c) * (nh2 / c);
+
+    T* memory       = h.memory_start();
+    const T* biases = b.memory_start();
+
+    auto pool_maps = [=](std::size_t first, std::size_t last) {
+        for (std::size_t m = first; m < last; ++m) {
+            pmp_detail::pmp_map(memory + m * map_size, p ? p + m * pool_size : nullptr, biases[m % k], scale, nh1, nh2, c);
+        }
+    };
+
+    const std::size_t blocks = std::min(maps, std::min(dll::threads(), n / parallel_pmp_threshold));
+
+    if (!Parallel || blocks < 2) {
+        pool_maps(0, maps);
+        return;
+    }
+
+    parallel_foreach_n(dll::shared_pool<Parallel>(), 0, blocks, [=](std::size_t b) {
+        pool_maps((b * maps) / blocks, ((b + 1) * maps) / blocks);
+    });
+}
+
+/*!
+ * \copydoc pmp_pooling
+ */
+template <bool Parallel = true, typename H, typename P, typename B, cpp_enable_if(etl::is_etl_expr<P>::value)>
+void pmp_pooling(H&& h, P& p, const B& b, std::size_t c, etl::value_t<B> scale = 1) {
+    pmp_pooling<Parallel>(h, p.memory_start(), b, c, scale);
+}
+
+/*!
+ * \brief Compute the probabilistic max pooling of the given convolution
+ * output, in place.
+ *
+ * The last two dimensions of h are the dimensions of the feature maps,
+ * the previous dimensions are [batch x] filters. Large outputs are
+ * processed in parallel.
+ *
+ * \tparam Parallel Indicates if the maps can be processed in parallel
+ * \param h The output of the convolution, replaced by the probabilities of the hidden units
+ * \param b The biases of the filters
+ * \param c The size of the pooling blocks
+ * \param scale The scale of the activations
+ */
+template <bool Parallel = true, typename H, typename B>
+void pmp_hidden(H&& h, const B& b, std::size_t c, etl::value_t<B> scale = 1) {
+    pmp_pooling<Parallel>(h, nullptr, b, c, scale);
+}
+
+} //end of dll namespace
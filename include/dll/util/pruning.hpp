@@ -0,0 +1,171 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*!
+ * \file pruning.hpp
+ * \brief Pruning of the weights of trained layers.
+ *
+ * The weights are zeroed either by magnitude or by whole output units
+ * (dense and RBM layers) or filters (convolutional layers). The sparse
+ * kernels are not enabled by pruning, sparsify() converts a pruned layer
+ * to its sparse representation once the benchmarks have shown that it is
+ * faster for this layer. The sparse representation is dropped as soon as
+ * the weights of the layer are trained, loaded or restored.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+
+#include "cpp_utils/tmp.hpp"
+
+#include "etl/etl.hpp"
+
+#include "dll/util/sparse.hpp"
+
+namespace dll {
+
+namespace pruning_detail {
+
+/*!
+ * \brief Returns the indices of the count smallest scores
+ */
+inline std::vector<std::size_t> smallest(const std::vector<double>& scores, std::size_t count) {
+    std::vector<std::size_t> indices(scores.size());
+    std::iota(indices.begin(), indices.end(), 0);
+
+    count = std::min(count, indices.size());
+
+    std::nth_element(indices.begin(), indices.begin() + count, indices.end(), [&scores](std::size_t a, std::size_t b) {
+        return scores[a] < scores[b];
+    });
+
+    indices.resize(count);
+
+    return indices;
+}
+
+} //end of namespace pruning_detail
+
+/*!
+ * \brief Zero the given ratio of the weights with the smallest magnitudes
+ * \param w The weights
+ * \param ratio The ratio of weights to zero, in [0, 1]
+ */
+template <typename W>
+void prune_magnitude(W& w, double ratio) {
+    const std::size_t n = etl::size(w);
+
+    std::vector<double> scores(n);
+
+    for (std::size_t i = 0; i < n; ++i) {
+        scores[i] = std::abs(w[i]);
+    }
+
+    for (auto i : pruning_detail::smallest(scores, n * ratio)) {
+        w[i] = 0;
+    }
+}
+
+/*!
+ * \brief Zero the given ratio of the output units with the smallest L2
+ * norms of a (inputs x outputs) weights matrix.
+ * \param w The weights
+ * \param ratio The ratio of output units to zero, in [0, 1]
+ */
+template <typename W, cpp_enable_if(etl::decay_traits<W>::dimensions() == 2)>
+void prune_structured(W& w, double ratio) {
+    const std::size_t V = etl::dim<0>(w);
+    const std::size_t H = etl::dim<1>(w);
+
+    std::vector<double> scores(H, 0.0);
+
+    for (std::size_t i = 0; i < V; ++i) {
+        for (std::size_t j = 0; j < H; ++j) {
+            scores[j] += w(i, j) * w(i, j);
+        }
+    }
+
+    for (auto j : pruning_detail::smallest(scores, H * ratio)) {
+        for (std::size_t i = 0; i < V; ++i) {
+            w(i, j) = 0;
+        }
+    }
+}
+
+/*!
+ * \brief Zero the given ratio of the filters with the smallest L2 norms of
+ * a (K x NC x NW1 x NW2) weights tensor.
+ * \param w The weights
+ * \param ratio The ratio of filters to zero, in [0, 1]
+ */
+template <typename W, cpp_enable_if(etl::decay_traits<W>::dimensions() == 4)>
+void prune_structured(W& w, double ratio) {
+    const std::size_t K = etl::dim<0>(w);
+
+    std::vector<double> scores(K);
+
+    for (std::size_t k = 0; k < K; ++k) {
+        scores[k] = etl::sum(w(k) >> w(k));
+    }
+
+    for (auto k : pruning_detail::smallest(scores, K * ratio)) {
+        w(k) = 0;
+    }
+}
+
+/*!
+ * \brief Prune the weights of the given layer by magnitude.
+ * \param layer The layer to prune
+ * \param ratio The ratio of weights to zero, in [0, 1]
+ */
+template <typename L>
+void prune(L& layer, double ratio) {
+    prune_magnitude(layer.w, ratio);
+    clear_sparse_weights(layer);
+}
+
+/*!
+ * \brief Prune whole output units (or filters) of the given layer.
+ * \param layer The layer to prune
+ * \param ratio The ratio of units (or filters) to zero, in [0, 1]
+ */
+template <typename L>
+void prune_units(L& layer, double ratio) {
+    prune_structured(layer.w, ratio);
+    clear_sparse_weights(layer);
+}
+
+/*!
+ * \brief Use the sparse kernels for the given pruned layer, if its density
+ * (or its ratio of remaining filters) is at most the given one.
+ *
+ * The sparse representation must be rebuilt with this function after the
+ * weights are modified directly.
+ *
+ * \param layer The pruned layer
+ * \param max_density The maximum density for the sparse kernels to be used
+ */
+template <typename L>
+void sparsify(L& layer, double max_density) {
+    layer.sparsify(max_density);
+}
+
+/*!
+ * \brief Use the sparse kernels for the given pruned layer, if its density
+ * is at most the default threshold of its kind of layer.
+ * \param layer The pruned layer
+ */
+template <typename L>
+void sparsify(L& layer) {
+    layer.sparsify();
+}
+
+} //end of dll namespace
@@ -0,0 +1,408 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*!
+ * \file scheduler.hpp
+ * \brief Process-wide thread pool used by all the parallel loops of DLL.
+ *
+ * All the networks, layers and trainers share the same pool of threads,
+ * instead of each creating their own. Parallel loops started from inside
+ * another parallel loop are run serially by the worker, and ETL kernels
+ * called from the workers are run serially as well, so that the number of
+ * active threads never exceeds the size of the pool.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <type_traits>
+
+#include <pthread.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "cpp_utils/tmp.hpp"
+#include "cpp_utils/maybe_parallel.hpp"
+
+#include "etl/etl.hpp"
+
+namespace dll {
+
+/*!
+ * \brief Handle on the shared thread pool of the process.
+ *
+ * The networks, layers and trainers keep a reference to the handle,
+ * whose address never changes. The pool itself is owned by the handle
+ * and is replaced by set_threads or after a fork.
+ */
+struct shared_thread_pool {
+    /*!
+     * \brief Returns the current pool, creating it if necessary
+     */
+    cpp::thread_pool<true>& get();
+
+    /*!
+     * \brief Replace the current pool, if any, by a pool of n threads.
+     *
+     * The new pool is created before the current one is joined, the
+     * handle is left unchanged if the creation throws.
+     */
+    void reset(std::size_t n) {
+        if (pool) {
+            auto fresh = std::make_unique<cpp::thread_pool<true>>(n);
+            pool       = std::move(fresh);
+        }
+    }
+
+    /*!
+     * \brief Abandon the current pool, in a process created by fork().
+     *
+     * The threads of the pool do not exist in the child, the pool cannot
+     * be joined nor destroyed, its memory is leaked.
+     */
+    void abandon() {
+        pool.release();
+    }
+
+private:
+    std::unique_ptr<cpp::thread_pool<true>> pool; ///< The current pool, created on first use
+};
+
+/*!
+ * \brief The type of the pool returned by shared_pool
+ */
+template <bool Parallel>
+using shared_pool_t = std::conditional_t<Parallel, shared_thread_pool, cpp::thread_pool<false>>;
+
+namespace scheduler_detail {
+
+/*!
+ * \brief The global state of the scheduler
+ */
+struct scheduler_state {
+    scheduler_state();
+
+    std::mutex lock;                                ///< Lock protecting the pool and the affinity
+    std::size_t threads = etl::threads;             ///< The number of threads of the pool
+    std::vector<std::size_t> cpus;                  ///< The CPUs on which to pin the workers (none if empty)
+    std::atomic<std::size_t> next_cpu{0};           ///< The next CPU to assign to a worker
+    std::atomic<std::size_t> generation{1};         ///< Incremented each time the affinity changes
+    shared_thread_pool pool;                        ///< The handle on the shared pool
+};
+
+inline scheduler_state& state() {
+    static scheduler_state s;
+    return s;
+}
+
+/*!
+ * \brief Take the lock before fork(), so that the child inherits it in a
+ * consistent state
+ */
+inline void prepare_fork() {
+    state().lock.lock();
+}
+
+/*!
+ * \brief Release the lock in the parent after fork()
+ */
+inline void parent_after_fork() {
+    state().lock.unlock();
+}
+
+/*!
+ * \brief Release the lock in the child after fork() and abandon the
+ * inherited pool, a new one is created on its next use
+ */
+inline void child_after_fork() {
+    auto& s = state();
+
+    s.pool.abandon();
+    s.lock.unlock();
+}
+
+inline scheduler_state::scheduler_state() {
+    pthread_atfork(&prepare_fork, &parent_after_fork, &child_after_fork);
+}
+
+/*!
+ * \brief Returns a reference to the flag indicating if the current
+ * thread is running a task of a parallel loop
+ */
+inline bool& in_region() {
+    static thread_local bool region = false;
+    return region;
+}
+
+/*!
+ * \brief Pin the current thread on the next configured CPU, if the
+ * affinity has changed since it was last pinned.
+ */
+inline void pin_worker() {
+    static thread_local std::size_t pinned = 0;
+
+    auto& s = state();
+
+    const auto generation = s.generation.load(std::memory_order_relaxed);
+
+    if (pinned == generation) {
+        return;
+    }
+
+    pinned = generation;
+
+#ifdef __linux__
+    std::unique_lock<std::mutex> l(s.lock);
+
+    if (!s.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(s.cpus[s.next_cpu++ % s.cpus.size()], &set);
+
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+    }
+#endif
+}
+
+/*!
+ * \brief RAII guard marking the current thread as running a task of a
+ * parallel loop. While the guard is alive, nested DLL loops and ETL
+ * kernels are run serially.
+ */
+struct region_guard {
+    region_guard() : previous(in_region()), serial(etl::local_context().serial) {
+        pin_worker();
+
+        in_region()                 = true;
+        etl::local_context().serial = true;
+    }
+
+    region_guard(const region_guard& rhs) = delete;
+    region_guard& operator=(const region_guard& rhs) = delete;
+
+    ~region_guard() {
+        in_region()                 = previous;
+        etl::local_context().serial = serial;
+    }
+
+private:
+    bool previous; ///< The previous value of the region flag
+    bool serial;   ///< The previous value of the ETL serial flag
+};
+
+} //end of namespace scheduler_detail
+
+/*!
+ * \brief Returns the number of threads of the shared pool
+ */
+inline std::size_t threads() {
+    return scheduler_detail::state().threads;
+}
+
+/*!
+ * \brief Set the number of threads of the shared pool.
+ *
+ * If the pool has already been created, it is replaced by a new pool with
+ * the new number of threads. The networks and trainers keep references to
+ * the handle of the shared pool, which does not change. This must not be
+ * called while a parallel loop is running.
+ *
+ * \param n The number of threads (etl::threads if zero)
+ */
+inline void set_threads(std::size_t n) {
+    auto& s = scheduler_detail::state();
+
+    std::unique_lock<std::mutex> l(s.lock);
+
+    s.pool.reset(n ? n : etl::threads);
+
+    s.threads = n ? n : etl::threads;
+}
+
+/*!
+ * \brief Reset the scheduler in a process created by fork().
+ *
+ * The pool inherited from the parent has already been abandoned by the
+ * fork handler of the scheduler, the new pool is created with n threads
+ * on its first use.
+ *
+ * \param n The number of threads of the new pool (etl::threads if zero)
+ */
+inline void reset_after_fork(std::size_t n) {
+    set_threads(n);
+}
+
+/*!
+ * \brief Pin the workers of the shared pool on the given CPUs, in round
+ * robin. An empty list disables pinning for the workers pinned from now
+ * on.
+ * \param cpus The indices of the CPUs to use
+ */
+inline void set_affinity(std::vector<std::size_t> cpus) {
+    auto& s = scheduler_detail::state();
+
+    std::unique_lock<std::mutex> l(s.lock);
+
+    s.cpus     = std::move(cpus);
+    s.next_cpu = 0;
+    ++s.generation;
+}
+
+inline cpp::thread_pool<true>& shared_thread_pool::get() {
+    auto& s = scheduler_detail::state();
+
+    std::unique_lock<std::mutex> l(s.lock);
+
+    if (!pool) {
+        pool = std::make_unique<cpp::thread_pool<true>>(s.threads);
+    }
+
+    return *pool;
+}
+
+/*!
+ * \brief Returns the handle on the shared thread pool of the process
+ */
+template <bool Parallel, cpp_enable_if(Parallel)>
+shared_thread_pool& shared_pool() {
+    return scheduler_detail::state().pool;
+}
+
+/*!
+ * \copydoc shared_pool
+ */
+template <bool Parallel, cpp_disable_if(Parallel)>
+cpp::thread_pool<false>& shared_pool() {
+    static cpp::thread_pool<false> pool;
+    return pool;
+}
+
+/*!
+ * \brief Indicates if the current thread is running inside a parallel
+ * loop of the scheduler
+ */
+inline bool in_parallel_region() {
+    return scheduler_detail::in_region();
+}
+
+/*!
+ * \brief Apply the functor to each element of the range, in parallel if
+ * the pool is parallel and the loop is not nested inside another
+ * parallel loop.
+ * \param pool The thread pool
+ * \param first The beginning of the range
+ * \param last The end of the range
+ * \param fun The functor, called with the element and its index
+ */
+template <bool Parallel, typename Iterator, typename Functor>
+void parallel_foreach_i(cpp::thread_pool<Parallel>& pool, Iterator first, Iterator last, Functor&& fun) {
+    if (!Parallel || in_parallel_region()) {
+        for (std::size_t i = 0; first != last; ++first, ++i) {
+            fun(*first, i);
+        }
+    } else {
+        maybe_parallel_foreach_i(pool, first, last, [&fun](auto& value, std::size_t i) {
+            scheduler_detail::region_guard guard;
+            fun(value, i);
+        });
+    }
+}
+
+/*!
+ * \brief Apply the functor to each index of [first, last), in parallel if
+ * the pool is parallel and the loop is not nested inside another
+ * parallel loop.
+ * \param pool The thread pool
+ * \param first The first index
+ * \param last The index past the last one
+ * \param fun The functor, called with the index
+ */
+template <bool Parallel, typename Functor>
+void parallel_foreach_n(cpp::thread_pool<Parallel>& pool, std::size_t first, std::size_t last, Functor&& fun) {
+    if (!Parallel || in_parallel_region()) {
+        for (std::size_t i = first; i < last; ++i) {
+            fun(i);
+        }
+    } else {
+        maybe_parallel_foreach_n(pool, first, last, [&fun](std::size_t i) {
+            scheduler_detail::region_guard guard;
+            fun(i);
+        });
+    }
+}
+
+/*!
+ * \brief Apply the functor to each pair of elements of the two ranges,
+ * in parallel if the pool is parallel and the loop is not nested inside
+ * another parallel loop.
+ * \param pool The thread pool
+ * \param first1 The beginning of the first range
+ * \param last1 The end of the first range
+ * \param first2 The beginning of the second range
+ * \param last2 The end of the second range
+ * \param fun The functor, called with the two elements and their index
+ */
+template <bool Parallel, typename Iterator1, typename Iterator2, typename Functor>
+void parallel_foreach_pair_i(cpp::thread_pool<Parallel>& pool, Iterator1 first1, Iterator1 last1, Iterator2 first2, Iterator2 last2, Functor&& fun) {
+    if (!Parallel || in_parallel_region()) {
+        for (std::size_t i = 0; first1 != last1 && first2 != last2; ++first1, ++first2, ++i) {
+            fun(*first1, *first2, i);
+        }
+    } else {
+        maybe_parallel_foreach_pair_i(pool, first1, last1, first2, last2, [&fun](auto& a, auto& b, std::size_t i) {
+            scheduler_detail::region_guard guard;
+            fun(a, b, i);
+        });
+    }
+}
+
+/*!
+ * \copydoc parallel_foreach_i
+ */
+template <typename Iterator, typename Functor>
+void parallel_foreach_i(shared_thread_pool& pool, Iterator first, Iterator last, Functor&& fun) {
+    // The nested loops are serial, they do not need the pool
+    if (in_parallel_region()) {
+        parallel_foreach_i(shared_pool<false>(), first, last, std::forward<Functor>(fun));
+    } else {
+        parallel_foreach_i(pool.get(), first, last, std::forward<Functor>(fun));
+    }
+}
+
+/*!
+ * \copydoc parallel_foreach_n
+ */
+template <typename Functor>
+void parallel_foreach_n(shared_thread_pool& pool, std::size_t first, std::size_t last, Functor&& fun) {
+    // The nested loops are serial, they do not need the pool
+    if (in_parallel_region()) {
+        parallel_foreach_n(shared_pool<false>(), first, last, std::forward<Functor>(fun));
+    } else {
+        parallel_foreach_n(pool.get(), first, last, std::forward<Functor>(fun));
+    }
+}
+
+/*!
+ * \copydoc parallel_foreach_pair_i
+ */
+template <typename Iterator1, typename Iterator2, typename Functor>
+void parallel_foreach_pair_i(shared_thread_pool& pool, Iterator1 first1, Iterator1 last1, Iterator2 first2, Iterator2 last2, Functor&& fun) {
+    // The nested loops are serial, they do not need the pool
+    if (in_parallel_region()) {
+        parallel_foreach_pair_i(shared_pool<false>(), first1, last1, first2, last2, std::forward<Functor>(fun));
+    } else {
+        parallel_foreach_pair_i(pool.get(), first1, last1, first2, last2, std::forward<Functor>(fun));
+    }
+}
+
+} //end of dll namespace
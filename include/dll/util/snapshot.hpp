@@ -0,0 +1,303 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*!
+ * \file snapshot.hpp
+ * \brief Snapshots of the parameters of the layers and asynchronous
+ * checkpoints of the networks.
+ *
+ * The snapshot buffers of the parameters are allocated once and then
+ * refreshed in place with a parallel copy. The checkpoints are serialized
+ * in memory on the training thread and written to disk by a background
+ * thread, with two buffers swapped between the two threads.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <streambuf>
+#include <condition_variable>
+
+#include "etl/etl.hpp"
+
+#include "dll/util/timers.hpp"
+#include "dll/util/scheduler.hpp"
+
+namespace dll {
+
+/*!
+ * \brief Minimum number of parameters for a snapshot to be copied in parallel
+ */
+constexpr const std::size_t parallel_snapshot_threshold = 1UL << 18;
+
+/*!
+ * \brief Copy the given parameters into the given buffer of the same shape,
+ * in parallel for large buffers.
+ */
+template <typename M>
+void snapshot_copy(M& dst, const M& src) {
+    const std::size_t n = etl::size(src);
+
+    if (n < parallel_snapshot_threshold) {
+        dst = src;
+        return;
+    }
+
+    auto* d       = dst.memory_start();
+    const auto* s = src.memory_start();
+
+    const std::size_t blocks = std::max(std::size_t(1), std::min(dll::threads(), n / parallel_snapshot_threshold));
+
+    std::vector<std::size_t> ids(blocks);
+
+    parallel_foreach_i(dll::shared_pool<true>(), ids.begin(), ids.end(), [=](std::size_t& /*id*/, std::size_t b) {
+        std::copy(s + (b * n) / blocks, s + ((b + 1) * n) / blocks, d + (b * n) / blocks);
+    });
+}
+
+/*!
+ * \brief Save the given parameters into the snapshot buffer.
+ *
+ * The buffer is allocated on the first snapshot (or when the shape of the
+ * parameters changes) and reused afterwards.
+ *
+ * \param snapshot The snapshot buffer
+ * \param value The parameters to save
+ */
+template <typename M>
+void backup_parameter(std::unique_ptr<M>& snapshot, const M& value) {
+    if (!snapshot || etl::size(*snapshot) != etl::size(value)) {
+        snapshot = std::make_unique<M>(value);
+    } else {
+        snapshot_copy(*snapshot, value);
+    }
+}
+
+/*!
+ * \brief Restore the given parameters from the snapshot buffer. Does
+ * nothing if no snapshot was taken.
+ *
+ * \param value The parameters to restore
+ * \param snapshot The snapshot buffer
+ */
+template <typename M>
+void restore_parameter(M& value, const std::unique_ptr<M>& snapshot) {
+    if (snapshot) {
+        snapshot_copy(value, *snapshot);
+    }
+}
+
+namespace snapshot_detail {
+
+/*!
+ * \brief Stream buffer appending to a vector of bytes. The capacity of the
+ * vector is kept between the serializations.
+ */
+struct vector_streambuf final : std::streambuf {
+    explicit vector_streambuf(std::vector<char>& buffer) : buffer(buffer) {
+        buffer.clear();
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (c != traits_type::eof()) {
+            buffer.push_back(traits_type::to_char_type(c));
+        }
+
+        return c;
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        buffer.insert(buffer.end(), s, s + n);
+        return n;
+    }
+
+private:
+    std::vector<char>& buffer; ///< The destination buffer
+};
+
+} //end of namespace snapshot_detail
+
+/*!
+ * \brief Writer of checkpoints on a background thread.
+ *
+ * The model is serialized (with its store function) in memory by the
+ * caller, which is bounded by the memory bandwidth, and the bytes are
+ * written to disk by the background thread. The file is written under a
+ * temporary name and renamed once complete, so that a checkpoint is never
+ * left half-written.
+ *
+ * If a checkpoint is requested while the previous one is still being
+ * written, it replaces any checkpoint waiting to be written.
+ */
+struct async_checkpoint_writer {
+    async_checkpoint_writer() = default;
+
+    async_checkpoint_writer(const async_checkpoint_writer& rhs) = delete;
+    async_checkpoint_writer& operator=(const async_checkpoint_writer& rhs) = delete;
+
+    ~async_checkpoint_writer() {
+        if (thread.joinable()) {
+            {
+                std::unique_lock<std::mutex> l(lock);
+                stopping = true;
+            }
+
+            condition.notify_all();
+            thread.join();
+        }
+    }
+
+    /*!
+     * \brief Write a checkpoint of the given model.
+     *
+     * Only the serialization in memory is done on the calling thread.
+     *
+     * \param model The model to save, must have a store(std::ostream&) function
+     * \param path The path of the checkpoint
+     */
+    template <typename Model>
+    void write(const Model& model, const std::string& path) {
+        dll::auto_timer timer("checkpoint:serialize");
+
+        {
+            snapshot_detail::vector_streambuf streambuf(scratch);
+            std::ostream os(&streambuf);
+            model.store(os);
+        }
+
+        {
+            std::unique_lock<std::mutex> l(lock);
+
+            // Hand the serialized bytes to the writer thread
+            std::swap(scratch, pending);
+            pending_path = path;
+
+            if (!has_pending) {
+                has_pending = true;
+                ++requested;
+            }
+
+            if (!thread.joinable()) {
+                thread = std::thread([this] { run(); });
+            }
+        }
+
+        condition.notify_all();
+    }
+
+    /*!
+     * \brief Wait for all the requested checkpoints to be written
+     */
+    void wait() {
+        std::unique_lock<std::mutex> l(lock);
+
+        condition.wait(l, [this] { return completed == requested; });
+    }
+
+    /*!
+     * \brief Returns the number of checkpoints written
+     */
+    std::size_t written() {
+        std::unique_lock<std::mutex> l(lock);
+        return completed;
+    }
+
+    /*!
+     * \brief Returns the number of checkpoints that could not be written
+     */
+    std::size_t failed() {
+        std::unique_lock<std::mutex> l(lock);
+        return failures;
+    }
+
+private:
+    void run() {
+        std::string path;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> l(lock);
+
+                condition.wait(l, [this] { return has_pending || stopping; });
+
+                if (!has_pending) {
+                    return;
+                }
+
+                std::swap(pending, writing);
+                path        = pending_path;
+                has_pending = false;
+            }
+
+            const bool success = write_file(path);
+
+            {
+                std::unique_lock<std::mutex> l(lock);
+
+                ++completed;
+
+                if (!success) {
+                    ++failures;
+                }
+            }
+
+            condition.notify_all();
+        }
+    }
+
+    bool write_file(const std::string& path) {
+        dll::auto_timer timer("checkpoint:write");
+
+        const std::string tmp = path + ".tmp";
+
+        {
+            std::ofstream os(tmp, std::ofstream::binary);
+            os.write(writing.data(), writing.size());
+
+            if (!os) {
+                std::cerr << "DLL: Impossible to write the checkpoint " << path << std::endl;
+                return false;
+            }
+        }
+
+        return !std::rename(tmp.c_str(), path.c_str());
+    }
+
+    std::vector<char> scratch; ///< The buffer of the serialization
+    std::vector<char> pending; ///< The serialized checkpoint waiting to be written
+    std::vector<char> writing; ///< The serialized checkpoint being written
+
+    std::string pending_path; ///< The path of the pending checkpoint
+
+    std::thread thread;                ///< The writer thread, started with the first checkpoint
+    std::mutex lock;                   ///< Lock protecting the pending checkpoint and the counters
+    std::condition_variable condition; ///< Condition for the pending checkpoint and the completions
+
+    bool has_pending      = false; ///< Indicates if a checkpoint is waiting to be written
+    bool stopping         = false; ///< Indicates if the thread must stop once idle
+    std::size_t requested = 0;     ///< The number of checkpoints to be written
+    std::size_t completed = 0;     ///< The number of checkpoints processed
+    std::size_t failures  = 0;     ///< The number of checkpoints that could not be written
+};
+
+/*!
+ * \brief Returns the checkpoint writer of the process
+ */
+inline async_checkpoint_writer& checkpoint_writer() {
+    static async_checkpoint_writer writer;
+    return writer;
+}
+
+} //end of dll namespace
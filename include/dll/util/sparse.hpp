@@ -0,0 +1,443 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*!
+ * \file sparse.hpp
+ * \brief Sparse kernels for layers with mostly zero inputs or with pruned
+ * weights.
+ */
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "cpp_utils/tmp.hpp"
+
+#include "etl/etl.hpp"
+
+#include "dll/base_conf.hpp"
+#include "dll/util/timers.hpp"
+
+namespace dll {
+
+/*!
+ * \brief Maximum density (ratio of non-zero values) of an input for the
+ * sparse kernels to be used instead of the dense ones.
+ */
+constexpr const double sparse_density_threshold = 0.25;
+
+/*!
+ * \brief Default maximum density of pruned weights for the sparse weights
+ * kernels to be used instead of the dense ones.
+ *
+ * The break-even point depends on the layer and on the BLAS in use, it
+ * must be measured with the inference/forward_batch/dense_pruned
+ * benchmark and given to sparsify() when it differs.
+ */
+constexpr const double sparse_weights_density_threshold = 0.3;
+
+/*!
+ * \brief Default maximum ratio of remaining filters of a pruned
+ * convolutional layer for the compacted filters to be used instead of the
+ * full ones.
+ */
+constexpr const double sparse_filters_density_threshold = 0.9;
+
+/*!
+ * \brief Indicates if the layer described by the given descriptor uses
+ * the sparse input kernels
+ */
+template <typename Desc>
+constexpr bool has_sparse_input() {
+    return Desc::parameters::template contains<sparse_input>();
+}
+
+/*!
+ * \brief A batch of samples stored in Compressed Sparse Row (CSR) format
+ */
+template <typename T>
+struct sparse_batch {
+    std::vector<T> values;            ///< The non-zero values
+    std::vector<std::size_t> columns; ///< The column of each non-zero value
+    std::vector<std::size_t> rows;    ///< The position of the first value of each row, plus the end
+
+    /*!
+     * \brief Returns the number of samples in the batch
+     */
+    std::size_t size() const {
+        return rows.size() - 1;
+    }
+};
+
+namespace sparse_detail {
+
+/*!
+ * \brief Convert the given input, as B rows, to CSR format, in a single
+ * pass, stopping as soon as it is too dense for the sparse kernels.
+ * \return true if the input has been converted, false if it is too dense
+ */
+template <typename M>
+bool make_csr(const M& input, std::size_t B, sparse_batch<etl::value_t<M>>& sparse) {
+    const std::size_t N       = etl::size(input) / B;
+    const std::size_t max_nnz = etl::size(input) * sparse_density_threshold;
+
+    sparse.values.clear();
+    sparse.columns.clear();
+    sparse.rows.clear();
+
+    sparse.values.reserve(max_nnz);
+    sparse.columns.reserve(max_nnz);
+    sparse.rows.reserve(B + 1);
+    sparse.rows.push_back(0);
+
+    for (std::size_t s = 0; s < B; ++s) {
+        for (std::size_t i = 0; i < N; ++i) {
+            auto value = input[s * N + i];
+
+            if (value != 0.0) {
+                if (sparse.values.size() == max_nnz) {
+                    return false;
+                }
+
+                sparse.values.push_back(value);
+                sparse.columns.push_back(i);
+            }
+        }
+
+        sparse.rows.push_back(sparse.values.size());
+    }
+
+    return true;
+}
+
+} //end of namespace sparse_detail
+
+/*!
+ * \brief Convert a dense batch to CSR format, if it is sparse enough for
+ * the sparse kernels to be faster than the dense ones.
+ *
+ * The input is scanned only once, the conversion is abandoned as soon as
+ * too many non-zero values are found.
+ *
+ * \param input The dense batch, each row is a sample
+ * \param sparse The sparse batch to fill
+ * \return true if the batch has been converted, false if it is too dense
+ */
+template <typename M>
+bool make_sparse_batch(const M& input, sparse_batch<etl::value_t<M>>& sparse) {
+    dll::auto_timer timer("sparse:make_batch");
+
+    return sparse_detail::make_csr(input, etl::dim<0>(input), sparse);
+}
+
+/*!
+ * \brief Convert a dense sample to CSR format (a batch of one sample), if it
+ * is sparse enough for the sparse kernels to be faster than the dense ones.
+ * \param input The dense sample
+ * \param sparse The sparse batch to fill
+ * \return true if the sample has been converted, false if it is too dense
+ */
+template <typename M>
+bool make_sparse_sample(const M& input, sparse_batch<etl::value_t<M>>& sparse) {
+    dll::auto_timer timer("sparse:make_sample");
+
+    return sparse_detail::make_csr(input, 1, sparse);
+}
+
+/*!
+ * \brief Compute output = b + input * w for a sparse input sample.
+ *
+ * Only the rows of w corresponding to non-zero inputs are accessed.
+ *
+ * \param output The output vector
+ * \param input The sparse input, with a single sample
+ * \param w The weights matrix
+ * \param b The bias vector
+ */
+template <typename O, typename T, typename W, typename B>
+void sparse_linear_one(O&& output, const sparse_batch<T>& input, const W& w, const B& b) {
+    dll::auto_timer timer("sparse:linear_one");
+
+    output = b;
+
+    for (std::size_t k = input.rows[0]; k < input.rows[1]; ++k) {
+        output += input.values[k] * w(input.columns[k]);
+    }
+}
+
+/*!
+ * \brief Compute output = rep_l(b) + input * w for a sparse batch.
+ * \param output The output matrix, a row per sample
+ * \param input The sparse input batch
+ * \param w The weights matrix
+ * \param b The bias vector
+ */
+template <typename O, typename T, typename W, typename B>
+void sparse_linear(O&& output, const sparse_batch<T>& input, const W& w, const B& b) {
+    dll::auto_timer timer("sparse:linear");
+
+    for (std::size_t s = 0; s < input.size(); ++s) {
+        output(s) = b;
+
+        for (std::size_t k = input.rows[s]; k < input.rows[s + 1]; ++k) {
+            output(s) += input.values[k] * w(input.columns[k]);
+        }
+    }
+}
+
+/*!
+ * \brief Compute the outer product of a sparse batch and a dense batch,
+ * summed over the batch (the sparse equivalent of batch_outer).
+ * \param output The output matrix
+ * \param input The sparse batch
+ * \param rhs The dense batch
+ */
+template <typename O, typename T, typename R>
+void sparse_batch_outer(O&& output, const sparse_batch<T>& input, const R& rhs) {
+    dll::auto_timer timer("sparse:batch_outer");
+
+    output = 0;
+
+    for (std::size_t s = 0; s < input.size(); ++s) {
+        for (std::size_t k = input.rows[s]; k < input.rows[s + 1]; ++k) {
+            output(input.columns[k]) += input.values[k] * rhs(s);
+        }
+    }
+}
+
+/*!
+ * \brief Compute output = batch_outer(input, rhs), with the sparse kernel
+ * if enabled and if the input is sparse enough.
+ * \tparam Sparse Indicates if the sparse kernel can be used
+ */
+template <bool Sparse, typename O, typename I, typename R, cpp_enable_if(Sparse)>
+void select_batch_outer(O&& output, const I& input, const R& rhs) {
+    sparse_batch<etl::value_t<I>> sparse;
+
+    if (make_sparse_batch(input, sparse)) {
+        sparse_batch_outer(output, sparse, rhs);
+    } else {
+        output = batch_outer(input, rhs);
+    }
+}
+
+/*!
+ * \copydoc select_batch_outer
+ */
+template <bool Sparse, typename O, typename I, typename R, cpp_disable_if(Sparse)>
+void select_batch_outer(O&& output, const I& input, const R& rhs) {
+    output = batch_outer(input, rhs);
+}
+
+/*!
+ * \brief Returns the density (ratio of non-zero values) of the given matrix
+ */
+template <typename M>
+double density(const M& m) {
+    const std::size_t n = etl::size(m);
+
+    std::size_t nnz = 0;
+
+    for (std::size_t i = 0; i < n; ++i) {
+        if (m[i] != 0.0) {
+            ++nnz;
+        }
+    }
+
+    return n ? double(nnz) / n : 0.0;
+}
+
+/*!
+ * \brief A pruned weights matrix stored in Compressed Sparse Row (CSR)
+ * format, one row per output unit (the transpose of the weights).
+ */
+template <typename T>
+struct sparse_weights {
+    std::size_t inputs = 0;           ///< The number of input units
+    std::vector<T> values;            ///< The non-zero weights
+    std::vector<std::size_t> columns; ///< The input unit of each non-zero weight
+    std::vector<std::size_t> rows;    ///< The position of the first weight of each output unit, plus the end
+
+    /*!
+     * \brief Returns the number of output units
+     */
+    std::size_t outputs() const {
+        return rows.size() - 1;
+    }
+};
+
+/*!
+ * \brief Convert a (inputs x outputs) weights matrix to CSR format, if its
+ * density is at most the given one.
+ * \param w The weights matrix
+ * \param max_density The maximum density of the weights
+ * \return The sparse weights, or nullptr if the weights are too dense
+ */
+template <typename W>
+std::unique_ptr<sparse_weights<etl::value_t<W>>> make_sparse_weights(const W& w, double max_density = sparse_weights_density_threshold) {
+    if (density(w) > max_density) {
+        return nullptr;
+    }
+
+    dll::auto_timer timer("sparse:make_weights");
+
+    const std::size_t V = etl::dim<0>(w);
+    const std::size_t H = etl::dim<1>(w);
+
+    auto sparse = std::make_unique<sparse_weights<etl::value_t<W>>>();
+
+    sparse->inputs = V;
+    sparse->rows.reserve(H + 1);
+    sparse->rows.push_back(0);
+
+    for (std::size_t j = 0; j < H; ++j) {
+        for (std::size_t i = 0; i < V; ++i) {
+            auto value = w(i, j);
+
+            if (value != 0.0) {
+                sparse->values.push_back(value);
+                sparse->columns.push_back(i);
+            }
+        }
+
+        sparse->rows.push_back(sparse->values.size());
+    }
+
+    return sparse;
+}
+
+/*!
+ * \brief Compute output = rep_l(b) + input * w with pruned weights.
+ *
+ * The input and the output can have any dimensions, they are considered as
+ * batches of samples of w.inputs and w.outputs() values. Only the
+ * non-zero weights are accessed.
+ *
+ * \param output The output, a row per sample
+ * \param input The (dense) input, a row per sample
+ * \param w The sparse weights
+ * \param b The bias vector
+ */
+template <typename O, typename V, typename T, typename B>
+void sparse_weights_linear(O&& output, const V& input, const sparse_weights<T>& w, const B& b) {
+    dll::auto_timer timer("sparse:weights_linear");
+
+    const std::size_t H     = w.outputs();
+    const std::size_t Batch = etl::size(input) / w.inputs;
+
+    for (std::size_t s = 0; s < Batch; ++s) {
+        const std::size_t in = s * w.inputs;
+
+        for (std::size_t j = 0; j < H; ++j) {
+            T value = b[j];
+
+            for (std::size_t k = w.rows[j]; k < w.rows[j + 1]; ++k) {
+                value += w.values[k] * input[in + w.columns[k]];
+            }
+
+            output[s * H + j] = value;
+        }
+    }
+}
+
+/*!
+ * \brief The remaining filters of a pruned convolutional layer, compacted
+ * together.
+ */
+template <typename T>
+struct sparse_filters {
+    std::vector<std::size_t> alive; ///< The index of each remaining filter
+    etl::dyn_matrix<T, 4> w;        ///< The remaining filters
+};
+
+/*!
+ * \brief Compact the non-zero filters of a (K x NC x NW1 x NW2) weights
+ * tensor, if the ratio of remaining filters is at most the given one.
+ * \param w The filters
+ * \param max_ratio The maximum ratio of remaining filters
+ * \return The compacted filters, or nullptr if not enough filters are pruned
+ */
+template <typename W>
+std::unique_ptr<sparse_filters<etl::value_t<W>>> make_sparse_filters(const W& w, double max_ratio = sparse_filters_density_threshold) {
+    const std::size_t K = etl::dim<0>(w);
+
+    std::vector<std::size_t> alive;
+
+    for (std::size_t k = 0; k < K; ++k) {
+        if (density(w(k)) > 0.0) {
+            alive.push_back(k);
+        }
+    }
+
+    if (alive.size() > K * max_ratio) {
+        return nullptr;
+    }
+
+    auto sparse = std::make_unique<sparse_filters<etl::value_t<W>>>();
+
+    sparse->alive = std::move(alive);
+    sparse->w     = etl::dyn_matrix<etl::value_t<W>, 4>(std::max(sparse->alive.size(), std::size_t(1)), etl::dim<1>(w), etl::dim<2>(w), etl::dim<3>(w));
+    sparse->w     = 0;
+
+    for (std::size_t a = 0; a < sparse->alive.size(); ++a) {
+        sparse->w(a) = w(sparse->alive[a]);
+    }
+
+    return sparse;
+}
+
+/*!
+ * \brief Compute output = conv_4d_valid_flipped(input, w) with the
+ * compacted filters of a pruned layer, the outputs of the pruned filters
+ * are zero.
+ * \param output The output, (B x K x NH1 x NH2)
+ * \param input The input, (B x NC x NV1 x NV2)
+ * \param w The compacted filters
+ */
+template <typename O, typename V, typename T>
+void sparse_filters_conv(O&& output, const V& input, const sparse_filters<T>& w) {
+    dll::auto_timer timer("sparse:filters_conv");
+
+    const std::size_t Batch = etl::dim<0>(input);
+
+    etl::dyn_matrix<T, 4> compact(Batch, etl::dim<0>(w.w), etl::dim<2>(output), etl::dim<3>(output));
+
+    compact = etl::conv_4d_valid_flipped(input, w.w);
+
+    output = 0;
+
+    for (std::size_t s = 0; s < Batch; ++s) {
+        for (std::size_t a = 0; a < w.alive.size(); ++a) {
+            output(s)(w.alive[a]) = compact(s)(a);
+        }
+    }
+}
+
+namespace sparse_detail {
+
+template <typename L>
+auto clear_sparse_weights(L& layer, int /*select*/) -> decltype(layer.sparse_w.reset(), void()) {
+    layer.sparse_w.reset();
+}
+
+template <typename L>
+void clear_sparse_weights(L& /*layer*/, long /*select*/) {}
+
+} //end of namespace sparse_detail
+
+/*!
+ * \brief Drop the sparse weights of the given layer, if any, when its
+ * weights are modified or replaced.
+ */
+template <typename L>
+void clear_sparse_weights(L& layer) {
+    sparse_detail::clear_sparse_weights(layer, 0);
+}
+
+} //end of dll namespace
@@ -0,0 +1,173 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*!
+ * \file update.hpp
+ * \brief Fused kernels to update the parameters from their gradients.
+ *
+ * Weight decay, penalties, gradient clipping, momentum and learning rate
+ * are applied in a single pass over each parameter tensor. The gradients
+ * are only read, never written back.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+#include "etl/etl.hpp"
+
+#include "dll/decay_type.hpp"
+#include "dll/util/timers.hpp"
+#include "dll/util/scheduler.hpp"
+
+namespace dll {
+
+/*!
+ * \brief Minimum number of parameters for an update to be done in parallel
+ */
+constexpr const std::size_t parallel_update_threshold = 1UL << 16;
+
+/*!
+ * \brief The hyper parameters of a fused update
+ */
+template <typename T>
+struct update_parameters {
+    T eps      = 0.0; ///< The learning rate, already scaled by the size of the batch
+    T momentum = 0.0; ///< The momentum
+    T l1       = 0.0; ///< The L1 weight cost
+    T l2       = 0.0; ///< The L2 weight cost
+    T penalty  = 0.0; ///< The penalty to subtract from each gradient
+    T scale    = 1.0; ///< The scale of the gradients (gradient clipping)
+};
+
+namespace update_detail {
+
+/*!
+ * \brief Compute the final value of one gradient, before scaling
+ */
+template <decay_type Decay, typename T>
+inline T decayed(T g, T v, const update_parameters<T>& p) {
+    if (Decay == decay_type::L1) {
+        return g - p.l1 * std::abs(v) - p.penalty;
+    } else if (Decay == decay_type::L2) {
+        return g - p.l2 * v - p.penalty;
+    } else if (Decay == decay_type::L1L2) {
+        return g - p.l1 * std::abs(v) - p.l2 * v - p.penalty;
+    } else {
+        return g - p.penalty;
+    }
+}
+
+template <decay_type Decay, bool Momentum, typename T>
+void update_block(T* value, const T* grad, T* inc, std::size_t first, std::size_t last, const update_parameters<T>& p) {
+    if (Momentum) {
+        for (std::size_t i = first; i < last; ++i) {
+            inc[i] = p.momentum * inc[i] + p.eps * p.scale * decayed<Decay>(grad[i], value[i], p);
+            value[i] += inc[i];
+        }
+    } else {
+        for (std::size_t i = first; i < last; ++i) {
+            value[i] += p.eps * p.scale * decayed<Decay>(grad[i], value[i], p);
+        }
+    }
+}
+
+template <decay_type Decay, bool Momentum, typename Pool, typename T>
+void update(Pool& pool, T* value, const T* grad, T* inc, std::size_t n, const update_parameters<T>& p) {
+    if (n < parallel_update_threshold) {
+        update_block<Decay, Momentum>(value, grad, inc, 0, n, p);
+        return;
+    }
+
+    const std::size_t blocks = std::max(std::size_t(1), std::min(dll::threads(), n / parallel_update_threshold));
+
+    parallel_foreach_n(pool, 0, blocks, [=, &p](std::size_t b) {
+        update_block<Decay, Momentum>(value, grad, inc, (b * n) / blocks, ((b + 1) * n) / blocks, p);
+    });
+}
+
+} //end of namespace update_detail
+
+/*!
+ * \brief Compute the scale to apply to the gradients so that their L2 norm
+ * (after decay and penalty) does not exceed the given threshold.
+ * \param value The parameters
+ * \param grad The gradients of the parameters
+ * \param p The hyper parameters of the update
+ * \param threshold The maximum norm of the gradients
+ * \param n The number of samples of the batch
+ * \return The scale of the gradients
+ */
+template <decay_type Decay, typename V, typename G, typename T>
+T clip_scale(const V& value, const G& grad, const update_parameters<T>& p, T threshold, double n) {
+    value.ensure_cpu_up_to_date();
+    grad.ensure_cpu_up_to_date();
+
+    const T* v = value.memory_start();
+    const T* g = grad.memory_start();
+
+    double sum = 0.0;
+
+    for (std::size_t i = 0; i < etl::size(value); ++i) {
+        auto x = update_detail::decayed<Decay>(g[i], v[i], p);
+        sum += x * x;
+    }
+
+    auto norm = std::sqrt(sum / (n * n));
+
+    return norm > threshold ? threshold / norm : T(1.0);
+}
+
+/*!
+ * \brief Update the parameters from their gradients, with momentum, in a
+ * single pass.
+ * \param pool The thread pool to use for large parameters
+ * \param value The parameters to update
+ * \param grad The gradients of the parameters
+ * \param inc The increments of the parameters (momentum)
+ * \param p The hyper parameters of the update
+ */
+template <decay_type Decay, typename Pool, typename V, typename G, typename I, typename T>
+void fused_update(Pool& pool, V& value, const G& grad, I& inc, const update_parameters<T>& p) {
+    dll::auto_timer timer("update:fused:momentum");
+
+    // The raw memory is accessed directly, it must be up to date on the CPU
+    value.ensure_cpu_up_to_date();
+    grad.ensure_cpu_up_to_date();
+    inc.ensure_cpu_up_to_date();
+
+    update_detail::update<Decay, true>(pool, value.memory_start(), grad.memory_start(), inc.memory_start(), etl::size(value), p);
+
+    // The copies on the GPU, if any, are now stale
+    value.invalidate_gpu();
+    inc.invalidate_gpu();
+}
+
+/*!
+ * \brief Update the parameters from their gradients, without momentum, in
+ * a single pass.
+ * \param pool The thread pool to use for large parameters
+ * \param value The parameters to update
+ * \param grad The gradients of the parameters
+ * \param p The hyper parameters of the update
+ */
+template <decay_type Decay, typename Pool, typename V, typename G, typename T>
+void fused_update(Pool& pool, V& value, const G& grad, const update_parameters<T>& p) {
+    dll::auto_timer timer("update:fused");
+
+    // The raw memory is accessed directly, it must be up to date on the CPU
+    value.ensure_cpu_up_to_date();
+    grad.ensure_cpu_up_to_date();
+
+    update_detail::update<Decay, false>(pool, value.memory_start(), grad.memory_start(), static_cast<T*>(nullptr), etl::size(value), p);
+
+    // The copy on the GPU, if any, is now stale
+    value.invalidate_gpu();
+}
+
+} //end of dll namespace
@@ -13,20 +13,32 @@
 
 #include "cpp_utils/stop_watch.hpp"
 
+#include "util/timers.hpp"
+#include "util/metrics.hpp"
+
 #include "trainer/rbm_training_context.hpp"
 #include "layer_traits.hpp"
 #include "dbn_traits.hpp"
 
 namespace dll {
 
+/*!
+ * \brief The default watcher of the RBM training.
+ *
+ * The batch and epoch metrics are pushed into the metrics pipeline and
+ * written by its background thread.
+ */
 template <typename R>
 struct default_rbm_watcher {
     cpp::stop_watch<std::chrono::seconds> watch;
+    dll::stop_timer epoch_timer;
 
     template <typename RBM = R>
     void training_begin(const RBM& rbm) {
         using rbm_t = std::decay_t<RBM>;
 
+        dll::metrics().drain();
+
         std::cout << "Train RBM with \"" << RBM::desc::template trainer_t<RBM, false>::name() << "\"" << std::endl;
 
         rbm.display();
@@ -68,34 +80,51 @@ struct default_rbm_watcher {
         } else if (rbm_layer_traits<RBM>::sparsity_method() == sparsity_method::LOCAL_TARGET) {
             std::cout << "   sparsity_target(Local)=" << rbm.sparsity_target << std::endl;
         }
+
+        epoch_timer.start();
     }
 
     template <typename RBM = R>
-    void epoch_end(std::size_t epoch, const rbm_training_context& context, const RBM& /*rbm*/) {
-        char formatted[1024];
-        if (rbm_layer_traits<RBM>::free_energy()) {
-            snprintf(formatted, 1024, "epoch %ld - Reconstruction error: %.5f - Free energy: %.3f - Sparsity: %.5f", epoch,
-                     context.reconstruction_error, context.free_energy, context.sparsity);
-        } else {
-            snprintf(formatted, 1024, "epoch %ld - Reconstruction error: %.5f - Sparsity: %.5f", epoch, context.reconstruction_error, context.sparsity);
-        }
-        std::cout << formatted << std::endl;
+    void epoch_end(std::size_t epoch, const rbm_training_context& context, const RBM& rbm) {
+        metric_record record(metric_kind::RBM_EPOCH);
+        record.epoch           = epoch;
+        record.error           = context.reconstruction_error;
+        record.sparsity        = context.sparsity;
+        record.free_energy     = context.free_energy;
+        record.has_free_energy = rbm_layer_traits<RBM>::free_energy();
+        record.learning_rate   = rbm.learning_rate;
+        record.duration        = epoch_timer.stop();
+
+        dll::metrics().push(record);
+
+        epoch_timer.start();
     }
 
     template <typename RBM = R>
     void batch_end(const RBM& /* rbm */, const rbm_training_context& context, std::size_t batch, std::size_t batches) {
-        char formatted[1024];
-        sprintf(formatted, "Batch %ld/%ld - Reconstruction error: %.5f - Sparsity: %.5f", batch, batches,
-                context.batch_error, context.batch_sparsity);
-        std::cout << formatted << std::endl;
+        metric_record record(metric_kind::RBM_BATCH);
+        record.batch    = batch;
+        record.batches  = batches;
+        record.error    = context.batch_error;
+        record.sparsity = context.batch_sparsity;
+
+        dll::metrics().push(record);
     }
 
     template <typename RBM = R>
     void training_end(const RBM&) {
+        dll::metrics().drain();
+
         std::cout << "Training took " << watch.elapsed() << "s" << std::endl;
     }
 };
 
+/*!
+ * \brief The default watcher of the DBN training.
+ *
+ * The fine-tuning metrics are pushed into the metrics pipeline and written
+ * by its background thread.
+ */
 template <typename DBN>
 struct default_dbn_watcher {
     static constexpr const bool ignore_sub  = false;
@@ -112,6 +141,8 @@ struct default_dbn_watcher {
 
     template <typename RBM>
     void pretrain_layer(const DBN& /*dbn*/, std::size_t I, const RBM& rbm, std::size_t input_size) {
+        dll::metrics().drain();
+
         if (input_size) {
             std::cout << "DBN: Pretrain layer " << I << " (" << rbm.to_short_string() << ") with " << input_size << " entries" << std::endl;
         } else {
@@ -120,6 +151,8 @@ struct default_dbn_watcher {
     }
 
     void pretraining_end(const DBN& /*dbn*/) {
+        dll::metrics().drain();
+
         std::cout << "DBN: Pretraining finished after " << watch.elapsed() << "s" << std::endl;
     }
 
@@ -133,6 +166,8 @@ struct default_dbn_watcher {
      * \param max_epochs The maximum number of epochs to train the network
      */
     void fine_tuning_begin(const DBN& dbn, size_t max_epochs) {
+        dll::metrics().drain();
+
         std::cout << "Train the network with \"" << DBN::desc::template trainer_t<DBN>::name() << "\"" << std::endl;
         std::cout << "With parameters:" << std::endl;
         std::cout << "          epochs=" << max_epochs << std::endl;
@@ -159,6 +194,10 @@ struct default_dbn_watcher {
             std::cout << "   lr_driver(STEP)=" << dbn.lr_step_size << ":" << dbn.lr_step_gamma << std::endl;
         }
 
+        if (dbn_traits<DBN>::checkpoint()) {
+            std::cout << "   checkpoint=" << dbn_traits<DBN>::checkpoint() << std::endl;
+        }
+
         ft_max_epochs = max_epochs;
     }
 
@@ -181,28 +220,63 @@ struct default_dbn_watcher {
      * \param dbn The network being trained
      */
     void ft_epoch_end(std::size_t epoch, double error, double loss, const DBN& dbn) {
-        cpp_unused(dbn);
-        auto duration = ft_epoch_timer.stop();
-        printf("Epoch %3ld/%ld - Classification error: %.5f Loss: %.5f Time %ldms \n", epoch, ft_max_epochs, error, loss, duration);
-        std::cout.flush();
+        metric_record record(metric_kind::FT_EPOCH);
+        record.epoch         = epoch;
+        record.max_epochs    = ft_max_epochs;
+        record.error         = error;
+        record.loss          = loss;
+        record.learning_rate = dbn.learning_rate;
+        record.duration      = ft_epoch_timer.stop();
+
+        dll::metrics().push(record);
     }
 
     void ft_batch_end(size_t epoch, size_t batch, size_t batches, double batch_error, double batch_loss, double error, const DBN&) {
-        printf("Epoch %3ld:%ld/%ld- B. Error: %.5f B. Loss: %.5f Set: %.5f \n", epoch, batch, batches, batch_error, batch_loss, error);
-        std::cout.flush();
+        metric_record record(metric_kind::FT_BATCH);
+        record.epoch     = epoch;
+        record.batch     = batch;
+        record.batches   = batches;
+        record.error     = batch_error;
+        record.loss      = batch_loss;
+        record.set_error = error;
+
+        dll::metrics().push(record);
     }
 
     void ft_batch_end(size_t epoch, double batch_error, double batch_loss, double error, const DBN&) {
-        printf("Epoch %3ld - B.Error: %.5f B.Loss: %.5f Set: %.5f \n", epoch, batch_error, batch_loss, error);
-        std::cout.flush();
+        metric_record record(metric_kind::FT_BATCH);
+        record.epoch     = epoch;
+        record.error     = batch_error;
+        record.loss      = batch_loss;
+        record.set_error = error;
+
+        dll::metrics().push(record);
     }
 
     void lr_adapt(const DBN& dbn) {
-        printf("driver: learning rate adapted to %.5f \n", dbn.learning_rate);
-        std::cout.flush();
+        metric_record record(metric_kind::LR_ADAPT);
+        record.learning_rate = dbn.learning_rate;
+
+        dll::metrics().push(record);
+    }
+
+    /*!
+     * \brief Fine-tuning with gradient checkpointing is over
+     * \param dbn The network being trained
+     * \param bytes The largest number of bytes of activations freed after a forward pass
+     */
+    void ft_checkpoint(const DBN& dbn, std::size_t bytes) {
+        cpp_unused(dbn);
+
+        metric_record record(metric_kind::FT_CHECKPOINT);
+        record.bytes = bytes;
+
+        dll::metrics().push(record);
     }
 
     void fine_tuning_end(const DBN&) {
+        dll::metrics().drain();
+
         std::cout << "Training took " << watch.elapsed() << "s" << std::endl;
     }
 };
@@ -238,6 +312,8 @@ struct mute_dbn_watcher {
 
     void lr_adapt(const DBN& /*dbn*/) {}
 
+    void ft_checkpoint(const DBN& /*dbn*/, std::size_t /*bytes*/) {}
+
     void fine_tuning_end(const DBN& /*dbn*/) {}
 };
 
@@ -0,0 +1,38 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "layer.hpp"
+
+namespace dllp {
+
+/*!
+ * \brief Indicates if the network can be run in interpreted mode, i.e.
+ * with the dynamic layers prebuilt in dllp, without generating and
+ * compiling code.
+ * \param layers The layers of the network
+ * \param t The task
+ * \param reason Set to the reason if the network cannot be interpreted
+ * \return true if the network can be interpreted, false otherwise
+ */
+bool interpretable(const layers_t& layers, const dll::processor::task& t, std::string& reason);
+
+/*!
+ * \brief Build the network at runtime from the given layers and execute
+ * the actions on it.
+ * \param layers The layers of the network
+ * \param t The task
+ * \param actions The actions to execute
+ * \return 0 on success, a non-zero error code otherwise
+ */
+int interpret(const layers_t& layers, dll::processor::task& t, const std::vector<std::string>& actions);
+
+} //end of namespace dllp
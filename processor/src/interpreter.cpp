@@ -0,0 +1,331 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Interpreted mode of dllp: the network is built at runtime with the
+ * dynamic layers, from a catalogue of network types prebuilt in dllp.
+ *
+ * The catalogue is made of the networks of 1 to max_depth layers, either
+ * all dense or all RBM, for the fine-tuning batch sizes of
+ * batch_sizes. The networks are always built with momentum and L1L2
+ * weight decay, the unused terms being disabled at runtime by setting
+ * their factors to zero.
+ */
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <algorithm>
+
+#include "dll/rbm/dyn_rbm.hpp"
+#include "dll/neural/dyn_dense_layer.hpp"
+#include "dll/trainer/stochastic_gradient_descent.hpp"
+#include "dll/dbn.hpp"
+
+#include "dll/processor/processor.hpp"
+
+#include "layer.hpp"
+#include "interpreter.hpp"
+
+namespace dllp {
+
+namespace {
+
+constexpr const double stupid_default = dll::processor::stupid_default;
+
+constexpr const std::size_t max_depth = 3; ///< The maximum number of layers of an interpreted network
+
+const std::vector<std::size_t> batch_sizes{1, 10, 20, 50, 100}; ///< The supported fine-tuning batch sizes
+
+using sample_t = etl::dyn_vector<float>;
+
+template <dll::function F>
+using dense_t = typename dll::dyn_dense_desc<dll::activation<F>>::layer_t;
+
+template <dll::unit_type Hidden>
+using rbm_t = typename dll::dyn_rbm_desc<dll::momentum, dll::weight_decay<dll::decay_type::L1L2>, dll::hidden<Hidden>>::layer_t;
+
+template <std::size_t B, typename... Layers>
+using network_t = typename dll::dbn_desc<
+    dll::dbn_layers<Layers...>,
+    dll::trainer<dll::sgd_trainer>,
+    dll::momentum,
+    dll::batch_size<B>,
+    dll::weight_decay<dll::decay_type::L1L2>>::dbn_t;
+
+/*!
+ * \brief The network made of D - 1 Hidden layers followed by a Last layer
+ */
+template <std::size_t B, std::size_t D, typename Hidden, typename Last, typename... Layers>
+struct network_of {
+    using type = typename network_of<B, D - 1, Hidden, Last, Hidden, Layers...>::type;
+};
+
+template <std::size_t B, typename Hidden, typename Last, typename... Layers>
+struct network_of<B, 1, Hidden, Last, Layers...> {
+    using type = network_t<B, Layers..., Last>;
+};
+
+const dllp::rbm_layer* as_rbm(const std::unique_ptr<dllp::layer>& layer) {
+    return dynamic_cast<const dllp::rbm_layer*>(layer.get());
+}
+
+const dllp::dense_layer* as_dense(const std::unique_ptr<dllp::layer>& layer) {
+    return dynamic_cast<const dllp::dense_layer*>(layer.get());
+}
+
+/*!
+ * \brief Returns the activation function of a dense layer
+ */
+std::string activation(const dllp::dense_layer& layer) {
+    return layer.activation.empty() ? "sigmoid" : layer.activation;
+}
+
+/*!
+ * \brief Returns the activation function of the hidden dense layers
+ */
+std::string hidden_activation(const layers_t& layers) {
+    if (layers.size() > 1) {
+        return activation(*as_dense(layers.front()));
+    }
+
+    auto last = activation(*as_dense(layers.back()));
+
+    return last == "softmax" ? "sigmoid" : last;
+}
+
+bool supported_decay(const std::string& decay) {
+    return decay == "none" || decay == "l1" || decay == "l2" || decay == "l1l2";
+}
+
+/*!
+ * \brief Returns the weight cost of the given decay term, zero if the term
+ * is not used by the decay
+ */
+double decay_cost(const std::string& decay, const std::string& term, double cost, double current) {
+    if (decay.find(term) == std::string::npos) {
+        return 0.0;
+    }
+
+    return cost != stupid_default ? cost : current;
+}
+
+bool interpretable_rbm(const layers_t& layers, std::string& reason) {
+    for (std::size_t i = 0; i < layers.size(); ++i) {
+        auto& rbm = *as_rbm(layers[i]);
+
+        if (!rbm.visible_unit.empty() && rbm.visible_unit != "binary") {
+            reason = "only binary visible units are supported";
+            return false;
+        }
+
+        if (!rbm.hidden_unit.empty() && rbm.hidden_unit != "binary" && (rbm.hidden_unit != "softmax" || i + 1 < layers.size())) {
+            reason = "only binary hidden units are supported (softmax for the last layer)";
+            return false;
+        }
+
+        if (rbm.sparsity != "none" || rbm.trainer != "cd" || rbm.shuffle || rbm.parallel_mode) {
+            reason = "sparsity, pcd, shuffle and parallel_mode are not supported";
+            return false;
+        }
+
+        if (!supported_decay(rbm.decay)) {
+            reason = "invalid weight decay: " + rbm.decay;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool interpretable_dense(const layers_t& layers, std::string& reason) {
+    auto hidden = hidden_activation(layers);
+
+    if (hidden == "softmax") {
+        reason = "softmax is only supported for the last layer";
+        return false;
+    }
+
+    for (std::size_t i = 0; i + 1 < layers.size(); ++i) {
+        if (activation(*as_dense(layers[i])) != hidden) {
+            reason = "all the hidden layers must have the same activation function";
+            return false;
+        }
+    }
+
+    auto last = activation(*as_dense(layers.back()));
+
+    if (last != hidden && last != "softmax") {
+        reason = "the last layer must use softmax or the activation function of the hidden layers";
+        return false;
+    }
+
+    return true;
+}
+
+template <typename Layer, cpp_enable_if(dll::decay_layer_traits<Layer>::is_rbm_layer())>
+void configure_layer(Layer& layer, const dllp::layer& desc) {
+    auto& rbm = static_cast<const dllp::rbm_layer&>(desc);
+
+    layer.init_layer(rbm.visible, rbm.hidden);
+
+    if (rbm.batch_size > 0) {
+        layer.batch_size = rbm.batch_size;
+    }
+
+    if (rbm.learning_rate != stupid_default) {
+        layer.learning_rate = rbm.learning_rate;
+    }
+
+    layer.initial_momentum = rbm.momentum != stupid_default ? rbm.momentum : 0.0;
+    layer.final_momentum   = rbm.momentum != stupid_default ? rbm.momentum : 0.0;
+
+    layer.l1_weight_cost = decay_cost(rbm.decay, "l1", rbm.l1_weight_cost, layer.l1_weight_cost);
+    layer.l2_weight_cost = decay_cost(rbm.decay, "l2", rbm.l2_weight_cost, layer.l2_weight_cost);
+}
+
+template <typename Layer, cpp_disable_if(dll::decay_layer_traits<Layer>::is_rbm_layer())>
+void configure_layer(Layer& layer, const dllp::layer& desc) {
+    auto& dense = static_cast<const dllp::dense_layer&>(desc);
+
+    layer.init_layer(dense.visible, dense.hidden);
+}
+
+template <typename DBN>
+int run(const layers_t& layers, dll::processor::task& t, const std::vector<std::string>& actions) {
+    auto dbn = std::make_unique<DBN>();
+
+    if (t.ft_desc.learning_rate != stupid_default) {
+        dbn->learning_rate = t.ft_desc.learning_rate;
+    }
+
+    dbn->initial_momentum = t.ft_desc.momentum != stupid_default ? t.ft_desc.momentum : 0.0;
+    dbn->final_momentum   = t.ft_desc.momentum != stupid_default ? t.ft_desc.momentum : 0.0;
+
+    dbn->l1_weight_cost = decay_cost(t.ft_desc.decay, "l1", t.ft_desc.l1_weight_cost, dbn->l1_weight_cost);
+    dbn->l2_weight_cost = decay_cost(t.ft_desc.decay, "l2", t.ft_desc.l2_weight_cost, dbn->l2_weight_cost);
+
+    std::size_t i = 0;
+
+    dbn->for_each_layer([&layers, &i](auto& layer) {
+        configure_layer(layer, *layers[i++]);
+    });
+
+    dll::processor::execute<sample_t, false>(*dbn, t, actions);
+
+    return 0;
+}
+
+template <std::size_t B, typename Hidden, typename Last>
+int run_depth(const layers_t& layers, dll::processor::task& t, const std::vector<std::string>& actions) {
+    static_assert(max_depth == 3, "run_depth must handle all the depths up to max_depth");
+
+    switch (layers.size()) {
+        case 1:
+            return run<typename network_of<B, 1, Hidden, Last>::type>(layers, t, actions);
+        case 2:
+            return run<typename network_of<B, 2, Hidden, Last>::type>(layers, t, actions);
+        default:
+            return run<typename network_of<B, 3, Hidden, Last>::type>(layers, t, actions);
+    }
+}
+
+template <std::size_t B, dll::function F>
+int run_dense(const layers_t& layers, dll::processor::task& t, const std::vector<std::string>& actions) {
+    if (activation(*as_dense(layers.back())) == "softmax") {
+        return run_depth<B, dense_t<F>, dense_t<dll::function::SOFTMAX>>(layers, t, actions);
+    } else {
+        return run_depth<B, dense_t<F>, dense_t<F>>(layers, t, actions);
+    }
+}
+
+template <std::size_t B>
+int run_batch(const layers_t& layers, dll::processor::task& t, const std::vector<std::string>& actions) {
+    if (as_rbm(layers.front())) {
+        if (as_rbm(layers.back())->hidden_unit == "softmax") {
+            return run_depth<B, rbm_t<dll::unit_type::BINARY>, rbm_t<dll::unit_type::SOFTMAX>>(layers, t, actions);
+        } else {
+            return run_depth<B, rbm_t<dll::unit_type::BINARY>, rbm_t<dll::unit_type::BINARY>>(layers, t, actions);
+        }
+    }
+
+    auto hidden = hidden_activation(layers);
+
+    if (hidden == "tanh") {
+        return run_dense<B, dll::function::TANH>(layers, t, actions);
+    } else if (hidden == "relu") {
+        return run_dense<B, dll::function::RELU>(layers, t, actions);
+    } else {
+        return run_dense<B, dll::function::SIGMOID>(layers, t, actions);
+    }
+}
+
+} //end of anonymous namespace
+
+bool interpretable(const layers_t& layers, const dll::processor::task& t, std::string& reason) {
+    if (layers.empty() || layers.size() > max_depth) {
+        reason = "only networks of 1 to " + std::to_string(max_depth) + " layers are supported";
+        return false;
+    }
+
+    if (t.general_desc.batch_mode || t.pt_desc.denoising) {
+        reason = "batch mode and denoising pretraining are not supported";
+        return false;
+    }
+
+    if (t.ft_desc.trainer != "sgd" && t.ft_desc.trainer != "none") {
+        reason = "only the sgd trainer is supported";
+        return false;
+    }
+
+    if (!supported_decay(t.ft_desc.decay)) {
+        reason = "invalid weight decay: " + t.ft_desc.decay;
+        return false;
+    }
+
+    const std::size_t batch = std::max(std::size_t(1), t.ft_desc.batch_size);
+
+    if (std::find(batch_sizes.begin(), batch_sizes.end(), batch) == batch_sizes.end()) {
+        reason = "unsupported batch size: " + std::to_string(batch);
+        return false;
+    }
+
+    if (std::all_of(layers.begin(), layers.end(), [](auto& layer) { return as_rbm(layer); })) {
+        return interpretable_rbm(layers, reason);
+    }
+
+    if (std::all_of(layers.begin(), layers.end(), [](auto& layer) { return as_dense(layer); })) {
+        return interpretable_dense(layers, reason);
+    }
+
+    reason = "only networks of rbm layers or of dense layers are supported";
+    return false;
+}
+
+int interpret(const layers_t& layers, dll::processor::task& t, const std::vector<std::string>& actions) {
+    auto final_actions = actions;
+
+    if (std::find(actions.begin(), actions.end(), "auto") != actions.end()) {
+        final_actions = t.default_actions;
+    }
+
+    switch (std::max(std::size_t(1), t.ft_desc.batch_size)) {
+        case 10:
+            return run_batch<10>(layers, t, final_actions);
+        case 20:
+            return run_batch<20>(layers, t, final_actions);
+        case 50:
+            return run_batch<50>(layers, t, final_actions);
+        case 100:
+            return run_batch<100>(layers, t, final_actions);
+        default:
+            return run_batch<1>(layers, t, final_actions);
+    }
+}
+
+} //end of namespace dllp
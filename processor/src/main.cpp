@@ -22,7 +22,7 @@
 namespace {
 
 void print_usage() {
-    std::cout << "Usage: dllp conf_file action" << std::endl;
+    std::cout << "Usage: dllp [--mkl] [--cufft] [--cublas] [--cache] [--interpreted] conf_file action" << std::endl;
 }
 
 void parse_options(int argc, char* argv[], dll::processor::options& opt, std::vector<std::string>& actions, std::string& source_file) {
@@ -41,6 +41,9 @@ void parse_options(int argc, char* argv[], dll::processor::options& opt, std::ve
         } else if (std::string(argv[i]) == "--cache") {
             opt.cache = true;
             ++i;
+        } else if (std::string(argv[i]) == "--interpreted") {
+            opt.interpreted = true;
+            ++i;
         } else {
             break;
         }
@@ -62,15 +65,6 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    //Check that $CXX is defined
-
-    const auto* cxx = std::getenv("CXX");
-
-    if (!cxx) {
-        std::cout << "CXX environment variable must be set" << std::endl;
-        return 2;
-    }
-
     //Parse the options
 
     dll::processor::options opt;
@@ -79,7 +73,7 @@ int main(int argc, char* argv[]) {
 
     parse_options(argc, argv, opt, actions, source_file);
 
-    //Process the file
+    //Process the file ($CXX is checked only if the network is compiled)
 
     return dll::processor::process_file(opt, actions, source_file);
 }
@@ -9,6 +9,7 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <memory>
 #include <cstdlib>
 
@@ -19,6 +20,7 @@
 
 #include "parse_utils.hpp"
 #include "layer.hpp"
+#include "interpreter.hpp"
 
 #include "dll/processor/processor.hpp"
 
@@ -80,6 +82,9 @@ dll::processor::datasource parse_datasource(const std::vector<std::string>& line
             source.normal_noise   = true;
             source.normal_noise_d = std::stod(extract_value(lines[i], "normal_noise: "));
             ++i;
+        } else if (starts_with(lines[i], "cache: ")) {
+            source.cache = extract_value(lines[i], "cache: ") == "true";
+            ++i;
         } else if (starts_with(lines[i], "shift: ")) {
             source.shift   = true;
             source.shift_d = std::stod(extract_value(lines[i], "shift: "));
@@ -172,6 +177,8 @@ bool parse_file(const std::string& source_file, dll::processor::task& t, std::ve
                     dllp::parse_datasource_pack(t.training, lines, ++i);
                 } else if (lines[i] == "testing:") {
                     dllp::parse_datasource_pack(t.testing, lines, ++i);
+                } else if (lines[i] == "predicting:") {
+                    dllp::parse_datasource_pack(t.predicting, lines, ++i);
                 } else {
                     break;
                 }
@@ -300,6 +307,39 @@ bool parse_file(const std::string& source_file, dll::processor::task& t, std::ve
                                 return false;
                             }
 
+                            ++i;
+                        } else {
+                            break;
+                        }
+                    }
+                } else if (lines[i] == "predict:") {
+                    ++i;
+
+                    while (i < lines.size()) {
+                        if (dllp::starts_with(lines[i], "file:")) {
+                            t.pr_desc.file = dllp::extract_value(lines[i], "file: ");
+                            ++i;
+                        } else if (dllp::starts_with(lines[i], "features_file:")) {
+                            t.pr_desc.features_file = dllp::extract_value(lines[i], "features_file: ");
+                            ++i;
+                        } else if (dllp::starts_with(lines[i], "format:")) {
+                            t.pr_desc.format = dllp::extract_value(lines[i], "format: ");
+
+                            if (t.pr_desc.format != "csv" && t.pr_desc.format != "binary") {
+                                std::cout << "dllp: error: invalid format must be one of [csv, binary]" << std::endl;
+                                return false;
+                            }
+
+                            ++i;
+                        } else if (dllp::starts_with(lines[i], "chunk:")) {
+                            const long chunk = std::stol(dllp::extract_value(lines[i], "chunk: "));
+
+                            if (chunk <= 0) {
+                                std::cout << "dllp: error: chunk must be strictly positive" << std::endl;
+                                return false;
+                            }
+
+                            t.pr_desc.chunk = chunk;
                             ++i;
                         } else {
                             break;
@@ -335,6 +375,56 @@ bool parse_file(const std::string& source_file, dll::processor::task& t, std::ve
     return true;
 }
 
+/*!
+ * \brief Indicates if the network must be interpreted rather than compiled.
+ *
+ * If the interpreted mode is asked for a network that cannot be
+ * interpreted, dllp falls back to the compiled mode.
+ */
+bool use_interpreter(const options& opt, const dll::processor::task& t, const std::vector<std::unique_ptr<dllp::layer>>& layers) {
+    if (!opt.interpreted) {
+        return false;
+    }
+
+    std::string reason;
+
+    if (!dllp::interpretable(layers, t, reason)) {
+        std::cout << "dllp: warning: the network cannot be interpreted (" << reason << "), it will be compiled" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Check that a compiler is available to compile the network
+ */
+bool check_compiler() {
+    if (!std::getenv("CXX")) {
+        std::cout << "CXX environment variable must be set" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Redirect std::cout to another stream for its lifetime
+ */
+struct cout_redirect {
+    explicit cout_redirect(std::ostream& os) : previous(std::cout.rdbuf(os.rdbuf())) {}
+
+    cout_redirect(const cout_redirect& rhs) = delete;
+    cout_redirect& operator=(const cout_redirect& rhs) = delete;
+
+    ~cout_redirect() {
+        std::cout.rdbuf(previous);
+    }
+
+private:
+    std::streambuf* previous; ///< The previous buffer of std::cout
+};
+
 bool compile_exe(const dllp::options& opt, const std::vector<std::string>& actions, const std::string& source_file, const dll::processor::task& t, const std::vector<std::unique_ptr<dllp::layer>>& layers) {
     bool process = true;
 
@@ -382,6 +472,7 @@ std::string datasource_to_string(const std::string& lhs, const dll::processor::d
     result += lhs + ".normal_noise = " + (ds.normal_noise ? "true" : "false") + ";\n";
     result += lhs + ".normal_noise_d = " + std::to_string(ds.normal_noise_d) + ";\n";
     result += lhs + ".limit = " + std::to_string(ds.limit) + ";\n";
+    result += lhs + ".cache = " + (ds.cache ? "true" : "false") + ";\n";
 
     return result;
 }
@@ -410,6 +501,17 @@ std::string w_desc_to_string(const std::string& lhs, const dll::processor::weigh
     return result;
 }
 
+std::string pr_desc_to_string(const std::string& lhs, const dll::processor::prediction_desc& desc) {
+    std::string result;
+
+    result += lhs + ".file = \"" + desc.file + "\";\n";
+    result += lhs + ".features_file = \"" + desc.features_file + "\";\n";
+    result += lhs + ".format = \"" + desc.format + "\";\n";
+    result += lhs + ".chunk = " + std::to_string(desc.chunk) + ";";
+
+    return result;
+}
+
 std::string task_to_string(const std::string& name, const dll::processor::task& t) {
     std::string result;
 
@@ -428,12 +530,16 @@ std::string task_to_string(const std::string& name, const dll::processor::task&
     result += "\n";
     result += datasource_to_string("   " + name + ".testing.labels", t.testing.labels);
     result += "\n";
+    result += datasource_to_string("   " + name + ".predicting.samples", t.predicting.samples);
+    result += "\n";
     result += pt_desc_to_string("   " + name + ".pt_desc", t.pt_desc);
     result += "\n";
     result += ft_desc_to_string("   " + name + ".ft_desc", t.ft_desc);
     result += "\n";
     result += w_desc_to_string("   " + name + ".w_desc", t.w_desc);
     result += "\n";
+    result += pr_desc_to_string("   " + name + ".pr_desc", t.pr_desc);
+    result += "\n";
 
     return result;
 }
@@ -458,20 +564,23 @@ std::string vector_to_string(const std::string& name, const std::vector<std::str
 }
 
 std::string get_data_type(const std::vector<std::unique_ptr<dllp::layer>>& layers, const dll::processor::task& t){
-    if(t.training.samples.reader == "mnist"){
+    //A network used only for scoring may not have training samples
+    auto& reader = t.training.samples.empty() && !t.predicting.samples.empty() ? t.predicting.samples.reader : t.training.samples.reader;
+
+    if(reader == "mnist"){
         if(layers.front()->is_conv()){
             return "etl::fast_dyn_matrix<float, 1, 28, 28>";
         } else {
             return "etl::fast_dyn_vector<float, 784>";
         }
-    } else if(t.training.samples.reader == "text"){
+    } else if(reader == "text"){
         if(layers.front()->is_conv()){
             return "etl::dyn_matrix<float, 3>";
         } else {
             return "etl::dyn_vector<float>";
         }
     } else {
-        std::cerr << "dllp: error: unknown samples reader: " << t.training.samples.reader << std::endl;
+        std::cerr << "dllp: error: unknown samples reader: " << reader << std::endl;
         return "";
     }
 }
@@ -660,13 +769,23 @@ int dll::processor::process_file(const dllp::options& opt, const std::vector<std
         return 1;
     }
 
-    //2. Generate the executable
+    //2. Interpret the network directly, if possible
+
+    if (dllp::use_interpreter(opt, t, layers)) {
+        return dllp::interpret(layers, t, actions);
+    }
+
+    if (!dllp::check_compiler()) {
+        return 2;
+    }
+
+    //3. Generate the executable
 
     if (!dllp::compile_exe(opt, actions, source_file, t, layers)) {
         return 1;
     }
 
-    //3. Run the generated program
+    //4. Run the generated program
 
     if (!opt.quiet) {
         std::cout << "Executing the program" << std::endl;
@@ -692,13 +811,36 @@ std::string dll::processor::process_file_result(const dllp::options& opt, const
         return "";
     }
 
-    //2. Generate the executable
+    //2. Interpret the network directly, if possible
+
+    std::stringstream output;
+    bool interpreted = false;
+
+    {
+        dllp::cout_redirect redirect(output);
+
+        interpreted = dllp::use_interpreter(opt, t, layers);
+
+        if (interpreted) {
+            dllp::interpret(layers, t, actions);
+        }
+    }
+
+    if (interpreted) {
+        return output.str();
+    }
+
+    if (!dllp::check_compiler()) {
+        return "";
+    }
+
+    //3. Generate the executable
 
     if (!dllp::compile_exe(opt, actions, source_file, t, layers)) {
         return "";
     }
 
-    //3. Execute and return the result directly
+    //4. Execute and return the result directly, after the warnings
 
-    return dllp::command_result("./.dbn.out");
+    return output.str() + dllp::command_result("./.dbn.out");
 }
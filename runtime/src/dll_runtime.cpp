@@ -0,0 +1,176 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "cpp_utils/assert.hpp"
+
+#include "dll/runtime/runtime_impl.hpp"
+
+namespace dll {
+
+namespace runtime {
+
+// Explicit instantiations of the catalogue
+
+template struct layer_impl<dense_t<function::IDENTITY>>;
+template struct layer_impl<dense_t<function::SIGMOID>>;
+template struct layer_impl<dense_t<function::TANH>>;
+template struct layer_impl<dense_t<function::RELU>>;
+template struct layer_impl<dense_t<function::SOFTMAX>>;
+
+template struct layer_impl<rbm_t<unit_type::BINARY, unit_type::BINARY>>;
+template struct layer_impl<rbm_t<unit_type::BINARY, unit_type::RELU>>;
+template struct layer_impl<rbm_t<unit_type::BINARY, unit_type::SOFTMAX>>;
+template struct layer_impl<rbm_t<unit_type::GAUSSIAN, unit_type::BINARY>>;
+template struct layer_impl<rbm_t<unit_type::GAUSSIAN, unit_type::RELU>>;
+template struct layer_impl<rbm_t<unit_type::GAUSSIAN, unit_type::SOFTMAX>>;
+
+namespace {
+
+template <unit_type V>
+std::unique_ptr<layer> make_rbm_hidden(std::size_t visible, std::size_t hidden, unit_type hidden_unit) {
+    switch (hidden_unit) {
+        case unit_type::BINARY:
+            return std::make_unique<layer_impl<rbm_t<V, unit_type::BINARY>>>(visible, hidden);
+        case unit_type::RELU:
+            return std::make_unique<layer_impl<rbm_t<V, unit_type::RELU>>>(visible, hidden);
+        case unit_type::SOFTMAX:
+            return std::make_unique<layer_impl<rbm_t<V, unit_type::SOFTMAX>>>(visible, hidden);
+        default:
+            return nullptr;
+    }
+}
+
+} // end of anonymous namespace
+
+std::unique_ptr<layer> make_dense(std::size_t visible, std::size_t hidden, function activation) {
+    switch (activation) {
+        case function::IDENTITY:
+            return std::make_unique<layer_impl<dense_t<function::IDENTITY>>>(visible, hidden);
+        case function::SIGMOID:
+            return std::make_unique<layer_impl<dense_t<function::SIGMOID>>>(visible, hidden);
+        case function::TANH:
+            return std::make_unique<layer_impl<dense_t<function::TANH>>>(visible, hidden);
+        case function::RELU:
+            return std::make_unique<layer_impl<dense_t<function::RELU>>>(visible, hidden);
+        case function::SOFTMAX:
+            return std::make_unique<layer_impl<dense_t<function::SOFTMAX>>>(visible, hidden);
+    }
+
+    return nullptr;
+}
+
+std::unique_ptr<layer> make_rbm(std::size_t visible, std::size_t hidden, unit_type visible_unit, unit_type hidden_unit) {
+    switch (visible_unit) {
+        case unit_type::BINARY:
+            return make_rbm_hidden<unit_type::BINARY>(visible, hidden, hidden_unit);
+        case unit_type::GAUSSIAN:
+            return make_rbm_hidden<unit_type::GAUSSIAN>(visible, hidden, hidden_unit);
+        default:
+            return nullptr;
+    }
+}
+
+void network::add(std::unique_ptr<layer> l) {
+    if (!l) {
+        throw std::invalid_argument("dll: runtime: invalid layer added to the network");
+    }
+
+    if (!stack.empty() && stack.back()->output_size() != l->input_size()) {
+        throw std::invalid_argument("dll: runtime: incompatible layer added to the network (" + std::to_string(l->input_size())
+                                    + " inputs for " + std::to_string(stack.back()->output_size()) + " outputs)");
+    }
+
+    stack.push_back(std::move(l));
+}
+
+std::size_t network::input_size() const {
+    return stack.empty() ? 0 : stack.front()->input_size();
+}
+
+std::size_t network::output_size() const {
+    return stack.empty() ? 0 : stack.back()->output_size();
+}
+
+std::vector<float> network::forward(const std::vector<float>& input, std::size_t batch) const {
+    cpp_assert(input.size() == batch * input_size(), "Invalid size of the input of the network");
+
+    std::vector<float> current(input);
+    std::vector<float> next;
+
+    for (auto& l : stack) {
+        next.resize(batch * l->output_size());
+        l->forward(current.data(), next.data(), batch);
+        std::swap(current, next);
+    }
+
+    return current;
+}
+
+void network::pretrain(const std::vector<std::vector<float>>& samples, std::size_t epochs, const hyper_parameters& params) {
+    std::vector<std::vector<float>> current(samples);
+
+    for (std::size_t i = 0; i < stack.size(); ++i) {
+        auto& l = *stack[i];
+
+        if (l.pretrainable()) {
+            std::cout << "DLL: Pretrain layer " << i << " (" << l.to_short_string() << ")" << std::endl;
+
+            l.pretrain(current, epochs, params);
+        }
+
+        // Compute the inputs of the next layer, one batch at a time
+        if (i + 1 < stack.size()) {
+            const std::size_t batch = std::max<std::size_t>(params.batch_size, 1);
+
+            std::vector<float> input;
+            std::vector<float> output;
+
+            for (std::size_t first = 0; first < current.size(); first += batch) {
+                const std::size_t n = std::min(batch, current.size() - first);
+
+                input.resize(n * l.input_size());
+                output.resize(n * l.output_size());
+
+                for (std::size_t b = 0; b < n; ++b) {
+                    std::copy(current[first + b].begin(), current[first + b].end(), input.begin() + b * l.input_size());
+                }
+
+                l.forward(input.data(), output.data(), n);
+
+                for (std::size_t b = 0; b < n; ++b) {
+                    current[first + b].assign(output.begin() + b * l.output_size(), output.begin() + (b + 1) * l.output_size());
+                }
+            }
+        }
+    }
+}
+
+void network::store(std::ostream& os) const {
+    for (auto& l : stack) {
+        l->store(os);
+    }
+}
+
+void network::load(std::istream& is) {
+    for (auto& l : stack) {
+        l->load(is);
+    }
+}
+
+void network::display() const {
+    for (std::size_t i = 0; i < stack.size(); ++i) {
+        std::cout << "Layer " << i << ": " << stack[i]->to_short_string() << std::endl;
+    }
+}
+
+} //end of namespace runtime
+
+} //end of namespace dll
@@ -0,0 +1,54 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <chrono>
+#include <iostream>
+
+#include "catch.hpp"
+
+#include "dll/rbm/rbm.hpp"
+#include "dll/util/numa.hpp"
+
+#include "mnist/mnist_reader.hpp"
+#include "mnist/mnist_utils.hpp"
+
+// Report the training throughput for each number of NUMA nodes
+TEST_CASE("rbm/perf/numa", "rbm::numa") {
+    using rbm_t = dll::rbm_desc<
+        28 * 28, 500,
+        dll::batch_size<64>,
+        dll::parallel_mode>::layer_t;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(2048);
+    REQUIRE(!dataset.training_images.empty());
+
+    mnist::binarize_dataset(dataset);
+
+    constexpr const std::size_t epochs = 5;
+
+    const auto nodes = dll::numa_nodes().size();
+
+    for (std::size_t n = 1; n <= nodes; ++n) {
+        dll::enable_numa(n);
+
+        auto rbm = std::make_unique<rbm_t>();
+
+        auto start = std::chrono::steady_clock::now();
+
+        rbm->train(dataset.training_images, epochs);
+
+        auto end = std::chrono::steady_clock::now();
+
+        auto seconds = std::chrono::duration_cast<std::chrono::duration<double>>(end - start).count();
+
+        std::cout << "numa: nodes=" << n
+                  << " threads=" << dll::threads()
+                  << " samples/s=" << (epochs * dataset.training_images.size()) / seconds << std::endl;
+    }
+
+    dll::disable_numa();
+}
@@ -174,3 +174,37 @@ TEST_CASE("unit/cdbn/mnist/6", "[cdbn][mp][svm][unit]") {
     std::cout << "test_error:" << test_error << std::endl;
     REQUIRE(test_error < 0.5);
 }
+
+TEST_CASE("unit/cdbn/batch/1", "[cdbn][crbm_mp][unit]") {
+    typedef dll::dbn_desc<
+        dll::dbn_layers<
+            dll::conv_rbm_desc_square<1, 28, 10, 9, dll::momentum, dll::batch_size<10>>::layer_t,
+            dll::mp_layer_3d_desc<10, 20, 20, 1, 2, 2>::layer_t,
+            dll::conv_rbm_mp_desc_square<10, 10, 10, 5, 2, dll::momentum, dll::batch_size<10>>::layer_t>>::dbn_t dbn_t;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::fast_dyn_matrix<float, 1, 28, 28>>(50);
+    REQUIRE(!dataset.training_images.empty());
+
+    mnist::binarize_dataset(dataset);
+
+    auto dbn = std::make_unique<dbn_t>();
+
+    dbn->pretrain(dataset.training_images, 2);
+
+    // The CRBM with Probabilistic Max Pooling must output its pooling units,
+    // in the batched path as well as for a single sample
+    auto batch = dbn->batch_features(dataset.training_images.begin(), dataset.training_images.end());
+
+    REQUIRE(batch.size() == dataset.training_images.size());
+
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        auto features = dbn->features(dataset.training_images[i]);
+
+        REQUIRE(etl::size(batch[i]) == dbn->output_size());
+        REQUIRE(etl::size(batch[i]) == etl::size(features));
+
+        for (std::size_t j = 0; j < etl::size(features); ++j) {
+            REQUIRE(batch[i][j] == Approx(features[j]).epsilon(1e-4));
+        }
+    }
+}
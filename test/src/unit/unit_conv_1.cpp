@@ -14,6 +14,7 @@
 #include "dll/transform/scale_layer.hpp"
 #include "dll/dbn.hpp"
 #include "dll/trainer/stochastic_gradient_descent.hpp"
+#include "dll/util/pruning.hpp"
 
 #include "mnist/mnist_reader.hpp"
 #include "mnist/mnist_utils.hpp"
@@ -164,3 +165,30 @@ TEST_CASE("unit/conv/sgd/partial/1", "[conv][dbn][mnist][sgd]") {
     std::cout << "test_error:" << test_error << std::endl;
     REQUIRE(test_error < 0.2);
 }
+
+// Test the compacted filters of a pruned layer
+TEST_CASE("unit/conv/prune/1", "[unit][conv][prune]") {
+    dll::conv_desc<1, 12, 12, 10, 3, 3, dll::activation<dll::function::RELU>>::layer_t layer;
+
+    dll::prune_units(layer, 0.5);
+    dll::sparsify(layer);
+
+    REQUIRE(layer.sparse_w);
+    REQUIRE(layer.sparse_w->alive.size() == 5);
+
+    etl::fast_matrix<float, 4, 1, 12, 12> input;
+    input = etl::normal_generator<float>(0.0, 1.0);
+
+    etl::fast_matrix<float, 4, 10, 10, 10> sparse_output;
+    etl::fast_matrix<float, 4, 10, 10, 10> dense_output;
+
+    layer.batch_activate_hidden(sparse_output, input);
+
+    layer.sparse_w.reset();
+
+    layer.batch_activate_hidden(dense_output, input);
+
+    for (std::size_t i = 0; i < etl::size(dense_output); ++i) {
+        REQUIRE(sparse_output[i] == Approx(dense_output[i]).epsilon(1e-4));
+    }
+}
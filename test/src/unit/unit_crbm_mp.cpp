@@ -183,3 +183,63 @@ TEST_CASE("unit/crbm_mp/mnist/7", "[crbm_mp][lee][gaussian][unit]") {
     auto error = rbm.train(dataset.training_images, 30);
     REQUIRE(error < 0.1);
 }
+
+TEST_CASE("unit/crbm_mp/pmp/1", "[crbm_mp][pmp][unit]") {
+    etl::fast_matrix<float, 2, 3, 8, 6> x;
+    etl::fast_matrix<float, 2, 3, 8, 6> h;
+    etl::fast_matrix<float, 2, 3, 4, 3> p;
+    etl::fast_vector<float, 3> b;
+
+    x = etl::normal_generator<float>(0.0, 2.0);
+    b = etl::normal_generator<float>(0.0, 1.0);
+
+    h = x;
+    dll::pmp_pooling(h, p, b, 2);
+
+    for (std::size_t i = 0; i < 2; ++i) {
+        for (std::size_t k = 0; k < 3; ++k) {
+            etl::fast_matrix<float, 8, 6> a;
+            a = b(k) + x(i)(k);
+
+            etl::fast_matrix<float, 8, 6> ref_h;
+            etl::fast_matrix<float, 4, 3> ref_p;
+            ref_h = etl::p_max_pool_h(a, 2, 2);
+            ref_p = etl::p_max_pool_p(a, 2, 2);
+
+            for (std::size_t j = 0; j < etl::size(ref_h); ++j) {
+                REQUIRE(h(i)(k)[j] == Approx(ref_h[j]).epsilon(1e-4));
+            }
+
+            for (std::size_t j = 0; j < etl::size(ref_p); ++j) {
+                REQUIRE(p(i)(k)[j] == Approx(ref_p[j]).epsilon(1e-4));
+            }
+        }
+    }
+}
+
+TEST_CASE("unit/crbm_mp/pmp/2", "[crbm_mp][pmp][unit]") {
+    // Large enough to be split between the threads
+    etl::dyn_matrix<float, 4> x(8, 20, 24, 24);
+    etl::dyn_matrix<float, 4> h(8, 20, 24, 24);
+    etl::dyn_matrix<float, 4> h_serial(8, 20, 24, 24);
+    etl::dyn_matrix<float, 4> p(8, 20, 12, 12);
+    etl::dyn_matrix<float, 4> p_serial(8, 20, 12, 12);
+    etl::dyn_vector<float> b(20);
+
+    x = etl::normal_generator<float>(0.0, 2.0);
+    b = etl::normal_generator<float>(0.0, 1.0);
+
+    h = x;
+    dll::pmp_pooling(h, p, b, 2);
+
+    h_serial = x;
+    dll::pmp_pooling<false>(h_serial, p_serial, b, 2);
+
+    for (std::size_t j = 0; j < etl::size(h); ++j) {
+        REQUIRE(h[j] == Approx(h_serial[j]));
+    }
+
+    for (std::size_t j = 0; j < etl::size(p); ++j) {
+        REQUIRE(p[j] == Approx(p_serial[j]));
+    }
+}
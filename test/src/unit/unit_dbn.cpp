@@ -5,7 +5,9 @@
 //  http://opensource.org/licenses/MIT)
 //=======================================================================
 
+#include <list>
 #include <deque>
+#include <cstdio>
 
 #include "catch.hpp"
 #include "dll_test.hpp"
@@ -15,6 +17,7 @@
 #include "dll/rbm/rbm.hpp"
 #include "dll/rbm/dyn_rbm.hpp"
 #include "dll/dbn.hpp"
+#include "dll/neural/dense_layer.hpp"
 #include "dll/transform/binarize_layer.hpp"
 #include "dll/trainer/conjugate_gradient.hpp"
 #include "dll/trainer/stochastic_gradient_descent.hpp"
@@ -441,3 +444,268 @@ TEST_CASE("unit/dbn/mnist/12", "[dbn][unit]") {
 
     dll::dump_timers();
 }
+
+TEST_CASE("unit/dbn/snapshot/1", "[unit][rbm][dbn][snapshot]") {
+    typedef dll::dbn_desc<
+        dll::dbn_layers<
+            dll::rbm_desc<500, 600, dll::momentum, dll::batch_size<25>>::layer_t,
+            dll::rbm_desc<600, 10, dll::momentum, dll::batch_size<25>>::layer_t
+        >, dll::batch_size<10>>::dbn_t dbn_t;
+
+    auto dbn = std::make_unique<dbn_t>();
+
+    auto& layer = dbn->template layer_get<0>();
+
+    // Large enough for the parallel copy
+    REQUIRE(etl::size(layer.w) >= dll::parallel_snapshot_threshold);
+
+    auto w = layer.w;
+
+    dbn->backup_weights();
+
+    layer.w = 0.0;
+
+    dbn->restore_weights();
+
+    REQUIRE(etl::sum(etl::abs(layer.w - w)) == 0.0f);
+
+    // The checkpoint is written in the background and can be loaded back
+
+    dbn->store_async("snapshot_test.dat");
+
+    layer.w = 0.0;
+
+    dll::checkpoint_writer().wait();
+
+    REQUIRE(dll::checkpoint_writer().failed() == 0);
+
+    auto loaded = std::make_unique<dbn_t>();
+    loaded->load("snapshot_test.dat");
+
+    REQUIRE(etl::sum(etl::abs(loaded->template layer_get<0>().w - w)) == 0.0f);
+    REQUIRE(etl::sum(etl::abs(loaded->template layer_get<1>().w - dbn->template layer_get<1>().w)) == 0.0f);
+}
+
+TEST_CASE("unit/dbn/snapshot/2", "[unit][rbm][dense][dbn][snapshot]") {
+    typedef dll::dbn_desc<
+        dll::dbn_layers<
+            dll::rbm_desc<50, 40, dll::momentum, dll::batch_size<25>>::layer_t,
+            dll::binarize_layer_desc<30>::layer_t,
+            dll::dense_desc<40, 20>::layer_t,
+            dll::dense_desc<20, 10, dll::activation<dll::function::SOFTMAX>>::layer_t
+        >, dll::batch_size<10>>::dbn_t dbn_t;
+
+    auto dbn = std::make_unique<dbn_t>();
+
+    dbn->template layer_get<2>().b = etl::normal_generator<float>();
+    dbn->template layer_get<3>().b = etl::normal_generator<float>();
+
+    // The dense layers are stored along with the RBM
+
+    dbn->store_async("snapshot_test_2.dat");
+
+    dll::checkpoint_writer().wait();
+
+    REQUIRE(dll::checkpoint_writer().failed() == 0);
+
+    auto loaded = std::make_unique<dbn_t>();
+    loaded->load("snapshot_test_2.dat");
+
+    REQUIRE(etl::sum(etl::abs(loaded->template layer_get<0>().w - dbn->template layer_get<0>().w)) == 0.0f);
+    REQUIRE(etl::sum(etl::abs(loaded->template layer_get<0>().c - dbn->template layer_get<0>().c)) == 0.0f);
+    REQUIRE(etl::sum(etl::abs(loaded->template layer_get<2>().w - dbn->template layer_get<2>().w)) == 0.0f);
+    REQUIRE(etl::sum(etl::abs(loaded->template layer_get<2>().b - dbn->template layer_get<2>().b)) == 0.0f);
+    REQUIRE(etl::sum(etl::abs(loaded->template layer_get<3>().w - dbn->template layer_get<3>().w)) == 0.0f);
+    REQUIRE(etl::sum(etl::abs(loaded->template layer_get<3>().b - dbn->template layer_get<3>().b)) == 0.0f);
+
+    std::remove("snapshot_test_2.dat");
+}
+
+TEST_CASE("unit/dbn/batch/1", "[unit][rbm][dbn][mnist]") {
+    typedef dll::dbn_desc<
+        dll::dbn_layers<
+            dll::rbm_desc<28 * 28, 100, dll::momentum, dll::batch_size<25>>::layer_t,
+            dll::rbm_desc<100, 50, dll::momentum, dll::batch_size<25>>::layer_t,
+            dll::rbm_desc<50, 10, dll::momentum, dll::batch_size<25>, dll::hidden<dll::unit_type::SOFTMAX>>::layer_t
+        >, dll::batch_size<16>>::dbn_t dbn_t;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(100);
+    REQUIRE(!dataset.training_images.empty());
+
+    mnist::binarize_dataset(dataset);
+
+    auto dbn = std::make_unique<dbn_t>();
+
+    dbn->pretrain(dataset.training_images, 5);
+
+    // The batched activations (with an incomplete last batch) must be the
+    // same as the activations of each sample
+    auto batch = dbn->batch_features(dataset.training_images.begin(), dataset.training_images.end());
+
+    REQUIRE(batch.size() == dataset.training_images.size());
+
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        auto features = dbn->features(dataset.training_images[i]);
+
+        REQUIRE(etl::size(batch[i]) == etl::size(features));
+
+        for (std::size_t j = 0; j < etl::size(features); ++j) {
+            REQUIRE(batch[i][j] == Approx(features[j]).epsilon(1e-4));
+        }
+    }
+}
+
+TEST_CASE("unit/dbn/batch/2", "[unit][rbm][dbn][mnist]") {
+    typedef dll::dbn_desc<
+        dll::dbn_label_layers<
+            dll::rbm_desc<28 * 28, 100, dll::batch_size<25>, dll::momentum>::layer_t,
+            dll::rbm_desc<100, 100, dll::batch_size<25>, dll::momentum>::layer_t,
+            dll::rbm_desc<110, 200, dll::batch_size<25>, dll::momentum>::layer_t>,
+        dll::batch_size<16>>::dbn_t dbn_t;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(100);
+    REQUIRE(!dataset.training_images.empty());
+
+    mnist::binarize_dataset(dataset);
+
+    auto dbn = std::make_unique<dbn_t>();
+
+    dbn->train_with_labels(dataset.training_images, dataset.training_labels, 10, 5);
+
+    // The label units are sampled, the batched predictions (with an
+    // incomplete last batch) must mostly agree with the predictions of
+    // each sample
+    auto batch = dbn->predict_labels(dataset.training_images.begin(), dataset.training_images.end(), 10);
+
+    // The samples of a list cannot be gathered in batches
+    std::list<etl::dyn_vector<float>> list(dataset.training_images.begin(), dataset.training_images.end());
+
+    auto single = dbn->predict_labels(list.begin(), list.end(), 10);
+
+    REQUIRE(batch.size() == dataset.training_images.size());
+    REQUIRE(single.size() == dataset.training_images.size());
+
+    std::size_t batch_same  = 0;
+    std::size_t single_same = 0;
+
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        auto label = dbn->predict_labels(dataset.training_images[i], 10);
+
+        REQUIRE(batch[i] < 10);
+        REQUIRE(single[i] < 10);
+
+        batch_same += batch[i] == label;
+        single_same += single[i] == label;
+    }
+
+    REQUIRE(batch_same >= 0.8 * batch.size());
+    REQUIRE(single_same >= 0.8 * single.size());
+}
+
+TEST_CASE("unit/dbn/svm/1", "[dbn][svm][unit]") {
+    using dbn_t = dll::dbn_desc<
+        dll::dbn_layers<
+            dll::rbm_desc<28 * 28, 100, dll::momentum, dll::batch_size<25>, dll::init_weights>::layer_t,
+            dll::rbm_desc<100, 50, dll::momentum, dll::batch_size<25>>::layer_t>,
+        dll::batch_size<16>>::dbn_t;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(200);
+
+    REQUIRE(!dataset.training_images.empty());
+
+    mnist::binarize_dataset(dataset);
+
+    auto dbn = std::make_unique<dbn_t>();
+
+    dbn->pretrain(dataset.training_images, 5);
+
+    // There must be one label per sample
+    std::vector<uint8_t> missing(dataset.training_labels.begin(), dataset.training_labels.end() - 1);
+
+    REQUIRE(!dbn->svm_train(dataset.training_images, missing));
+
+    // The features extracted in batches must be the same as the features
+    // extracted one sample at a time (the samples of a list cannot be
+    // gathered in batches)
+    REQUIRE(dbn->svm_train(dataset.training_images, dataset.training_labels));
+
+    std::vector<double> batch;
+
+    for (std::size_t i = 0; i < dataset.training_images.size(); ++i) {
+        for (std::size_t f = 0; f < 50; ++f) {
+            batch.push_back(dbn->problem.sample(i)[f].value);
+        }
+    }
+
+    std::list<etl::dyn_vector<float>> list(dataset.training_images.begin(), dataset.training_images.end());
+
+    REQUIRE(dbn->svm_train(list.begin(), list.end(), dataset.training_labels.begin(), dataset.training_labels.end()));
+
+    for (std::size_t i = 0; i < dataset.training_images.size(); ++i) {
+        REQUIRE(dbn->problem.sample(i)[50].index == -1);
+
+        for (std::size_t f = 0; f < 50; ++f) {
+            REQUIRE(dbn->problem.sample(i)[f].value == Approx(batch[i * 50 + f]).epsilon(1e-4));
+        }
+    }
+
+    // The batched predictions must match the ones of each sample
+    auto predictions      = dbn->svm_predict(dataset.training_images.begin(), dataset.training_images.end());
+    auto list_predictions = dll::svm_predict(*dbn, list.begin(), list.end());
+
+    REQUIRE(predictions.size() == dataset.training_images.size());
+    REQUIRE(list_predictions.size() == dataset.training_images.size());
+
+    std::size_t same = 0;
+
+    for (std::size_t i = 0; i < dataset.training_images.size(); ++i) {
+        auto single = dbn->svm_predict(dataset.training_images[i]);
+
+        REQUIRE(list_predictions[i] == single);
+
+        same += predictions[i] == single;
+    }
+
+    // The batched features may differ slightly, which can flip a sample at the margin
+    REQUIRE(same >= 0.98 * predictions.size());
+}
+
+TEST_CASE("unit/dbn/shuffle_pre/1", "[dbn][unit]") {
+    typedef dll::dbn_desc<
+        dll::dbn_layers<
+            dll::rbm_desc<28 * 28, 100, dll::momentum, dll::batch_size<25>>::layer_t,
+            dll::rbm_desc<100, 50, dll::momentum, dll::batch_size<25>>::layer_t>,
+        dll::batch_mode, dll::shuffle_pre>::dbn_t dbn_t;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(100);
+    REQUIRE(!dataset.training_images.empty());
+
+    mnist::binarize_dataset(dataset);
+
+    // Random access inputs are shuffled through a permutation
+    auto dbn = std::make_unique<dbn_t>();
+    dbn->pretrain(dataset.training_images.begin(), dataset.training_images.end(), 5);
+
+    // Other inputs are copied before being shuffled
+    std::list<etl::dyn_vector<float>> list(dataset.training_images.begin(), dataset.training_images.end());
+
+    auto dbn_list = std::make_unique<dbn_t>();
+    dbn_list->pretrain(list.begin(), list.end(), 5);
+
+    REQUIRE(std::isfinite(etl::sum(dbn->template layer_get<1>().w)));
+    REQUIRE(std::isfinite(etl::sum(dbn_list->template layer_get<1>().w)));
+}
+
+TEST_CASE("unit/dbn/memory/1", "[dbn][unit]") {
+    typedef dll::dbn_desc<
+        dll::dbn_layers<
+            dll::rbm_desc<28 * 28, 100, dll::momentum, dll::batch_size<25>>::layer_t,
+            dll::rbm_desc<100, 10, dll::momentum, dll::batch_size<25>, dll::hidden<dll::unit_type::SOFTMAX>>::layer_t>,
+        dll::trainer<dll::sgd_trainer>, dll::batch_size<10>>::dbn_t dbn_t;
+
+    using rbm_t = dbn_t::layer_type<0>;
+
+    // The buffers of the CD trainer (at least the weight gradients) are counted
+    REQUIRE(dbn_t::layer_training_memory_bytes<0>() >= sizeof(rbm_t) + 28 * 28 * 100 * sizeof(float));
+    REQUIRE(dbn_t::training_memory_bytes() == dbn_t::layer_training_memory_bytes<0>() + dbn_t::layer_training_memory_bytes<1>());
+}
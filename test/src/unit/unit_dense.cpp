@@ -14,6 +14,7 @@
 #include "dll/neural/activation_layer.hpp"
 #include "dll/dbn.hpp"
 #include "dll/trainer/stochastic_gradient_descent.hpp"
+#include "dll/util/pruning.hpp"
 
 #include "mnist/mnist_reader.hpp"
 #include "mnist/mnist_utils.hpp"
@@ -332,3 +333,189 @@ TEST_CASE("unit/dense/sgd/14", "[unit][dense][dbn][mnist][sgd]") {
     FT_CHECK(50, 5e-2);
     TEST_CHECK(0.2);
 }
+
+// Test fine-tuning directly on contiguous data with class indices
+TEST_CASE("unit/dense/sgd/15", "[unit][dense][dbn][mnist][sgd]") {
+    typedef dll::dbn_desc<
+        dll::dbn_layers<
+            dll::dense_desc<28 * 28, 100>::layer_t,
+            dll::dense_desc<100, 10, dll::activation<dll::function::SOFTMAX>>::layer_t>,
+        dll::trainer<dll::sgd_trainer>, dll::batch_size<10>>::dbn_t dbn_t;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::fast_dyn_matrix<float, 28 * 28>>(350);
+    REQUIRE(!dataset.training_images.empty());
+
+    dll_test::mnist_scale(dataset);
+
+    const size_t n = dataset.training_images.size();
+
+    etl::dyn_matrix<float, 2> data(n, 28 * 28);
+    etl::dyn_matrix<float, 1> labels(n);
+
+    for (size_t i = 0; i < n; ++i) {
+        data(i)   = dataset.training_images[i];
+        labels[i] = dataset.training_labels[i];
+    }
+
+    auto dbn = std::make_unique<dbn_t>();
+
+    dbn->learning_rate = 0.1;
+
+    auto ft_error = dbn->fine_tune(data, labels, 50);
+    std::cout << "ft_error:" << ft_error << std::endl;
+    CHECK(ft_error < 5e-2);
+
+    TEST_CHECK(0.3);
+}
+
+TEST_CASE("unit/dense/sgd/16", "[unit][dense][dbn][sgd]") {
+    typedef dll::dbn_desc<
+        dll::dbn_layers<
+            dll::dense_desc<28 * 28, 150>::layer_t,
+            dll::dense_desc<150, 10>::layer_t>,
+        dll::trainer<dll::sgd_trainer>, dll::batch_size<10>>::dbn_t dbn_t;
+
+    typedef dll::dbn_desc<
+        dll::dbn_layers<
+            dll::dense_desc<28 * 28, 150>::layer_t,
+            dll::dense_desc<150, 10>::layer_t>,
+        dll::momentum, dll::trainer<dll::sgd_trainer>, dll::batch_size<10>>::dbn_t momentum_dbn_t;
+
+    // The momentum state is only allocated when momentum is enabled
+    REQUIRE(dbn_t::training_memory_bytes() < momentum_dbn_t::training_memory_bytes());
+    REQUIRE(dbn_t::training_memory_bytes() == dbn_t::layer_training_memory_bytes<0>() + dbn_t::layer_training_memory_bytes<1>());
+    REQUIRE(momentum_dbn_t::layer_training_memory_bytes<0>() - dbn_t::layer_training_memory_bytes<0>() >= (28 * 28 * 150 + 150) * sizeof(float));
+}
+
+// The fused output kernel must give the same results with one-hot labels and with class indices
+TEST_CASE("unit/dense/sgd/17", "[unit][dense][dbn][sgd]") {
+    typedef dll::dbn_desc<
+        dll::dbn_layers<
+            dll::dense_desc<5, 3, dll::activation<dll::function::SOFTMAX>>::layer_t>,
+        dll::trainer<dll::sgd_trainer>, dll::batch_size<4>>::dbn_t dbn_t;
+
+    auto dbn = std::make_unique<dbn_t>();
+
+    dll::sgd_trainer<dbn_t> trainer(*dbn);
+
+    etl::fast_dyn_matrix<float, 4, 3> output({0.7, 0.2, 0.1,
+                                              0.1, 0.8, 0.1,
+                                              0.3, 0.3, 0.4,
+                                              0.5, 0.4, 0.1});
+
+    etl::fast_dyn_matrix<float, 4, 3> one_hot({1.0, 0.0, 0.0,
+                                               0.0, 0.0, 1.0,
+                                               0.0, 0.0, 1.0,
+                                               0.0, 1.0, 0.0});
+
+    etl::fast_dyn_vector<float, 4> classes({0.0, 2.0, 2.0, 1.0});
+
+    etl::fast_dyn_matrix<float, 4, 3> one_hot_errors;
+    etl::fast_dyn_matrix<float, 4, 3> classes_errors;
+
+    // The last sample is not part of the batch
+    auto one_hot_result  = trainer.output_errors(output, one_hot, one_hot_errors, 3);
+    auto one_hot_misses  = trainer.misclassified;
+    auto classes_result  = trainer.output_errors(output, classes, classes_errors, 3);
+    auto classes_misses  = trainer.misclassified;
+
+    REQUIRE(one_hot_misses == 1);
+    REQUIRE(classes_misses == 1);
+
+    REQUIRE(one_hot_result.first == Approx(classes_result.first));
+    REQUIRE(one_hot_result.second == Approx(classes_result.second));
+    REQUIRE(one_hot_result.second == Approx(-(std::log(0.7) + std::log(0.1) + std::log(0.4)) / 3.0));
+
+    for (std::size_t i = 0; i < etl::size(one_hot_errors); ++i) {
+        REQUIRE(one_hot_errors[i] == Approx(classes_errors[i]));
+    }
+
+    REQUIRE(etl::sum(one_hot_errors(3)) == 0.0);
+}
+
+// Test the sparse kernels of a pruned layer
+TEST_CASE("unit/dense/prune/1", "[unit][dense][prune]") {
+    dll::dense_desc<100, 50, dll::activation<dll::function::SIGMOID>>::layer_t layer;
+
+    dll::prune(layer, 0.8);
+
+    // Pruning alone does not enable the sparse kernels
+    REQUIRE(!layer.sparse_w);
+
+    dll::sparsify(layer);
+
+    REQUIRE(layer.sparse_w);
+    REQUIRE(dll::density(layer.w) == Approx(0.2).epsilon(0.01));
+
+    etl::fast_matrix<float, 8, 100> input;
+    input = etl::normal_generator<float>(0.0, 1.0);
+
+    etl::fast_matrix<float, 8, 50> sparse_output;
+    etl::fast_matrix<float, 8, 50> dense_output;
+
+    layer.batch_activate_hidden(sparse_output, input);
+
+    layer.sparse_w.reset();
+
+    layer.batch_activate_hidden(dense_output, input);
+
+    for (std::size_t i = 0; i < etl::size(dense_output); ++i) {
+        REQUIRE(sparse_output[i] == Approx(dense_output[i]).epsilon(1e-4));
+    }
+}
+
+// The sparse weights must be dropped when the weights are replaced
+TEST_CASE("unit/dense/prune/2", "[unit][dense][prune]") {
+    dll::dense_desc<100, 50, dll::activation<dll::function::SIGMOID>>::layer_t layer;
+
+    layer.backup_weights();
+
+    dll::prune(layer, 0.8);
+    dll::sparsify(layer);
+
+    REQUIRE(layer.sparse_w);
+
+    layer.restore_weights();
+
+    REQUIRE(!layer.sparse_w);
+    REQUIRE(dll::density(layer.w) > 0.9);
+}
+
+// The sparse input kernels must compute the same activations as the dense ones
+TEST_CASE("unit/dense/sparse_input/1", "[unit][dense][sparse_input]") {
+    dll::dense_desc<100, 50, dll::activation<dll::function::SIGMOID>>::layer_t dense;
+    dll::dense_desc<100, 50, dll::activation<dll::function::SIGMOID>, dll::sparse_input>::layer_t sparse;
+
+    sparse.w = dense.w;
+    sparse.b = dense.b;
+
+    etl::fast_matrix<float, 8, 100> input;
+    input = 0.0;
+
+    for (std::size_t i = 0; i < etl::size(input); i += 11) {
+        input[i] = 1.0 + i * 0.01;
+    }
+
+    REQUIRE(dll::density(input) < dll::sparse_density_threshold);
+
+    etl::fast_matrix<float, 8, 50> sparse_output;
+    etl::fast_matrix<float, 8, 50> dense_output;
+
+    // Sparse batch
+    sparse.batch_activate_hidden(sparse_output, input);
+    dense.batch_activate_hidden(dense_output, input);
+
+    for (std::size_t i = 0; i < etl::size(dense_output); ++i) {
+        REQUIRE(sparse_output[i] == Approx(dense_output[i]).epsilon(1e-4));
+    }
+
+    // Dense batch (falls back to the dense kernels)
+    input = etl::normal_generator<float>(0.0, 1.0);
+
+    sparse.batch_activate_hidden(sparse_output, input);
+    dense.batch_activate_hidden(dense_output, input);
+
+    for (std::size_t i = 0; i < etl::size(dense_output); ++i) {
+        REQUIRE(sparse_output[i] == Approx(dense_output[i]).epsilon(1e-4));
+    }
+}
@@ -0,0 +1,199 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <cmath>
+#include <vector>
+
+#include "dll_test.hpp"
+
+#include "dll/util/distributed.hpp"
+#include "dll/neural/dense_layer.hpp"
+#include "dll/rbm/rbm.hpp"
+#include "dll/dbn.hpp"
+#include "dll/trainer/stochastic_gradient_descent.hpp"
+
+#include "mnist/mnist_reader.hpp"
+#include "mnist/mnist_utils.hpp"
+
+namespace {
+
+// Indicates if the given weights are the same in all the processes
+template <typename W>
+bool same_weights(W& w) {
+    W average = w;
+
+    dll::synchronize_weights(average);
+
+    return etl::max(etl::abs(average - w)) < 1e-5;
+}
+
+// Each worker reduces a buffer filled with its rank
+bool check_allreduce(std::size_t rank, std::size_t size) {
+    auto* comm = dll::get_communicator();
+
+    if (!comm || comm->rank() != rank || comm->size() != size) {
+        return false;
+    }
+
+    // Larger than a slot of the segment, to use several pieces
+    std::vector<float> a(300000, float(rank));
+    std::vector<double> b(1001, double(rank));
+
+    comm->average(a.data(), a.size());
+    comm->allreduce(b.data(), b.size());
+
+    for (auto& v : a) {
+        if (v != 1.5f) {
+            return false;
+        }
+    }
+
+    for (auto& v : b) {
+        if (v != 6.0) {
+            return false;
+        }
+    }
+
+    comm->barrier();
+
+    return true;
+}
+
+// Each worker starts from weights filled with its rank
+bool check_broadcast(std::size_t rank, std::size_t size) {
+    etl::dyn_matrix<float, 2> w(30, 20, float(rank + 1));
+    etl::dyn_vector<float> b(20, float(rank + 1));
+
+    dll::synchronize_weights(w, b);
+
+    double error = rank;
+    double loss  = 2.0 * rank;
+
+    dll::average_epoch(error, loss);
+
+    if (etl::min(w) != 1.0f || etl::max(w) != 1.0f || etl::min(b) != 1.0f || etl::max(b) != 1.0f) {
+        return false;
+    }
+
+    // The errors of the epoch are averaged
+    return std::abs(error - (size - 1) / 2.0) < 1e-9 && std::abs(loss - double(size - 1)) < 1e-9;
+}
+
+} // end of anonymous namespace
+
+TEST_CASE("unit/distributed/shm/1", "[unit][distributed]") {
+    dll::distributed_options options;
+    options.capacity = 1UL << 20;
+
+    REQUIRE(dll::launch_workers(4, check_allreduce, options) == 0);
+}
+
+TEST_CASE("unit/distributed/tcp/1", "[unit][distributed]") {
+    dll::distributed_options options;
+    options.transport = dll::distributed_transport::TCP;
+    options.port      = 0;
+
+    REQUIRE(dll::launch_workers(4, check_allreduce, options) == 0);
+}
+
+TEST_CASE("unit/distributed/shm/2", "[unit][distributed]") {
+    REQUIRE(dll::launch_workers(4, check_broadcast) == 0);
+}
+
+TEST_CASE("unit/distributed/shm/3", "[unit][distributed]") {
+    dll::distributed_options options;
+    options.timeout = 30;
+
+    // One worker leaves without reaching the barrier, the others must not wait for it
+    auto failures = dll::launch_workers(4, [](std::size_t rank, std::size_t /*size*/) {
+        if (rank == 2) {
+            return false;
+        }
+
+        dll::get_communicator()->barrier();
+
+        return true;
+    }, options);
+
+    REQUIRE(failures == 4);
+}
+
+TEST_CASE("unit/distributed/tcp/2", "[unit][distributed]") {
+    dll::distributed_options options;
+    options.transport = dll::distributed_transport::TCP;
+    options.port      = 0;
+
+    REQUIRE(dll::launch_workers(3, check_broadcast, options) == 0);
+}
+
+TEST_CASE("unit/distributed/sgd/1", "[unit][distributed][dense][dbn][mnist][sgd]") {
+    typedef dll::dbn_desc<
+        dll::dbn_layers<
+            dll::dense_desc<28 * 28, 100>::layer_t,
+            dll::dense_desc<100, 10>::layer_t>,
+        dll::trainer<dll::sgd_trainer>, dll::batch_size<10>>::dbn_t dbn_t;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::fast_dyn_matrix<float, 28 * 28>>(400);
+    REQUIRE(!dataset.training_images.empty());
+
+    auto failures = dll::launch_workers(4, [&dataset](std::size_t rank, std::size_t /*size*/) {
+        auto dbn = std::make_unique<dbn_t>();
+
+        dbn->learning_rate = 0.03;
+
+        auto& l1 = dbn->template layer_get<0>();
+        auto& l2 = dbn->template layer_get<1>();
+
+        // The trainer starts all the replicas from the weights of the first one
+        l1.w(0, 0) += rank;
+        l2.b(0) += rank;
+
+        auto images = dll::distributed_shard(dataset.training_images.begin(), dataset.training_images.end());
+        auto labels = dll::distributed_shard(dataset.training_labels.begin(), dataset.training_labels.end());
+
+        std::vector<etl::fast_dyn_matrix<float, 28 * 28>> shard_images(images.first, images.second);
+        std::vector<uint8_t> shard_labels(labels.first, labels.second);
+
+        auto ft_error = dbn->fine_tune(shard_images, shard_labels, 50);
+
+        // The replicas must still be identical
+        return ft_error < 5e-2 && same_weights(l1.w) && same_weights(l2.w) && same_weights(l2.b);
+    });
+
+    REQUIRE(failures == 0);
+}
+
+TEST_CASE("unit/distributed/rbm/1", "[unit][distributed][rbm][mnist]") {
+    using rbm_t = dll::rbm_desc<28 * 28, 100, dll::batch_size<25>, dll::momentum>::layer_t;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(200);
+    REQUIRE(!dataset.training_images.empty());
+
+    mnist::binarize_dataset(dataset);
+
+    dll::distributed_options options;
+    options.mode   = dll::distributed_mode::WEIGHTS;
+    options.period = 2;
+
+    auto failures = dll::launch_workers(4, [&dataset](std::size_t rank, std::size_t /*size*/) {
+        auto rbm = std::make_unique<rbm_t>();
+
+        // The trainer starts all the replicas from the weights of the first one
+        rbm->w(0, 0) += rank;
+
+        auto images = dll::distributed_shard(dataset.training_images.begin(), dataset.training_images.end());
+
+        std::vector<etl::dyn_vector<float>> shard(images.first, images.second);
+
+        // 2 batches per epoch, the weights are averaged after each epoch
+        auto error = rbm->train(shard, 50);
+
+        return error < 5e-2 && same_weights(rbm->w);
+    }, options);
+
+    REQUIRE(failures == 0);
+}
@@ -193,3 +193,105 @@ TEST_CASE("unit/dyn_dense/sgd/7", "[unit][dyn_dense][dbn][mnist][sgd]") {
     FT_CHECK(50, 5e-2);
     TEST_CHECK(0.2);
 }
+
+// Test Relu -> Relu -> Relu -> Softmax network with checkpointing
+TEST_CASE("unit/dyn_dense/sgd/8", "[unit][dyn_dense][dbn][mnist][sgd][checkpoint]") {
+    using layers_t = dll::dbn_layers<
+        dll::dyn_dense_desc<dll::activation<dll::function::RELU>>::layer_t,
+        dll::dyn_dense_desc<dll::activation<dll::function::RELU>>::layer_t,
+        dll::dyn_dense_desc<dll::activation<dll::function::RELU>>::layer_t,
+        dll::dyn_dense_desc<dll::activation<dll::function::SOFTMAX>>::layer_t>;
+
+    typedef dll::dbn_desc<layers_t, dll::momentum, dll::checkpoint<2>, dll::trainer<dll::sgd_trainer>, dll::batch_size<10>>::dbn_t dbn_t;
+    typedef dll::dbn_desc<layers_t, dll::momentum, dll::trainer<dll::sgd_trainer>, dll::batch_size<10>>::dbn_t ref_dbn_t;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::fast_dyn_matrix<float, 28 * 28>>(500);
+    REQUIRE(!dataset.training_images.empty());
+
+    dll_test::mnist_scale(dataset);
+
+    auto dbn     = std::make_unique<dbn_t>();
+    auto ref_dbn = std::make_unique<ref_dbn_t>();
+
+    dbn->template layer_get<0>().init_layer(28 * 28, 150);
+    dbn->template layer_get<1>().init_layer(150, 150);
+    dbn->template layer_get<2>().init_layer(150, 100);
+    dbn->template layer_get<3>().init_layer(100, 10);
+
+    ref_dbn->template layer_get<0>().init_layer(28 * 28, 150);
+    ref_dbn->template layer_get<1>().init_layer(150, 150);
+    ref_dbn->template layer_get<2>().init_layer(150, 100);
+    ref_dbn->template layer_get<3>().init_layer(100, 10);
+
+    // Both networks start from the same weights
+
+    dbn->for_each_layer_i([&ref_dbn](std::size_t i, auto& layer) {
+        ref_dbn->for_each_layer_i([i, &layer](std::size_t j, auto& ref_layer) {
+            if (i == j) {
+                ref_layer.w = layer.w;
+                ref_layer.b = layer.b;
+            }
+        });
+    });
+
+    dbn->initial_momentum = 0.9;
+    dbn->final_momentum   = 0.9;
+    dbn->learning_rate    = 0.01;
+
+    ref_dbn->initial_momentum = 0.9;
+    ref_dbn->final_momentum   = 0.9;
+    ref_dbn->learning_rate    = 0.01;
+
+    dbn->momentum     = 0.9;
+    ref_dbn->momentum = 0.9;
+
+    // Train both networks on the same batches
+
+    {
+        dll::sgd_trainer<dbn_t> trainer(*dbn);
+        dll::sgd_trainer<ref_dbn_t> ref_trainer(*ref_dbn);
+
+        etl::dyn_matrix<float, 2> inputs(10, 28 * 28);
+        etl::dyn_matrix<float, 2> labels(10, 10);
+
+        auto no_transform = [](auto&) {};
+
+        for (std::size_t b = 0; b < 5; ++b) {
+            labels = 0.0;
+
+            for (std::size_t i = 0; i < 10; ++i) {
+                inputs(i) = dataset.training_images[b * 10 + i];
+
+                labels(i, dataset.training_labels[b * 10 + i]) = 1.0;
+            }
+
+            trainer.train_batch(0, inputs, labels, no_transform);
+            ref_trainer.train_batch(0, inputs, labels, no_transform);
+        }
+
+        // The activations of the layers between the checkpoints were released
+        REQUIRE(trainer.checkpoint_saved > 0);
+        REQUIRE(ref_trainer.checkpoint_saved == 0);
+
+        // The released activations kept in the stash are not counted as freed
+        REQUIRE(trainer.stash.size() > 0);
+        REQUIRE(trainer.checkpoint_saved < (150 + 150 + 150 + 100 + 100) * 10 * sizeof(float));
+    }
+
+    dbn->for_each_layer_i([&ref_dbn](std::size_t i, auto& layer) {
+        ref_dbn->for_each_layer_i([i, &layer](std::size_t j, auto& ref_layer) {
+            if (i == j) {
+                for (std::size_t k = 0; k < etl::size(layer.w); ++k) {
+                    REQUIRE(layer.w[k] == Approx(ref_layer.w[k]).epsilon(1e-4));
+                }
+
+                for (std::size_t k = 0; k < etl::size(layer.b); ++k) {
+                    REQUIRE(layer.b[k] == Approx(ref_layer.b[k]).epsilon(1e-4));
+                }
+            }
+        });
+    });
+
+    FT_CHECK(50, 5e-2);
+    TEST_CHECK(0.2);
+}
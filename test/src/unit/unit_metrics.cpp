@@ -0,0 +1,154 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <thread>
+#include <vector>
+#include <fstream>
+
+#include "catch.hpp"
+
+#include "dll/util/metrics.hpp"
+
+namespace {
+
+// Sink keeping the records in memory
+struct memory_sink : dll::metrics_sink {
+    std::vector<dll::metric_record>& records;
+
+    explicit memory_sink(std::vector<dll::metric_record>& records) : records(records) {}
+
+    void write(const dll::metric_record& record) override {
+        records.push_back(record);
+    }
+};
+
+} // end of anonymous namespace
+
+TEST_CASE("unit/metrics/queue/1", "[unit][metrics]") {
+    dll::bounded_queue<std::size_t, 8> queue;
+
+    std::size_t value = 0;
+
+    REQUIRE(!queue.try_pop(value));
+
+    for (std::size_t i = 0; i < 8; ++i) {
+        REQUIRE(queue.try_push(i));
+    }
+
+    // The queue is full
+    REQUIRE(!queue.try_push(8));
+
+    for (std::size_t i = 0; i < 8; ++i) {
+        REQUIRE(queue.try_pop(value));
+        REQUIRE(value == i);
+    }
+
+    REQUIRE(!queue.try_pop(value));
+}
+
+TEST_CASE("unit/metrics/queue/2", "[unit][metrics]") {
+    dll::bounded_queue<std::size_t, 64> queue;
+
+    std::vector<std::size_t> counts(4, 0);
+
+    std::thread consumer([&] {
+        std::size_t value = 0;
+        std::size_t popped = 0;
+
+        while (popped < 4 * 10000) {
+            if (queue.try_pop(value)) {
+                ++counts[value % 4];
+                ++popped;
+            }
+        }
+    });
+
+    std::vector<std::thread> producers;
+
+    for (std::size_t p = 0; p < 4; ++p) {
+        producers.emplace_back([&queue, p] {
+            for (std::size_t i = 0; i < 10000; ++i) {
+                while (!queue.try_push(i * 4 + p)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    for (auto& producer : producers) {
+        producer.join();
+    }
+
+    consumer.join();
+
+    for (auto count : counts) {
+        REQUIRE(count == 10000);
+    }
+}
+
+TEST_CASE("unit/metrics/pipeline/1", "[unit][metrics]") {
+    std::vector<dll::metric_record> records;
+
+    auto pipeline_ptr = std::make_unique<dll::metrics_pipeline>();
+    auto& pipeline    = *pipeline_ptr;
+    pipeline.clear_sinks();
+    pipeline.add_sink(std::make_unique<memory_sink>(records));
+    pipeline.add_sink(std::make_unique<dll::csv_sink>("metrics_test.csv"));
+
+    for (std::size_t epoch = 1; epoch <= 10; ++epoch) {
+        dll::metric_record record(dll::metric_kind::FT_EPOCH);
+        record.epoch      = epoch;
+        record.max_epochs = 10;
+        record.error      = 1.0 / epoch;
+
+        pipeline.push(record);
+    }
+
+    pipeline.drain();
+
+    // The epoch records are never dropped and are written in order
+    REQUIRE(records.size() == 10);
+
+    for (std::size_t i = 0; i < 10; ++i) {
+        REQUIRE(records[i].kind == dll::metric_kind::FT_EPOCH);
+        REQUIRE(records[i].epoch == i + 1);
+    }
+
+    std::ifstream csv("metrics_test.csv");
+    std::string line;
+    std::size_t lines = 0;
+
+    while (std::getline(csv, line)) {
+        ++lines;
+    }
+
+    // Header + records
+    REQUIRE(lines == 11);
+}
+
+TEST_CASE("unit/metrics/pipeline/2", "[unit][metrics]") {
+    std::vector<dll::metric_record> records;
+
+    auto pipeline_ptr = std::make_unique<dll::metrics_pipeline>();
+    auto& pipeline    = *pipeline_ptr;
+    pipeline.clear_sinks();
+    pipeline.add_sink(std::make_unique<memory_sink>(records));
+
+    const std::size_t n = 4 * dll::metrics_pipeline::capacity;
+
+    for (std::size_t batch = 0; batch < n; ++batch) {
+        dll::metric_record record(dll::metric_kind::FT_BATCH);
+        record.batch = batch;
+
+        pipeline.push(record);
+    }
+
+    pipeline.drain();
+
+    // The batch records may be dropped, but never block the training
+    REQUIRE(records.size() + pipeline.dropped() == n);
+}
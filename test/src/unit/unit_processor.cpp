@@ -6,6 +6,12 @@
 //=======================================================================
 
 #include <deque>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
 
 #include "cpp_utils/string.hpp"
 
@@ -129,6 +135,16 @@ std::vector<std::string> get_result(const dll::processor::options& opt, const st
     return lines;
 }
 
+bool has_fallback_warning(const std::vector<std::string>& lines) {
+    for (auto& line : lines) {
+        if (line.find("dllp: warning: the network cannot be interpreted") != std::string::npos) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 dll::processor::options default_options() {
     dll::processor::options opt;
     opt.mkl   = true;
@@ -137,6 +153,77 @@ dll::processor::options default_options() {
     return opt;
 }
 
+// The network of rbm_predict_1.conf and rbm_predict_2.conf
+using predict_dbn_t = dll::dbn_desc<
+    dll::dbn_layers<
+        dll::rbm_desc<28 * 28, 100>::layer_t,
+        dll::rbm_desc<100, 10>::layer_t>>::dbn_t;
+
+// Read all the values of a CSV file written by the scoring
+template <typename T>
+std::vector<T> read_csv_values(const std::string& file) {
+    std::ifstream stream(file);
+
+    std::vector<T> values;
+    std::string line;
+
+    while (std::getline(stream, line)) {
+        std::stringstream line_stream(line);
+        std::string value;
+
+        while (std::getline(line_stream, value, ';')) {
+            values.push_back(static_cast<T>(std::stod(value)));
+        }
+    }
+
+    return values;
+}
+
+// Read all the values of a binary file written by the scoring
+template <typename T>
+std::vector<T> read_binary_values(const std::string& file) {
+    std::ifstream stream(file, std::ios::binary | std::ios::ate);
+
+    std::vector<T> values(stream ? std::size_t(stream.tellg()) / sizeof(T) : 0);
+
+    stream.seekg(0);
+    stream.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(T));
+
+    return values;
+}
+
+// Compare the scored labels and features with the ones of the network loaded from the saved weights
+void check_scores(const std::string& weights, const std::vector<std::uint32_t>& labels, const std::vector<float>& features) {
+    auto dbn = std::make_unique<predict_dbn_t>();
+    dbn->load(weights);
+
+    dll::processor::datasource ds("mnist/t10k-images-idx3-ubyte", "mnist");
+    ds.limit    = 1000;
+    ds.binarize = true;
+
+    std::vector<etl::dyn_vector<float>> samples;
+    REQUIRE(dll::processor::read_samples<false>(ds, samples));
+
+    REQUIRE(labels.size() == samples.size());
+    REQUIRE(features.size() == samples.size() * 10);
+
+    for (std::size_t i = 0; i < samples.size(); ++i) {
+        auto expected = dbn->features(samples[i]);
+
+        for (std::size_t j = 0; j < 10; ++j) {
+            REQUIRE(features[i * 10 + j] == Approx(expected[j]).epsilon(1e-4));
+        }
+
+        std::vector<float> sorted(expected.begin(), expected.end());
+        std::sort(sorted.begin(), sorted.end(), std::greater<float>());
+
+        // A near tie may be broken differently by the batch and the single sample kernels
+        if (sorted[0] - sorted[1] > 1e-5) {
+            REQUIRE(labels[i] == dbn->predict(samples[i]));
+        }
+    }
+}
+
 } // end of anonymous namespace
 
 #define FT_ERROR_BELOW(min)                                \
@@ -415,3 +502,222 @@ TEST_CASE("unit/processor/cdbn/2", "[unit][dbn][mnist][conv][proc]") {
     SPARSITY_BELOW("epoch 24", 0.11, 0);
     SPARSITY_BELOW("epoch 24", 0.11, 1);
 }
+
+// Interpreted mode
+
+TEST_CASE("unit/processor/interpreted/1", "[unit][dense][dbn][mnist][sgd][proc]") {
+    auto opt = default_options();
+    opt.interpreted = true;
+
+    auto lines = get_result(opt, {"auto"}, "dense_sgd_1.conf");
+    REQUIRE(!lines.empty());
+
+    // The network must really be interpreted, not compiled
+    REQUIRE(!has_fallback_warning(lines));
+
+    FT_ERROR_BELOW(5e-2);
+    TEST_ERROR_BELOW(0.3);
+}
+
+TEST_CASE("unit/processor/interpreted/2", "[unit][dense][dbn][mnist][sgd][proc]") {
+    auto opt = default_options();
+    opt.interpreted = true;
+
+    auto lines = get_result(opt, {"pretrain", "train", "test"}, "dbn_sgd_1.conf");
+    REQUIRE(!lines.empty());
+
+    // The network must really be interpreted, not compiled
+    REQUIRE(!has_fallback_warning(lines));
+
+    FT_ERROR_BELOW(5e-2);
+    TEST_ERROR_BELOW(0.3);
+}
+
+// Bulk scoring
+
+TEST_CASE("unit/processor/predict/1", "[unit][dense][dbn][mnist][sgd][proc]") {
+    auto opt = default_options();
+    opt.interpreted = true;
+
+    auto lines = get_result(opt, {"train", "predict", "features"}, "dense_predict_1.conf");
+    REQUIRE(!lines.empty());
+
+    FT_ERROR_BELOW(5e-2);
+
+    auto labels   = read_csv_values<std::uint32_t>("predictions_test.csv");
+    auto features = read_csv_values<float>("features_test.csv");
+
+    std::remove("predictions_test.csv");
+    std::remove("features_test.csv");
+
+    REQUIRE(labels.size() == 1000);
+    REQUIRE(features.size() == 1000 * 10);
+
+    for (auto label : labels) {
+        REQUIRE(label < 10);
+    }
+}
+
+TEST_CASE("unit/processor/predict/2", "[unit][rbm][dbn][mnist][proc]") {
+    auto opt = default_options();
+    opt.interpreted = true;
+
+    auto lines = get_result(opt, {"pretrain", "save", "predict", "features"}, "rbm_predict_1.conf");
+    REQUIRE(!lines.empty());
+
+    REQUIRE(!has_fallback_warning(lines));
+
+    auto labels   = read_csv_values<std::uint32_t>("rbm_predictions_test.csv");
+    auto features = read_csv_values<float>("rbm_features_test.csv");
+
+    check_scores("rbm_predict_test.dat", labels, features);
+
+    std::remove("rbm_predictions_test.csv");
+    std::remove("rbm_features_test.csv");
+    std::remove("rbm_predict_test.dat");
+}
+
+TEST_CASE("unit/processor/predict/3", "[unit][rbm][dbn][mnist][proc]") {
+    auto lines = get_result(default_options(), {"pretrain", "save", "predict", "features"}, "rbm_predict_2.conf");
+    REQUIRE(!lines.empty());
+
+    auto labels   = read_binary_values<std::uint32_t>("rbm_predictions_test.dat");
+    auto features = read_binary_values<float>("rbm_features_test.dat");
+
+    check_scores("rbm_predict_test_2.dat", labels, features);
+
+    std::remove("rbm_predictions_test.dat");
+    std::remove("rbm_features_test.dat");
+    std::remove("rbm_predict_test_2.dat");
+}
+
+// Preprocessing
+
+TEST_CASE("unit/processor/transform/1", "[unit][proc]") {
+    dll::processor::datasource ds;
+    ds.binarize = true;
+    ds.shift    = true;
+    ds.shift_d  = 1.0;
+    ds.scale    = true;
+    ds.scale_d  = 0.5;
+
+    const float values[]   = {0.0f, 10.0f, 31.0f, 255.0f, 29.0f, 100.0f};
+    const float expected[] = {0.5f, 0.5f, 1.0f, 1.0f, 0.5f, 1.0f};
+
+    etl::dyn_vector<float> sample(6);
+    std::copy_n(values, 6, sample.memory_start());
+
+    // The fused transforms are applied in the order binarize, shift, scale
+    dll::processor::detail::transform_sample(ds, sample);
+
+    for (std::size_t i = 0; i < 6; ++i) {
+        REQUIRE(sample[i] == Approx(expected[i]));
+    }
+}
+
+TEST_CASE("unit/processor/transform/2", "[unit][proc]") {
+    dll::processor::datasource ds;
+    ds.normalize = true;
+
+    const float values[] = {1.0f, 2.0f, 3.0f, 4.0f};
+
+    etl::dyn_vector<float> sample(4);
+    std::copy_n(values, 4, sample.memory_start());
+
+    dll::processor::detail::transform_sample(ds, sample);
+
+    REQUIRE(etl::mean(sample) == Approx(0.0f).margin(1e-5));
+    REQUIRE(etl::stddev(sample) == Approx(1.0f));
+
+    // A constant sample is only centered
+    etl::dyn_vector<float> constant(4);
+    constant = 42.0f;
+
+    dll::processor::detail::transform_sample(ds, constant);
+
+    for (std::size_t i = 0; i < 4; ++i) {
+        REQUIRE(constant[i] == 0.0f);
+    }
+}
+
+TEST_CASE("unit/processor/cache/1", "[unit][proc]") {
+    // The text reader reads all the files of a directory
+
+    const std::string source = "dllp_cache_test";
+
+    mkdir(source.c_str(), 0755);
+
+    {
+        std::ofstream stream(source + "/1.dat");
+        stream << "source" << std::endl;
+    }
+
+    dll::processor::datasource ds(source, "text");
+    ds.normalize = true;
+
+    std::vector<etl::dyn_vector<float>> samples;
+
+    for (std::size_t i = 0; i < 2; ++i) {
+        samples.emplace_back(3);
+
+        for (std::size_t j = 0; j < 3; ++j) {
+            samples[i][j] = i * 3 + j + 1;
+        }
+    }
+
+    const auto key = dll::processor::detail::cache_key(ds, false);
+
+    dll::processor::detail::write_cache(key, samples);
+
+    // Cache hit
+
+    std::vector<etl::dyn_vector<float>> cached;
+    REQUIRE(dll::processor::detail::read_cache(key, cached));
+    REQUIRE(cached.size() == 2);
+
+    for (std::size_t i = 0; i < 2; ++i) {
+        for (std::size_t j = 0; j < 3; ++j) {
+            REQUIRE(cached[i][j] == samples[i][j]);
+        }
+    }
+
+    // The key changes with the transforms
+
+    auto other = ds;
+    other.scale   = true;
+    other.scale_d = 2.0;
+
+    const auto scaled_key = dll::processor::detail::cache_key(other, false);
+
+    REQUIRE(scaled_key != key);
+    REQUIRE(!dll::processor::detail::read_cache(scaled_key, cached));
+
+    // The key changes when a file of the source is modified
+
+    {
+        std::ofstream stream(source + "/1.dat", std::ios::app);
+        stream << "modified" << std::endl;
+    }
+
+    const auto modified_key = dll::processor::detail::cache_key(ds, false);
+
+    REQUIRE(modified_key != key);
+    REQUIRE(!dll::processor::detail::read_cache(modified_key, cached));
+
+    // The key changes when a file is added to the source
+
+    {
+        std::ofstream stream(source + "/2.dat");
+        stream << "source" << std::endl;
+    }
+
+    const auto added_key = dll::processor::detail::cache_key(ds, false);
+
+    REQUIRE(added_key != modified_key);
+    REQUIRE(!dll::processor::detail::read_cache(added_key, cached));
+
+    std::remove(dll::processor::detail::cache_file(key).c_str());
+    std::remove((source + "/1.dat").c_str());
+    std::remove((source + "/2.dat").c_str());
+    std::remove(source.c_str());
+}
@@ -5,6 +5,8 @@
 //  http://opensource.org/licenses/MIT)
 //=======================================================================
 
+#include <list>
+#include <cmath>
 #include <numeric>
 
 #include "catch.hpp"
@@ -12,6 +14,8 @@
 #include "cpp_utils/data.hpp"
 
 #include "dll/rbm/rbm.hpp"
+#include "dll/trainer/multi_rbm_trainer.hpp"
+#include "dll/util/sparse.hpp"
 
 #include "mnist/mnist_reader.hpp"
 #include "mnist/mnist_utils.hpp"
@@ -229,3 +233,259 @@ TEST_CASE("unit/rbm/mnist/10", "[rbm][pcd][unit]") {
         REQUIRE(error < 15e-2);
     }
 }
+
+TEST_CASE("unit/rbm/mnist/11", "[rbm][sparse_input][unit]") {
+    dll::rbm_desc<
+        28 * 28, 100,
+        dll::batch_size<25>,
+        dll::momentum,
+        dll::sparse_input>::layer_t rbm;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(100);
+    REQUIRE(!dataset.training_images.empty());
+
+    mnist::binarize_dataset(dataset);
+
+    auto error = rbm.train(dataset.training_images, 50);
+
+    REQUIRE(error < 1e-2);
+
+    auto rec_error = rbm.reconstruction_error(dataset.training_images[4]);
+
+    REQUIRE(rec_error < 1e-2);
+}
+
+// The sparse input kernels must compute the same activations as the dense ones
+TEST_CASE("unit/rbm/sparse_input/1", "[rbm][sparse_input][unit]") {
+    dll::rbm_desc<28 * 28, 100, dll::batch_size<25>>::layer_t dense;
+    dll::rbm_desc<28 * 28, 100, dll::batch_size<25>, dll::sparse_input>::layer_t sparse;
+
+    sparse.w = dense.w;
+    sparse.b = dense.b;
+    sparse.c = dense.c;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(25);
+    REQUIRE(!dataset.training_images.empty());
+
+    mnist::binarize_dataset(dataset);
+
+    etl::fast_dyn_matrix<float, 25, 28 * 28> input;
+
+    for (std::size_t i = 0; i < 25; ++i) {
+        input(i) = dataset.training_images[i];
+    }
+
+    REQUIRE(dll::density(input) < dll::sparse_density_threshold);
+
+    etl::fast_dyn_matrix<float, 25, 100> dense_a;
+    etl::fast_dyn_matrix<float, 25, 100> dense_s;
+    etl::fast_dyn_matrix<float, 25, 100> sparse_a;
+    etl::fast_dyn_matrix<float, 25, 100> sparse_s;
+
+    // Sparse batch
+    dense.batch_activate_hidden<true, false>(dense_a, dense_s, input, input);
+    sparse.batch_activate_hidden<true, false>(sparse_a, sparse_s, input, input);
+
+    for (std::size_t i = 0; i < etl::size(dense_a); ++i) {
+        REQUIRE(sparse_a[i] == Approx(dense_a[i]).epsilon(1e-4));
+    }
+
+    // Sparse sample
+    etl::fast_dyn_vector<float, 100> dense_one;
+    etl::fast_dyn_vector<float, 100> sparse_one;
+
+    dense.activate_hidden(dense_one, dataset.training_images[0]);
+    sparse.activate_hidden(sparse_one, dataset.training_images[0]);
+
+    for (std::size_t i = 0; i < etl::size(dense_one); ++i) {
+        REQUIRE(sparse_one[i] == Approx(dense_one[i]).epsilon(1e-4));
+    }
+
+    // Dense batch (falls back to the dense kernels)
+    input = etl::uniform_generator<float>(0.1, 1.0);
+
+    dense.batch_activate_hidden<true, false>(dense_a, dense_s, input, input);
+    sparse.batch_activate_hidden<true, false>(sparse_a, sparse_s, input, input);
+
+    for (std::size_t i = 0; i < etl::size(dense_a); ++i) {
+        REQUIRE(sparse_a[i] == Approx(dense_a[i]).epsilon(1e-4));
+    }
+}
+
+TEST_CASE("unit/rbm/mnist/12", "[rbm][free_energy][unit]") {
+    dll::rbm_desc<
+        28 * 28, 100,
+        dll::batch_size<25>,
+        dll::momentum,
+        dll::free_energy,
+        dll::free_energy_subset<50>,
+        dll::free_energy_every<2>>::layer_t rbm;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(100);
+    REQUIRE(!dataset.training_images.empty());
+
+    mnist::binarize_dataset(dataset);
+
+    rbm.train(dataset.training_images, 5);
+
+    // The batched free energy kernels must compute the same energy as the
+    // free energy of each sample
+    etl::fast_dyn_matrix<float, 25, 28 * 28> v;
+    etl::fast_dyn_matrix<float, 25, 100> h_a;
+    etl::fast_dyn_matrix<float, 25, 100> h_s;
+
+    for (std::size_t i = 0; i < 25; ++i) {
+        v(i) = dataset.training_images[i];
+    }
+
+    rbm.batch_activate_hidden<true, false>(h_a, h_s, v, v);
+
+    float reference   = 0.0;
+    float reference_n = 0.0;
+
+    for (std::size_t i = 0; i < 25; ++i) {
+        reference += rbm.free_energy(dataset.training_images[i]);
+
+        if (i < 10) {
+            reference_n += rbm.free_energy(dataset.training_images[i]);
+        }
+    }
+
+    REQUIRE(rbm.batch_free_energy(v) == Approx(reference).epsilon(1e-3));
+    REQUIRE(rbm.batch_free_energy(v, h_a, 25) == Approx(reference).epsilon(1e-3));
+    REQUIRE(rbm.batch_free_energy(v, h_a, 10) == Approx(reference_n).epsilon(1e-3));
+}
+
+TEST_CASE("unit/rbm/mnist/15", "[rbm][free_energy][unit]") {
+    dll::rbm_desc<
+        28 * 28, 10,
+        dll::batch_size<25>,
+        dll::momentum,
+        dll::hidden<dll::unit_type::SOFTMAX>,
+        dll::free_energy>::layer_t rbm;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(100);
+    REQUIRE(!dataset.training_images.empty());
+
+    mnist::binarize_dataset(dataset);
+
+    rbm.train(dataset.training_images, 5);
+
+    // The softmax activations cannot be reused, the free energy of the
+    // batch must be computed from the samples instead of being zero
+    etl::fast_dyn_matrix<float, 25, 28 * 28> v;
+    etl::fast_dyn_matrix<float, 25, 10> h_a;
+    etl::fast_dyn_matrix<float, 25, 10> h_s;
+
+    for (std::size_t i = 0; i < 25; ++i) {
+        v(i) = dataset.training_images[i];
+    }
+
+    rbm.batch_activate_hidden<true, false>(h_a, h_s, v, v);
+
+    const float full = rbm.batch_free_energy(v);
+
+    REQUIRE(full != 0.0f);
+    REQUIRE(rbm.batch_free_energy(v, h_a, 25) == Approx(full));
+
+    // Reference: -c.v - log(sum(e^x)) for each sample
+    float reference = 0.0f;
+
+    for (std::size_t i = 0; i < 25; ++i) {
+        etl::dyn_vector<float> x = rbm.b + v(i) * rbm.w;
+        reference += -etl::dot(rbm.c, v(i)) - std::log(etl::sum(etl::exp(x)));
+    }
+
+    REQUIRE(full == Approx(reference).epsilon(1e-3));
+}
+
+template <typename RBM, bool Denoising>
+using cd2_trainer_t = dll::cd_trainer<2, RBM, Denoising>;
+
+TEST_CASE("unit/rbm/mnist/13", "[rbm][multi][unit]") {
+    dll::rbm_desc<
+        28 * 28, 100,
+        dll::batch_size<25>,
+        dll::momentum>::layer_t rbm_1;
+
+    dll::rbm_desc<
+        28 * 28, 50,
+        dll::batch_size<25>,
+        dll::momentum,
+        dll::trainer_rbm<cd2_trainer_t>>::layer_t rbm_2;
+
+    rbm_2.learning_rate = 0.05;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(100);
+    REQUIRE(!dataset.training_images.empty());
+
+    mnist::binarize_dataset(dataset);
+
+    auto trainer = dll::make_multi_rbm_trainer(rbm_1, rbm_2);
+
+    auto errors = trainer.train(dataset.training_images, 50);
+
+    REQUIRE(errors[0] < 1e-2);
+    REQUIRE(errors[1] < 5e-2);
+}
+
+TEST_CASE("unit/rbm/mnist/14", "[rbm][multi][unit]") {
+    dll::rbm_desc<
+        28 * 28, 100,
+        dll::batch_size<25>,
+        dll::momentum,
+        dll::shuffle>::layer_t rbm_1;
+
+    dll::rbm_desc<
+        28 * 28, 50,
+        dll::batch_size<25>,
+        dll::momentum>::layer_t rbm_2;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(100);
+    REQUIRE(!dataset.training_images.empty());
+
+    mnist::binarize_dataset(dataset);
+
+    auto trainer = dll::make_multi_rbm_trainer(rbm_1, rbm_2);
+
+    trainer.parallel = false;
+
+    auto errors = trainer.train(dataset.training_images, 50);
+
+    REQUIRE(errors[0] < 1e-2);
+    REQUIRE(errors[1] < 5e-2);
+}
+
+TEST_CASE("unit/rbm/init_weights/1", "[rbm][unit]") {
+    using rbm_t = dll::rbm_desc<28 * 28, 100, dll::init_weights>::layer_t;
+
+    auto dataset = mnist::read_dataset_direct<std::vector, etl::dyn_vector<float>>(1000);
+    REQUIRE(!dataset.training_images.empty());
+
+    mnist::binarize_dataset(dataset);
+
+    auto& images = dataset.training_images;
+
+    // Blocks of samples merged in parallel
+    auto rbm = std::make_unique<rbm_t>();
+    rbm->init_weights(images.begin(), images.end());
+
+    // Single serial pass (the samples of a list are not split in blocks)
+    std::list<etl::dyn_vector<float>> list(images.begin(), images.end());
+
+    auto serial = std::make_unique<rbm_t>();
+    serial->init_weights(list.begin(), list.end());
+
+    for (std::size_t i = 0; i < 28 * 28; ++i) {
+        std::size_t ones = 0;
+
+        for (auto& image : images) {
+            ones += image[i] == 1.0f;
+        }
+
+        const double pi = double(ones) / images.size() + 0.0001;
+
+        REQUIRE(rbm->c(i) == serial->c(i));
+        REQUIRE(rbm->c(i) == Approx(std::log(pi / (1.0 - pi))));
+    }
+}
@@ -0,0 +1,145 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+#include "catch.hpp"
+
+#include "cpp_utils/io.hpp"
+
+#include "dll/runtime/runtime.hpp"
+#include "dll/neural/dense_layer.hpp"
+
+#include "mnist/mnist_reader.hpp"
+#include "mnist/mnist_utils.hpp"
+
+TEST_CASE("unit/runtime/forward/1", "[unit][runtime]") {
+    dll::dense_desc<20, 15, dll::activation<dll::function::SIGMOID>>::layer_t l1;
+    dll::dense_desc<15, 10, dll::activation<dll::function::SOFTMAX>>::layer_t l2;
+
+    dll::runtime::network net;
+    net.add(dll::runtime::make_dense(20, 15, dll::function::SIGMOID));
+    net.add(dll::runtime::make_dense(15, 10, dll::function::SOFTMAX));
+
+    REQUIRE(net.layers() == 2);
+    REQUIRE(net.input_size() == 20);
+    REQUIRE(net.output_size() == 10);
+
+    // Use the weights of the compiled layers in the network
+
+    std::stringstream stream;
+    cpp::binary_write_all(stream, l1.w);
+    cpp::binary_write_all(stream, l1.b);
+    cpp::binary_write_all(stream, l2.w);
+    cpp::binary_write_all(stream, l2.b);
+
+    net.load(stream);
+
+    etl::fast_dyn_matrix<float, 5, 20> input;
+
+    for (std::size_t i = 0; i < etl::size(input); ++i) {
+        input[i] = float(i % 7) / 7.0f;
+    }
+
+    etl::fast_dyn_matrix<float, 5, 15> hidden;
+    etl::fast_dyn_matrix<float, 5, 10> expected;
+
+    l1.batch_activate_hidden(hidden, input);
+    l2.batch_activate_hidden(expected, hidden);
+
+    auto output = net.forward(std::vector<float>(input.begin(), input.end()), 5);
+
+    REQUIRE(output.size() == 5 * 10);
+
+    for (std::size_t i = 0; i < output.size(); ++i) {
+        REQUIRE(output[i] == Approx(expected[i]));
+    }
+
+    // The buffers of the layers are reused with the same batch
+
+    auto second = net.forward(std::vector<float>(input.begin(), input.end()), 5);
+
+    for (std::size_t i = 0; i < output.size(); ++i) {
+        REQUIRE(second[i] == output[i]);
+    }
+}
+
+TEST_CASE("unit/runtime/add/1", "[unit][runtime]") {
+    dll::runtime::network net;
+    net.add(dll::runtime::make_dense(20, 15));
+
+    REQUIRE_THROWS_AS(net.add(nullptr), std::invalid_argument);
+    REQUIRE_THROWS_AS(net.add(dll::runtime::make_dense(10, 5)), std::invalid_argument);
+    REQUIRE_THROWS_AS(net.add(dll::runtime::make_rbm(10, 5, dll::unit_type::SOFTMAX)), std::invalid_argument);
+
+    REQUIRE(net.layers() == 1);
+
+    net.add(dll::runtime::make_dense(15, 5));
+
+    REQUIRE(net.layers() == 2);
+}
+
+TEST_CASE("unit/runtime/catalogue/1", "[unit][runtime]") {
+    REQUIRE(dll::runtime::make_rbm(10, 5));
+    REQUIRE(dll::runtime::make_rbm(10, 5, dll::unit_type::GAUSSIAN, dll::unit_type::RELU));
+    REQUIRE(!dll::runtime::make_rbm(10, 5, dll::unit_type::SOFTMAX, dll::unit_type::BINARY));
+
+    REQUIRE(dll::runtime::make_rbm(10, 5)->pretrainable());
+    REQUIRE(!dll::runtime::make_dense(10, 5)->pretrainable());
+}
+
+TEST_CASE("unit/runtime/pretrain/1", "[unit][runtime][mnist]") {
+    auto dataset = mnist::read_dataset_direct<std::vector, std::vector<float>>(200);
+    REQUIRE(!dataset.training_images.empty());
+
+    mnist::binarize_dataset(dataset);
+
+    dll::runtime::network net;
+    net.add(dll::runtime::make_rbm(28 * 28, 100));
+    net.add(dll::runtime::make_rbm(100, 50));
+    net.add(dll::runtime::make_dense(50, 10, dll::function::SOFTMAX));
+
+    dll::runtime::hyper_parameters params;
+    params.batch_size = 10;
+
+    net.pretrain(dataset.training_images, 5, params);
+
+    auto error = net.layer_get(0).pretrain(dataset.training_images, 1, params);
+    REQUIRE(error < 0.2);
+}
+
+TEST_CASE("unit/runtime/store/1", "[unit][runtime]") {
+    dll::runtime::network net;
+    net.add(dll::runtime::make_rbm(20, 15));
+    net.add(dll::runtime::make_dense(15, 10, dll::function::TANH));
+
+    std::vector<float> input(3 * 20);
+
+    for (std::size_t i = 0; i < input.size(); ++i) {
+        input[i] = float(i % 2);
+    }
+
+    auto output = net.forward(input, 3);
+
+    std::stringstream stream;
+    net.store(stream);
+
+    dll::runtime::network copy;
+    copy.add(dll::runtime::make_rbm(20, 15));
+    copy.add(dll::runtime::make_dense(15, 10, dll::function::TANH));
+    copy.load(stream);
+
+    auto copy_output = copy.forward(input, 3);
+
+    REQUIRE(copy_output.size() == output.size());
+
+    for (std::size_t i = 0; i < output.size(); ++i) {
+        REQUIRE(copy_output[i] == Approx(output[i]));
+    }
+}
@@ -0,0 +1,90 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <numeric>
+
+#include "catch.hpp"
+
+#include "dll/util/scheduler.hpp"
+
+TEST_CASE("unit/scheduler/1", "[unit][scheduler]") {
+    decltype(auto) pool = dll::shared_pool<true>();
+
+    // The pool is shared
+    REQUIRE(&pool == &dll::shared_pool<true>());
+
+    std::vector<std::size_t> outer(16);
+    std::vector<std::size_t> results(16);
+    std::vector<int> regions(16);
+
+    dll::parallel_foreach_i(pool, outer.begin(), outer.end(), [&](std::size_t& /*value*/, std::size_t i) {
+        // Catch is not thread safe, the results are checked after the loop
+        regions[i] = dll::in_parallel_region();
+
+        std::vector<std::size_t> inner(100);
+
+        // The nested loop is run serially by the worker
+        dll::parallel_foreach_i(pool, inner.begin(), inner.end(), [](std::size_t& value, std::size_t j) {
+            value = j;
+        });
+
+        results[i] = std::accumulate(inner.begin(), inner.end(), std::size_t(0));
+    });
+
+    REQUIRE(!dll::in_parallel_region());
+
+    for (std::size_t i = 0; i < 16; ++i) {
+        REQUIRE(regions[i]);
+        REQUIRE(results[i] == 4950);
+    }
+}
+
+TEST_CASE("unit/scheduler/2", "[unit][scheduler]") {
+    dll::set_threads(2);
+
+    REQUIRE(dll::threads() == 2);
+
+    std::vector<std::size_t> a(32);
+    std::vector<std::size_t> b(32);
+
+    dll::parallel_foreach_pair_i(dll::shared_pool<true>(), a.begin(), a.end(), b.begin(), b.end(), [](std::size_t& x, std::size_t& y, std::size_t i) {
+        x = i;
+        y = 2 * i;
+    });
+
+    for (std::size_t i = 0; i < 32; ++i) {
+        REQUIRE(a[i] == i);
+        REQUIRE(b[i] == 2 * i);
+    }
+
+    dll::set_threads(0);
+}
+
+TEST_CASE("unit/scheduler/3", "[unit][scheduler]") {
+    decltype(auto) pool = dll::shared_pool<true>();
+
+    std::vector<std::size_t> a(64);
+
+    dll::parallel_foreach_i(pool, a.begin(), a.end(), [](std::size_t& x, std::size_t i) {
+        x = i;
+    });
+
+    // The pool is resized in place, the references to it remain valid
+    dll::set_threads(3);
+
+    REQUIRE(&pool == &dll::shared_pool<true>());
+
+    dll::parallel_foreach_i(pool, a.begin(), a.end(), [](std::size_t& x, std::size_t i) {
+        x = 2 * i;
+    });
+
+    for (std::size_t i = 0; i < 64; ++i) {
+        REQUIRE(a[i] == 2 * i);
+    }
+
+    dll::set_threads(0);
+}
@@ -0,0 +1,126 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <cmath>
+
+#include "catch.hpp"
+
+#include "dll/util/update.hpp"
+
+namespace {
+
+// The decay and penalty of the gradients, as computed before the fused kernels
+template <dll::decay_type Decay, typename G, typename V>
+void reference_grad(G& grad, const V& value, float l1, float l2, float penalty) {
+    if (Decay == dll::decay_type::NONE) {
+        grad = grad - penalty;
+    } else if (Decay == dll::decay_type::L1) {
+        grad = grad - l1 * etl::abs(value) - penalty;
+    } else if (Decay == dll::decay_type::L2) {
+        grad = grad - l2 * value - penalty;
+    } else {
+        grad = grad - l1 * etl::abs(value) - l2 * value - penalty;
+    }
+}
+
+// The gradient clipping, as computed before the fused kernels
+template <typename G>
+void reference_clip(G& grad, float t, double n) {
+    auto grad_l2_norm = std::sqrt(etl::sum(grad >> grad) / (n * n));
+
+    if (grad_l2_norm > t) {
+        grad = grad >> (t / grad_l2_norm);
+    }
+}
+
+template <dll::decay_type Decay>
+void check_update(std::size_t n, bool momentum, bool clip) {
+    const double n_samples = 10.0;
+    const float threshold  = 5.0f;
+
+    etl::dyn_vector<float> value(n);
+    etl::dyn_vector<float> grad(n);
+    etl::dyn_vector<float> inc(n);
+
+    value = etl::normal_generator<float>();
+    grad  = 10.0f * etl::normal_generator<float>();
+    inc   = 0.1f * etl::normal_generator<float>();
+
+    etl::dyn_vector<float> ref_value(value);
+    etl::dyn_vector<float> ref_grad(grad);
+    etl::dyn_vector<float> ref_inc(inc);
+
+    dll::update_parameters<float> p;
+    p.eps      = 0.1 / n_samples;
+    p.momentum = momentum ? 0.9f : 0.0f;
+    p.l1       = 0.01f;
+    p.l2       = 0.02f;
+    p.penalty  = 0.05f;
+
+    if (clip) {
+        p.scale = dll::clip_scale<Decay>(value, grad, p, threshold, n_samples);
+
+        // The gradients must really be clipped
+        REQUIRE(p.scale < 1.0f);
+    }
+
+    auto& pool = dll::shared_pool<true>();
+
+    if (momentum) {
+        dll::fused_update<Decay>(pool, value, grad, inc, p);
+    } else {
+        dll::fused_update<Decay>(pool, value, grad, p);
+    }
+
+    reference_grad<Decay>(ref_grad, ref_value, p.l1, p.l2, p.penalty);
+
+    if (clip) {
+        reference_clip(ref_grad, threshold, n_samples);
+    }
+
+    if (momentum) {
+        ref_inc = p.momentum * ref_inc + p.eps * ref_grad;
+        ref_value += ref_inc;
+    } else {
+        ref_value += p.eps * ref_grad;
+    }
+
+    for (std::size_t i = 0; i < n; ++i) {
+        REQUIRE(value[i] == Approx(ref_value[i]).epsilon(1e-4));
+        REQUIRE(inc[i] == Approx(ref_inc[i]).epsilon(1e-4));
+    }
+}
+
+template <dll::decay_type Decay>
+void check_updates() {
+    // Below and above the threshold of the parallel update
+    for (std::size_t n : {std::size_t(1000), 2 * dll::parallel_update_threshold + 3}) {
+        for (bool momentum : {false, true}) {
+            for (bool clip : {false, true}) {
+                check_update<Decay>(n, momentum, clip);
+            }
+        }
+    }
+}
+
+} // end of anonymous namespace
+
+TEST_CASE("unit/update/fused/none", "[unit][update]") {
+    check_updates<dll::decay_type::NONE>();
+}
+
+TEST_CASE("unit/update/fused/l1", "[unit][update]") {
+    check_updates<dll::decay_type::L1>();
+}
+
+TEST_CASE("unit/update/fused/l2", "[unit][update]") {
+    check_updates<dll::decay_type::L2>();
+}
+
+TEST_CASE("unit/update/fused/l1l2", "[unit][update]") {
+    check_updates<dll::decay_type::L1L2>();
+}
@@ -0,0 +1,25 @@
+#!/bin/bash
+
+# Compare the compilation time and memory of a network built from the
+# templates and of the same network built from the precompiled runtime
+
+make clean > /dev/null
+
+function measure {
+    results=$(/usr/bin/time -v make $1 2>&1)
+    rss=$(echo "$results" | grep "Maximum resident set size" | rev | cut -d" " -f1 | rev)
+    elapsed=$(echo "$results" | grep "Elapsed" | rev | cut -d" " -f1 | rev)
+    memory=$(echo "scale=2; $rss/1024" | bc -l)
+    echo "$1 => $elapsed => ${memory}MB"
+}
+
+echo "Compile the runtime library (once)"
+measure release_debug/runtime/src/dll_runtime.cpp.o
+
+echo "Compile 1 Dynamic RBM network"
+measure release_debug/workbench/src/compile_dyn_rbm_one.cpp.o
+measure release_debug/bin/dll_compile_dyn_rbm_one
+
+echo "Compile 1 Runtime RBM network"
+measure release_debug/workbench/src/compile_runtime_one.cpp.o
+measure release_debug/bin/dll_compile_runtime_one
@@ -0,0 +1,34 @@
+//=======================================================================
+// Copyright (c) 2014-2017 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <iostream>
+#include <chrono>
+
+#include "dll/runtime/runtime.hpp"
+
+#include "mnist/mnist_reader.hpp"
+#include "mnist/mnist_utils.hpp"
+
+// 1 3-layer network, with the precompiled layers (same network as compile_dyn_rbm_one)
+
+int main(int, char**) {
+    auto dataset = mnist::read_dataset_direct<std::vector, std::vector<float>>();
+
+    mnist::binarize_dataset(dataset);
+
+    dll::runtime::hyper_parameters params;
+    params.batch_size = 64;
+
+    dll::runtime::network net;
+    net.add(dll::runtime::make_rbm(28 * 28, 500 + 1));
+    net.add(dll::runtime::make_rbm(500 + 1, 400 + 1));
+    net.add(dll::runtime::make_rbm(400 + 1, 10, dll::unit_type::BINARY, dll::unit_type::SOFTMAX));
+
+    net.pretrain(dataset.training_images, 10, params);
+
+    return 0;
+}